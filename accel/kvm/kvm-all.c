@@ -30,6 +30,7 @@
 #include "exec/gdbstub.h"
 #include "sysemu/kvm_int.h"
 #include "sysemu/runstate.h"
+#include "sysemu/sysemu.h"
 #include "sysemu/cpus.h"
 #include "sysemu/accel-blocker.h"
 #include "qemu/bswap.h"
@@ -618,7 +619,10 @@ static bool kvm_slot_get_dirty_log(KVMState *s, KVMSlot *slot)
     return ret == 0;
 }
 
-/* Should be with all slots_lock held for the address spaces. */
+/*
+ * Should be with all slots_lock held for the address spaces.  Pages can be
+ * marked concurrently by the reaper shards, hence the atomic bit update.
+ */
 static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
                                      uint32_t slot_id, uint64_t offset)
 {
@@ -637,7 +641,7 @@ static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
         return;
     }
 
-    set_bit(offset, mem->dirty_bmap);
+    set_bit_atomic(offset, mem->dirty_bmap);
 }
 
 static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
@@ -672,7 +676,9 @@ static void dirty_gfn_set_collected(struct kvm_dirty_gfn *gfn)
 
 /*
  * Should be with all slots_lock held for the address spaces.  It returns the
- * dirty page we've collected on this dirty ring.
+ * dirty page we've collected on this dirty ring.  A given ring is only ever
+ * harvested by one thread at a time: either the slots_lock owner itself, or
+ * the reaper shard the vCPU is assigned to while the owner waits for it.
  */
 static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
 {
@@ -710,6 +716,68 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
     return count;
 }
 
+static void *kvm_dirty_ring_reap_shard_thread(void *data)
+{
+    struct KVMDirtyRingReapShard *shard = data;
+    KVMState *s = shard->s;
+    struct KVMDirtyRingReaper *r = &s->reaper;
+    CPUState *cpu;
+
+    rcu_register_thread();
+
+    while (true) {
+        uint64_t total = 0;
+
+        qemu_sem_wait(&shard->sem);
+        if (qatomic_read(&r->shards_stop)) {
+            break;
+        }
+
+        WITH_RCU_READ_LOCK_GUARD() {
+            CPU_FOREACH(cpu) {
+                if (cpu->cpu_index % r->nr_shards == shard->index) {
+                    total += kvm_dirty_ring_reap_one(s, cpu);
+                }
+            }
+        }
+        shard->total = total;
+
+        /* The last shard to finish hands the rings back for the reset */
+        if (qatomic_fetch_dec(&r->shards_pending) == 1) {
+            qemu_event_set(&r->shards_done);
+        }
+    }
+
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
+/*
+ * Harvest all the dirty rings using the reaper shards.  The caller holds
+ * slots_lock for the whole round, which keeps the memslots stable while the
+ * shards mark pages and serializes against any other reaper.
+ */
+static uint64_t kvm_dirty_ring_reap_shards(KVMState *s)
+{
+    struct KVMDirtyRingReaper *r = &s->reaper;
+    uint64_t total = 0;
+    int i;
+
+    qemu_event_reset(&r->shards_done);
+    qatomic_set(&r->shards_pending, r->nr_shards);
+    for (i = 0; i < r->nr_shards; i++) {
+        qemu_sem_post(&r->shards[i].sem);
+    }
+    qemu_event_wait(&r->shards_done);
+
+    for (i = 0; i < r->nr_shards; i++) {
+        total += r->shards[i].total;
+    }
+
+    return total;
+}
+
 /* Must be with slots_lock held */
 static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
 {
@@ -721,6 +789,8 @@ static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
 
     if (cpu) {
         total = kvm_dirty_ring_reap_one(s, cpu);
+    } else if (s->reaper.shards) {
+        total = kvm_dirty_ring_reap_shards(s);
     } else {
         CPU_FOREACH(cpu) {
             total += kvm_dirty_ring_reap_one(s, cpu);
@@ -742,8 +812,10 @@ static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
 }
 
 /*
- * Currently for simplicity, we must hold BQL before calling this.  We can
- * consider to drop the BQL if we're clear with all the race conditions.
+ * Currently for simplicity, we must hold BQL before calling this to reap
+ * all the rings.  Reaping the ring of a single vCPU only needs slots_lock,
+ * which is what allows vCPUs exiting on a full ring to reap their own ring
+ * without serializing on the BQL.
  */
 static uint64_t kvm_dirty_ring_reap(KVMState *s, CPUState *cpu)
 {
@@ -1415,9 +1487,56 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
     return NULL;
 }
 
+/*
+ * Stops and joins the reaper shards at exit.  With slots_lock held no
+ * round is in progress, and later reaps walk all the rings themselves.
+ */
+static void kvm_dirty_ring_reap_shards_exit(Notifier *n, void *data)
+{
+    KVMState *s = container_of(n, KVMState, reaper.shards_exit);
+    struct KVMDirtyRingReaper *r = &s->reaper;
+    struct KVMDirtyRingReapShard *shards;
+    int i;
+
+    kvm_slots_lock();
+    shards = r->shards;
+    r->shards = NULL;
+    qatomic_set(&r->shards_stop, true);
+    kvm_slots_unlock();
+
+    for (i = 0; i < r->nr_shards; i++) {
+        qemu_sem_post(&shards[i].sem);
+    }
+    for (i = 0; i < r->nr_shards; i++) {
+        qemu_thread_join(&shards[i].thread);
+        qemu_sem_destroy(&shards[i].sem);
+    }
+    qemu_event_destroy(&r->shards_done);
+    g_free(shards);
+}
+
 static void kvm_dirty_ring_reaper_init(KVMState *s)
 {
     struct KVMDirtyRingReaper *r = &s->reaper;
+    int i;
+
+    if (r->nr_shards > 1) {
+        qemu_event_init(&r->shards_done, false);
+        r->shards = g_new0(struct KVMDirtyRingReapShard, r->nr_shards);
+        for (i = 0; i < r->nr_shards; i++) {
+            struct KVMDirtyRingReapShard *shard = &r->shards[i];
+            g_autofree char *name = g_strdup_printf("kvm-reaper-%d", i);
+
+            shard->index = i;
+            shard->s = s;
+            qemu_sem_init(&shard->sem, 0);
+            qemu_thread_create(&shard->thread, name,
+                               kvm_dirty_ring_reap_shard_thread,
+                               shard, QEMU_THREAD_JOINABLE);
+        }
+        r->shards_exit.notify = kvm_dirty_ring_reap_shards_exit;
+        qemu_add_exit_notifier(&r->shards_exit);
+    }
 
     qemu_thread_create(&r->reaper_thr, "kvm-reaper",
                        kvm_dirty_ring_reaper_thread,
@@ -2942,19 +3061,14 @@ int kvm_cpu_exec(CPUState *cpu)
              * still full.  Got kicked by KVM_RESET_DIRTY_RINGS.
              */
             trace_kvm_dirty_ring_full(cpu->cpu_index);
-            bql_lock();
             /*
-             * We throttle vCPU by making it sleep once it exit from kernel
-             * due to dirty ring full. In the dirtylimit scenario, reaping
-             * all vCPUs after a single vCPU dirty ring get full result in
-             * the miss of sleep, so just reap the ring-fulled vCPU.
+             * Only reap the ring-fulled vCPU: reaping all vCPUs here would
+             * make every vCPU exiting on a full ring serialize behind the
+             * BQL and a walk of all the rings.  It also makes sure we don't
+             * miss the sleep when throttling vCPUs in the dirtylimit case.
+             * The other rings are collected by the reaper thread.
              */
-            if (dirtylimit_in_service()) {
-                kvm_dirty_ring_reap(kvm_state, cpu);
-            } else {
-                kvm_dirty_ring_reap(kvm_state, NULL);
-            }
-            bql_unlock();
+            kvm_dirty_ring_reap(kvm_state, cpu);
             dirtylimit_vcpu_execute(cpu);
             ret = 0;
             break;
@@ -3600,6 +3714,39 @@ static void kvm_set_dirty_ring_size(Object *obj, Visitor *v,
     s->kvm_dirty_ring_size = value;
 }
 
+static void kvm_get_dirty_ring_reap_threads(Object *obj, Visitor *v,
+                                            const char *name, void *opaque,
+                                            Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->reaper.nr_shards;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void kvm_set_dirty_ring_reap_threads(Object *obj, Visitor *v,
+                                            const char *name, void *opaque,
+                                            Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value;
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator has been initialized");
+        return;
+    }
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value > 256) {
+        error_setg(errp, "dirty-ring-reap-threads must be at most 256.");
+        return;
+    }
+
+    s->reaper.nr_shards = value;
+}
+
 static char *kvm_get_device(Object *obj,
                             Error **errp G_GNUC_UNUSED)
 {
@@ -3677,6 +3824,13 @@ static void kvm_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "dirty-ring-size",
         "Size of KVM dirty page ring buffer (default: 0, i.e. use bitmap)");
 
+    object_class_property_add(oc, "dirty-ring-reap-threads", "uint32",
+        kvm_get_dirty_ring_reap_threads, kvm_set_dirty_ring_reap_threads,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-ring-reap-threads",
+        "Number of threads reaping KVM dirty rings in parallel "
+        "(default: 0, i.e. reap from the reaper thread only)");
+
     object_class_property_add_str(oc, "device", kvm_get_device, kvm_set_device);
     object_class_property_set_description(oc, "device",
         "Path to the device node to use (default: /dev/kvm)");
@@ -0,0 +1,232 @@
+/*
+ * Allocation map of backing chains
+ *
+ * Finding the layer of a backing chain that owns some data means asking
+ * every layer from the top until one allocates it, which makes block
+ * status queries on long chains slow.  Each node remembers, for the ranges
+ * that were queried, how many layers from the top don't allocate them.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/lockable.h"
+#include "block/block_int.h"
+
+/*
+ * Past this many ranges, the map is emptied instead of growing further,
+ * which keeps it around a megabyte per node.
+ */
+#define BDRV_CHAIN_MAP_MAX_EXTENTS  16384
+
+/* Number of active maps, so that writes can skip invalidation altogether */
+static unsigned int chain_maps_active;
+
+typedef struct BdrvChainMapExtent {
+    IntervalTreeNode node;
+    /* Number of layers, starting with the node itself, that don't allocate */
+    int skip;
+} BdrvChainMapExtent;
+
+static BdrvChainMapExtent *chain_map_find(BdrvChainMap *map,
+                                          uint64_t start, uint64_t last)
+{
+    IntervalTreeNode *node = interval_tree_iter_first(&map->extents,
+                                                      start, last);
+
+    return node ? container_of(node, BdrvChainMapExtent, node) : NULL;
+}
+
+static void chain_map_insert(BdrvChainMap *map, uint64_t start,
+                             uint64_t last, int skip)
+{
+    BdrvChainMapExtent *e = g_new0(BdrvChainMapExtent, 1);
+
+    e->node.start = start;
+    e->node.last = last;
+    e->skip = skip;
+    interval_tree_insert(&e->node, &map->extents);
+    map->nb_extents++;
+}
+
+static void chain_map_remove(BdrvChainMap *map, BdrvChainMapExtent *e)
+{
+    interval_tree_remove(&e->node, &map->extents);
+    map->nb_extents--;
+    g_free(e);
+}
+
+static void chain_map_clear_locked(BdrvChainMap *map)
+{
+    BdrvChainMapExtent *e;
+
+    while ((e = chain_map_find(map, 0, UINT64_MAX))) {
+        chain_map_remove(map, e);
+    }
+}
+
+/* Drop [start, last] from the map, keeping the parts of ranges around it */
+static void chain_map_remove_range_locked(BdrvChainMap *map,
+                                          uint64_t start, uint64_t last)
+{
+    BdrvChainMapExtent *e;
+
+    while ((e = chain_map_find(map, start, last))) {
+        uint64_t e_start = e->node.start;
+        uint64_t e_last = e->node.last;
+        int skip = e->skip;
+
+        chain_map_remove(map, e);
+        if (e_start < start) {
+            chain_map_insert(map, e_start, start - 1, skip);
+        }
+        if (e_last > last) {
+            chain_map_insert(map, last + 1, e_last, skip);
+        }
+    }
+}
+
+void bdrv_chain_map_init(BlockDriverState *bs)
+{
+    qemu_mutex_init(&bs->chain_map.lock);
+}
+
+static void chain_map_set_active_locked(BdrvChainMap *map, bool active)
+{
+    if (map->active != active) {
+        qatomic_set(&map->active, active);
+        if (active) {
+            qatomic_inc(&chain_maps_active);
+        } else {
+            qatomic_dec(&chain_maps_active);
+        }
+    }
+}
+
+void bdrv_chain_map_cleanup(BlockDriverState *bs)
+{
+    chain_map_clear_locked(&bs->chain_map);
+    chain_map_set_active_locked(&bs->chain_map, false);
+    qemu_mutex_destroy(&bs->chain_map.lock);
+}
+
+int bdrv_chain_map_lookup(BlockDriverState *bs, int64_t offset,
+                          int64_t *bytes, uint64_t *gen)
+{
+    BdrvChainMap *map = &bs->chain_map;
+    BdrvChainMapExtent *e;
+    int skip = 0;
+    IO_CODE();
+
+    QEMU_LOCK_GUARD(&map->lock);
+
+    chain_map_set_active_locked(map, true);
+    /*
+     * Pairs with the barrier in bdrv_chain_map_invalidate_range(): either
+     * a write that allocates data sees the map active and invalidates it,
+     * or the block status query that follows sees the allocation.
+     */
+    smp_mb();
+
+    if (map->graph_gen != bdrv_graph_generation()) {
+        /* The backing chain may not be the same anymore */
+        chain_map_clear_locked(map);
+        map->graph_gen = bdrv_graph_generation();
+        map->gen++;
+    }
+
+    e = chain_map_find(map, offset, offset);
+    if (e) {
+        skip = e->skip;
+        *bytes = MIN(*bytes, e->node.last - offset + 1);
+    }
+
+    *gen = map->gen;
+    return skip;
+}
+
+void bdrv_chain_map_fill(BlockDriverState *bs, int64_t offset,
+                         int64_t bytes, int skip, uint64_t gen)
+{
+    BdrvChainMap *map = &bs->chain_map;
+    uint64_t start = offset;
+    uint64_t last = offset + bytes - 1;
+    BdrvChainMapExtent *e;
+    IO_CODE();
+
+    assert(bytes > 0 && skip > 0);
+
+    QEMU_LOCK_GUARD(&map->lock);
+
+    if (map->gen != gen) {
+        /* Something was allocated since, the result may be stale */
+        return;
+    }
+
+    chain_map_remove_range_locked(map, start, last);
+
+    /* Merge with the neighbours if they skip as many layers */
+    if (start > 0) {
+        e = chain_map_find(map, start - 1, start - 1);
+        if (e && e->skip == skip) {
+            start = e->node.start;
+            chain_map_remove(map, e);
+        }
+    }
+    e = chain_map_find(map, last + 1, last + 1);
+    if (e && e->skip == skip) {
+        last = e->node.last;
+        chain_map_remove(map, e);
+    }
+
+    if (map->nb_extents >= BDRV_CHAIN_MAP_MAX_EXTENTS) {
+        chain_map_clear_locked(map);
+    }
+    chain_map_insert(map, start, last, skip);
+}
+
+void bdrv_chain_map_invalidate_range(BlockDriverState *bs, int64_t offset,
+                                     int64_t bytes)
+{
+    BdrvChainMap *map = &bs->chain_map;
+    BdrvChild *c;
+    IO_CODE();
+
+    /* Order the allocation before checking whether anyone looks */
+    smp_mb();
+    if (!qatomic_read(&chain_maps_active)) {
+        return;
+    }
+
+    if (qatomic_read(&map->active)) {
+        WITH_QEMU_LOCK_GUARD(&map->lock) {
+            map->gen++;
+            if (bytes > 0 && map->nb_extents) {
+                chain_map_remove_range_locked(map, offset, offset + bytes - 1);
+            }
+            /*
+             * A lookup that is still going on cannot fill the map anymore
+             * because of the new generation, so it can be skipped until the
+             * next lookup
+             */
+            if (!map->nb_extents) {
+                chain_map_set_active_locked(map, false);
+            }
+        }
+    }
+
+    /* The layers of the chains of the overlays include @bs */
+    QLIST_FOREACH(c, &bs->parents, next_parent) {
+        if (c->klass->parent_is_bds &&
+            bdrv_filter_or_cow_child(c->opaque) == c) {
+            bdrv_chain_map_invalidate_range(c->opaque, offset, bytes);
+        }
+    }
+}
+
+void bdrv_chain_map_invalidate(BlockDriverState *bs)
+{
+    IO_CODE();
+    bdrv_chain_map_invalidate_range(bs, 0, INT64_MAX);
+}
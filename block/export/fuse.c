@@ -27,8 +27,10 @@
 #include "block/qapi.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-block.h"
+#include "qemu/coroutine.h"
 #include "qemu/main-loop.h"
 #include "sysemu/block-backend.h"
+#include "sysemu/iothread.h"
 
 #include <fuse.h>
 #include <fuse_lowlevel.h>
@@ -44,25 +46,58 @@
 /* Prevent overly long bounce buffer allocations */
 #define FUSE_MAX_BOUNCE_BYTES (MIN(BDRV_REQUEST_MAX_BYTES, 64 * 1024 * 1024))
 
+/* Request buffers that a queue keeps for the next requests */
+#define FUSE_MAX_FREE_REQUESTS 16
 
-typedef struct FuseExport {
+typedef struct FuseExport FuseExport;
+typedef struct FuseRequest FuseRequest;
+
+/*
+ * Reads requests from the FUSE device in one AioContext.  All queues of an
+ * export read from the same file descriptor, each request goes to the queue
+ * that reads it first.
+ */
+typedef struct FuseQueue {
+    FuseExport *exp;
+    AioContext *ctx;
+    IOThread *iothread; /* NULL for the queue in the export's AioContext */
+
+    /* Only accessed in @ctx */
+    QSLIST_HEAD(, FuseRequest) free_requests;
+    unsigned int nb_free_requests;
+} FuseQueue;
+
+/* A request read from the FUSE device, processed in its own coroutine */
+struct FuseRequest {
+    FuseQueue *q;
+    struct fuse_buf fuse_buf;
+    QSLIST_ENTRY(FuseRequest) next;
+};
+
+struct FuseExport {
     BlockExport common;
 
     struct fuse_session *fuse_session;
-    struct fuse_buf fuse_buf;
+    FuseQueue *queues;
+    int num_queues;
     unsigned int in_flight; /* atomic */
     bool mounted, fd_handler_set_up;
 
     char *mountpoint;
     bool writable;
     bool growable;
+    /*
+     * Serializes size changes, which requests in different queues may
+     * attempt at the same time
+     */
+    CoMutex size_lock;
     /* Whether allow_other was used as a mount option or not */
     bool allow_other;
 
     mode_t st_mode;
     uid_t st_uid;
     gid_t st_gid;
-} FuseExport;
+};
 
 static GHashTable *exports;
 static const struct fuse_lowlevel_ops fuse_ops;
@@ -72,6 +107,9 @@ static void fuse_export_delete(BlockExport *exp);
 
 static void init_exports_table(void);
 
+static int fuse_export_init_queues(FuseExport *exp,
+                                   BlockExportOptionsFuse *args,
+                                   Error **errp);
 static int setup_fuse_export(FuseExport *exp, const char *mountpoint,
                              bool allow_other, Error **errp);
 static void read_from_fuse_export(void *opaque);
@@ -79,14 +117,36 @@ static void read_from_fuse_export(void *opaque);
 static bool is_regular_file(const char *path, Error **errp);
 
 
+static void fuse_export_attach_queues(FuseExport *exp)
+{
+    int i;
+
+    for (i = 0; i < exp->num_queues; i++) {
+        aio_set_fd_handler(exp->queues[i].ctx,
+                           fuse_session_fd(exp->fuse_session),
+                           read_from_fuse_export, NULL, NULL, NULL,
+                           &exp->queues[i]);
+    }
+    exp->fd_handler_set_up = true;
+}
+
+static void fuse_export_detach_queues(FuseExport *exp)
+{
+    int i;
+
+    for (i = 0; i < exp->num_queues; i++) {
+        aio_set_fd_handler(exp->queues[i].ctx,
+                           fuse_session_fd(exp->fuse_session),
+                           NULL, NULL, NULL, NULL, NULL);
+    }
+    exp->fd_handler_set_up = false;
+}
+
 static void fuse_export_drained_begin(void *opaque)
 {
     FuseExport *exp = opaque;
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session),
-                       NULL, NULL, NULL, NULL, NULL);
-    exp->fd_handler_set_up = false;
+    fuse_export_detach_queues(exp);
 }
 
 static void fuse_export_drained_end(void *opaque)
@@ -95,11 +155,9 @@ static void fuse_export_drained_end(void *opaque)
 
     /* Refresh AioContext in case it changed */
     exp->common.ctx = blk_get_aio_context(exp->common.blk);
+    exp->queues[0].ctx = exp->common.ctx;
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session),
-                       read_from_fuse_export, NULL, NULL, NULL, exp);
-    exp->fd_handler_set_up = true;
+    fuse_export_attach_queues(exp);
 }
 
 static bool fuse_export_drained_poll(void *opaque)
@@ -178,6 +236,7 @@ static int fuse_export_create(BlockExport *blk_exp,
     exp->mountpoint = g_strdup(args->mountpoint);
     exp->writable = blk_exp_args->writable;
     exp->growable = args->growable;
+    qemu_co_mutex_init(&exp->size_lock);
 
     /* set default */
     if (!args->has_allow_other) {
@@ -191,6 +250,11 @@ static int fuse_export_create(BlockExport *blk_exp,
     exp->st_uid = getuid();
     exp->st_gid = getgid();
 
+    ret = fuse_export_init_queues(exp, args, errp);
+    if (ret < 0) {
+        goto fail;
+    }
+
     if (args->allow_other == FUSE_EXPORT_ALLOW_OTHER_AUTO) {
         /* Ignore errors on our first attempt */
         ret = setup_fuse_export(exp, args->mountpoint, true, NULL);
@@ -213,6 +277,47 @@ fail:
     return ret;
 }
 
+/**
+ * Set up the queue in the export's AioContext, and one in each of the
+ * iothreads given by @args.
+ */
+static int fuse_export_init_queues(FuseExport *exp,
+                                   BlockExportOptionsFuse *args,
+                                   Error **errp)
+{
+    strList *e;
+    int i;
+
+    exp->num_queues = 1;
+    for (e = args->iothreads; e; e = e->next) {
+        exp->num_queues++;
+    }
+    exp->queues = g_new0(FuseQueue, exp->num_queues);
+
+    exp->queues[0] = (FuseQueue) {
+        .exp = exp,
+        .ctx = exp->common.ctx,
+    };
+
+    for (e = args->iothreads, i = 1; e; e = e->next, i++) {
+        IOThread *iothread = iothread_by_id(e->value);
+
+        if (!iothread) {
+            error_setg(errp, "iothread \"%s\" not found", e->value);
+            return -EINVAL;
+        }
+
+        object_ref(OBJECT(iothread));
+        exp->queues[i] = (FuseQueue) {
+            .exp = exp,
+            .ctx = iothread_get_aio_context(iothread),
+            .iothread = iothread,
+        };
+    }
+
+    return 0;
+}
+
 /**
  * Allocates the global @exports hash table.
  */
@@ -269,10 +374,19 @@ static int setup_fuse_export(FuseExport *exp, const char *mountpoint,
 
     g_hash_table_insert(exports, g_strdup(mountpoint), NULL);
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session),
-                       read_from_fuse_export, NULL, NULL, NULL, exp);
-    exp->fd_handler_set_up = true;
+    /*
+     * All queues wait for the same file descriptor to become readable, but
+     * only one of them gets the request.  The others must not block.
+     */
+    if (!g_unix_set_fd_nonblocking(fuse_session_fd(exp->fuse_session), true,
+                                   NULL)) {
+        error_setg_errno(errp, errno, "Failed to set FUSE session to "
+                         "non-blocking");
+        ret = -errno;
+        goto fail;
+    }
+
+    fuse_export_attach_queues(exp);
 
     return 0;
 
@@ -281,27 +395,90 @@ fail:
     return ret;
 }
 
+static FuseRequest *fuse_queue_get_request(FuseQueue *q)
+{
+    FuseRequest *req = QSLIST_FIRST(&q->free_requests);
+
+    if (req) {
+        QSLIST_REMOVE_HEAD(&q->free_requests, next);
+        q->nb_free_requests--;
+    } else {
+        /* libfuse allocates the buffer when receiving the first request */
+        req = g_new0(FuseRequest, 1);
+        req->q = q;
+    }
+
+    return req;
+}
+
+static void fuse_request_free(FuseRequest *req)
+{
+    free(req->fuse_buf.mem);
+    g_free(req);
+}
+
+static void fuse_queue_put_request(FuseRequest *req)
+{
+    FuseQueue *q = req->q;
+
+    if (q->nb_free_requests >= FUSE_MAX_FREE_REQUESTS) {
+        fuse_request_free(req);
+        return;
+    }
+
+    QSLIST_INSERT_HEAD(&q->free_requests, req, next);
+    q->nb_free_requests++;
+}
+
+/**
+ * Process a request, which may yield in the block layer while other
+ * requests are received and processed.
+ */
+static void coroutine_fn fuse_co_process_request(void *opaque)
+{
+    FuseRequest *req = opaque;
+    FuseExport *exp = req->q->exp;
+
+    fuse_session_process_buf(exp->fuse_session, &req->fuse_buf);
+    fuse_queue_put_request(req);
+
+    if (qatomic_fetch_dec(&exp->in_flight) == 1) {
+        aio_wait_kick(); /* wake AIO_WAIT_WHILE() */
+    }
+
+    blk_exp_unref(&exp->common);
+}
+
 /**
  * Callback to be invoked when the FUSE session FD can be read from.
  * (This is basically the FUSE event loop.)
  */
 static void read_from_fuse_export(void *opaque)
 {
-    FuseExport *exp = opaque;
+    FuseQueue *q = opaque;
+    FuseExport *exp = q->exp;
+    FuseRequest *req;
+    Coroutine *co;
     int ret;
 
     blk_exp_ref(&exp->common);
 
     qatomic_inc(&exp->in_flight);
 
+    req = fuse_queue_get_request(q);
     do {
-        ret = fuse_session_receive_buf(exp->fuse_session, &exp->fuse_buf);
+        ret = fuse_session_receive_buf(exp->fuse_session, &req->fuse_buf);
     } while (ret == -EINTR);
-    if (ret < 0) {
+    if (ret <= 0) {
+        /* -EAGAIN if another queue got the request first */
+        fuse_queue_put_request(req);
         goto out;
     }
 
-    fuse_session_process_buf(exp->fuse_session, &exp->fuse_buf);
+    /* The coroutine drops the in-flight counter and the reference */
+    co = qemu_coroutine_create(fuse_co_process_request, req);
+    qemu_coroutine_enter(co);
+    return;
 
 out:
     if (qatomic_fetch_dec(&exp->in_flight) == 1) {
@@ -319,10 +496,7 @@ static void fuse_export_shutdown(BlockExport *blk_exp)
         fuse_session_exit(exp->fuse_session);
 
         if (exp->fd_handler_set_up) {
-            aio_set_fd_handler(exp->common.ctx,
-                               fuse_session_fd(exp->fuse_session),
-                               NULL, NULL, NULL, NULL, NULL);
-            exp->fd_handler_set_up = false;
+            fuse_export_detach_queues(exp);
         }
     }
 
@@ -338,6 +512,8 @@ static void fuse_export_shutdown(BlockExport *blk_exp)
 static void fuse_export_delete(BlockExport *blk_exp)
 {
     FuseExport *exp = container_of(blk_exp, FuseExport, common);
+    FuseRequest *req;
+    int i;
 
     if (exp->fuse_session) {
         if (exp->mounted) {
@@ -347,7 +523,19 @@ static void fuse_export_delete(BlockExport *blk_exp)
         fuse_session_destroy(exp->fuse_session);
     }
 
-    free(exp->fuse_buf.mem);
+    for (i = 0; i < exp->num_queues; i++) {
+        FuseQueue *q = &exp->queues[i];
+
+        while ((req = QSLIST_FIRST(&q->free_requests))) {
+            QSLIST_REMOVE_HEAD(&q->free_requests, next);
+            fuse_request_free(req);
+        }
+        if (q->iothread) {
+            object_unref(OBJECT(q->iothread));
+        }
+    }
+    g_free(exp->queues);
+
     g_free(exp->mountpoint);
 }
 
@@ -403,21 +591,24 @@ static void fuse_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
 /**
  * Let clients get file attributes (i.e., stat() the file).
  */
-static void fuse_getattr(fuse_req_t req, fuse_ino_t inode,
-                         struct fuse_file_info *fi)
+static void coroutine_fn fuse_getattr(fuse_req_t req, fuse_ino_t inode,
+                                      struct fuse_file_info *fi)
 {
     struct stat statbuf;
     int64_t length, allocated_blocks;
     time_t now = time(NULL);
     FuseExport *exp = fuse_req_userdata(req);
 
-    length = blk_getlength(exp->common.blk);
+    length = blk_co_getlength(exp->common.blk);
     if (length < 0) {
         fuse_reply_err(req, -length);
         return;
     }
 
-    allocated_blocks = bdrv_get_allocated_file_size(blk_bs(exp->common.blk));
+    WITH_GRAPH_RDLOCK_GUARD() {
+        allocated_blocks =
+            bdrv_co_get_allocated_file_size(blk_bs(exp->common.blk));
+    }
     if (allocated_blocks <= 0) {
         allocated_blocks = DIV_ROUND_UP(length, 512);
     } else {
@@ -441,8 +632,9 @@ static void fuse_getattr(fuse_req_t req, fuse_ino_t inode,
     fuse_reply_attr(req, &statbuf, 1.);
 }
 
-static int fuse_do_truncate(const FuseExport *exp, int64_t size,
-                            bool req_zero_write, PreallocMode prealloc)
+static int coroutine_fn
+fuse_do_truncate(const FuseExport *exp, int64_t size, bool req_zero_write,
+                 PreallocMode prealloc)
 {
     uint64_t blk_perm, blk_shared_perm;
     BdrvRequestFlags truncate_flags = 0;
@@ -458,8 +650,11 @@ static int fuse_do_truncate(const FuseExport *exp, int64_t size,
 
     if (add_resize_perm) {
 
-        if (!qemu_in_main_thread()) {
-            /* Changing permissions like below only works in the main thread */
+        if (!qemu_in_main_thread() || qemu_in_coroutine()) {
+            /*
+             * Changing permissions like below only works in the main thread,
+             * outside of coroutines
+             */
             return -EPERM;
         }
 
@@ -472,8 +667,8 @@ static int fuse_do_truncate(const FuseExport *exp, int64_t size,
         }
     }
 
-    ret = blk_truncate(exp->common.blk, size, true, prealloc,
-                       truncate_flags, NULL);
+    ret = blk_co_truncate(exp->common.blk, size, true, prealloc,
+                          truncate_flags, NULL);
 
     if (add_resize_perm) {
         /* Must succeed, because we are only giving up the RESIZE permission */
@@ -485,6 +680,30 @@ static int fuse_do_truncate(const FuseExport *exp, int64_t size,
     return ret;
 }
 
+/**
+ * Grow the image to at least @size bytes.  The length is checked again under
+ * size_lock, so a concurrent request that needs less cannot shrink the image
+ * back after another one has grown it.
+ */
+static int coroutine_fn
+fuse_co_grow(FuseExport *exp, int64_t size, bool req_zero_write,
+             PreallocMode prealloc)
+{
+    int64_t length;
+    int ret = 0;
+
+    qemu_co_mutex_lock(&exp->size_lock);
+    length = blk_co_getlength(exp->common.blk);
+    if (length < 0) {
+        ret = length;
+    } else if (size > length) {
+        ret = fuse_do_truncate(exp, size, req_zero_write, prealloc);
+    }
+    qemu_co_mutex_unlock(&exp->size_lock);
+
+    return ret;
+}
+
 /**
  * Let clients set file attributes.  Only resizing and changing
  * permissions (st_mode, st_uid, st_gid) is allowed.
@@ -493,8 +712,9 @@ static int fuse_do_truncate(const FuseExport *exp, int64_t size,
  * without allow_other cannot be given a different UID or GID, and
  * they cannot be given non-owner access.
  */
-static void fuse_setattr(fuse_req_t req, fuse_ino_t inode, struct stat *statbuf,
-                         int to_set, struct fuse_file_info *fi)
+static void coroutine_fn
+fuse_setattr(fuse_req_t req, fuse_ino_t inode, struct stat *statbuf,
+             int to_set, struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
     int supported_attrs;
@@ -538,7 +758,9 @@ static void fuse_setattr(fuse_req_t req, fuse_ino_t inode, struct stat *statbuf,
             return;
         }
 
+        qemu_co_mutex_lock(&exp->size_lock);
         ret = fuse_do_truncate(exp, statbuf->st_size, true, PREALLOC_MODE_OFF);
+        qemu_co_mutex_unlock(&exp->size_lock);
         if (ret < 0) {
             fuse_reply_err(req, -ret);
             return;
@@ -573,8 +795,9 @@ static void fuse_open(fuse_req_t req, fuse_ino_t inode,
 /**
  * Handle client reads from the exported image.
  */
-static void fuse_read(fuse_req_t req, fuse_ino_t inode,
-                      size_t size, off_t offset, struct fuse_file_info *fi)
+static void coroutine_fn
+fuse_read(fuse_req_t req, fuse_ino_t inode,
+          size_t size, off_t offset, struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
     int64_t length;
@@ -591,7 +814,7 @@ static void fuse_read(fuse_req_t req, fuse_ino_t inode,
      * Clients will expect short reads at EOF, so we have to limit
      * offset+size to the image length.
      */
-    length = blk_getlength(exp->common.blk);
+    length = blk_co_getlength(exp->common.blk);
     if (length < 0) {
         fuse_reply_err(req, -length);
         return;
@@ -607,7 +830,7 @@ static void fuse_read(fuse_req_t req, fuse_ino_t inode,
         return;
     }
 
-    ret = blk_pread(exp->common.blk, offset, size, buf, 0);
+    ret = blk_co_pread(exp->common.blk, offset, size, buf, 0);
     if (ret >= 0) {
         fuse_reply_buf(req, buf, size);
     } else {
@@ -620,8 +843,9 @@ static void fuse_read(fuse_req_t req, fuse_ino_t inode,
 /**
  * Handle client writes to the exported image.
  */
-static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
-                       size_t size, off_t offset, struct fuse_file_info *fi)
+static void coroutine_fn
+fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
+           size_t size, off_t offset, struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
     int64_t length;
@@ -642,7 +866,7 @@ static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
      * Clients will expect short writes at EOF, so we have to limit
      * offset+size to the image length.
      */
-    length = blk_getlength(exp->common.blk);
+    length = blk_co_getlength(exp->common.blk);
     if (length < 0) {
         fuse_reply_err(req, -length);
         return;
@@ -650,7 +874,7 @@ static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
 
     if (offset + size > length) {
         if (exp->growable) {
-            ret = fuse_do_truncate(exp, offset + size, true, PREALLOC_MODE_OFF);
+            ret = fuse_co_grow(exp, offset + size, true, PREALLOC_MODE_OFF);
             if (ret < 0) {
                 fuse_reply_err(req, -ret);
                 return;
@@ -660,7 +884,7 @@ static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
         }
     }
 
-    ret = blk_pwrite(exp->common.blk, offset, size, buf, 0);
+    ret = blk_co_pwrite(exp->common.blk, offset, size, buf, 0);
     if (ret >= 0) {
         fuse_reply_write(req, size);
     } else {
@@ -671,9 +895,9 @@ static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
 /**
  * Let clients perform various fallocate() operations.
  */
-static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
-                           off_t offset, off_t length,
-                           struct fuse_file_info *fi)
+static void coroutine_fn
+fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
+               off_t offset, off_t length, struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
     int64_t blk_len;
@@ -684,7 +908,7 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
         return;
     }
 
-    blk_len = blk_getlength(exp->common.blk);
+    blk_len = blk_co_getlength(exp->common.blk);
     if (blk_len < 0) {
         fuse_reply_err(req, -blk_len);
         return;
@@ -697,23 +921,27 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
 #endif /* CONFIG_FALLOCATE_PUNCH_HOLE */
 
     if (!mode) {
-        /* We can only fallocate at the EOF with a truncate */
-        if (offset < blk_len) {
-            fuse_reply_err(req, EOPNOTSUPP);
-            return;
-        }
+        /* Another request may have changed the length in the meantime */
+        qemu_co_mutex_lock(&exp->size_lock);
+        blk_len = blk_co_getlength(exp->common.blk);
 
-        if (offset > blk_len) {
-            /* No preallocation needed here */
-            ret = fuse_do_truncate(exp, offset, true, PREALLOC_MODE_OFF);
-            if (ret < 0) {
-                fuse_reply_err(req, -ret);
-                return;
+        /* We can only fallocate at the EOF with a truncate */
+        if (blk_len < 0) {
+            ret = blk_len;
+        } else if (offset < blk_len) {
+            ret = -EOPNOTSUPP;
+        } else {
+            ret = 0;
+            if (offset > blk_len) {
+                /* No preallocation needed here */
+                ret = fuse_do_truncate(exp, offset, true, PREALLOC_MODE_OFF);
+            }
+            if (ret == 0) {
+                ret = fuse_do_truncate(exp, offset + length, true,
+                                       PREALLOC_MODE_FALLOC);
             }
         }
-
-        ret = fuse_do_truncate(exp, offset + length, true,
-                               PREALLOC_MODE_FALLOC);
+        qemu_co_mutex_unlock(&exp->size_lock);
     }
 #ifdef CONFIG_FALLOCATE_PUNCH_HOLE
     else if (mode & FALLOC_FL_PUNCH_HOLE) {
@@ -725,8 +953,9 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
         do {
             int size = MIN(length, BDRV_REQUEST_MAX_BYTES);
 
-            ret = blk_pwrite_zeroes(exp->common.blk, offset, size,
-                                    BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK);
+            ret = blk_co_pwrite_zeroes(exp->common.blk, offset, size,
+                                       BDRV_REQ_MAY_UNMAP |
+                                       BDRV_REQ_NO_FALLBACK);
             if (ret == -ENOTSUP) {
                 /*
                  * fallocate() specifies to return EOPNOTSUPP for unsupported
@@ -744,8 +973,7 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
     else if (mode & FALLOC_FL_ZERO_RANGE) {
         if (!(mode & FALLOC_FL_KEEP_SIZE) && offset + length > blk_len) {
             /* No need for zeroes, we are going to write them ourselves */
-            ret = fuse_do_truncate(exp, offset + length, false,
-                                   PREALLOC_MODE_OFF);
+            ret = fuse_co_grow(exp, offset + length, false, PREALLOC_MODE_OFF);
             if (ret < 0) {
                 fuse_reply_err(req, -ret);
                 return;
@@ -755,8 +983,8 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
         do {
             int size = MIN(length, BDRV_REQUEST_MAX_BYTES);
 
-            ret = blk_pwrite_zeroes(exp->common.blk,
-                                    offset, size, 0);
+            ret = blk_co_pwrite_zeroes(exp->common.blk,
+                                       offset, size, 0);
             offset += size;
             length -= size;
         } while (ret == 0 && length > 0);
@@ -772,13 +1000,14 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
 /**
  * Let clients fsync the exported image.
  */
-static void fuse_fsync(fuse_req_t req, fuse_ino_t inode, int datasync,
-                       struct fuse_file_info *fi)
+static void coroutine_fn
+fuse_fsync(fuse_req_t req, fuse_ino_t inode, int datasync,
+           struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
     int ret;
 
-    ret = blk_flush(exp->common.blk);
+    ret = blk_co_flush(exp->common.blk);
     fuse_reply_err(req, ret < 0 ? -ret : 0);
 }
 
@@ -786,8 +1015,8 @@ static void fuse_fsync(fuse_req_t req, fuse_ino_t inode, int datasync,
  * Called before an FD to the exported image is closed.  (libfuse
  * notes this to be a way to return last-minute errors.)
  */
-static void fuse_flush(fuse_req_t req, fuse_ino_t inode,
-                        struct fuse_file_info *fi)
+static void coroutine_fn
+fuse_flush(fuse_req_t req, fuse_ino_t inode, struct fuse_file_info *fi)
 {
     fuse_fsync(req, inode, 1, fi);
 }
@@ -796,8 +1025,9 @@ static void fuse_flush(fuse_req_t req, fuse_ino_t inode,
 /**
  * Let clients inquire allocation status.
  */
-static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
-                       int whence, struct fuse_file_info *fi)
+static void coroutine_fn
+fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
+           int whence, struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
 
@@ -810,8 +1040,11 @@ static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
         int64_t pnum;
         int ret;
 
-        ret = bdrv_block_status_above(blk_bs(exp->common.blk), NULL,
-                                      offset, INT64_MAX, &pnum, NULL, NULL);
+        WITH_GRAPH_RDLOCK_GUARD() {
+            ret = bdrv_co_block_status_above(blk_bs(exp->common.blk), NULL,
+                                             offset, INT64_MAX, &pnum,
+                                             NULL, NULL);
+        }
         if (ret < 0) {
             fuse_reply_err(req, -ret);
             return;
@@ -829,7 +1062,7 @@ static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
              * and @blk_len (the client-visible EOF).
              */
 
-            blk_len = blk_getlength(exp->common.blk);
+            blk_len = blk_co_getlength(exp->common.blk);
             if (blk_len < 0) {
                 fuse_reply_err(req, -blk_len);
                 return;
@@ -160,6 +160,12 @@ typedef struct BDRVRawState {
     bool has_write_zeroes:1;
     bool use_linux_aio:1;
     bool use_linux_io_uring:1;
+#ifdef CONFIG_LINUX_IO_URING
+    bool io_uring_fixed;
+    /* Requests of all AioContexts may fall back to LURING_RING_DEFAULT */
+    LuringRingType io_uring_ring;
+    int io_uring_file_index;
+#endif
     int page_cache_inconsistent; /* errno from fdatasync failure */
     bool has_fallocate;
     bool needs_alignment;
@@ -541,6 +547,27 @@ static void raw_parse_filename(const char *filename, QDict *options,
     bdrv_parse_filename_strip_prefix(filename, "file:", options);
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+/* Makes s->fd a fixed file of the io_uring rings if requested */
+static void raw_io_uring_register_file(BDRVRawState *s)
+{
+    if (s->use_linux_io_uring && s->io_uring_fixed) {
+        s->io_uring_file_index = luring_register_file(s->fd);
+        if (s->io_uring_file_index < 0) {
+            s->io_uring_file_index = -1;
+        }
+    }
+}
+
+static void raw_io_uring_unregister_file(BDRVRawState *s)
+{
+    if (s->io_uring_file_index >= 0) {
+        luring_unregister_file(s->io_uring_file_index);
+        s->io_uring_file_index = -1;
+    }
+}
+#endif
+
 static QemuOptsList raw_runtime_opts = {
     .name = "raw",
     .head = QTAILQ_HEAD_INITIALIZER(raw_runtime_opts.head),
@@ -560,6 +587,26 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "AIO max batch size (0 = auto handled by AIO backend, default: 0)",
         },
+#ifdef CONFIG_LINUX_IO_URING
+        {
+            .name = "io-uring-fixed",
+            .type = QEMU_OPT_BOOL,
+            .help = "register the file and I/O buffers with io_uring "
+                    "(default: off)",
+        },
+        {
+            .name = "io-uring-sqpoll",
+            .type = QEMU_OPT_BOOL,
+            .help = "submit io_uring requests from a kernel thread "
+                    "(default: off)",
+        },
+        {
+            .name = "io-uring-iopoll",
+            .type = QEMU_OPT_BOOL,
+            .help = "poll the device for io_uring completions "
+                    "(default: off)",
+        },
+#endif
         {
             .name = "locking",
             .type = QEMU_OPT_STRING,
@@ -601,6 +648,9 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     int fd, ret;
     struct stat st;
     OnOffAuto locking;
+#ifdef CONFIG_LINUX_IO_URING
+    bool io_uring_sqpoll, io_uring_iopoll;
+#endif
 
     opts = qemu_opts_create(&raw_runtime_opts, NULL, 0, &error_abort);
     if (!qemu_opts_absorb_qdict(opts, options, errp)) {
@@ -637,6 +687,13 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     s->use_linux_aio = (aio == BLOCKDEV_AIO_OPTIONS_NATIVE);
 #ifdef CONFIG_LINUX_IO_URING
     s->use_linux_io_uring = (aio == BLOCKDEV_AIO_OPTIONS_IO_URING);
+    s->io_uring_fixed = qemu_opt_get_bool(opts, "io-uring-fixed", false);
+    io_uring_sqpoll = qemu_opt_get_bool(opts, "io-uring-sqpoll", false);
+    io_uring_iopoll = qemu_opt_get_bool(opts, "io-uring-iopoll", false);
+    s->io_uring_ring = io_uring_iopoll ? LURING_RING_IOPOLL :
+                       io_uring_sqpoll ? LURING_RING_SQPOLL :
+                       LURING_RING_DEFAULT;
+    s->io_uring_file_index = -1;
 #endif
 
     s->aio_max_batch = qemu_opt_get_number(opts, "aio-max-batch", 0);
@@ -734,6 +791,21 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         ret = -EINVAL;
         goto fail;
     }
+#else
+    if (io_uring_iopoll && io_uring_sqpoll) {
+        error_setg(errp, "io-uring-iopoll and io-uring-sqpoll cannot be "
+                         "used together");
+        ret = -EINVAL;
+        goto fail;
+    }
+    /* Only direct I/O completions can be polled */
+    if (io_uring_iopoll &&
+        (!s->use_linux_io_uring || !(s->open_flags & O_DIRECT))) {
+        error_setg(errp, "io-uring-iopoll requires aio=io_uring and "
+                         "cache.direct=on");
+        ret = -EINVAL;
+        goto fail;
+    }
 #endif /* !defined(CONFIG_LINUX_IO_URING) */
 
     s->has_discard = true;
@@ -805,6 +877,9 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         /* When extending regular files, we get zeros from the OS */
         bs->supported_truncate_flags = BDRV_REQ_ZERO_WRITE;
     }
+#ifdef CONFIG_LINUX_IO_URING
+    raw_io_uring_register_file(s);
+#endif
     ret = 0;
 fail:
     if (ret < 0 && s->fd != -1) {
@@ -2432,7 +2507,13 @@ static bool bdrv_qiov_is_aligned(BlockDriverState *bs, QEMUIOVector *qiov)
 }
 
 #ifdef CONFIG_LINUX_IO_URING
-static inline bool raw_check_linux_io_uring(BDRVRawState *s)
+/*
+ * Sets up the io_uring ring of the current AioContext, returning its type
+ * in @ring.  Requests must be submitted to this ring, because the ring
+ * type of @s can change in another thread.
+ */
+static inline bool raw_check_linux_io_uring(BDRVRawState *s,
+                                            LuringRingType *ring)
 {
     Error *local_err = NULL;
     AioContext *ctx;
@@ -2442,7 +2523,14 @@ static inline bool raw_check_linux_io_uring(BDRVRawState *s)
     }
 
     ctx = qemu_get_current_aio_context();
-    if (unlikely(!aio_setup_linux_io_uring(ctx, &local_err))) {
+    *ring = qatomic_read(&s->io_uring_ring);
+    if (unlikely(!aio_setup_linux_io_uring(ctx, *ring, &local_err))) {
+        if (*ring != LURING_RING_DEFAULT) {
+            error_reportf_err(local_err, "Unable to set up polled io_uring, "
+                                         "falling back to a regular ring: ");
+            qatomic_set(&s->io_uring_ring, LURING_RING_DEFAULT);
+            return raw_check_linux_io_uring(s, ring);
+        }
         error_reportf_err(local_err, "Unable to use linux io_uring, "
                                      "falling back to thread pool: ");
         s->use_linux_io_uring = false;
@@ -2450,6 +2538,26 @@ static inline bool raw_check_linux_io_uring(BDRVRawState *s)
     }
     return true;
 }
+
+static bool raw_register_buf(BlockDriverState *bs, void *host, size_t size,
+                             Error **errp)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->io_uring_fixed) {
+        return luring_register_buf(host, size, errp);
+    }
+    return true;
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host, size_t size)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->io_uring_fixed) {
+        luring_unregister_buf(host, size);
+    }
+}
 #endif
 
 #ifdef CONFIG_LINUX_AIO
@@ -2480,6 +2588,9 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, int64_t *offset_ptr,
     RawPosixAIOData acb;
     int ret;
     uint64_t offset = *offset_ptr;
+#ifdef CONFIG_LINUX_IO_URING
+    LuringRingType ring;
+#endif
 
     if (fd_open(bs) < 0)
         return -EIO;
@@ -2503,9 +2614,21 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, int64_t *offset_ptr,
     if (s->needs_alignment && !bdrv_qiov_is_aligned(bs, qiov)) {
         type |= QEMU_AIO_MISALIGNED;
 #ifdef CONFIG_LINUX_IO_URING
-    } else if (raw_check_linux_io_uring(s)) {
+    } else if (raw_check_linux_io_uring(s, &ring)) {
         assert(qiov->size == bytes);
-        ret = luring_co_submit(bs, s->fd, offset, qiov, type);
+        ret = luring_co_submit(bs, ring, s->fd, s->io_uring_file_index,
+                               offset, qiov, type);
+        if (ret == -EOPNOTSUPP && ring == LURING_RING_IOPOLL) {
+            /* The device has no poll queues, e.g. nvme.poll_queues=0 */
+            warn_report_once("Device does not support polled I/O, disabling "
+                             "io-uring-iopoll");
+            qatomic_set(&s->io_uring_ring, LURING_RING_DEFAULT);
+            if (raw_check_linux_io_uring(s, &ring)) {
+                ret = luring_co_submit(bs, ring, s->fd,
+                                       s->io_uring_file_index, offset, qiov,
+                                       type);
+            }
+        }
         goto out;
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2583,6 +2706,9 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
     BDRVRawState *s = bs->opaque;
     RawPosixAIOData acb;
     int ret;
+#ifdef CONFIG_LINUX_IO_URING
+    LuringRingType ring;
+#endif
 
     ret = fd_open(bs);
     if (ret < 0) {
@@ -2596,8 +2722,10 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
     };
 
 #ifdef CONFIG_LINUX_IO_URING
-    if (raw_check_linux_io_uring(s)) {
-        return luring_co_submit(bs, s->fd, 0, NULL, QEMU_AIO_FLUSH);
+    if (raw_check_linux_io_uring(s, &ring)) {
+        return luring_co_submit(bs, ring, s->fd,
+                                s->io_uring_file_index, 0, NULL,
+                                QEMU_AIO_FLUSH);
     }
 #endif
     return raw_thread_pool_submit(handle_aiocb_flush, &acb);
@@ -2610,6 +2738,9 @@ static void raw_close(BlockDriverState *bs)
     if (s->fd >= 0) {
 #if defined(CONFIG_BLKZONED)
         g_free(bs->wps);
+#endif
+#ifdef CONFIG_LINUX_IO_URING
+        raw_io_uring_unregister_file(s);
 #endif
         qemu_close(s->fd);
         s->fd = -1;
@@ -3802,9 +3933,15 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
+#ifdef CONFIG_LINUX_IO_URING
+        raw_io_uring_unregister_file(s);
+#endif
         qemu_close(s->fd);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
+#ifdef CONFIG_LINUX_IO_URING
+        raw_io_uring_register_file(s);
+#endif
     }
     s->perm_change_fd = 0;
 
@@ -3909,6 +4046,10 @@ BlockDriver bdrv_file = {
     .bdrv_check_perm = raw_check_perm,
     .bdrv_set_perm   = raw_set_perm,
     .bdrv_abort_perm_update = raw_abort_perm_update,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf   = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
+#endif
     .create_opts = &raw_create_opts,
     .mutable_opts = mutable_opts,
 };
@@ -4278,6 +4419,10 @@ static BlockDriver bdrv_host_device = {
     .bdrv_check_perm = raw_check_perm,
     .bdrv_set_perm   = raw_set_perm,
     .bdrv_abort_perm_update = raw_abort_perm_update,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf   = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
+#endif
     .bdrv_probe_blocksizes = hdev_probe_blocksizes,
     .bdrv_probe_geometry = hdev_probe_geometry,
 
@@ -33,6 +33,9 @@ static QemuMutex aio_context_list_lock;
 /* Written and read with atomic operations. */
 static int has_writer;
 
+/* Incremented by every writer, read with atomic operations. */
+static uint64_t graph_generation;
+
 /*
  * A reader coroutine could move from an AioContext to another.
  * If this happens, there is no problem from the point of view of
@@ -139,9 +142,16 @@ void no_coroutine_fn bdrv_graph_wrlock(void)
         smp_mb();
     } while (reader_count() >= 1);
 
+    qatomic_set(&graph_generation, graph_generation + 1);
+
     bdrv_drain_all_end();
 }
 
+uint64_t bdrv_graph_generation(void)
+{
+    return qatomic_read(&graph_generation);
+}
+
 void no_coroutine_fn bdrv_graph_wrunlock(void)
 {
     GLOBAL_STATE_CODE();
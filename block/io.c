@@ -1280,6 +1280,12 @@ bdrv_co_do_copy_on_readv(BdrvChild *child, int64_t offset, int64_t bytes,
                                           BDRV_REQ_WRITE_UNCHANGED);
             }
 
+            /*
+             * The copy allocates the range in @bs without going through
+             * bdrv_co_write_req_finish(), even if it failed half-way
+             */
+            bdrv_chain_map_invalidate_range(bs, align_offset, pnum);
+
             if (ret < 0) {
                 /* It might be okay to ignore write errors for guest
                  * requests.  If this is a deliberate copy-on-read
@@ -2017,6 +2023,12 @@ bdrv_co_write_req_finish(BdrvChild *child, int64_t offset, int64_t bytes,
 
     qatomic_inc(&bs->write_gen);
 
+    if (req->type == BDRV_TRACKED_TRUNCATE) {
+        bdrv_chain_map_invalidate(bs);
+    } else {
+        bdrv_chain_map_invalidate_range(bs, offset, bytes);
+    }
+
     /*
      * Discard cannot extend the image, but in error handling cases, such as
      * when reverting a qcow2 cluster allocation, the discarded range can pass
@@ -2634,6 +2646,8 @@ bdrv_co_common_block_status_above(BlockDriverState *bs,
     BlockDriverState *p;
     int64_t eof = 0;
     int dummy;
+    int skip;
+    uint64_t gen = 0;
     IO_CODE();
 
     assert(!include_base || base); /* Can't include NULL base */
@@ -2649,22 +2663,54 @@ bdrv_co_common_block_status_above(BlockDriverState *bs,
         return 0;
     }
 
-    ret = bdrv_co_do_block_status(bs, want_zero, offset, bytes, pnum,
-                                  map, file);
-    ++*depth;
-    if (ret < 0 || *pnum == 0 || ret & BDRV_BLOCK_ALLOCATED || bs == base) {
-        return ret;
-    }
+    /*
+     * Whether a layer allocates data doesn't depend on want_zero, so the
+     * layers that are known not to allocate this range can be skipped.
+     * Always query the last layer above @base, whose result is returned
+     * when no layer allocates the range.
+     */
+    skip = bs == base ? 0 : bdrv_chain_map_lookup(bs, offset, &bytes, &gen);
+    p = bs;
+    while (*depth < skip && p != base) {
+        BlockDriverState *next = bdrv_filter_or_cow_bs(p);
 
-    if (ret & BDRV_BLOCK_EOF) {
-        eof = offset + *pnum;
+        if (!next || (!include_base && next == base)) {
+            break;
+        }
+        p = next;
+        ++*depth;
     }
 
-    assert(*pnum <= bytes);
-    bytes = *pnum;
+    if (p == bs) {
+        ret = bdrv_co_do_block_status(bs, want_zero, offset, bytes, pnum,
+                                      map, file);
+        ++*depth;
+        if (ret < 0 || *pnum == 0 || ret & BDRV_BLOCK_ALLOCATED ||
+            bs == base) {
+            return ret;
+        }
+
+        if (ret & BDRV_BLOCK_EOF) {
+            eof = offset + *pnum;
+        }
+
+        assert(*pnum <= bytes);
+        bytes = *pnum;
+        p = bdrv_filter_or_cow_bs(bs);
+    } else {
+        /* What bdrv_co_do_block_status() on @bs would report as EOF */
+        eof = bdrv_co_getlength(bs);
+        if (eof < 0) {
+            return eof;
+        }
+        if (offset >= eof) {
+            *pnum = 0;
+            return BDRV_BLOCK_EOF;
+        }
+        bytes = MIN(bytes, eof - offset);
+    }
 
-    for (p = bdrv_filter_or_cow_bs(bs); include_base || p != base;
-         p = bdrv_filter_or_cow_bs(p))
+    for (; include_base || p != base; p = bdrv_filter_or_cow_bs(p))
     {
         ret = bdrv_co_do_block_status(p, want_zero, offset, bytes, pnum,
                                       map, file);
@@ -2719,6 +2765,11 @@ bdrv_co_common_block_status_above(BlockDriverState *bs,
         ret |= BDRV_BLOCK_EOF;
     }
 
+    /* All layers above the last one that was queried don't allocate */
+    if (*depth - 1 > skip && *pnum) {
+        bdrv_chain_map_fill(bs, offset, *pnum, *depth - 1, gen);
+    }
+
     return ret;
 }
 
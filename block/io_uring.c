@@ -16,6 +16,8 @@
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
 #include "qemu/defer-call.h"
+#include "qemu/lockable.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
 #include "sysemu/block-backend.h"
 #include "trace.h"
@@ -26,6 +28,13 @@
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Number of fixed file slots in each ring */
+#define MAX_FIXED_FILES 256
+
+/* Limits of the kernel on registered buffers */
+#define MAX_FIXED_BUFFERS 1024
+#define MAX_FIXED_BUFFER_SIZE (1 * GiB)
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
@@ -58,8 +67,318 @@ struct LuringState {
     LuringQueue io_q;
 
     QEMUBH *completion_bh;
+
+    /* Completions are only found by polling, see LURING_RING_IOPOLL */
+    bool iopoll;
+
+    /* Whether the slots of luring_fixed.files are usable with this ring */
+    bool fixed_files;
+
+    /*
+     * Registered buffers, copied from luring_fixed.buffers by the home
+     * thread when buffers_generation is out of date.  Each ring pins the
+     * memory it registers, so buffers are only registered once the ring
+     * has seen a request on one of them.
+     */
+    bool use_buffers;
+    struct iovec *buffers;
+    unsigned int nr_buffers;
+    unsigned int buffers_generation;
+
+    QLIST_ENTRY(LuringState) next;
 };
 
+typedef struct LuringFixedBuffer {
+    struct iovec iov;
+    unsigned int refcnt;
+} LuringFixedBuffer;
+
+/*
+ * Files and memory registered with the rings.  Files are installed in
+ * all rings right away, because a ring keeps the file open as long as
+ * it is registered.  Buffers are picked up by the rings that use them
+ * before their next submission, because re-registering them must not
+ * race with requests being prepared.
+ */
+static struct {
+    QemuMutex lock;
+    QLIST_HEAD(, LuringState) rings;
+    int files[MAX_FIXED_FILES];
+    /*
+     * LuringFixedBuffer sorted by address, at most 1 GiB each and at most
+     * MAX_FIXED_BUFFERS of them
+     */
+    GArray *buffers;
+    unsigned int nr_buffers;
+    unsigned int buffers_generation;
+} luring_fixed;
+
+static void __attribute__((constructor)) luring_fixed_init(void)
+{
+    int i;
+
+    qemu_mutex_init(&luring_fixed.lock);
+    QLIST_INIT(&luring_fixed.rings);
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        luring_fixed.files[i] = -1;
+    }
+    luring_fixed.buffers = g_array_new(false, false,
+                                       sizeof(LuringFixedBuffer));
+}
+
+static void luring_fixed_files_update(int index, int fd)
+{
+    LuringState *s;
+    int ret;
+
+    luring_fixed.files[index] = fd;
+    QLIST_FOREACH(s, &luring_fixed.rings, next) {
+        if (!qatomic_read(&s->fixed_files)) {
+            continue;
+        }
+        ret = io_uring_register_files_update(&s->ring, index, &fd, 1);
+        if (ret < 0) {
+            /* The slot is unusable, stop using fixed files in this ring */
+            qatomic_set(&s->fixed_files, false);
+        }
+    }
+}
+
+int luring_register_file(int fd)
+{
+    int i;
+
+    QEMU_LOCK_GUARD(&luring_fixed.lock);
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (luring_fixed.files[i] == -1) {
+            luring_fixed_files_update(i, fd);
+            trace_luring_register_file(fd, i);
+            return i;
+        }
+    }
+    return -ENOSPC;
+}
+
+void luring_unregister_file(int index)
+{
+    QEMU_LOCK_GUARD(&luring_fixed.lock);
+
+    assert(luring_fixed.files[index] != -1);
+    trace_luring_unregister_file(luring_fixed.files[index], index);
+    luring_fixed_files_update(index, -1);
+}
+
+static int luring_fixed_buffer_cmp(gconstpointer a, gconstpointer b)
+{
+    const LuringFixedBuffer *buf_a = a;
+    const LuringFixedBuffer *buf_b = b;
+
+    if (buf_a->iov.iov_base != buf_b->iov.iov_base) {
+        return buf_a->iov.iov_base < buf_b->iov.iov_base ? -1 : 1;
+    }
+    if (buf_a->iov.iov_len != buf_b->iov.iov_len) {
+        return buf_a->iov.iov_len < buf_b->iov.iov_len ? -1 : 1;
+    }
+    return 0;
+}
+
+/* Returns the index of the buffer that is equal to @buf, or -1 */
+static int luring_fixed_buffer_lookup(const LuringFixedBuffer *buf)
+{
+    GArray *buffers = luring_fixed.buffers;
+    guint i;
+
+    for (i = 0; i < buffers->len; i++) {
+        if (!luring_fixed_buffer_cmp(&g_array_index(buffers, LuringFixedBuffer,
+                                                    i), buf)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool luring_register_buf(void *host, size_t size, Error **errp)
+{
+    GArray *buffers = luring_fixed.buffers;
+    unsigned int nr_new = 0;
+    size_t offset;
+
+    QEMU_LOCK_GUARD(&luring_fixed.lock);
+
+    /* The kernel rejects the whole table if it is too large */
+    for (offset = 0; offset < size; offset += MAX_FIXED_BUFFER_SIZE) {
+        LuringFixedBuffer buf = {
+            .iov.iov_base = host + offset,
+            .iov.iov_len = MIN(size - offset, MAX_FIXED_BUFFER_SIZE),
+        };
+
+        if (luring_fixed_buffer_lookup(&buf) < 0) {
+            nr_new++;
+        }
+    }
+    if (buffers->len + nr_new > MAX_FIXED_BUFFERS) {
+        error_setg(errp, "Cannot register more than %d io_uring fixed "
+                   "buffers of up to 1 GiB", MAX_FIXED_BUFFERS);
+        return false;
+    }
+
+    for (offset = 0; offset < size; offset += MAX_FIXED_BUFFER_SIZE) {
+        LuringFixedBuffer buf = {
+            .iov.iov_base = host + offset,
+            .iov.iov_len = MIN(size - offset, MAX_FIXED_BUFFER_SIZE),
+            .refcnt = 1,
+        };
+        int i = luring_fixed_buffer_lookup(&buf);
+
+        if (i >= 0) {
+            g_array_index(buffers, LuringFixedBuffer, i).refcnt++;
+        } else {
+            g_array_append_val(buffers, buf);
+        }
+    }
+    g_array_sort(buffers, luring_fixed_buffer_cmp);
+    qatomic_set(&luring_fixed.nr_buffers, buffers->len);
+    qatomic_inc(&luring_fixed.buffers_generation);
+    return true;
+}
+
+void luring_unregister_buf(void *host, size_t size)
+{
+    GArray *buffers = luring_fixed.buffers;
+    size_t offset;
+
+    QEMU_LOCK_GUARD(&luring_fixed.lock);
+
+    for (offset = 0; offset < size; offset += MAX_FIXED_BUFFER_SIZE) {
+        LuringFixedBuffer buf = {
+            .iov.iov_base = host + offset,
+            .iov.iov_len = MIN(size - offset, MAX_FIXED_BUFFER_SIZE),
+        };
+        int i = luring_fixed_buffer_lookup(&buf);
+
+        if (i >= 0 &&
+            --g_array_index(buffers, LuringFixedBuffer, i).refcnt == 0) {
+            g_array_remove_index(buffers, i);
+        }
+    }
+    qatomic_set(&luring_fixed.nr_buffers, buffers->len);
+    qatomic_inc(&luring_fixed.buffers_generation);
+}
+
+/* Re-registers the buffers of the ring, called from its home thread */
+static void luring_sync_buffers(LuringState *s)
+{
+    unsigned int i;
+    int ret;
+
+    if (s->nr_buffers) {
+        io_uring_unregister_buffers(&s->ring);
+        g_free(s->buffers);
+        s->buffers = NULL;
+        s->nr_buffers = 0;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&luring_fixed.lock) {
+        GArray *buffers = luring_fixed.buffers;
+
+        s->buffers_generation = luring_fixed.buffers_generation;
+        assert(buffers->len <= MAX_FIXED_BUFFERS);
+        s->nr_buffers = buffers->len;
+        s->buffers = g_new(struct iovec, s->nr_buffers);
+        for (i = 0; i < s->nr_buffers; i++) {
+            s->buffers[i] = g_array_index(buffers, LuringFixedBuffer, i).iov;
+        }
+    }
+
+    if (!s->nr_buffers) {
+        return;
+    }
+
+    ret = io_uring_register_buffers(&s->ring, s->buffers, s->nr_buffers);
+    trace_luring_register_buffers(s, s->nr_buffers, ret);
+    if (ret < 0) {
+        /* Most likely RLIMIT_MEMLOCK, requests will not use fixed buffers */
+        g_free(s->buffers);
+        s->buffers = NULL;
+        s->nr_buffers = 0;
+    }
+}
+
+/*
+ * Returns the index of the buffer in @bufs that contains the single buffer
+ * of @qiov, or -1 if there is none.  @bufs is sorted by address and holds
+ * @nr_bufs elements of @stride bytes, each starting with a struct iovec.
+ */
+static int luring_find_iov(const void *bufs, size_t stride,
+                           unsigned int nr_bufs, QEMUIOVector *qiov)
+{
+    uintptr_t start, end;
+    unsigned int low = 0, high = nr_bufs;
+
+    if (qiov->niov != 1) {
+        return -1;
+    }
+
+    start = (uintptr_t)qiov->iov[0].iov_base;
+    end = start + qiov->iov[0].iov_len;
+    while (low < high) {
+        unsigned int mid = low + (high - low) / 2;
+        const struct iovec *buf = bufs + mid * stride;
+        uintptr_t base = (uintptr_t)buf->iov_base;
+
+        if (start < base) {
+            high = mid;
+        } else if (start >= base + buf->iov_len) {
+            low = mid + 1;
+        } else {
+            return end <= base + buf->iov_len ? mid : -1;
+        }
+    }
+    return -1;
+}
+
+static int luring_find_buffer(LuringState *s, QEMUIOVector *qiov)
+{
+    return luring_find_iov(s->buffers, sizeof(struct iovec), s->nr_buffers,
+                           qiov);
+}
+
+/*
+ * Whether @qiov lies in registered memory, so that the ring starts using
+ * fixed buffers
+ */
+static bool luring_wants_buffers(QEMUIOVector *qiov)
+{
+    GArray *buffers = luring_fixed.buffers;
+
+    QEMU_BUILD_BUG_ON(offsetof(LuringFixedBuffer, iov) != 0);
+
+    if (qiov->niov != 1 || !qatomic_read(&luring_fixed.nr_buffers)) {
+        return false;
+    }
+
+    QEMU_LOCK_GUARD(&luring_fixed.lock);
+    return luring_find_iov(buffers->data, sizeof(LuringFixedBuffer),
+                           buffers->len, qiov) >= 0;
+}
+
+/* Turns a request on a registered buffer into a plain readv/writev */
+static void luring_unfix_buffer(LuringAIOCB *luringcb)
+{
+    luringcb->sqeq.opcode = luringcb->is_read ? IORING_OP_READV :
+                                                IORING_OP_WRITEV;
+    luringcb->sqeq.addr = (uintptr_t)luringcb->qiov->iov;
+    luringcb->sqeq.len = luringcb->qiov->niov;
+    luringcb->sqeq.buf_index = 0;
+}
+
+static bool luring_is_fixed_buffer(LuringAIOCB *luringcb)
+{
+    return luringcb->sqeq.opcode == IORING_OP_READ_FIXED ||
+           luringcb->sqeq.opcode == IORING_OP_WRITE_FIXED;
+}
+
 /**
  * luring_resubmit:
  *
@@ -101,6 +420,8 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
                       remaining);
 
     /* Update sqe */
+    luringcb->sqeq.opcode = IORING_OP_READV;
+    luringcb->sqeq.buf_index = 0;
     luringcb->sqeq.off += nread;
     luringcb->sqeq.addr = (uintptr_t)luringcb->resubmit_qiov.iov;
     luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
@@ -184,6 +505,16 @@ static void luring_process_completions(LuringState *s)
                 luring_resubmit(s, luringcb);
                 continue;
             }
+
+            /*
+             * The buffer was unregistered while the request was queued,
+             * retry without it.
+             */
+            if (ret == -EFAULT && luring_is_fixed_buffer(luringcb)) {
+                luring_unfix_buffer(luringcb);
+                luring_resubmit(s, luringcb);
+                continue;
+            }
         } else if (!luringcb->qiov) {
             goto end;
         } else if (total_bytes == luringcb->qiov->size) {
@@ -221,7 +552,13 @@ end:
         }
     }
 
-    qemu_bh_cancel(s->completion_bh);
+    /*
+     * A polled ring signals nothing when requests complete, so keep the
+     * event loop from blocking while there are requests in flight.
+     */
+    if (!s->iopoll || !s->io_q.in_flight) {
+        qemu_bh_cancel(s->completion_bh);
+    }
 
     defer_call_end();
 }
@@ -295,6 +632,12 @@ static bool qemu_luring_poll_cb(void *opaque)
 {
     LuringState *s = opaque;
 
+    if (s->iopoll && s->io_q.in_flight && !io_uring_cq_ready(&s->ring)) {
+        struct io_uring_cqe *cqe;
+
+        /* Enters the kernel, which polls the device for completions */
+        io_uring_peek_cqe(&s->ring, &cqe);
+    }
     return io_uring_cq_ready(&s->ring);
 }
 
@@ -326,6 +669,7 @@ static void luring_deferred_fn(void *opaque)
 /**
  * luring_do_submit:
  * @fd: file descriptor for I/O
+ * @file_index: fixed file slot of @fd, or -1
  * @luringcb: AIO control block
  * @s: AIO state
  * @offset: offset for request
@@ -334,24 +678,55 @@ static void luring_deferred_fn(void *opaque)
  * Fetches sqes from ring, adds to pending queue and preps them
  *
  */
-static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
-                            uint64_t offset, int type)
+static int luring_do_submit(int fd, int file_index, LuringAIOCB *luringcb,
+                            LuringState *s, uint64_t offset, int type)
 {
     int ret;
+    int buf_index = -1;
+    bool fixed_file = file_index >= 0 && qatomic_read(&s->fixed_files);
     struct io_uring_sqe *sqes = &luringcb->sqeq;
 
+    if (fixed_file) {
+        fd = file_index;
+    }
+    if (type == QEMU_AIO_READ || type == QEMU_AIO_WRITE) {
+        if (!s->use_buffers && luring_wants_buffers(luringcb->qiov)) {
+            s->use_buffers = true;
+            luring_sync_buffers(s);
+        } else if (s->use_buffers &&
+                   qatomic_read(&luring_fixed.buffers_generation) !=
+                   s->buffers_generation) {
+            luring_sync_buffers(s);
+        }
+        if (s->nr_buffers) {
+            buf_index = luring_find_buffer(s, luringcb->qiov);
+        }
+    }
+
     switch (type) {
     case QEMU_AIO_WRITE:
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
+        if (buf_index >= 0) {
+            io_uring_prep_write_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                      luringcb->qiov->iov[0].iov_len, offset,
+                                      buf_index);
+        } else {
+            io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
+                                 luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_ZONE_APPEND:
         io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
                              luringcb->qiov->niov, offset);
         break;
     case QEMU_AIO_READ:
-        io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
-                            luringcb->qiov->niov, offset);
+        if (buf_index >= 0) {
+            io_uring_prep_read_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                     luringcb->qiov->iov[0].iov_len, offset,
+                                     buf_index);
+        } else {
+            io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
+                                luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_FLUSH:
         io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
@@ -361,6 +736,9 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
+    if (fixed_file) {
+        sqes->flags |= IOSQE_FIXED_FILE;
+    }
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -379,21 +757,36 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
     return 0;
 }
 
-int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
+int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringRingType ring,
+                                  int fd, int file_index, uint64_t offset,
                                   QEMUIOVector *qiov, int type)
 {
     int ret;
     AioContext *ctx = qemu_get_current_aio_context();
-    LuringState *s = aio_get_linux_io_uring(ctx);
+    LuringState *s;
     LuringAIOCB luringcb = {
         .co         = qemu_coroutine_self(),
         .ret        = -EINPROGRESS,
         .qiov       = qiov,
         .is_read    = (type == QEMU_AIO_READ),
     };
+
+    /* Polled rings only support reads and writes */
+    if (ring == LURING_RING_IOPOLL &&
+        type != QEMU_AIO_READ && type != QEMU_AIO_WRITE) {
+        Error *local_err = NULL;
+
+        if (!aio_setup_linux_io_uring(ctx, LURING_RING_DEFAULT, &local_err)) {
+            error_report_err(local_err);
+            return -EIO;
+        }
+        ring = LURING_RING_DEFAULT;
+    }
+    s = aio_get_linux_io_uring(ctx, ring);
+
     trace_luring_co_submit(bs, s, &luringcb, fd, offset, qiov ? qiov->size : 0,
                            type);
-    ret = luring_do_submit(fd, &luringcb, s, offset, type);
+    ret = luring_do_submit(fd, file_index, &luringcb, s, offset, type);
 
     if (ret < 0) {
         return ret;
@@ -422,15 +815,23 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
                        qemu_luring_poll_cb, qemu_luring_poll_ready, s);
 }
 
-LuringState *luring_init(Error **errp)
+LuringState *luring_init(LuringRingType type, Error **errp)
 {
     int rc;
     LuringState *s = g_new0(LuringState, 1);
     struct io_uring *ring = &s->ring;
+    unsigned flags = 0;
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    if (type == LURING_RING_SQPOLL) {
+        flags |= IORING_SETUP_SQPOLL;
+    } else if (type == LURING_RING_IOPOLL) {
+        flags |= IORING_SETUP_IOPOLL;
+        s->iopoll = true;
+    }
+
+    rc = io_uring_queue_init(MAX_ENTRIES, ring, flags);
     if (rc < 0) {
         error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
         g_free(s);
@@ -438,13 +839,25 @@ LuringState *luring_init(Error **errp)
     }
 
     ioq_init(&s->io_q);
+
+    WITH_QEMU_LOCK_GUARD(&luring_fixed.lock) {
+        /* Older kernels don't accept empty slots, do without fixed files */
+        rc = io_uring_register_files(ring, luring_fixed.files,
+                                     MAX_FIXED_FILES);
+        s->fixed_files = rc == 0;
+        QLIST_INSERT_HEAD(&luring_fixed.rings, s, next);
+    }
     return s;
 
 }
 
 void luring_cleanup(LuringState *s)
 {
+    WITH_QEMU_LOCK_GUARD(&luring_fixed.lock) {
+        QLIST_REMOVE(s, next);
+    }
     io_uring_queue_exit(&s->ring);
+    g_free(s->buffers);
     trace_luring_cleanup_state(s);
     g_free(s);
 }
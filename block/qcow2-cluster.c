@@ -887,7 +887,6 @@ qcow2_alloc_compressed_cluster_offset(BlockDriverState *bs, uint64_t offset,
 static int coroutine_fn GRAPH_RDLOCK
 perform_cow(BlockDriverState *bs, QCowL2Meta *m)
 {
-    BDRVQcow2State *s = bs->opaque;
     Qcow2COWRegion *start = &m->cow_start;
     Qcow2COWRegion *end = &m->cow_end;
     unsigned buffer_size;
@@ -937,7 +936,6 @@ perform_cow(BlockDriverState *bs, QCowL2Meta *m)
                                                        data_bytes)
                                 : 0));
 
-    qemu_co_mutex_unlock(&s->lock);
     /* First we read the existing data from both COW regions. We
      * either read the whole region in one go, or the start and end
      * regions separately. */
@@ -1009,19 +1007,24 @@ perform_cow(BlockDriverState *bs, QCowL2Meta *m)
     }
 
 fail:
-    qemu_co_mutex_lock(&s->lock);
+    qemu_vfree(start_buffer);
+    qemu_iovec_destroy(&qiov);
+    return ret;
+}
 
-    /*
-     * Before we update the L2 table to actually point to the new cluster, we
-     * need to be sure that the refcounts have been increased and COW was
-     * handled.
-     */
+/*
+ * Copies the unmodified parts of the clusters of @m, and writes the guest
+ * data along with them if it was merged into @m. Only does data I/O on
+ * clusters owned by this request, so s->lock must not be held.
+ */
+int coroutine_fn qcow2_alloc_cluster_cow(BlockDriverState *bs, QCowL2Meta *m)
+{
+    int ret;
+
+    ret = perform_cow(bs, m);
     if (ret == 0) {
-        qcow2_cache_depends_on_flush(s->l2_table_cache);
+        m->cow_done = true;
     }
-
-    qemu_vfree(start_buffer);
-    qemu_iovec_destroy(&qiov);
     return ret;
 }
 
@@ -1043,9 +1046,22 @@ int coroutine_fn qcow2_alloc_cluster_link_l2(BlockDriverState *bs,
     }
 
     /* copy content of unmodified sectors */
-    ret = perform_cow(bs, m);
-    if (ret < 0) {
-        goto err;
+    if (!m->cow_done) {
+        qemu_co_mutex_unlock(&s->lock);
+        ret = qcow2_alloc_cluster_cow(bs, m);
+        qemu_co_mutex_lock(&s->lock);
+        if (ret < 0) {
+            goto err;
+        }
+    }
+
+    /*
+     * Before we update the L2 table to actually point to the new cluster, we
+     * need to be sure that the refcounts have been increased and COW was
+     * handled.
+     */
+    if ((m->cow_start.nb_bytes || m->cow_end.nb_bytes) && !m->skip_cow) {
+        qcow2_cache_depends_on_flush(s->l2_table_cache);
     }
 
     /* Update L2 table. */
@@ -1606,6 +1622,7 @@ do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
                         uint64_t *host_offset, uint64_t *nb_clusters)
 {
     BDRVQcow2State *s = bs->opaque;
+    uint64_t guest_cluster_offset;
 
     trace_qcow2_do_alloc_clusters_offset(qemu_coroutine_self(), guest_offset,
                                          *host_offset, *nb_clusters);
@@ -1619,16 +1636,19 @@ do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
 
     /* Allocate new clusters */
     trace_qcow2_cluster_alloc_phys(qemu_coroutine_self());
+    guest_cluster_offset = start_of_cluster(s, guest_offset);
     if (*host_offset == INV_OFFSET) {
         int64_t cluster_offset =
-            qcow2_alloc_clusters(bs, *nb_clusters * s->cluster_size);
+            qcow2_alloc_data_clusters(bs, guest_cluster_offset,
+                                      *nb_clusters * s->cluster_size);
         if (cluster_offset < 0) {
             return cluster_offset;
         }
         *host_offset = cluster_offset;
         return 0;
     } else {
-        int64_t ret = qcow2_alloc_clusters_at(bs, *host_offset, *nb_clusters);
+        int64_t ret = qcow2_alloc_data_clusters_at(bs, guest_cluster_offset,
+                                                   *host_offset, *nb_clusters);
         if (ret < 0) {
             return ret;
         }
@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include "block/block-io.h"
+#include "block/aio_task.h"
 #include "qapi/error.h"
 #include "qcow2.h"
 #include "qemu/range.h"
@@ -1065,6 +1066,206 @@ int64_t coroutine_fn qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offs
     return i;
 }
 
+/* Frees the clusters that @st allocated ahead and didn't use */
+static void GRAPH_RDLOCK
+prealloc_stream_free(BlockDriverState *bs, Qcow2PreallocStream *st)
+{
+    if (st->bytes) {
+        qcow2_free_clusters(bs, st->offset, st->bytes, QCOW2_DISCARD_NEVER);
+        st->offset += st->bytes;
+        st->bytes = 0;
+    }
+}
+
+/*
+ * Returns the stream that a data allocation at @guest_offset continues, or
+ * replaces the stream that looks the least like a sequential one if there
+ * is none.  *@sequential tells which of both happened.
+ */
+static Qcow2PreallocStream * GRAPH_RDLOCK
+prealloc_stream_get(BlockDriverState *bs, uint64_t guest_offset,
+                    bool *sequential)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2PreallocStream *st, *victim = NULL;
+    int i;
+
+    for (i = 0; i < QCOW2_PREALLOC_STREAMS; i++) {
+        st = &s->prealloc_streams[i];
+        if (st->last_use && st->guest_end == guest_offset) {
+            *sequential = true;
+            return st;
+        }
+        if (!victim || st->window < victim->window ||
+            (st->window == victim->window && st->last_use < victim->last_use))
+        {
+            victim = st;
+        }
+    }
+
+    prealloc_stream_free(bs, victim);
+    *victim = (Qcow2PreallocStream) {};
+    *sequential = false;
+    return victim;
+}
+
+/* Tries to allocate @bytes more clusters right after those of @st */
+static int coroutine_fn GRAPH_RDLOCK
+prealloc_stream_extend(BlockDriverState *bs, Qcow2PreallocStream *st,
+                       uint64_t bytes)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int64_t nb_clusters;
+
+    if (!st->offset) {
+        return 0;
+    }
+
+    nb_clusters = qcow2_alloc_clusters_at(bs, st->offset + st->bytes,
+                                          size_to_clusters(s, bytes));
+    if (nb_clusters < 0) {
+        return nb_clusters;
+    }
+
+    st->bytes += nb_clusters << s->cluster_bits;
+    return 0;
+}
+
+/* Hands out the first @bytes of the clusters that @st allocated ahead */
+static int64_t prealloc_stream_take(BDRVQcow2State *s, Qcow2PreallocStream *st,
+                                    uint64_t bytes)
+{
+    int64_t offset = st->offset;
+
+    assert(bytes <= st->bytes);
+    st->offset += bytes;
+    st->bytes -= bytes;
+    st->guest_end += bytes;
+    return offset;
+}
+
+/*
+ * Allocates @size bytes of clusters for the guest data at @guest_offset,
+ * which must be cluster aligned.
+ *
+ * If the allocation continues where an earlier one ended in the guest, the
+ * clusters are taken from those that were allocated ahead for the stream of
+ * sequential writes, which are then allocated twice as far ahead as before,
+ * up to sequential_prealloc_size.  This keeps the data of the stream
+ * contiguous in the image file, with metadata and the data of other writes
+ * in between only every so often, and takes a single refcount update per
+ * range instead of one per write.  The clusters that are allocated ahead
+ * have their refcount set, so if QEMU doesn't exit cleanly, they are leaked.
+ */
+int64_t coroutine_fn qcow2_alloc_data_clusters(BlockDriverState *bs,
+                                               uint64_t guest_offset,
+                                               uint64_t size)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2PreallocStream *st;
+    bool sequential;
+    int64_t offset;
+    int ret;
+
+    if (!s->sequential_prealloc_size) {
+        return qcow2_alloc_clusters(bs, size);
+    }
+
+    st = prealloc_stream_get(bs, guest_offset, &sequential);
+    st->last_use = ++s->prealloc_clock;
+
+    if (!sequential) {
+        offset = qcow2_alloc_clusters(bs, size);
+        if (offset >= 0) {
+            st->guest_end = guest_offset + size;
+            st->offset = offset + size;
+        }
+        return offset;
+    }
+
+    if (st->bytes < size) {
+        st->window = MIN(MAX(st->window * 2, size),
+                         s->sequential_prealloc_size);
+        ret = prealloc_stream_extend(bs, st, size - st->bytes + st->window);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    if (st->bytes < size) {
+        /* Something else was allocated in the way, continue elsewhere */
+        prealloc_stream_free(bs, st);
+        offset = qcow2_alloc_clusters(bs, size + st->window);
+        if (offset < 0) {
+            return offset;
+        }
+        st->offset = offset;
+        st->bytes = size + st->window;
+    }
+
+    return prealloc_stream_take(s, st, size);
+}
+
+/*
+ * Like qcow2_alloc_clusters_at(), but for the guest data at @guest_offset,
+ * see qcow2_alloc_data_clusters().  Returns the number of clusters that
+ * could be allocated at @offset, possibly 0.
+ */
+int64_t coroutine_fn qcow2_alloc_data_clusters_at(BlockDriverState *bs,
+                                                  uint64_t guest_offset,
+                                                  uint64_t offset,
+                                                  int64_t nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2PreallocStream *st;
+    uint64_t bytes = nb_clusters << s->cluster_bits;
+    int i, ret;
+
+    if (!s->sequential_prealloc_size) {
+        return qcow2_alloc_clusters_at(bs, offset, nb_clusters);
+    }
+
+    for (i = 0; i < QCOW2_PREALLOC_STREAMS; i++) {
+        st = &s->prealloc_streams[i];
+        if (st->last_use && st->guest_end == guest_offset &&
+            st->offset == offset)
+        {
+            break;
+        }
+    }
+    if (i == QCOW2_PREALLOC_STREAMS) {
+        return qcow2_alloc_clusters_at(bs, offset, nb_clusters);
+    }
+
+    st->last_use = ++s->prealloc_clock;
+    if (st->bytes < bytes) {
+        ret = prealloc_stream_extend(bs, st, bytes - st->bytes + st->window);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    bytes = MIN(bytes, st->bytes);
+    prealloc_stream_take(s, st, bytes);
+    return bytes >> s->cluster_bits;
+}
+
+/*
+ * Frees the clusters that were allocated ahead for sequential writes.  Must
+ * be called before anything that expects all clusters with a refcount to be
+ * referenced, such as a check or closing the image.
+ */
+void qcow2_prealloc_release(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int i;
+
+    for (i = 0; i < QCOW2_PREALLOC_STREAMS; i++) {
+        prealloc_stream_free(bs, &s->prealloc_streams[i]);
+        s->prealloc_streams[i] = (Qcow2PreallocStream) {};
+    }
+}
+
 /* only used to allocate compressed sectors. We try to allocate
    contiguous sectors. size must be <= cluster_size */
 int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int size)
@@ -1240,25 +1441,173 @@ int qcow2_flush_caches(BlockDriverState *bs)
 
 
 
+/*
+ * Update the refcounts of the L2 table referenced by l1_table[l1_index] and
+ * of the clusters it references by @addend, and the copied flags of its
+ * entries.  Returns 1 if l1_table[l1_index] was changed, 0 if not, or
+ * -errno on failure.
+ */
+static int GRAPH_RDLOCK
+update_l2_table_refcount(BlockDriverState *bs, uint64_t *l1_table,
+                         int l1_index, int addend)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t *l2_slice = NULL;
+    uint64_t l2_offset, old_l2_offset, entry, old_entry, refcount;
+    unsigned slice, slice_size2, n_slices;
+    int j, ret;
+
+    slice_size2 = s->l2_slice_size * l2_entry_size(s);
+    n_slices = s->cluster_size / slice_size2;
+
+    l2_offset = l1_table[l1_index];
+    if (!l2_offset) {
+        return 0;
+    }
+
+    old_l2_offset = l2_offset;
+    l2_offset &= L1E_OFFSET_MASK;
+
+    if (offset_into_cluster(s, l2_offset)) {
+        qcow2_signal_corruption(bs, true, -1, -1, "L2 table offset %#"
+                                PRIx64 " unaligned (L1 index: %#x)",
+                                l2_offset, l1_index);
+        return -EIO;
+    }
+
+    for (slice = 0; slice < n_slices; slice++) {
+        ret = qcow2_cache_get(bs, s->l2_table_cache,
+                              l2_offset + slice * slice_size2,
+                              (void **) &l2_slice);
+        if (ret < 0) {
+            return ret;
+        }
+
+        for (j = 0; j < s->l2_slice_size; j++) {
+            uint64_t cluster_index;
+            uint64_t offset;
+
+            entry = get_l2_entry(s, l2_slice, j);
+            old_entry = entry;
+            entry &= ~QCOW_OFLAG_COPIED;
+            offset = entry & L2E_OFFSET_MASK;
+
+            switch (qcow2_get_cluster_type(bs, entry)) {
+            case QCOW2_CLUSTER_COMPRESSED:
+                if (addend != 0) {
+                    uint64_t coffset;
+                    int csize;
+
+                    qcow2_parse_compressed_l2_entry(bs, entry,
+                                                    &coffset, &csize);
+                    ret = update_refcount(
+                        bs, coffset, csize,
+                        abs(addend), addend < 0,
+                        QCOW2_DISCARD_SNAPSHOT);
+                    if (ret < 0) {
+                        goto fail;
+                    }
+                }
+                /* compressed clusters are never modified */
+                refcount = 2;
+                break;
+
+            case QCOW2_CLUSTER_NORMAL:
+            case QCOW2_CLUSTER_ZERO_ALLOC:
+                if (offset_into_cluster(s, offset)) {
+                    /* Here l2_index means table (not slice) index */
+                    int l2_index = slice * s->l2_slice_size + j;
+                    qcow2_signal_corruption(
+                        bs, true, -1, -1, "Cluster "
+                        "allocation offset %#" PRIx64
+                        " unaligned (L2 offset: %#"
+                        PRIx64 ", L2 index: %#x)",
+                        offset, l2_offset, l2_index);
+                    ret = -EIO;
+                    goto fail;
+                }
+
+                cluster_index = offset >> s->cluster_bits;
+                assert(cluster_index);
+                if (addend != 0) {
+                    ret = qcow2_update_cluster_refcount(
+                        bs, cluster_index, abs(addend), addend < 0,
+                        QCOW2_DISCARD_SNAPSHOT);
+                    if (ret < 0) {
+                        goto fail;
+                    }
+                }
+
+                ret = qcow2_get_refcount(bs, cluster_index, &refcount);
+                if (ret < 0) {
+                    goto fail;
+                }
+                break;
+
+            case QCOW2_CLUSTER_ZERO_PLAIN:
+            case QCOW2_CLUSTER_UNALLOCATED:
+                refcount = 0;
+                break;
+
+            default:
+                abort();
+            }
+
+            if (refcount == 1) {
+                entry |= QCOW_OFLAG_COPIED;
+            }
+            if (entry != old_entry) {
+                if (addend > 0) {
+                    qcow2_cache_set_dependency(bs, s->l2_table_cache,
+                                               s->refcount_block_cache);
+                }
+                set_l2_entry(s, l2_slice, j, entry);
+                qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
+            }
+        }
+
+        qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+    }
+
+    if (addend != 0) {
+        ret = qcow2_update_cluster_refcount(bs, l2_offset >> s->cluster_bits,
+                                            abs(addend), addend < 0,
+                                            QCOW2_DISCARD_SNAPSHOT);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    ret = qcow2_get_refcount(bs, l2_offset >> s->cluster_bits, &refcount);
+    if (ret < 0) {
+        return ret;
+    } else if (refcount == 1) {
+        l2_offset |= QCOW_OFLAG_COPIED;
+    }
+    if (l2_offset != old_l2_offset) {
+        l1_table[l1_index] = l2_offset;
+        return 1;
+    }
+    return 0;
+
+fail:
+    qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+    return ret;
+}
+
 /* update the refcounts of snapshots and the copied flag */
 int qcow2_update_snapshot_refcount(BlockDriverState *bs,
     int64_t l1_table_offset, int l1_size, int addend)
 {
     BDRVQcow2State *s = bs->opaque;
-    uint64_t *l1_table, *l2_slice, l2_offset, entry, l1_size2, refcount;
+    uint64_t *l1_table, l1_size2;
     bool l1_allocated = false;
-    int64_t old_entry, old_l2_offset;
-    unsigned slice, slice_size2, n_slices;
-    int i, j, l1_modified = 0;
+    int i, l1_modified = 0;
     int ret;
 
     assert(addend >= -1 && addend <= 1);
 
-    l2_slice = NULL;
     l1_table = NULL;
     l1_size2 = l1_size * L1E_SIZE;
-    slice_size2 = s->l2_slice_size * l2_entry_size(s);
-    n_slices = s->cluster_size / slice_size2;
 
     s->cache_discards = true;
 
@@ -1288,143 +1637,15 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
     }
 
     for (i = 0; i < l1_size; i++) {
-        l2_offset = l1_table[i];
-        if (l2_offset) {
-            old_l2_offset = l2_offset;
-            l2_offset &= L1E_OFFSET_MASK;
-
-            if (offset_into_cluster(s, l2_offset)) {
-                qcow2_signal_corruption(bs, true, -1, -1, "L2 table offset %#"
-                                        PRIx64 " unaligned (L1 index: %#x)",
-                                        l2_offset, i);
-                ret = -EIO;
-                goto fail;
-            }
-
-            for (slice = 0; slice < n_slices; slice++) {
-                ret = qcow2_cache_get(bs, s->l2_table_cache,
-                                      l2_offset + slice * slice_size2,
-                                      (void **) &l2_slice);
-                if (ret < 0) {
-                    goto fail;
-                }
-
-                for (j = 0; j < s->l2_slice_size; j++) {
-                    uint64_t cluster_index;
-                    uint64_t offset;
-
-                    entry = get_l2_entry(s, l2_slice, j);
-                    old_entry = entry;
-                    entry &= ~QCOW_OFLAG_COPIED;
-                    offset = entry & L2E_OFFSET_MASK;
-
-                    switch (qcow2_get_cluster_type(bs, entry)) {
-                    case QCOW2_CLUSTER_COMPRESSED:
-                        if (addend != 0) {
-                            uint64_t coffset;
-                            int csize;
-
-                            qcow2_parse_compressed_l2_entry(bs, entry,
-                                                            &coffset, &csize);
-                            ret = update_refcount(
-                                bs, coffset, csize,
-                                abs(addend), addend < 0,
-                                QCOW2_DISCARD_SNAPSHOT);
-                            if (ret < 0) {
-                                goto fail;
-                            }
-                        }
-                        /* compressed clusters are never modified */
-                        refcount = 2;
-                        break;
-
-                    case QCOW2_CLUSTER_NORMAL:
-                    case QCOW2_CLUSTER_ZERO_ALLOC:
-                        if (offset_into_cluster(s, offset)) {
-                            /* Here l2_index means table (not slice) index */
-                            int l2_index = slice * s->l2_slice_size + j;
-                            qcow2_signal_corruption(
-                                bs, true, -1, -1, "Cluster "
-                                "allocation offset %#" PRIx64
-                                " unaligned (L2 offset: %#"
-                                PRIx64 ", L2 index: %#x)",
-                                offset, l2_offset, l2_index);
-                            ret = -EIO;
-                            goto fail;
-                        }
-
-                        cluster_index = offset >> s->cluster_bits;
-                        assert(cluster_index);
-                        if (addend != 0) {
-                            ret = qcow2_update_cluster_refcount(
-                                bs, cluster_index, abs(addend), addend < 0,
-                                QCOW2_DISCARD_SNAPSHOT);
-                            if (ret < 0) {
-                                goto fail;
-                            }
-                        }
-
-                        ret = qcow2_get_refcount(bs, cluster_index, &refcount);
-                        if (ret < 0) {
-                            goto fail;
-                        }
-                        break;
-
-                    case QCOW2_CLUSTER_ZERO_PLAIN:
-                    case QCOW2_CLUSTER_UNALLOCATED:
-                        refcount = 0;
-                        break;
-
-                    default:
-                        abort();
-                    }
-
-                    if (refcount == 1) {
-                        entry |= QCOW_OFLAG_COPIED;
-                    }
-                    if (entry != old_entry) {
-                        if (addend > 0) {
-                            qcow2_cache_set_dependency(bs, s->l2_table_cache,
-                                                       s->refcount_block_cache);
-                        }
-                        set_l2_entry(s, l2_slice, j, entry);
-                        qcow2_cache_entry_mark_dirty(s->l2_table_cache,
-                                                     l2_slice);
-                    }
-                }
-
-                qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
-            }
-
-            if (addend != 0) {
-                ret = qcow2_update_cluster_refcount(bs, l2_offset >>
-                                                        s->cluster_bits,
-                                                    abs(addend), addend < 0,
-                                                    QCOW2_DISCARD_SNAPSHOT);
-                if (ret < 0) {
-                    goto fail;
-                }
-            }
-            ret = qcow2_get_refcount(bs, l2_offset >> s->cluster_bits,
-                                     &refcount);
-            if (ret < 0) {
-                goto fail;
-            } else if (refcount == 1) {
-                l2_offset |= QCOW_OFLAG_COPIED;
-            }
-            if (l2_offset != old_l2_offset) {
-                l1_table[i] = l2_offset;
-                l1_modified = 1;
-            }
+        ret = update_l2_table_refcount(bs, l1_table, i, addend);
+        if (ret < 0) {
+            goto fail;
         }
+        l1_modified |= ret;
     }
 
     ret = bdrv_flush(bs);
 fail:
-    if (l2_slice) {
-        qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
-    }
-
     s->cache_discards = false;
     qcow2_process_discards(bs, ret);
 
@@ -1446,6 +1667,49 @@ fail:
     return ret;
 }
 
+/*
+ * Like qcow2_update_snapshot_refcount(), but only for the L2 tables of
+ * l1_table[start] to l1_table[end - 1], which is either the active L1 table
+ * or a copy of a snapshot L1 table in memory.  The changed entries of the
+ * active L1 table are written back, those of a copy are not.  The clusters
+ * freed by the update are discarded together at the end, after the metadata
+ * has been flushed: an active L2 table still on its way to the disk may point
+ * to one of them.
+ *
+ * The refcounts are not flushed otherwise, so this may only be used while
+ * the image is marked dirty.
+ */
+int qcow2_update_snapshot_refcount_range(BlockDriverState *bs,
+                                         uint64_t *l1_table, int start,
+                                         int end, int addend)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int i, ret = 0;
+
+    assert(addend >= -1 && addend <= 1);
+
+    s->cache_discards = true;
+
+    for (i = start; i < end; i++) {
+        ret = update_l2_table_refcount(bs, l1_table, i, addend);
+        if (ret > 0 && l1_table == s->l1_table) {
+            ret = qcow2_write_l1_entry(bs, i);
+        }
+        if (ret < 0) {
+            break;
+        }
+    }
+
+    if (ret >= 0) {
+        /* s->lock is held, so flush the caches instead of bdrv_flush(bs) */
+        ret = qcow2_flush_caches(bs);
+    }
+    s->cache_discards = false;
+    qcow2_process_discards(bs, ret);
+
+    return ret < 0 ? ret : 0;
+}
+
 
 
 
@@ -1590,6 +1854,132 @@ enum {
     CHECK_FRAG_INFO = 0x2,      /* update BlockFragInfo counters */
 };
 
+/* Progress of qcow2_check_refcounts(), counted in L1 table entries */
+typedef struct Qcow2CheckProgress {
+    BlockDriverCheckStatusCB *status_cb;
+    void *cb_opaque;
+    int64_t done;
+    int64_t total;
+} Qcow2CheckProgress;
+
+static void check_progress(BlockDriverState *bs, Qcow2CheckProgress *progress,
+                           int64_t done)
+{
+    progress->done += done;
+    if (progress->status_cb) {
+        progress->status_cb(bs, progress->done, progress->total,
+                            progress->cb_opaque);
+    }
+}
+
+/*
+ * Number of L2 tables that are read in parallel while checking, the checks
+ * themselves still go through the tables in order.
+ */
+#define CHECK_L2_BATCH 32
+
+typedef struct CheckL2Batch {
+    /* CHECK_L2_BATCH tables of @table_size bytes */
+    void *buf;
+    size_t table_size;
+    int nb_tables;
+    int l1_index[CHECK_L2_BATCH];
+    int ret[CHECK_L2_BATCH];
+} CheckL2Batch;
+
+typedef struct CheckL2ReadTask {
+    AioTask task;
+    BlockDriverState *bs;
+    uint64_t l2_offset;
+    void *l2_table;
+    size_t table_size;
+    int *ret;
+} CheckL2ReadTask;
+
+static int check_l2_batch_init(BlockDriverState *bs, CheckL2Batch *batch)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    *batch = (CheckL2Batch) {
+        .table_size = s->l2_size * l2_entry_size(s),
+    };
+    batch->buf = qemu_try_blockalign(bs->file->bs,
+                                     CHECK_L2_BATCH * batch->table_size);
+    return batch->buf ? 0 : -ENOMEM;
+}
+
+static uint64_t *check_l2_batch_table(CheckL2Batch *batch, int n)
+{
+    return (uint64_t *)((char *)batch->buf + n * batch->table_size);
+}
+
+static int coroutine_fn GRAPH_RDLOCK check_l2_read_task_entry(AioTask *task)
+{
+    CheckL2ReadTask *t = container_of(task, CheckL2ReadTask, task);
+
+    *t->ret = bdrv_co_pread(t->bs->file, t->l2_offset, t->table_size,
+                            t->l2_table, 0);
+    return *t->ret;
+}
+
+/*
+ * Reads the L2 tables of the non-zero entries of @l1_table starting at
+ * *l1_index in parallel, at most CHECK_L2_BATCH of them, and advances
+ * *l1_index past the entries that the batch covers.  A batch ends before
+ * an L2 table that it already contains, so that changes made while going
+ * through the first copy are seen by the second one.
+ *
+ * The result of reading each table is stored in batch->ret[].
+ */
+static void coroutine_fn GRAPH_RDLOCK
+check_l2_batch_read(BlockDriverState *bs, CheckL2Batch *batch,
+                    const uint64_t *l1_table, int l1_size, int *l1_index)
+{
+    AioTaskPool *pool = aio_task_pool_new(CHECK_L2_BATCH);
+    int i, j;
+
+    batch->nb_tables = 0;
+    for (i = *l1_index; i < l1_size && batch->nb_tables < CHECK_L2_BATCH;
+         i++) {
+        uint64_t l2_offset = l1_table[i] & L1E_OFFSET_MASK;
+        int n = batch->nb_tables;
+        CheckL2ReadTask *t;
+
+        if (!l1_table[i]) {
+            continue;
+        }
+        for (j = 0; j < n; j++) {
+            int idx = batch->l1_index[j];
+
+            if ((l1_table[idx] & L1E_OFFSET_MASK) == l2_offset) {
+                break;
+            }
+        }
+        if (j < n) {
+            break;
+        }
+
+        batch->l1_index[n] = i;
+        batch->nb_tables++;
+
+        t = g_new(CheckL2ReadTask, 1);
+        *t = (CheckL2ReadTask) {
+            .task.func = check_l2_read_task_entry,
+            .bs = bs,
+            .l2_offset = l2_offset,
+            .l2_table = check_l2_batch_table(batch, n),
+            .table_size = batch->table_size,
+            .ret = &batch->ret[n],
+        };
+        aio_task_pool_start_task(pool, &t->task);
+    }
+
+    aio_task_pool_wait_all(pool);
+    g_free(pool);
+
+    *l1_index = i;
+}
+
 /*
  * Fix L2 entry by making it QCOW2_CLUSTER_ZERO_PLAIN (or making all its present
  * subclusters QCOW2_SUBCLUSTER_ZERO_PLAIN).
@@ -1653,8 +2043,11 @@ fail:
 
 /*
  * Increases the refcount in the given refcount table for the all clusters
- * referenced in the L2 table. While doing so, performs some checks on L2
- * entries.
+ * referenced in the L2 table, which was read from @l2_offset. While doing
+ * so, performs some checks on L2 entries.
+ *
+ * With CHECK_FRAG_INFO, *@extent_end is where the data of the previous L2
+ * table ended, so that extents are counted across L2 tables.
  *
  * Returns the number of errors found by the checks or -errno if an internal
  * error occurred.
@@ -1663,24 +2056,15 @@ static int coroutine_fn GRAPH_RDLOCK
 check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                    void **refcount_table,
                    int64_t *refcount_table_size, int64_t l2_offset,
-                   int flags, BdrvCheckMode fix, bool active)
+                   uint64_t *l2_table, int flags, BdrvCheckMode fix,
+                   bool active, uint64_t *extent_end)
 {
     BDRVQcow2State *s = bs->opaque;
     uint64_t l2_entry, l2_bitmap;
     uint64_t next_contiguous_offset = 0;
     int i, ret;
-    size_t l2_size_bytes = s->l2_size * l2_entry_size(s);
-    g_autofree uint64_t *l2_table = g_malloc(l2_size_bytes);
     bool metadata_overlap;
 
-    /* Read L2 table from disk */
-    ret = bdrv_co_pread(bs->file, l2_offset, l2_size_bytes, l2_table, 0);
-    if (ret < 0) {
-        fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
-        res->check_errors++;
-        return ret;
-    }
-
     /* Do the actual checks */
     for (i = 0; i < s->l2_size; i++) {
         uint64_t coffset;
@@ -1816,6 +2200,11 @@ check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                     res->bfi.fragmented_clusters++;
                 }
                 next_contiguous_offset = offset + s->cluster_size;
+
+                if (offset != *extent_end) {
+                    res->bfi.extents++;
+                }
+                *extent_end = offset + s->cluster_size;
             }
 
             /* Mark cluster as used */
@@ -1863,13 +2252,15 @@ static int coroutine_fn GRAPH_RDLOCK
 check_refcounts_l1(BlockDriverState *bs, BdrvCheckResult *res,
                    void **refcount_table, int64_t *refcount_table_size,
                    int64_t l1_table_offset, int l1_size,
-                   int flags, BdrvCheckMode fix, bool active)
+                   int flags, BdrvCheckMode fix, bool active,
+                   Qcow2CheckProgress *progress)
 {
     BDRVQcow2State *s = bs->opaque;
     size_t l1_size_bytes = l1_size * L1E_SIZE;
     g_autofree uint64_t *l1_table = NULL;
-    uint64_t l2_offset;
-    int i, ret;
+    CheckL2Batch batch;
+    uint64_t l2_offset, extent_end = 0;
+    int i, j, ret;
 
     if (!l1_size) {
         return 0;
@@ -1900,42 +2291,175 @@ check_refcounts_l1(BlockDriverState *bs, BdrvCheckResult *res,
         be64_to_cpus(&l1_table[i]);
     }
 
+    ret = check_l2_batch_init(bs, &batch);
+    if (ret < 0) {
+        res->check_errors++;
+        return ret;
+    }
+
     /* Do the actual checks */
-    for (i = 0; i < l1_size; i++) {
-        if (!l1_table[i]) {
-            continue;
+    for (i = 0; i < l1_size; ) {
+        int batch_start = i;
+
+        check_l2_batch_read(bs, &batch, l1_table, l1_size, &i);
+
+        for (j = 0; j < batch.nb_tables; j++) {
+            int idx = batch.l1_index[j];
+
+            if (l1_table[idx] & L1E_RESERVED_MASK) {
+                fprintf(stderr, "ERROR found L1 entry with reserved bits set: "
+                        "%" PRIx64 "\n", l1_table[idx]);
+                res->corruptions++;
+            }
+
+            l2_offset = l1_table[idx] & L1E_OFFSET_MASK;
+
+            /* Mark L2 table as used */
+            ret = qcow2_inc_refcounts_imrt(bs, res,
+                                           refcount_table, refcount_table_size,
+                                           l2_offset, s->cluster_size);
+            if (ret < 0) {
+                goto out;
+            }
+
+            /* L2 tables are cluster aligned */
+            if (offset_into_cluster(s, l2_offset)) {
+                fprintf(stderr, "ERROR l2_offset=%" PRIx64 ": Table is not "
+                    "cluster aligned; L1 entry corrupted\n", l2_offset);
+                res->corruptions++;
+            }
+
+            if (batch.ret[j] < 0) {
+                fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
+                res->check_errors++;
+                ret = batch.ret[j];
+                goto out;
+            }
+
+            /* Process and check L2 entries */
+            ret = check_refcounts_l2(bs, res, refcount_table,
+                                     refcount_table_size, l2_offset,
+                                     check_l2_batch_table(&batch, j), flags,
+                                     fix, active, &extent_end);
+            if (ret < 0) {
+                goto out;
+            }
         }
 
-        if (l1_table[i] & L1E_RESERVED_MASK) {
-            fprintf(stderr, "ERROR found L1 entry with reserved bits set: "
-                    "%" PRIx64 "\n", l1_table[i]);
-            res->corruptions++;
+        check_progress(bs, progress, i - batch_start);
+    }
+
+    ret = 0;
+out:
+    qemu_vfree(batch.buf);
+    return ret;
+}
+
+/*
+ * Checks the OFLAG_COPIED flag for L1 entry @l1_index and the entries of its
+ * L2 table, which was read into @l2_table with result @read_ret.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+check_oflag_copied_l2(BlockDriverState *bs, BdrvCheckResult *res, bool repair,
+                      int l1_index, uint64_t *l2_table, int read_ret)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t l1_entry = s->l1_table[l1_index];
+    uint64_t l2_offset = l1_entry & L1E_OFFSET_MASK;
+    uint64_t refcount;
+    int l2_dirty = 0;
+    int j, ret;
+
+    if (!l2_offset) {
+        return 0;
+    }
+
+    ret = qcow2_get_refcount(bs, l2_offset >> s->cluster_bits,
+                             &refcount);
+    if (ret < 0) {
+        /* don't print message nor increment check_errors */
+        return 0;
+    }
+    if ((refcount == 1) != ((l1_entry & QCOW_OFLAG_COPIED) != 0)) {
+        res->corruptions++;
+        fprintf(stderr, "%s OFLAG_COPIED L2 cluster: l1_index=%d "
+                "l1_entry=%" PRIx64 " refcount=%" PRIu64 "\n",
+                repair ? "Repairing" : "ERROR", l1_index, l1_entry, refcount);
+        if (repair) {
+            s->l1_table[l1_index] = refcount == 1
+                                  ? l1_entry |  QCOW_OFLAG_COPIED
+                                  : l1_entry & ~QCOW_OFLAG_COPIED;
+            ret = qcow2_write_l1_entry(bs, l1_index);
+            if (ret < 0) {
+                res->check_errors++;
+                return ret;
+            }
+            res->corruptions--;
+            res->corruptions_fixed++;
         }
+    }
 
-        l2_offset = l1_table[i] & L1E_OFFSET_MASK;
+    if (read_ret < 0) {
+        fprintf(stderr, "ERROR: Could not read L2 table: %s\n",
+                strerror(-read_ret));
+        res->check_errors++;
+        return read_ret;
+    }
 
-        /* Mark L2 table as used */
-        ret = qcow2_inc_refcounts_imrt(bs, res,
-                                       refcount_table, refcount_table_size,
-                                       l2_offset, s->cluster_size);
-        if (ret < 0) {
-            return ret;
+    for (j = 0; j < s->l2_size; j++) {
+        uint64_t l2_entry = get_l2_entry(s, l2_table, j);
+        uint64_t data_offset = l2_entry & L2E_OFFSET_MASK;
+        QCow2ClusterType cluster_type = qcow2_get_cluster_type(bs, l2_entry);
+
+        if (cluster_type == QCOW2_CLUSTER_NORMAL ||
+            cluster_type == QCOW2_CLUSTER_ZERO_ALLOC) {
+            if (has_data_file(bs)) {
+                refcount = 1;
+            } else {
+                ret = qcow2_get_refcount(bs,
+                                         data_offset >> s->cluster_bits,
+                                         &refcount);
+                if (ret < 0) {
+                    /* don't print message nor increment check_errors */
+                    continue;
+                }
+            }
+            if ((refcount == 1) != ((l2_entry & QCOW_OFLAG_COPIED) != 0)) {
+                res->corruptions++;
+                fprintf(stderr, "%s OFLAG_COPIED data cluster: "
+                        "l2_entry=%" PRIx64 " refcount=%" PRIu64 "\n",
+                        repair ? "Repairing" : "ERROR", l2_entry, refcount);
+                if (repair) {
+                    set_l2_entry(s, l2_table, j,
+                                 refcount == 1 ?
+                                 l2_entry |  QCOW_OFLAG_COPIED :
+                                 l2_entry & ~QCOW_OFLAG_COPIED);
+                    l2_dirty++;
+                }
+            }
         }
+    }
 
-        /* L2 tables are cluster aligned */
-        if (offset_into_cluster(s, l2_offset)) {
-            fprintf(stderr, "ERROR l2_offset=%" PRIx64 ": Table is not "
-                "cluster aligned; L1 entry corrupted\n", l2_offset);
-            res->corruptions++;
+    if (l2_dirty > 0) {
+        ret = qcow2_pre_write_overlap_check(bs, QCOW2_OL_ACTIVE_L2,
+                                            l2_offset, s->cluster_size,
+                                            false);
+        if (ret < 0) {
+            fprintf(stderr, "ERROR: Could not write L2 table; metadata "
+                    "overlap check failed: %s\n", strerror(-ret));
+            res->check_errors++;
+            return ret;
         }
 
-        /* Process and check L2 entries */
-        ret = check_refcounts_l2(bs, res, refcount_table,
-                                 refcount_table_size, l2_offset, flags,
-                                 fix, active);
+        ret = bdrv_co_pwrite(bs->file, l2_offset, s->cluster_size, l2_table, 0);
         if (ret < 0) {
+            fprintf(stderr, "ERROR: Could not write L2 table: %s\n",
+                    strerror(-ret));
+            res->check_errors++;
             return ret;
         }
+        res->corruptions -= l2_dirty;
+        res->corruptions_fixed += l2_dirty;
     }
 
     return 0;
@@ -1950,12 +2474,12 @@ check_refcounts_l1(BlockDriverState *bs, BdrvCheckResult *res,
  * (qcow2_check_refcounts) by the time this function is called).
  */
 static int coroutine_fn GRAPH_RDLOCK
-check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res, BdrvCheckMode fix)
+check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res,
+                   BdrvCheckMode fix, Qcow2CheckProgress *progress)
 {
     BDRVQcow2State *s = bs->opaque;
-    uint64_t *l2_table = qemu_blockalign(bs, s->cluster_size);
+    CheckL2Batch batch;
     int ret;
-    uint64_t refcount;
     int i, j;
     bool repair;
 
@@ -1971,110 +2495,33 @@ check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res, BdrvCheckMode fix
         repair = false;
     }
 
-    for (i = 0; i < s->l1_size; i++) {
-        uint64_t l1_entry = s->l1_table[i];
-        uint64_t l2_offset = l1_entry & L1E_OFFSET_MASK;
-        int l2_dirty = 0;
-
-        if (!l2_offset) {
-            continue;
-        }
-
-        ret = qcow2_get_refcount(bs, l2_offset >> s->cluster_bits,
-                                 &refcount);
-        if (ret < 0) {
-            /* don't print message nor increment check_errors */
-            continue;
-        }
-        if ((refcount == 1) != ((l1_entry & QCOW_OFLAG_COPIED) != 0)) {
-            res->corruptions++;
-            fprintf(stderr, "%s OFLAG_COPIED L2 cluster: l1_index=%d "
-                    "l1_entry=%" PRIx64 " refcount=%" PRIu64 "\n",
-                    repair ? "Repairing" : "ERROR", i, l1_entry, refcount);
-            if (repair) {
-                s->l1_table[i] = refcount == 1
-                               ? l1_entry |  QCOW_OFLAG_COPIED
-                               : l1_entry & ~QCOW_OFLAG_COPIED;
-                ret = qcow2_write_l1_entry(bs, i);
-                if (ret < 0) {
-                    res->check_errors++;
-                    goto fail;
-                }
-                res->corruptions--;
-                res->corruptions_fixed++;
-            }
-        }
-
-        ret = bdrv_co_pread(bs->file, l2_offset, s->l2_size * l2_entry_size(s),
-                            l2_table, 0);
-        if (ret < 0) {
-            fprintf(stderr, "ERROR: Could not read L2 table: %s\n",
-                    strerror(-ret));
-            res->check_errors++;
-            goto fail;
-        }
-
-        for (j = 0; j < s->l2_size; j++) {
-            uint64_t l2_entry = get_l2_entry(s, l2_table, j);
-            uint64_t data_offset = l2_entry & L2E_OFFSET_MASK;
-            QCow2ClusterType cluster_type = qcow2_get_cluster_type(bs, l2_entry);
+    ret = check_l2_batch_init(bs, &batch);
+    if (ret < 0) {
+        res->check_errors++;
+        return ret;
+    }
 
-            if (cluster_type == QCOW2_CLUSTER_NORMAL ||
-                cluster_type == QCOW2_CLUSTER_ZERO_ALLOC) {
-                if (has_data_file(bs)) {
-                    refcount = 1;
-                } else {
-                    ret = qcow2_get_refcount(bs,
-                                             data_offset >> s->cluster_bits,
-                                             &refcount);
-                    if (ret < 0) {
-                        /* don't print message nor increment check_errors */
-                        continue;
-                    }
-                }
-                if ((refcount == 1) != ((l2_entry & QCOW_OFLAG_COPIED) != 0)) {
-                    res->corruptions++;
-                    fprintf(stderr, "%s OFLAG_COPIED data cluster: "
-                            "l2_entry=%" PRIx64 " refcount=%" PRIu64 "\n",
-                            repair ? "Repairing" : "ERROR", l2_entry, refcount);
-                    if (repair) {
-                        set_l2_entry(s, l2_table, j,
-                                     refcount == 1 ?
-                                     l2_entry |  QCOW_OFLAG_COPIED :
-                                     l2_entry & ~QCOW_OFLAG_COPIED);
-                        l2_dirty++;
-                    }
-                }
-            }
-        }
+    for (i = 0; i < s->l1_size; ) {
+        int batch_start = i;
 
-        if (l2_dirty > 0) {
-            ret = qcow2_pre_write_overlap_check(bs, QCOW2_OL_ACTIVE_L2,
-                                                l2_offset, s->cluster_size,
-                                                false);
-            if (ret < 0) {
-                fprintf(stderr, "ERROR: Could not write L2 table; metadata "
-                        "overlap check failed: %s\n", strerror(-ret));
-                res->check_errors++;
-                goto fail;
-            }
+        check_l2_batch_read(bs, &batch, s->l1_table, s->l1_size, &i);
 
-            ret = bdrv_co_pwrite(bs->file, l2_offset, s->cluster_size, l2_table, 0);
+        for (j = 0; j < batch.nb_tables; j++) {
+            ret = check_oflag_copied_l2(bs, res, repair, batch.l1_index[j],
+                                        check_l2_batch_table(&batch, j),
+                                        batch.ret[j]);
             if (ret < 0) {
-                fprintf(stderr, "ERROR: Could not write L2 table: %s\n",
-                        strerror(-ret));
-                res->check_errors++;
                 goto fail;
             }
-            res->corruptions -= l2_dirty;
-            res->corruptions_fixed += l2_dirty;
         }
+
+        check_progress(bs, progress, i - batch_start);
     }
 
     ret = 0;
 
 fail:
-    qemu_vfree(l2_table);
+    qemu_vfree(batch.buf);
     return ret;
 }
 
@@ -2194,13 +2641,32 @@ resize_fail:
     return 0;
 }
 
+/* Number of L1 entries that calculate_refcounts() goes through */
+static int64_t calculate_refcounts_work(BDRVQcow2State *s)
+{
+    int64_t work = s->l1_size;
+    int i;
+
+    for (i = 0; i < s->nb_snapshots; i++) {
+        QCowSnapshot *sn = s->snapshots + i;
+
+        if (!offset_into_cluster(s, sn->l1_table_offset) &&
+            sn->l1_size <= QCOW_MAX_L1_SIZE / L1E_SIZE) {
+            work += sn->l1_size;
+        }
+    }
+
+    return work;
+}
+
 /*
  * Calculates an in-memory refcount table.
  */
 static int coroutine_fn GRAPH_RDLOCK
 calculate_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
                     BdrvCheckMode fix, bool *rebuild,
-                    void **refcount_table, int64_t *nb_clusters)
+                    void **refcount_table, int64_t *nb_clusters,
+                    Qcow2CheckProgress *progress)
 {
     BDRVQcow2State *s = bs->opaque;
     int64_t i;
@@ -2227,7 +2693,7 @@ calculate_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
     /* current L1 table */
     ret = check_refcounts_l1(bs, res, refcount_table, nb_clusters,
                              s->l1_table_offset, s->l1_size, CHECK_FRAG_INFO,
-                             fix, true);
+                             fix, true, progress);
     if (ret < 0) {
         return ret;
     }
@@ -2257,7 +2723,7 @@ calculate_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
         }
         ret = check_refcounts_l1(bs, res, refcount_table, nb_clusters,
                                  sn->l1_table_offset, sn->l1_size, 0, fix,
-                                 false);
+                                 false, progress);
         if (ret < 0) {
             return ret;
         }
@@ -2287,6 +2753,16 @@ calculate_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
         }
     }
 
+    /* compression dictionary */
+    if (s->compression_dict_header.length) {
+        ret = qcow2_inc_refcounts_imrt(bs, res, refcount_table, nb_clusters,
+                                       s->compression_dict_header.offset,
+                                       s->compression_dict_header.length);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
     /* bitmaps */
     ret = qcow2_check_bitmaps_refcounts(bs, res, refcount_table, nb_clusters);
     if (ret < 0) {
@@ -2780,9 +3256,17 @@ fail:
  * detected as corrupted, and -errno when an internal error occurred.
  */
 int coroutine_fn GRAPH_RDLOCK
-qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res, BdrvCheckMode fix)
+qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
+                      BdrvCheckMode fix, BlockDriverCheckStatusCB *status_cb,
+                      void *cb_opaque)
 {
     BDRVQcow2State *s = bs->opaque;
+    Qcow2CheckProgress progress = {
+        .status_cb = status_cb,
+        .cb_opaque = cb_opaque,
+        /* The active L1 table is gone through again by check_oflag_copied() */
+        .total = calculate_refcounts_work(s) + s->l1_size,
+    };
     BdrvCheckResult pre_compare_res;
     int64_t size, highest_cluster, nb_clusters;
     void *refcount_table = NULL;
@@ -2805,7 +3289,7 @@ qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res, BdrvCheckMode
         size_to_clusters(s, bs->total_sectors * BDRV_SECTOR_SIZE);
 
     ret = calculate_refcounts(bs, res, fix, &rebuild, &refcount_table,
-                              &nb_clusters);
+                              &nb_clusters, &progress);
     if (ret < 0) {
         goto fail;
     }
@@ -2837,8 +3321,9 @@ qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res, BdrvCheckMode
          * references have to be recalculated */
         rebuild = false;
         memset(refcount_table, 0, refcount_array_byte_size(s, nb_clusters));
+        progress.total += calculate_refcounts_work(s);
         ret = calculate_refcounts(bs, res, 0, &rebuild, &refcount_table,
-                                  &nb_clusters);
+                                  &nb_clusters, &progress);
         if (ret < 0) {
             goto fail;
         }
@@ -2887,7 +3372,7 @@ qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res, BdrvCheckMode
     }
 
     /* check OFLAG_COPIED */
-    ret = check_oflag_copied(bs, res, fix);
+    ret = check_oflag_copied(bs, res, fix, &progress);
     if (ret < 0) {
         goto fail;
     }
@@ -3040,6 +3525,16 @@ int qcow2_check_metadata_overlap(BlockDriverState *bs, int ign, int64_t offset,
         }
     }
 
+    if ((chk & QCOW2_OL_COMPRESSION_DICT) &&
+        s->compression_dict_header.length)
+    {
+        if (overlaps_with(s->compression_dict_header.offset,
+                          s->compression_dict_header.length))
+        {
+            return QCOW2_OL_COMPRESSION_DICT;
+        }
+    }
+
     return 0;
 }
 
@@ -3053,6 +3548,7 @@ static const char *metadata_ol_names[] = {
     [QCOW2_OL_INACTIVE_L1_BITNR]        = "inactive L1 table",
     [QCOW2_OL_INACTIVE_L2_BITNR]        = "inactive L2 table",
     [QCOW2_OL_BITMAP_DIRECTORY_BITNR]   = "bitmap directory",
+    [QCOW2_OL_COMPRESSION_DICT_BITNR]   = "compression dictionary",
 };
 QEMU_BUILD_BUG_ON(QCOW2_OL_MAX_BITNR != ARRAY_SIZE(metadata_ol_names));
 
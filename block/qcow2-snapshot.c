@@ -743,7 +743,7 @@ int qcow2_snapshot_create(BlockDriverState *bs, QEMUSnapshotInfo *sn_info)
 #ifdef DEBUG_ALLOC
     {
       BdrvCheckResult result = {0};
-      qcow2_check_refcounts(bs, &result, 0);
+      qcow2_check_refcounts(bs, &result, 0, NULL, NULL);
     }
 #endif
     return 0;
@@ -896,7 +896,7 @@ int qcow2_snapshot_goto(BlockDriverState *bs, const char *snapshot_id)
 #ifdef DEBUG_ALLOC
     {
         BdrvCheckResult result = {0};
-        qcow2_check_refcounts(bs, &result, 0);
+        qcow2_check_refcounts(bs, &result, 0, NULL, NULL);
     }
 #endif
     return 0;
@@ -906,14 +906,183 @@ fail:
     return ret;
 }
 
+/*
+ * Number of L2 tables whose refcounts are updated at once while freeing the
+ * clusters of deleted snapshots.  Guest requests that need s->lock wait for
+ * at most one batch.
+ */
+#define QCOW2_SNAPSHOT_FREE_BATCH 8
+
+/*
+ * Free the clusters of the L2 tables in the next batch of a deleted
+ * snapshot.  Once all deleted snapshots are freed, update the copied flags
+ * of the next batch of active L2 tables instead, and mark the image clean
+ * after the last one.
+ *
+ * Returns 1 if there is more to do, 0 when done, or -errno on failure.
+ */
+static int GRAPH_RDLOCK qcow2_snapshot_free_batch(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DeletedSnapshot *ds = QSIMPLEQ_FIRST(&s->deleted_snapshots);
+    int start, end, ret;
+
+    if (ds) {
+        start = ds->l1_index;
+        end = MIN(start + QCOW2_SNAPSHOT_FREE_BATCH, ds->l1_size);
+        ret = qcow2_update_snapshot_refcount_range(bs, ds->l1_table,
+                                                   start, end, -1);
+        if (ret < 0) {
+            return ret;
+        }
+
+        ds->l1_index = end;
+        if (ds->l1_index == ds->l1_size) {
+            qcow2_free_clusters(bs, ds->l1_table_offset,
+                                ds->l1_size * L1E_SIZE,
+                                QCOW2_DISCARD_SNAPSHOT);
+            QSIMPLEQ_REMOVE_HEAD(&s->deleted_snapshots, next);
+            g_free(ds->l1_table);
+            g_free(ds);
+
+            /* Start over, more clusters may be used only once now */
+            s->copied_flags_index = 0;
+        }
+        return 1;
+    }
+
+    if (s->copied_flags_index < 0) {
+        return 0;
+    }
+
+    /* The active L1 table may have shrunk in the meantime */
+    start = s->copied_flags_index;
+    end = MIN(start + QCOW2_SNAPSHOT_FREE_BATCH, s->l1_size);
+    ret = qcow2_update_snapshot_refcount_range(bs, s->l1_table,
+                                               start, end, 0);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (end < s->l1_size) {
+        s->copied_flags_index = end;
+        return 1;
+    }
+    s->copied_flags_index = -1;
+
+    /* With lazy refcounts, the dirty bit is cleared on close */
+    if (!s->use_lazy_refcounts) {
+        ret = qcow2_mark_clean(bs);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Give up freeing the clusters of deleted snapshots.  They are leaked, and
+ * because snapshot_free_failed keeps the image dirty, they are reclaimed the
+ * next time it is opened read-write.
+ */
+static void qcow2_snapshot_free_abort(BlockDriverState *bs, int ret)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DeletedSnapshot *ds;
+
+    error_report("qcow2: Failed to free the clusters of deleted snapshots: "
+                 "%s", strerror(-ret));
+
+    while ((ds = QSIMPLEQ_FIRST(&s->deleted_snapshots))) {
+        QSIMPLEQ_REMOVE_HEAD(&s->deleted_snapshots, next);
+        g_free(ds->l1_table);
+        g_free(ds);
+    }
+    s->copied_flags_index = -1;
+    s->snapshot_free_failed = true;
+}
+
+static void coroutine_fn qcow2_snapshot_free_co_entry(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVQcow2State *s = bs->opaque;
+    int ret = 0;
+
+    /*
+     * Stop at the next batch when the node is drained; this keeps drained
+     * sections short, and qcow2_drain_end() starts over.
+     */
+    while (!qatomic_read(&bs->quiesce_counter)) {
+        WITH_GRAPH_RDLOCK_GUARD() {
+            qemu_co_mutex_lock(&s->lock);
+            ret = qcow2_snapshot_free_batch(bs);
+            if (ret < 0) {
+                qcow2_snapshot_free_abort(bs, ret);
+            }
+            qemu_co_mutex_unlock(&s->lock);
+        }
+
+        if (ret <= 0) {
+            break;
+        }
+
+        /* Let the requests that waited for s->lock run */
+        qemu_co_sleep_ns(QEMU_CLOCK_REALTIME, 0);
+    }
+
+    s->snapshot_free_running = false;
+    bdrv_dec_in_flight(bs);
+}
+
+/*
+ * Start freeing the clusters of deleted snapshots in the background, unless
+ * there is nothing to do or it is running already.
+ */
+void qcow2_snapshot_free_start(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Coroutine *co;
+
+    if (s->snapshot_free_running ||
+        (QSIMPLEQ_EMPTY(&s->deleted_snapshots) && s->copied_flags_index < 0))
+    {
+        return;
+    }
+
+    s->snapshot_free_running = true;
+    co = qemu_coroutine_create(qcow2_snapshot_free_co_entry, bs);
+    bdrv_inc_in_flight(bs);
+    aio_co_enter(bdrv_get_aio_context(bs), co);
+}
+
+/*
+ * Free the clusters of all deleted snapshots right away, for operations
+ * that need the refcounts to be complete or the image to be clean.  The
+ * caller must either hold s->lock or have drained the node.
+ */
+int qcow2_snapshot_free_finish(BlockDriverState *bs)
+{
+    int ret;
+
+    do {
+        ret = qcow2_snapshot_free_batch(bs);
+    } while (ret > 0);
+
+    if (ret < 0) {
+        qcow2_snapshot_free_abort(bs, ret);
+    }
+    return ret;
+}
+
 int qcow2_snapshot_delete(BlockDriverState *bs,
                           const char *snapshot_id,
                           const char *name,
                           Error **errp)
 {
     BDRVQcow2State *s = bs->opaque;
+    Qcow2DeletedSnapshot *ds = NULL;
     QCowSnapshot sn;
-    int snapshot_index, ret;
+    int snapshot_index, i, ret;
 
     if (has_data_file(bs)) {
         return -ENOTSUP;
@@ -934,6 +1103,42 @@ int qcow2_snapshot_delete(BlockDriverState *bs,
         return ret;
     }
 
+    /*
+     * Walking all of the snapshot's L2 tables can take long for large
+     * images.  If the image has a dirty bit to cover for the refcounts
+     * being out of date, only remove the snapshot from the list here, and
+     * free its clusters in the background once the node is not drained
+     * anymore.
+     */
+    if (s->qcow_version >= 3) {
+        ds = g_new0(Qcow2DeletedSnapshot, 1);
+        ds->l1_table_offset = sn.l1_table_offset;
+        ds->l1_size = sn.l1_size;
+        ds->l1_table = g_try_new(uint64_t, sn.l1_size);
+        if (sn.l1_size && ds->l1_table == NULL) {
+            ret = -ENOMEM;
+            error_setg(errp, "Failed to allocate the snapshot L1 table");
+            goto fail;
+        }
+
+        ret = bdrv_pread(bs->file, sn.l1_table_offset, sn.l1_size * L1E_SIZE,
+                         ds->l1_table, 0);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Failed to read the snapshot L1 "
+                             "table");
+            goto fail;
+        }
+        for (i = 0; i < sn.l1_size; i++) {
+            be64_to_cpus(&ds->l1_table[i]);
+        }
+
+        ret = qcow2_mark_dirty(bs);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Failed to mark the image dirty");
+            goto fail;
+        }
+    }
+
     /* Remove it from the snapshot list */
     memmove(s->snapshots + snapshot_index,
             s->snapshots + snapshot_index + 1,
@@ -943,7 +1148,7 @@ int qcow2_snapshot_delete(BlockDriverState *bs,
     if (ret < 0) {
         error_setg_errno(errp, -ret,
                          "Failed to remove snapshot from snapshot list");
-        return ret;
+        goto fail;
     }
 
     /*
@@ -954,6 +1159,11 @@ int qcow2_snapshot_delete(BlockDriverState *bs,
     g_free(sn.id_str);
     g_free(sn.name);
 
+    if (ds) {
+        QSIMPLEQ_INSERT_TAIL(&s->deleted_snapshots, ds, next);
+        return 0;
+    }
+
     /*
      * Now decrease the refcounts of clusters referenced by the snapshot and
      * free the L1 table.
@@ -978,10 +1188,196 @@ int qcow2_snapshot_delete(BlockDriverState *bs,
 #ifdef DEBUG_ALLOC
     {
         BdrvCheckResult result = {0};
-        qcow2_check_refcounts(bs, &result, 0);
+        qcow2_check_refcounts(bs, &result, 0, NULL, NULL);
     }
 #endif
     return 0;
+
+fail:
+    if (ds) {
+        g_free(ds->l1_table);
+        g_free(ds);
+    }
+    return ret;
+}
+
+/*
+ * Move the VM state from the active L1 table into the snapshot, whose
+ * disk state was captured before the VM state was written.  The VM state
+ * lives in its own L2 tables, past the end of the disk, so the snapshot
+ * gets a new L1 table made of its own disk part and the VM state part of
+ * the active L1 table.
+ *
+ * Refcounts are taken for the new references before the snapshot table
+ * is updated and dropped for the old ones after, so that a failure in
+ * between only leaks clusters.
+ */
+int qcow2_snapshot_attach_vmstate(BlockDriverState *bs,
+                                  const char *snapshot_id,
+                                  uint64_t vm_state_size)
+{
+    BDRVQcow2State *s = bs->opaque;
+    QCowSnapshot *sn;
+    uint64_t *l1_table = NULL, *old_l1_table = NULL;
+    int64_t l1_table_offset, old_l1_table_offset;
+    uint64_t old_vm_state_size;
+    int l1_size = s->l1_size, old_l1_size;
+    int vm_state_index = s->l1_vm_state_index;
+    int snapshot_index, i, ret;
+    bool old_vm_state = false;
+
+    if (has_data_file(bs)) {
+        return -ENOTSUP;
+    }
+
+    snapshot_index = find_snapshot_by_id_or_name(bs, snapshot_id);
+    if (snapshot_index < 0) {
+        return -ENOENT;
+    }
+    sn = &s->snapshots[snapshot_index];
+    old_l1_table_offset = sn->l1_table_offset;
+    old_l1_size = sn->l1_size;
+    old_vm_state_size = sn->vm_state_size;
+
+    /* The disk must not have been resized since the snapshot was taken */
+    if (sn->disk_size != bs->total_sectors * BDRV_SECTOR_SIZE ||
+        old_l1_size > l1_size) {
+        return -EINVAL;
+    }
+
+    ret = qcow2_validate_table(bs, old_l1_table_offset, old_l1_size,
+                               L1E_SIZE, QCOW_MAX_L1_SIZE,
+                               "Snapshot L1 table", NULL);
+    if (ret < 0) {
+        return ret;
+    }
+
+    old_l1_table = g_try_new0(uint64_t, old_l1_size);
+    l1_table = g_try_new0(uint64_t, l1_size);
+    if ((old_l1_size && !old_l1_table) || (l1_size && !l1_table)) {
+        ret = -ENOMEM;
+        goto fail;
+    }
+
+    ret = bdrv_pread(bs->file, old_l1_table_offset, old_l1_size * L1E_SIZE,
+                     old_l1_table, 0);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    l1_table_offset = qcow2_alloc_clusters(bs, l1_size * L1E_SIZE);
+    if (l1_table_offset < 0) {
+        ret = l1_table_offset;
+        goto fail;
+    }
+
+    ret = qcow2_pre_write_overlap_check(bs, 0, l1_table_offset,
+                                        l1_size * L1E_SIZE, false);
+    if (ret < 0) {
+        goto fail_free_l1;
+    }
+
+    /*
+     * Take the references of the snapshot to the VM state, using the new
+     * L1 table with only the VM state part filled in.
+     */
+    for (i = vm_state_index; i < l1_size; i++) {
+        l1_table[i] = cpu_to_be64(s->l1_table[i] & ~QCOW_OFLAG_COPIED);
+    }
+
+    ret = bdrv_pwrite(bs->file, l1_table_offset, l1_size * L1E_SIZE,
+                      l1_table, 0);
+    if (ret < 0) {
+        goto fail_free_l1;
+    }
+
+    ret = qcow2_update_snapshot_refcount(bs, l1_table_offset, l1_size, 1);
+    if (ret < 0) {
+        goto fail_free_l1;
+    }
+
+    /* Then complete it with the disk part and switch the snapshot over */
+    for (i = 0; i < MIN(vm_state_index, old_l1_size); i++) {
+        l1_table[i] = old_l1_table[i];
+    }
+
+    ret = bdrv_pwrite_sync(bs->file, l1_table_offset, l1_size * L1E_SIZE,
+                           l1_table, 0);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    sn->l1_table_offset = l1_table_offset;
+    sn->l1_size = l1_size;
+    sn->vm_state_size = vm_state_size;
+
+    ret = qcow2_write_snapshots(bs);
+    if (ret < 0) {
+        sn->l1_table_offset = old_l1_table_offset;
+        sn->l1_size = old_l1_size;
+        sn->vm_state_size = old_vm_state_size;
+        goto fail;
+    }
+
+    /*
+     * Drop the references of the old L1 table to whatever VM state the
+     * active L1 table held when the snapshot was taken, then free it.
+     */
+    for (i = 0; i < old_l1_size; i++) {
+        if (i < vm_state_index) {
+            old_l1_table[i] = 0;
+        } else if (old_l1_table[i]) {
+            old_vm_state = true;
+        }
+    }
+
+    if (old_vm_state) {
+        ret = qcow2_pre_write_overlap_check(bs, 0, old_l1_table_offset,
+                                            old_l1_size * L1E_SIZE, false);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        ret = bdrv_pwrite(bs->file, old_l1_table_offset,
+                          old_l1_size * L1E_SIZE, old_l1_table, 0);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        ret = qcow2_update_snapshot_refcount(bs, old_l1_table_offset,
+                                             old_l1_size, -1);
+        if (ret < 0) {
+            goto fail;
+        }
+    }
+    qcow2_free_clusters(bs, old_l1_table_offset, old_l1_size * L1E_SIZE,
+                        QCOW2_DISCARD_SNAPSHOT);
+
+    /* must update the copied flag on the current cluster offsets */
+    ret = qcow2_update_snapshot_refcount(bs, s->l1_table_offset, s->l1_size, 0);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    /*
+     * As in qcow2_snapshot_create(), the VM state isn't needed any more in
+     * the active L1 table.
+     */
+    qcow2_cluster_discard(bs, qcow2_vm_state_offset(s),
+                          ROUND_UP(vm_state_size, s->cluster_size),
+                          QCOW2_DISCARD_NEVER, false);
+
+    g_free(old_l1_table);
+    g_free(l1_table);
+    return 0;
+
+fail_free_l1:
+    qcow2_free_clusters(bs, l1_table_offset, l1_size * L1E_SIZE,
+                        QCOW2_DISCARD_ALWAYS);
+fail:
+    g_free(old_l1_table);
+    g_free(l1_table);
+    return ret;
 }
 
 int qcow2_snapshot_list(BlockDriverState *bs, QEMUSnapshotInfo **psn_tab)
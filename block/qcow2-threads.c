@@ -38,24 +38,30 @@
 #include "block/thread-pool.h"
 #include "crypto.h"
 
+/*
+ * Run @func in the thread pool, with at most @max_threads of the tasks
+ * counted by @nb_threads running at a time. Tasks over the limit wait
+ * in @queue.
+ */
 static int coroutine_fn
-qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
+qcow2_co_process(BlockDriverState *bs, CoQueue *queue, int *nb_threads,
+                 int max_threads, ThreadPoolFunc *func, void *arg)
 {
     int ret;
     BDRVQcow2State *s = bs->opaque;
 
     qemu_co_mutex_lock(&s->lock);
-    while (s->nb_threads >= QCOW2_MAX_THREADS) {
-        qemu_co_queue_wait(&s->thread_task_queue, &s->lock);
+    while (*nb_threads >= max_threads) {
+        qemu_co_queue_wait(queue, &s->lock);
     }
-    s->nb_threads++;
+    (*nb_threads)++;
     qemu_co_mutex_unlock(&s->lock);
 
     ret = thread_pool_submit_co(func, arg);
 
     qemu_co_mutex_lock(&s->lock);
-    s->nb_threads--;
-    qemu_co_queue_next(&s->thread_task_queue);
+    (*nb_threads)--;
+    qemu_co_queue_next(queue);
     qemu_co_mutex_unlock(&s->lock);
 
     return ret;
@@ -66,13 +72,22 @@ qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
  * Compression
  */
 
+struct Qcow2CompressionDict {
+#ifdef CONFIG_ZSTD
+    ZSTD_CDict *cdict;
+    ZSTD_DDict *ddict;
+#endif
+};
+
 typedef ssize_t (*Qcow2CompressFunc)(void *dest, size_t dest_size,
-                                     const void *src, size_t src_size);
+                                     const void *src, size_t src_size,
+                                     Qcow2CompressionDict *dict);
 typedef struct Qcow2CompressData {
     void *dest;
     size_t dest_size;
     const void *src;
     size_t src_size;
+    Qcow2CompressionDict *dict;
     ssize_t ret;
 
     Qcow2CompressFunc func;
@@ -85,13 +100,15 @@ typedef struct Qcow2CompressData {
  *
  * @dest - destination buffer, @dest_size bytes
  * @src - source buffer, @src_size bytes
+ * @dict - unused, images with a dictionary use zstd
  *
  * Returns: compressed size on success
  *          -ENOMEM destination buffer is not enough to store compressed data
  *          -EIO    on any other error
  */
 static ssize_t qcow2_zlib_compress(void *dest, size_t dest_size,
-                                   const void *src, size_t src_size)
+                                   const void *src, size_t src_size,
+                                   Qcow2CompressionDict *dict)
 {
     ssize_t ret;
     z_stream strm;
@@ -133,12 +150,14 @@ static ssize_t qcow2_zlib_compress(void *dest, size_t dest_size,
  *
  * @dest - destination buffer, @dest_size bytes
  * @src - source buffer, @src_size bytes
+ * @dict - unused, images with a dictionary use zstd
  *
  * Returns: 0 on success
  *          -EIO on fail
  */
 static ssize_t qcow2_zlib_decompress(void *dest, size_t dest_size,
-                                     const void *src, size_t src_size)
+                                     const void *src, size_t src_size,
+                                     Qcow2CompressionDict *dict)
 {
     int ret;
     z_stream strm;
@@ -180,13 +199,15 @@ static ssize_t qcow2_zlib_decompress(void *dest, size_t dest_size,
  *
  * @dest - destination buffer, @dest_size bytes
  * @src - source buffer, @src_size bytes
+ * @dict - dictionary of the image or NULL
  *
  * Returns: compressed size on success
  *          -ENOMEM destination buffer is not enough to store compressed data
  *          -EIO    on any other error
  */
 static ssize_t qcow2_zstd_compress(void *dest, size_t dest_size,
-                                   const void *src, size_t src_size)
+                                   const void *src, size_t src_size,
+                                   Qcow2CompressionDict *dict)
 {
     ssize_t ret;
     size_t zstd_ret;
@@ -205,6 +226,10 @@ static ssize_t qcow2_zstd_compress(void *dest, size_t dest_size,
     if (!cctx) {
         return -EIO;
     }
+    if (dict && ZSTD_isError(ZSTD_CCtx_refCDict(cctx, dict->cdict))) {
+        ret = -EIO;
+        goto out;
+    }
     /*
      * Use the zstd streamed interface for symmetry with decompression,
      * where streaming is essential since we don't record the exact
@@ -249,12 +274,14 @@ out:
  *
  * @dest - destination buffer, @dest_size bytes
  * @src - source buffer, @src_size bytes
+ * @dict - dictionary of the image or NULL
  *
  * Returns: 0 on success
  *          -EIO on any error
  */
 static ssize_t qcow2_zstd_decompress(void *dest, size_t dest_size,
-                                     const void *src, size_t src_size)
+                                     const void *src, size_t src_size,
+                                     Qcow2CompressionDict *dict)
 {
     size_t zstd_ret = 0;
     ssize_t ret = 0;
@@ -273,6 +300,10 @@ static ssize_t qcow2_zstd_decompress(void *dest, size_t dest_size,
     if (!dctx) {
         return -EIO;
     }
+    if (dict && ZSTD_isError(ZSTD_DCtx_refDDict(dctx, dict->ddict))) {
+        ZSTD_freeDCtx(dctx);
+        return -EIO;
+    }
 
     /*
      * The compressed stream from the input buffer may consist of more
@@ -330,7 +361,7 @@ static int qcow2_compress_pool_func(void *opaque)
     Qcow2CompressData *data = opaque;
 
     data->ret = data->func(data->dest, data->dest_size,
-                           data->src, data->src_size);
+                           data->src, data->src_size, data->dict);
 
     return 0;
 }
@@ -339,15 +370,18 @@ static ssize_t coroutine_fn
 qcow2_co_do_compress(BlockDriverState *bs, void *dest, size_t dest_size,
                      const void *src, size_t src_size, Qcow2CompressFunc func)
 {
+    BDRVQcow2State *s = bs->opaque;
     Qcow2CompressData arg = {
         .dest = dest,
         .dest_size = dest_size,
         .src = src,
         .src_size = src_size,
+        .dict = s->compression_dict,
         .func = func,
     };
 
-    qcow2_co_process(bs, qcow2_compress_pool_func, &arg);
+    qcow2_co_process(bs, &s->compress_task_queue, &s->nb_compress_threads,
+                     s->compress_threads, qcow2_compress_pool_func, &arg);
 
     return arg.ret;
 }
@@ -425,6 +459,60 @@ qcow2_co_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
     return qcow2_co_do_compress(bs, dest, dest_size, src, src_size, fn);
 }
 
+/*
+ * qcow2_compression_dict_init()
+ *
+ * Prepare @size bytes of zstd dictionary at @dict for the compression and
+ * decompression of the clusters of @bs. The dictionary is copied.
+ *
+ * Returns: 0 on success
+ *          -EINVAL if the dictionary can't be used
+ */
+int qcow2_compression_dict_init(BlockDriverState *bs, const void *dict,
+                                size_t size, Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+#ifdef CONFIG_ZSTD
+    Qcow2CompressionDict *d;
+
+    assert(s->compression_type == QCOW2_COMPRESSION_TYPE_ZSTD);
+    assert(!s->compression_dict);
+
+    d = g_new0(Qcow2CompressionDict, 1);
+    d->cdict = ZSTD_createCDict(dict, size, ZSTD_CLEVEL_DEFAULT);
+    d->ddict = ZSTD_createDDict(dict, size);
+    if (!d->cdict || !d->ddict) {
+        error_setg(errp, "Invalid compression dictionary");
+        ZSTD_freeCDict(d->cdict);
+        ZSTD_freeDDict(d->ddict);
+        g_free(d);
+        return -EINVAL;
+    }
+
+    s->compression_dict = d;
+    return 0;
+#else
+    error_setg(errp, "Compression dictionaries require zstd support");
+    return -EINVAL;
+#endif
+}
+
+void qcow2_compression_dict_free(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2CompressionDict *d = s->compression_dict;
+
+    if (!d) {
+        return;
+    }
+#ifdef CONFIG_ZSTD
+    ZSTD_freeCDict(d->cdict);
+    ZSTD_freeDDict(d->ddict);
+#endif
+    g_free(d);
+    s->compression_dict = NULL;
+}
+
 
 /*
  * Cryptography
@@ -475,7 +563,13 @@ qcow2_co_encdec(BlockDriverState *bs, uint64_t host_offset,
     assert(QEMU_IS_ALIGNED(host_offset, sector_size));
     assert(QEMU_IS_ALIGNED(len, sector_size));
 
-    return len == 0 ? 0 : qcow2_co_process(bs, qcow2_encdec_pool_func, &arg);
+    if (len == 0) {
+        return 0;
+    }
+
+    /* s->crypto was opened with one cipher for each of QCOW2_MAX_THREADS */
+    return qcow2_co_process(bs, &s->thread_task_queue, &s->nb_threads,
+                            QCOW2_MAX_THREADS, qcow2_encdec_pool_func, &arg);
 }
 
 /*
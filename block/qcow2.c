@@ -73,6 +73,7 @@ typedef struct {
 #define  QCOW2_EXT_MAGIC_CRYPTO_HEADER 0x0537be77
 #define  QCOW2_EXT_MAGIC_BITMAPS 0x23852875
 #define  QCOW2_EXT_MAGIC_DATA_FILE 0x44415441
+#define  QCOW2_EXT_MAGIC_COMPRESSION_DICT 0x7a646963
 
 static int coroutine_fn
 qcow2_co_preadv_compressed(BlockDriverState *bs,
@@ -327,6 +328,41 @@ qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
             }
         }   break;
 
+        case QCOW2_EXT_MAGIC_COMPRESSION_DICT:
+            if (ext.len != sizeof(Qcow2CompressionDictHeaderExt)) {
+                error_setg(errp, "compression dictionary header extension "
+                           "size %u, but expected size %zu", ext.len,
+                           sizeof(Qcow2CompressionDictHeaderExt));
+                return -EINVAL;
+            }
+
+            ret = bdrv_co_pread(bs->file, offset, ext.len,
+                                &s->compression_dict_header, 0);
+            if (ret < 0) {
+                error_setg_errno(errp, -ret, "Unable to read compression "
+                                 "dictionary header extension");
+                return ret;
+            }
+            s->compression_dict_header.offset =
+                be64_to_cpu(s->compression_dict_header.offset);
+            s->compression_dict_header.length =
+                be64_to_cpu(s->compression_dict_header.length);
+
+            if (offset_into_cluster(s, s->compression_dict_header.offset) ||
+                !s->compression_dict_header.offset) {
+                error_setg(errp, "Invalid compression dictionary offset '%"
+                           PRIu64 "'", s->compression_dict_header.offset);
+                return -EINVAL;
+            }
+            if (!s->compression_dict_header.length ||
+                s->compression_dict_header.length >
+                QCOW2_MAX_COMPRESSION_DICT_SIZE) {
+                error_setg(errp, "Invalid compression dictionary length '%"
+                           PRIu64 "'", s->compression_dict_header.length);
+                return -EINVAL;
+            }
+            break;
+
         case QCOW2_EXT_MAGIC_BITMAPS:
             if (ext.len != sizeof(bitmaps_ext)) {
                 error_setg_errno(errp, -ret, "bitmaps_ext: "
@@ -537,10 +573,20 @@ int qcow2_mark_dirty(BlockDriverState *bs)
  * function when there are no pending requests, it does not guard against
  * concurrent requests dirtying the image.
  */
-static int GRAPH_RDLOCK qcow2_mark_clean(BlockDriverState *bs)
+int qcow2_mark_clean(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
 
+    if (!QSIMPLEQ_EMPTY(&s->deleted_snapshots) || s->copied_flags_index >= 0 ||
+        s->snapshot_free_failed)
+    {
+        /*
+         * The refcounts are only fixed once deleted snapshots are freed, or
+         * by a check if that failed
+         */
+        return 0;
+    }
+
     if (s->incompatible_features & QCOW2_INCOMPAT_DIRTY) {
         int ret;
 
@@ -606,21 +652,30 @@ static void qcow2_add_check_result(BdrvCheckResult *out,
 
 static int coroutine_fn GRAPH_RDLOCK
 qcow2_co_check_locked(BlockDriverState *bs, BdrvCheckResult *result,
-                      BdrvCheckMode fix)
+                      BdrvCheckMode fix, BlockDriverCheckStatusCB *status_cb,
+                      void *cb_opaque)
 {
+    BDRVQcow2State *s = bs->opaque;
     BdrvCheckResult snapshot_res = {};
     BdrvCheckResult refcount_res = {};
     int ret;
 
     memset(result, 0, sizeof(*result));
 
+    /* Deleted snapshots and clusters allocated ahead would be leaks */
+    ret = qcow2_snapshot_free_finish(bs);
+    if (ret < 0) {
+        return ret;
+    }
+    qcow2_prealloc_release(bs);
+
     ret = qcow2_check_read_snapshot_table(bs, &snapshot_res, fix);
     if (ret < 0) {
         qcow2_add_check_result(result, &snapshot_res, false);
         return ret;
     }
 
-    ret = qcow2_check_refcounts(bs, &refcount_res, fix);
+    ret = qcow2_check_refcounts(bs, &refcount_res, fix, status_cb, cb_opaque);
     qcow2_add_check_result(result, &refcount_res, true);
     if (ret < 0) {
         qcow2_add_check_result(result, &snapshot_res, false);
@@ -634,6 +689,10 @@ qcow2_co_check_locked(BlockDriverState *bs, BdrvCheckResult *result,
     }
 
     if (fix && result->check_errors == 0 && result->corruptions == 0) {
+        if ((fix & BDRV_FIX_LEAKS) && result->leaks == 0) {
+            /* Whatever a failed snapshot deletion left behind is repaired */
+            s->snapshot_free_failed = false;
+        }
         ret = qcow2_mark_clean(bs);
         if (ret < 0) {
             return ret;
@@ -645,13 +704,14 @@ qcow2_co_check_locked(BlockDriverState *bs, BdrvCheckResult *result,
 
 static int coroutine_fn GRAPH_RDLOCK
 qcow2_co_check(BlockDriverState *bs, BdrvCheckResult *result,
-               BdrvCheckMode fix)
+               BdrvCheckMode fix, BlockDriverCheckStatusCB *status_cb,
+               void *cb_opaque)
 {
     BDRVQcow2State *s = bs->opaque;
     int ret;
 
     qemu_co_mutex_lock(&s->lock);
-    ret = qcow2_co_check_locked(bs, result, fix);
+    ret = qcow2_co_check_locked(bs, result, fix, status_cb, cb_opaque);
     qemu_co_mutex_unlock(&s->lock);
     return ret;
 }
@@ -696,11 +756,14 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_OVERLAP_INACTIVE_L1,
     QCOW2_OPT_OVERLAP_INACTIVE_L2,
     QCOW2_OPT_OVERLAP_BITMAP_DIRECTORY,
+    QCOW2_OPT_OVERLAP_COMPRESSION_DICT,
     QCOW2_OPT_CACHE_SIZE,
     QCOW2_OPT_L2_CACHE_SIZE,
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_COMPRESS_THREADS,
+    QCOW2_OPT_SEQUENTIAL_PREALLOC_SIZE,
     NULL
 };
 
@@ -791,6 +854,12 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_BOOL,
             .help = "Check for unintended writes into the bitmap directory",
         },
+        {
+            .name = QCOW2_OPT_OVERLAP_COMPRESSION_DICT,
+            .type = QEMU_OPT_BOOL,
+            .help = "Check for unintended writes into the compression "
+                    "dictionary",
+        },
         {
             .name = QCOW2_OPT_CACHE_SIZE,
             .type = QEMU_OPT_SIZE,
@@ -817,6 +886,17 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_COMPRESS_THREADS,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Maximum number of clusters compressed in parallel",
+        },
+        {
+            .name = QCOW2_OPT_SEQUENTIAL_PREALLOC_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Maximum size of clusters allocated ahead for "
+                    "sequential writes (0 to disable)",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -833,6 +913,7 @@ static const char *overlap_bool_option_names[QCOW2_OL_MAX_BITNR] = {
     [QCOW2_OL_INACTIVE_L1_BITNR]      = QCOW2_OPT_OVERLAP_INACTIVE_L1,
     [QCOW2_OL_INACTIVE_L2_BITNR]      = QCOW2_OPT_OVERLAP_INACTIVE_L2,
     [QCOW2_OL_BITMAP_DIRECTORY_BITNR] = QCOW2_OPT_OVERLAP_BITMAP_DIRECTORY,
+    [QCOW2_OL_COMPRESSION_DICT_BITNR] = QCOW2_OPT_OVERLAP_COMPRESSION_DICT,
 };
 
 static void cache_clean_timer_cb(void *opaque)
@@ -878,6 +959,12 @@ static void qcow2_attach_aio_context(BlockDriverState *bs,
     cache_clean_timer_init(bs, new_context);
 }
 
+static void qcow2_drain_end(BlockDriverState *bs)
+{
+    /* Resume freeing the clusters of deleted snapshots */
+    qcow2_snapshot_free_start(bs);
+}
+
 static bool read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
                              uint64_t *l2_cache_size,
                              uint64_t *l2_cache_entry_size,
@@ -979,6 +1066,8 @@ typedef struct Qcow2ReopenState {
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     bool discard_no_unref;
     uint64_t cache_clean_interval;
+    int compress_threads;
+    uint64_t sequential_prealloc_size;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -991,6 +1080,7 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
     const char *opt_overlap_check, *opt_overlap_check_template;
     int overlap_check_template = 0;
     uint64_t l2_cache_size, l2_cache_entry_size, refcount_cache_size;
+    uint64_t compress_threads;
     int i;
     const char *encryptfmt;
     QDict *encryptopts = NULL;
@@ -1032,6 +1122,9 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
         goto fail;
     }
 
+    /* Return what sequential writes didn't use before flushing the caches */
+    qcow2_prealloc_release(bs);
+
     /* alloc new L2 table/refcount block cache, flush old one */
     if (s->l2_table_cache) {
         ret = qcow2_cache_flush(bs, s->l2_table_cache);
@@ -1079,6 +1172,28 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
         goto fail;
     }
 
+    compress_threads = qemu_opt_get_number(opts, QCOW2_OPT_COMPRESS_THREADS,
+                                           QCOW2_MAX_THREADS);
+    if (compress_threads < 1 || compress_threads > QCOW2_MAX_COMPRESS_THREADS) {
+        error_setg(errp, QCOW2_OPT_COMPRESS_THREADS " must be between 1 and %d",
+                   QCOW2_MAX_COMPRESS_THREADS);
+        ret = -EINVAL;
+        goto fail;
+    }
+    r->compress_threads = compress_threads;
+
+    r->sequential_prealloc_size =
+        qemu_opt_get_size(opts, QCOW2_OPT_SEQUENTIAL_PREALLOC_SIZE, 0);
+    if (r->sequential_prealloc_size > QCOW2_MAX_SEQUENTIAL_PREALLOC_SIZE) {
+        error_setg(errp, QCOW2_OPT_SEQUENTIAL_PREALLOC_SIZE
+                   " must be at most %" PRIu64,
+                   (uint64_t)QCOW2_MAX_SEQUENTIAL_PREALLOC_SIZE);
+        ret = -EINVAL;
+        goto fail;
+    }
+    r->sequential_prealloc_size = ROUND_UP(r->sequential_prealloc_size,
+                                           s->cluster_size);
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1238,6 +1353,8 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
     }
 
     s->discard_no_unref = r->discard_no_unref;
+    s->compress_threads = r->compress_threads;
+    s->sequential_prealloc_size = r->sequential_prealloc_size;
 
     if (s->cache_clean_interval != r->cache_clean_interval) {
         cache_clean_timer_del(bs);
@@ -1315,6 +1432,50 @@ static int validate_compression_type(BDRVQcow2State *s, Error **errp)
 }
 
 /* Called with s->lock held.  */
+/*
+ * Load the compression dictionary of the image, if it has one. Must be
+ * called after the header extensions have been read.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_load_compression_dict(BlockDriverState *bs, Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    g_autofree void *dict = NULL;
+    int ret;
+
+    if (!(s->incompatible_features & QCOW2_INCOMPAT_COMPRESSION_DICT)) {
+        if (s->compression_dict_header.offset) {
+            error_setg(errp, "Compression dictionary header extension found, "
+                       "but the compression dictionary bit is not set");
+            return -EINVAL;
+        }
+        return 0;
+    }
+
+    if (!s->compression_dict_header.offset) {
+        error_setg(errp, "Compression dictionary bit set, but no compression "
+                   "dictionary header extension found");
+        return -EINVAL;
+    }
+    if (s->compression_type != QCOW2_COMPRESSION_TYPE_ZSTD) {
+        error_setg(errp, "Compression dictionaries are only supported with "
+                   "zstd compression");
+        return -EINVAL;
+    }
+
+    dict = g_malloc(s->compression_dict_header.length);
+    ret = bdrv_co_pread(bs->file, s->compression_dict_header.offset,
+                        s->compression_dict_header.length, dict, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read compression dictionary");
+        return ret;
+    }
+
+    return qcow2_compression_dict_init(bs, dict,
+                                       s->compression_dict_header.length,
+                                       errp);
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
               bool open_data_file, Error **errp)
@@ -1627,7 +1788,11 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     QLIST_INIT(&s->cluster_allocs);
+    QSIMPLEQ_INIT(&s->link_queue);
+    qemu_spin_init(&s->link_queue_lock);
     QTAILQ_INIT(&s->discards);
+    QSIMPLEQ_INIT(&s->deleted_snapshots);
+    s->copied_flags_index = -1;
 
     /* read qcow2 extensions */
     if (qcow2_read_extensions(bs, header.header_length, ext_end, NULL,
@@ -1636,6 +1801,11 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
         goto fail;
     }
 
+    ret = qcow2_load_compression_dict(bs, errp);
+    if (ret < 0) {
+        goto fail;
+    }
+
     if (open_data_file) {
         /* Open external data file */
         bdrv_graph_co_rdunlock();
@@ -1856,7 +2026,8 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
         BdrvCheckResult result = {0};
 
         ret = qcow2_co_check_locked(bs, &result,
-                                    BDRV_FIX_ERRORS | BDRV_FIX_LEAKS);
+                                    BDRV_FIX_ERRORS | BDRV_FIX_LEAKS,
+                                    NULL, NULL);
         if (ret < 0 || result.check_errors) {
             if (ret >= 0) {
                 ret = -EIO;
@@ -1869,11 +2040,13 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
 #ifdef DEBUG_ALLOC
     {
         BdrvCheckResult result = {0};
-        qcow2_check_refcounts(bs, &result, 0);
+        qcow2_check_refcounts(bs, &result, 0, NULL, NULL);
     }
 #endif
 
     qemu_co_queue_init(&s->thread_task_queue);
+    qemu_co_queue_init(&s->compress_task_queue);
+    qemu_co_queue_init(&s->compress_alloc_queue);
 
     return ret;
 
@@ -1901,6 +2074,7 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
     }
     qcrypto_block_free(s->crypto);
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
+    qcow2_compression_dict_free(bs);
     return ret;
 }
 
@@ -1997,6 +2171,13 @@ qcow2_reopen_prepare(BDRVReopenState *state,BlockReopenQueue *queue,
             goto fail;
         }
 
+        ret = qcow2_snapshot_free_finish(state->bs);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Failed to free the clusters of "
+                             "deleted snapshots");
+            goto fail;
+        }
+
         ret = bdrv_flush(state->bs);
         if (ret < 0) {
             goto fail;
@@ -2569,6 +2750,90 @@ handle_alloc_space(BlockDriverState *bs, QCowL2Meta *l2meta)
     return 0;
 }
 
+struct Qcow2LinkRequest {
+    QCowL2Meta *l2meta;
+    Coroutine *co;
+    int ret;
+    /* Woken up to link the queue instead of with a result */
+    bool leader;
+    QSIMPLEQ_ENTRY(Qcow2LinkRequest) next;
+};
+
+/*
+ * Links the L2 entries of a write request whose data and COW regions are
+ * already on disk, and frees @l2meta.
+ *
+ * Allocating writes from several queues and iothreads would otherwise each
+ * take s->lock for a short L2 and refcount update, handing the lock over
+ * from thread to thread every time. Instead, the first request to get here
+ * takes s->lock and links every request that is queued at that point, the
+ * others just wait to be woken up with their result. Requests that queue
+ * up while the leader is linking are handed to the first of them as the
+ * next leader, so that no request links an unbounded number of others.
+ *
+ * Called with s->lock unlocked.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_co_link_l2meta(BlockDriverState *bs, QCowL2Meta *l2meta)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2LinkRequest req = {
+        .l2meta = l2meta,
+        .co = qemu_coroutine_self(),
+    };
+    QSIMPLEQ_HEAD(, Qcow2LinkRequest) batch = QSIMPLEQ_HEAD_INITIALIZER(batch);
+    Qcow2LinkRequest *r, *next_r;
+    bool leader;
+    int nb_linked = 0;
+
+    qemu_spin_lock(&s->link_queue_lock);
+    QSIMPLEQ_INSERT_TAIL(&s->link_queue, &req, next);
+    leader = !s->link_active;
+    s->link_active = true;
+    qemu_spin_unlock(&s->link_queue_lock);
+
+    if (!leader) {
+        /* Woken up exactly once, after req.ret or req.leader has been set */
+        qemu_coroutine_yield();
+        if (!req.leader) {
+            return req.ret;
+        }
+    }
+
+    qemu_co_mutex_lock(&s->lock);
+    qemu_spin_lock(&s->link_queue_lock);
+    QSIMPLEQ_CONCAT(&batch, &s->link_queue);
+    qemu_spin_unlock(&s->link_queue_lock);
+
+    QSIMPLEQ_FOREACH_SAFE(r, &batch, next, next_r) {
+        r->ret = qcow2_handle_l2meta(bs, &r->l2meta, true);
+        qcow2_handle_l2meta(bs, &r->l2meta, false);
+        nb_linked++;
+
+        /* @r lives on the stack of its coroutine, don't touch it after this */
+        if (r != &req) {
+            aio_co_wake(r->co);
+        }
+    }
+    qemu_co_mutex_unlock(&s->lock);
+
+    qemu_spin_lock(&s->link_queue_lock);
+    r = QSIMPLEQ_FIRST(&s->link_queue);
+    if (!r) {
+        s->link_active = false;
+    }
+    qemu_spin_unlock(&s->link_queue_lock);
+
+    /* Others only append while link_active is set, @r stays queued */
+    if (r) {
+        r->leader = true;
+        aio_co_wake(r->co);
+    }
+
+    trace_qcow2_link_l2meta(qemu_coroutine_self(), nb_linked);
+    return req.ret;
+}
+
 /*
  * qcow2_co_pwritev_task
  * Called with s->lock unlocked
@@ -2584,6 +2849,7 @@ int qcow2_co_pwritev_task(BlockDriverState *bs, uint64_t host_offset,
     BDRVQcow2State *s = bs->opaque;
     void *crypt_buf = NULL;
     QEMUIOVector encrypted_qiov;
+    QCowL2Meta *m;
 
     if (bs->encrypted) {
         assert(s->crypto);
@@ -2627,15 +2893,23 @@ int qcow2_co_pwritev_task(BlockDriverState *bs, uint64_t host_offset,
         }
     }
 
-    qemu_co_mutex_lock(&s->lock);
+    /* Do the COW before taking s->lock, it only touches our own clusters */
+    for (m = l2meta; m != NULL; m = m->next) {
+        ret = qcow2_alloc_cluster_cow(bs, m);
+        if (ret < 0) {
+            goto out_unlocked;
+        }
+    }
 
-    ret = qcow2_handle_l2meta(bs, &l2meta, true);
-    goto out_locked;
+    if (l2meta) {
+        ret = qcow2_co_link_l2meta(bs, l2meta);
+    }
+    qemu_vfree(crypt_buf);
+
+    return ret;
 
 out_unlocked:
     qemu_co_mutex_lock(&s->lock);
-
-out_locked:
     qcow2_handle_l2meta(bs, &l2meta, false);
     qemu_co_mutex_unlock(&s->lock);
 
@@ -2748,6 +3022,15 @@ static int GRAPH_RDLOCK qcow2_inactivate(BlockDriverState *bs)
     int ret, result = 0;
     Error *local_err = NULL;
 
+    ret = qcow2_snapshot_free_finish(bs);
+    if (ret < 0) {
+        result = ret;
+        error_report("Failed to free the clusters of deleted snapshots: %s",
+                     strerror(-ret));
+    }
+
+    qcow2_prealloc_release(bs);
+
     qcow2_store_persistent_dirty_bitmaps(bs, true, &local_err);
     if (local_err != NULL) {
         result = -EINVAL;
@@ -2781,6 +3064,10 @@ static void coroutine_mixed_fn GRAPH_RDLOCK
 qcow2_do_close(BlockDriverState *bs, bool close_data_file)
 {
     BDRVQcow2State *s = bs->opaque;
+
+    /* Needs the L1 table to update the copied flags */
+    qcow2_snapshot_free_finish(bs);
+
     qemu_vfree(s->l1_table);
     /* else pre-write overlap checks in cache_destroy may crash */
     s->l1_table = NULL;
@@ -2797,6 +3084,8 @@ qcow2_do_close(BlockDriverState *bs, bool close_data_file)
     s->crypto = NULL;
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
 
+    qcow2_compression_dict_free(bs);
+
     g_free(s->unknown_header_fields);
     cleanup_unknown_header_ext(bs);
 
@@ -3032,6 +3321,21 @@ int qcow2_update_header(BlockDriverState *bs)
         buflen -= ret;
     }
 
+    /* Compression dictionary header extension */
+    if (s->compression_dict_header.offset != 0) {
+        Qcow2CompressionDictHeaderExt dict_header = {
+            .offset = cpu_to_be64(s->compression_dict_header.offset),
+            .length = cpu_to_be64(s->compression_dict_header.length),
+        };
+        ret = header_ext_add(buf, QCOW2_EXT_MAGIC_COMPRESSION_DICT,
+                             &dict_header, sizeof(dict_header), buflen);
+        if (ret < 0) {
+            goto fail;
+        }
+        buf += ret;
+        buflen -= ret;
+    }
+
     /*
      * Feature table.  A mere 8 feature names occupies 392 bytes, and
      * when coupled with the v3 minimum header of 104 bytes plus the
@@ -3067,6 +3371,11 @@ int qcow2_update_header(BlockDriverState *bs)
                 .bit  = QCOW2_INCOMPAT_EXTL2_BITNR,
                 .name = "extended L2 entries",
             },
+            {
+                .type = QCOW2_FEAT_TYPE_INCOMPATIBLE,
+                .bit  = QCOW2_INCOMPAT_COMPRESSION_DICT_BITNR,
+                .name = "compression dictionary",
+            },
             {
                 .type = QCOW2_FEAT_TYPE_COMPATIBLE,
                 .bit  = QCOW2_COMPAT_LAZY_REFCOUNTS_BITNR,
@@ -3233,6 +3542,67 @@ qcow2_set_up_encryption(BlockDriverState *bs,
     return ret;
 }
 
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_set_up_compression_dict(BlockDriverState *bs, const char *filename,
+                              Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    g_autoptr(GError) gerr = NULL;
+    g_autofree char *dict = NULL;
+    g_autofree void *buf = NULL;
+    gsize size;
+    int64_t offset, clusterlen;
+    int ret;
+
+    if (!g_file_get_contents(filename, &dict, &size, &gerr)) {
+        error_setg(errp, "Could not read compression dictionary: %s",
+                   gerr->message);
+        return -EIO;
+    }
+    if (size == 0 || size > QCOW2_MAX_COMPRESSION_DICT_SIZE) {
+        error_setg(errp, "Compression dictionary size must be between 1 and "
+                   "%" PRIu64 " bytes",
+                   (uint64_t)QCOW2_MAX_COMPRESSION_DICT_SIZE);
+        return -EINVAL;
+    }
+
+    ret = qcow2_compression_dict_init(bs, dict, size, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    offset = qcow2_alloc_clusters(bs, size);
+    if (offset < 0) {
+        error_setg_errno(errp, -offset, "Could not allocate clusters for the "
+                         "compression dictionary");
+        return offset;
+    }
+
+    /* Zero fill the tail of the last cluster */
+    clusterlen = size_to_clusters(s, size) * s->cluster_size;
+    buf = g_malloc0(clusterlen);
+    memcpy(buf, dict, size);
+    assert(qcow2_pre_write_overlap_check(bs, 0, offset, clusterlen,
+                                         false) == 0);
+    ret = bdrv_co_pwrite(bs->file, offset, clusterlen, buf, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not write compression dictionary");
+        return ret;
+    }
+
+    s->compression_dict_header.offset = offset;
+    s->compression_dict_header.length = size;
+    s->incompatible_features |= QCOW2_INCOMPAT_COMPRESSION_DICT;
+
+    ret = qcow2_update_header(bs);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not update qcow2 header");
+        return ret;
+    }
+
+    return 0;
+}
+
 /**
  * Preallocates metadata structures for data clusters between @offset (in the
  * guest disk) and @new_length (which is thus generally the new guest disk
@@ -3687,6 +4057,14 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
         compression_type = qcow2_opts->compression_type;
     }
 
+    if (qcow2_opts->compression_dictionary &&
+        compression_type != QCOW2_COMPRESSION_TYPE_ZSTD) {
+        error_setg(errp, "A compression dictionary requires the zstd "
+                   "compression type");
+        ret = -EINVAL;
+        goto out;
+    }
+
     /* Create BlockBackend to write to the image */
     blk = blk_co_new_with_bs(bs, BLK_PERM_WRITE | BLK_PERM_RESIZE, BLK_PERM_ALL,
                              errp);
@@ -3847,6 +4225,19 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
         }
     }
 
+    /* Want a compression dictionary? There you go. */
+    if (qcow2_opts->compression_dictionary) {
+        bdrv_graph_co_rdlock();
+        ret = qcow2_set_up_compression_dict(blk_bs(blk),
+                                            qcow2_opts->compression_dictionary,
+                                            errp);
+        bdrv_graph_co_rdunlock();
+
+        if (ret < 0) {
+            goto out;
+        }
+    }
+
     blk_co_unref(blk);
     blk = NULL;
 
@@ -3931,6 +4322,7 @@ qcow2_co_create_opts(BlockDriver *drv, const char *filename, QemuOpts *opts,
         { BLOCK_OPT_COMPAT_LEVEL,       "version" },
         { BLOCK_OPT_DATA_FILE_RAW,      "data-file-raw" },
         { BLOCK_OPT_COMPRESSION_TYPE,   "compression-type" },
+        { BLOCK_OPT_COMPRESSION_DICT,   "compression-dictionary" },
         { NULL, NULL },
     };
 
@@ -4335,6 +4727,9 @@ qcow2_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
             goto fail;
         }
 
+        /* The image file is cut after the last cluster in use */
+        qcow2_prealloc_release(bs);
+
         ret = qcow2_cluster_discard(bs, ROUND_UP(offset, s->cluster_size),
                                     old_length - ROUND_UP(offset,
                                                           s->cluster_size),
@@ -4657,6 +5052,25 @@ fail:
     return ret;
 }
 
+/*
+ * Wait until the compressed writes that arrived before the one that got
+ * @ticket have allocated their cluster. Called with s->lock held.
+ */
+static void coroutine_fn
+qcow2_compress_wait_turn(BDRVQcow2State *s, unsigned ticket)
+{
+    while (s->compress_alloc_ticket != ticket) {
+        qemu_co_queue_wait(&s->compress_alloc_queue, &s->lock);
+    }
+}
+
+/* Let the next compressed write allocate. Called with s->lock held. */
+static void coroutine_fn qcow2_compress_next_turn(BDRVQcow2State *s)
+{
+    s->compress_alloc_ticket++;
+    qemu_co_queue_restart_all(&s->compress_alloc_queue);
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
                                  uint64_t offset, uint64_t bytes,
@@ -4667,10 +5081,14 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
     ssize_t out_len;
     uint8_t *buf, *out_buf;
     uint64_t cluster_offset;
+    unsigned ticket;
 
     assert(bytes == s->cluster_size || (bytes < s->cluster_size &&
            (offset + bytes == bs->total_sectors << BDRV_SECTOR_BITS)));
 
+    /* Nothing yielded yet, so this is the order in which writes arrived */
+    ticket = qatomic_fetch_inc(&s->compress_next_ticket);
+
     buf = qemu_blockalign(bs, s->cluster_size);
     if (bytes < s->cluster_size) {
         /* Zero-pad last write if image size is not cluster aligned */
@@ -4682,21 +5100,28 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
 
     out_len = qcow2_co_compress(bs, out_buf, s->cluster_size - 1,
                                 buf, s->cluster_size);
-    if (out_len == -ENOMEM) {
-        /* could not compress: write normal cluster */
-        ret = qcow2_co_pwritev_part(bs, offset, bytes, qiov, qiov_offset, 0);
-        if (ret < 0) {
-            goto fail;
+
+    qemu_co_mutex_lock(&s->lock);
+    qcow2_compress_wait_turn(s, ticket);
+    if (out_len < 0) {
+        qcow2_compress_next_turn(s);
+        qemu_co_mutex_unlock(&s->lock);
+        if (out_len == -ENOMEM) {
+            /* could not compress: write normal cluster */
+            ret = qcow2_co_pwritev_part(bs, offset, bytes, qiov, qiov_offset,
+                                        0);
+            if (ret < 0) {
+                goto fail;
+            }
+            goto success;
         }
-        goto success;
-    } else if (out_len < 0) {
         ret = -EINVAL;
         goto fail;
     }
 
-    qemu_co_mutex_lock(&s->lock);
     ret = qcow2_alloc_compressed_cluster_offset(bs, offset, out_len,
                                                 &cluster_offset);
+    qcow2_compress_next_turn(s);
     if (ret < 0) {
         qemu_co_mutex_unlock(&s->lock);
         goto fail;
@@ -4780,7 +5205,8 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
         uint64_t chunk_size = MIN(bytes, s->cluster_size);
 
         if (!aio && chunk_size != bytes) {
-            aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
+            aio = aio_task_pool_new(MAX(QCOW2_MAX_WORKERS,
+                                        s->compress_threads));
         }
 
         ret = qcow2_add_task(bs, aio, qcow2_co_pwritev_compressed_task_entry,
@@ -5005,6 +5431,12 @@ static int GRAPH_RDLOCK qcow2_make_empty(BlockDriverState *bs)
     int step = QEMU_ALIGN_DOWN(INT_MAX, s->cluster_size);
     int l1_clusters, ret = 0;
 
+    ret = qcow2_snapshot_free_finish(bs);
+    if (ret < 0) {
+        return ret;
+    }
+    qcow2_prealloc_release(bs);
+
     l1_clusters = DIV_ROUND_UP(s->l1_size, s->cluster_size / L1E_SIZE);
 
     if (s->qcow_version >= 3 && !s->snapshots && !s->nb_bitmaps &&
@@ -5281,6 +5713,10 @@ qcow2_get_specific_info(BlockDriverState *bs, Error **errp)
             .has_data_file_raw  = has_data_file(bs),
             .data_file_raw      = data_file_is_raw(bs),
             .compression_type   = s->compression_type,
+            .has_compression_dictionary_size =
+                !!s->compression_dict_header.offset,
+            .compression_dictionary_size =
+                s->compression_dict_header.length,
         };
     } else {
         /* if this assertion fails, this probably means a new version was
@@ -5313,6 +5749,21 @@ qcow2_get_specific_info(BlockDriverState *bs, Error **errp)
     return spec_info;
 }
 
+static BlockStatsSpecific *qcow2_get_specific_stats(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    BlockStatsSpecific *stats = g_new0(BlockStatsSpecific, 1);
+
+    stats->driver = BLOCKDEV_DRIVER_QCOW2;
+    stats->u.qcow2.l2_cache = g_new0(Qcow2CacheStats, 1);
+    qcow2_cache_get_stats(s->l2_table_cache, stats->u.qcow2.l2_cache);
+    stats->u.qcow2.refcount_cache = g_new0(Qcow2CacheStats, 1);
+    qcow2_cache_get_stats(s->refcount_block_cache,
+                          stats->u.qcow2.refcount_cache);
+
+    return stats;
+}
+
 static int coroutine_mixed_fn GRAPH_RDLOCK
 qcow2_has_zero_init(BlockDriverState *bs)
 {
@@ -5686,6 +6137,14 @@ qcow2_amend_options(BlockDriverState *bs, QemuOpts *opts,
     Qcow2AmendHelperCBInfo helper_cb_info;
     bool encryption_update = false;
 
+    ret = qcow2_snapshot_free_finish(bs);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret,
+                         "Failed to free the clusters of deleted snapshots");
+        return ret;
+    }
+    qcow2_prealloc_release(bs);
+
     while (desc && desc->name) {
         if (!qemu_opt_find(opts, desc->name)) {
             /* only change explicitly defined options */
@@ -6099,6 +6558,12 @@ static QemuOptsList qcow2_create_opts = {
             .help = "Compression method used for image cluster "        \
                     "compression",                                      \
             .def_value_str = "zlib"                                     \
+        },                                                              \
+        {                                                               \
+            .name = BLOCK_OPT_COMPRESSION_DICT,                         \
+            .type = QEMU_OPT_STRING,                                    \
+            .help = "File with a zstd dictionary for compressed "       \
+                    "clusters",                                         \
         },
         QCOW_COMMON_OPTIONS,
         { /* end of list */ }
@@ -6157,11 +6622,13 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_snapshot_create               = qcow2_snapshot_create,
     .bdrv_snapshot_goto                 = qcow2_snapshot_goto,
     .bdrv_snapshot_delete               = qcow2_snapshot_delete,
+    .bdrv_snapshot_attach_vmstate       = qcow2_snapshot_attach_vmstate,
     .bdrv_snapshot_list                 = qcow2_snapshot_list,
     .bdrv_snapshot_load_tmp             = qcow2_snapshot_load_tmp,
     .bdrv_measure                       = qcow2_measure,
     .bdrv_co_get_info                   = qcow2_co_get_info,
     .bdrv_get_specific_info             = qcow2_get_specific_info,
+    .bdrv_get_specific_stats            = qcow2_get_specific_stats,
 
     .bdrv_co_save_vmstate               = qcow2_co_save_vmstate,
     .bdrv_co_load_vmstate               = qcow2_co_load_vmstate,
@@ -6184,6 +6651,7 @@ BlockDriver bdrv_qcow2 = {
 
     .bdrv_detach_aio_context            = qcow2_detach_aio_context,
     .bdrv_attach_aio_context            = qcow2_attach_aio_context,
+    .bdrv_drain_end                     = qcow2_drain_end,
 
     .bdrv_supports_persistent_dirty_bitmap =
             qcow2_supports_persistent_dirty_bitmap,
@@ -145,11 +145,15 @@
 #define QCOW2_OPT_OVERLAP_INACTIVE_L1 "overlap-check.inactive-l1"
 #define QCOW2_OPT_OVERLAP_INACTIVE_L2 "overlap-check.inactive-l2"
 #define QCOW2_OPT_OVERLAP_BITMAP_DIRECTORY "overlap-check.bitmap-directory"
+#define QCOW2_OPT_OVERLAP_COMPRESSION_DICT \
+    "overlap-check.compression-dictionary"
 #define QCOW2_OPT_CACHE_SIZE "cache-size"
 #define QCOW2_OPT_L2_CACHE_SIZE "l2-cache-size"
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_COMPRESS_THREADS "compress-threads"
+#define QCOW2_OPT_SEQUENTIAL_PREALLOC_SIZE "sequential-prealloc-size"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -231,11 +235,33 @@ typedef struct QCowSnapshot {
 struct Qcow2Cache;
 typedef struct Qcow2Cache Qcow2Cache;
 
+typedef struct Qcow2LinkRequest Qcow2LinkRequest;
+
+/* A deleted snapshot whose clusters are still being freed */
+typedef struct Qcow2DeletedSnapshot {
+    uint64_t l1_table_offset;
+    uint32_t l1_size;
+    uint64_t *l1_table;
+    /* Index of the next L1 entry whose L2 table is to be freed */
+    uint32_t l1_index;
+    QSIMPLEQ_ENTRY(Qcow2DeletedSnapshot) next;
+} Qcow2DeletedSnapshot;
+
 typedef struct Qcow2CryptoHeaderExtension {
     uint64_t offset;
     uint64_t length;
 } QEMU_PACKED Qcow2CryptoHeaderExtension;
 
+typedef struct Qcow2CompressionDictHeaderExt {
+    uint64_t offset;
+    uint64_t length;
+} QEMU_PACKED Qcow2CompressionDictHeaderExt;
+
+/* Largest compression dictionary that is accepted */
+#define QCOW2_MAX_COMPRESSION_DICT_SIZE (1 * MiB)
+
+typedef struct Qcow2CompressionDict Qcow2CompressionDict;
+
 typedef struct Qcow2UnknownHeaderExtension {
     uint32_t magic;
     uint32_t len;
@@ -256,17 +282,21 @@ enum {
     QCOW2_INCOMPAT_DATA_FILE_BITNR  = 2,
     QCOW2_INCOMPAT_COMPRESSION_BITNR = 3,
     QCOW2_INCOMPAT_EXTL2_BITNR      = 4,
+    QCOW2_INCOMPAT_COMPRESSION_DICT_BITNR = 5,
     QCOW2_INCOMPAT_DIRTY            = 1 << QCOW2_INCOMPAT_DIRTY_BITNR,
     QCOW2_INCOMPAT_CORRUPT          = 1 << QCOW2_INCOMPAT_CORRUPT_BITNR,
     QCOW2_INCOMPAT_DATA_FILE        = 1 << QCOW2_INCOMPAT_DATA_FILE_BITNR,
     QCOW2_INCOMPAT_COMPRESSION      = 1 << QCOW2_INCOMPAT_COMPRESSION_BITNR,
     QCOW2_INCOMPAT_EXTL2            = 1 << QCOW2_INCOMPAT_EXTL2_BITNR,
+    QCOW2_INCOMPAT_COMPRESSION_DICT =
+        1 << QCOW2_INCOMPAT_COMPRESSION_DICT_BITNR,
 
     QCOW2_INCOMPAT_MASK             = QCOW2_INCOMPAT_DIRTY
                                     | QCOW2_INCOMPAT_CORRUPT
                                     | QCOW2_INCOMPAT_DATA_FILE
                                     | QCOW2_INCOMPAT_COMPRESSION
-                                    | QCOW2_INCOMPAT_EXTL2,
+                                    | QCOW2_INCOMPAT_EXTL2
+                                    | QCOW2_INCOMPAT_COMPRESSION_DICT,
 };
 
 /* Compatible feature bits */
@@ -323,6 +353,26 @@ typedef struct Qcow2BitmapHeaderExt {
 } QEMU_PACKED Qcow2BitmapHeaderExt;
 
 #define QCOW2_MAX_THREADS 4
+/* Upper limit for the compress-threads option */
+#define QCOW2_MAX_COMPRESS_THREADS 64
+
+/* Upper limit for the sequential-prealloc-size option */
+#define QCOW2_MAX_SEQUENTIAL_PREALLOC_SIZE (1 * GiB)
+
+/* Number of sequential write streams that clusters are allocated ahead for */
+#define QCOW2_PREALLOC_STREAMS 4
+
+typedef struct Qcow2PreallocStream {
+    /* Guest offset right after the last allocation of the stream */
+    uint64_t guest_end;
+    /* Clusters allocated ahead that the stream didn't use yet */
+    uint64_t offset;
+    uint64_t bytes;
+    /* How far to allocate ahead the next time */
+    uint64_t window;
+    /* For finding the stream to replace with a new one */
+    uint64_t last_use;
+} Qcow2PreallocStream;
 
 typedef struct BDRVQcow2State {
     int cluster_bits;
@@ -350,6 +400,15 @@ typedef struct BDRVQcow2State {
 
     QLIST_HEAD(, QCowL2Meta) cluster_allocs;
 
+    /*
+     * Write requests whose data is on disk and that wait for their
+     * QCowL2Meta to be linked, see qcow2_co_link_l2meta(). Protected by
+     * link_queue_lock, which may be taken with or without s->lock held.
+     */
+    QSIMPLEQ_HEAD(, Qcow2LinkRequest) link_queue;
+    QemuSpin link_queue_lock;
+    bool link_active;
+
     uint64_t *refcount_table;
     uint64_t refcount_table_offset;
     uint32_t refcount_table_size;
@@ -370,6 +429,19 @@ typedef struct BDRVQcow2State {
     unsigned int nb_snapshots;
     QCowSnapshot *snapshots;
 
+    /*
+     * The clusters of deleted snapshots are freed in the background while
+     * the image is marked dirty, see qcow2_snapshot_free_co_entry().  After
+     * that, the copied flags of the active L1 table are updated starting at
+     * copied_flags_index, unless it is -1.  If that fails, clusters are
+     * leaked and copied flags may be wrong, so snapshot_free_failed keeps
+     * the image dirty until a check repairs it.  Protected by s->lock.
+     */
+    QSIMPLEQ_HEAD(, Qcow2DeletedSnapshot) deleted_snapshots;
+    int copied_flags_index;
+    bool snapshot_free_running;
+    bool snapshot_free_failed;
+
     uint32_t nb_bitmaps;
     uint64_t bitmap_directory_size;
     uint64_t bitmap_directory_offset;
@@ -411,6 +483,31 @@ typedef struct BDRVQcow2State {
     CoQueue thread_task_queue;
     int nb_threads;
 
+    /* Compression runs in up to compress_threads threads at a time */
+    CoQueue compress_task_queue;
+    int nb_compress_threads;
+    int compress_threads;
+
+    /*
+     * Compressed clusters are allocated in the order in which their
+     * writes arrived, whatever order their compression finishes in, so
+     * that a sequential stream of compressed writes stays sequential in
+     * the image file. compress_alloc_ticket is protected by s->lock.
+     */
+    CoQueue compress_alloc_queue;
+    unsigned compress_next_ticket;
+    unsigned compress_alloc_ticket;
+
+    /*
+     * Data writes that continue where an earlier one ended allocate up to
+     * sequential_prealloc_size bytes of clusters ahead, so that the data of
+     * a stream stays contiguous, see qcow2_alloc_data_clusters().  The
+     * streams are protected by s->lock.
+     */
+    uint64_t sequential_prealloc_size;
+    Qcow2PreallocStream prealloc_streams[QCOW2_PREALLOC_STREAMS];
+    uint64_t prealloc_clock;
+
     BdrvChild *data_file;
 
     bool metadata_preallocation_checked;
@@ -422,6 +519,11 @@ typedef struct BDRVQcow2State {
      * is to convert the image with the desired compression type set.
      */
     Qcow2CompressionType compression_type;
+
+    /* Location of the compression dictionary, if the image has one */
+    Qcow2CompressionDictHeaderExt compression_dict_header;
+    /* The loaded dictionary, used for all compressed clusters */
+    Qcow2CompressionDict *compression_dict;
 } BDRVQcow2State;
 
 typedef struct Qcow2COWRegion {
@@ -480,6 +582,12 @@ typedef struct QCowL2Meta
      */
     bool skip_cow;
 
+    /**
+     * Set by qcow2_alloc_cluster_cow() once the COW regions have been
+     * written, so that qcow2_alloc_cluster_link_l2() doesn't repeat it.
+     */
+    bool cow_done;
+
     /**
      * Indicates that this is not a normal write request but a preallocation.
      * If the image has extended L2 entries this means that no new individual
@@ -557,8 +665,9 @@ typedef enum QCow2MetadataOverlap {
     QCOW2_OL_INACTIVE_L1_BITNR      = 6,
     QCOW2_OL_INACTIVE_L2_BITNR      = 7,
     QCOW2_OL_BITMAP_DIRECTORY_BITNR = 8,
+    QCOW2_OL_COMPRESSION_DICT_BITNR = 9,
 
-    QCOW2_OL_MAX_BITNR              = 9,
+    QCOW2_OL_MAX_BITNR              = 10,
 
     QCOW2_OL_NONE             = 0,
     QCOW2_OL_MAIN_HEADER      = (1 << QCOW2_OL_MAIN_HEADER_BITNR),
@@ -572,12 +681,14 @@ typedef enum QCow2MetadataOverlap {
      * reads. */
     QCOW2_OL_INACTIVE_L2      = (1 << QCOW2_OL_INACTIVE_L2_BITNR),
     QCOW2_OL_BITMAP_DIRECTORY = (1 << QCOW2_OL_BITMAP_DIRECTORY_BITNR),
+    QCOW2_OL_COMPRESSION_DICT = (1 << QCOW2_OL_COMPRESSION_DICT_BITNR),
 } QCow2MetadataOverlap;
 
 /* Perform all overlap checks which can be done in constant time */
 #define QCOW2_OL_CONSTANT \
     (QCOW2_OL_MAIN_HEADER | QCOW2_OL_ACTIVE_L1 | QCOW2_OL_REFCOUNT_TABLE | \
-     QCOW2_OL_SNAPSHOT_TABLE | QCOW2_OL_BITMAP_DIRECTORY)
+     QCOW2_OL_SNAPSHOT_TABLE | QCOW2_OL_BITMAP_DIRECTORY | \
+     QCOW2_OL_COMPRESSION_DICT)
 
 /* Perform all overlap checks which don't require disk access */
 #define QCOW2_OL_CACHED \
@@ -835,6 +946,7 @@ int64_t qcow2_refcount_metadata_size(int64_t clusters, size_t cluster_size,
                                      uint64_t *refblock_count);
 
 int GRAPH_RDLOCK qcow2_mark_dirty(BlockDriverState *bs);
+int GRAPH_RDLOCK qcow2_mark_clean(BlockDriverState *bs);
 int GRAPH_RDLOCK qcow2_mark_corrupt(BlockDriverState *bs);
 int GRAPH_RDLOCK qcow2_update_header(BlockDriverState *bs);
 
@@ -874,6 +986,13 @@ qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
                         int64_t nb_clusters);
 
 int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int size);
+int64_t coroutine_fn GRAPH_RDLOCK
+qcow2_alloc_data_clusters(BlockDriverState *bs, uint64_t guest_offset,
+                          uint64_t size);
+int64_t coroutine_fn GRAPH_RDLOCK
+qcow2_alloc_data_clusters_at(BlockDriverState *bs, uint64_t guest_offset,
+                             uint64_t offset, int64_t nb_clusters);
+void GRAPH_RDLOCK qcow2_prealloc_release(BlockDriverState *bs);
 void GRAPH_RDLOCK qcow2_free_clusters(BlockDriverState *bs,
                                       int64_t offset, int64_t size,
                                       enum qcow2_discard_type type);
@@ -884,11 +1003,16 @@ qcow2_free_any_cluster(BlockDriverState *bs, uint64_t l2_entry,
 int GRAPH_RDLOCK
 qcow2_update_snapshot_refcount(BlockDriverState *bs, int64_t l1_table_offset,
                                int l1_size, int addend);
+int GRAPH_RDLOCK
+qcow2_update_snapshot_refcount_range(BlockDriverState *bs, uint64_t *l1_table,
+                                     int start, int end, int addend);
 
 int GRAPH_RDLOCK qcow2_flush_caches(BlockDriverState *bs);
 int GRAPH_RDLOCK qcow2_write_caches(BlockDriverState *bs);
 int coroutine_fn qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
-                                       BdrvCheckMode fix);
+                                       BdrvCheckMode fix,
+                                       BlockDriverCheckStatusCB *status_cb,
+                                       void *cb_opaque);
 
 void GRAPH_RDLOCK qcow2_process_discards(BlockDriverState *bs, int ret);
 
@@ -944,6 +1068,9 @@ void GRAPH_RDLOCK
 qcow2_parse_compressed_l2_entry(BlockDriverState *bs, uint64_t l2_entry,
                                 uint64_t *coffset, int *csize);
 
+int coroutine_fn GRAPH_RDLOCK
+qcow2_alloc_cluster_cow(BlockDriverState *bs, QCowL2Meta *m);
+
 int coroutine_fn GRAPH_RDLOCK
 qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m);
 
@@ -974,6 +1101,13 @@ int GRAPH_RDLOCK
 qcow2_snapshot_delete(BlockDriverState *bs, const char *snapshot_id,
                           const char *name, Error **errp);
 
+void qcow2_snapshot_free_start(BlockDriverState *bs);
+int GRAPH_RDLOCK qcow2_snapshot_free_finish(BlockDriverState *bs);
+
+int GRAPH_RDLOCK
+qcow2_snapshot_attach_vmstate(BlockDriverState *bs, const char *snapshot_id,
+                              uint64_t vm_state_size);
+
 int GRAPH_RDLOCK
 qcow2_snapshot_list(BlockDriverState *bs, QEMUSnapshotInfo **psn_tab);
 
@@ -1021,6 +1155,7 @@ qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
+void qcow2_cache_get_stats(Qcow2Cache *c, Qcow2CacheStats *stats);
 
 /* qcow2-bitmap.c functions */
 int coroutine_fn GRAPH_RDLOCK
@@ -1064,6 +1199,9 @@ qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
 ssize_t coroutine_fn
 qcow2_co_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
                     const void *src, size_t src_size);
+int qcow2_compression_dict_init(BlockDriverState *bs, const void *dict,
+                                size_t size, Error **errp);
+void qcow2_compression_dict_free(BlockDriverState *bs);
 int coroutine_fn
 qcow2_co_encrypt(BlockDriverState *bs, uint64_t host_offset,
                  uint64_t guest_offset, void *buf, size_t len);
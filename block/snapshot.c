@@ -256,6 +256,11 @@ int bdrv_snapshot_goto(BlockDriverState *bs,
 
     if (drv->bdrv_snapshot_goto) {
         ret = drv->bdrv_snapshot_goto(bs, snapshot_id);
+
+        bdrv_graph_rdlock_main_loop();
+        bdrv_chain_map_invalidate(bs);
+        bdrv_graph_rdunlock_main_loop();
+
         if (ret < 0) {
             error_setg_errno(errp, -ret, "Failed to load snapshot");
         }
@@ -478,6 +483,57 @@ int bdrv_snapshot_load_tmp_by_id_or_name(BlockDriverState *bs,
     return ret;
 }
 
+bool bdrv_snapshot_can_attach_vmstate(BlockDriverState *bs)
+{
+    BlockDriver *drv = bs->drv;
+
+    GLOBAL_STATE_CODE();
+
+    if (!drv) {
+        return false;
+    }
+
+    if (!drv->bdrv_snapshot_attach_vmstate) {
+        BlockDriverState *fallback_bs = bdrv_snapshot_fallback(bs);
+        if (fallback_bs) {
+            return bdrv_snapshot_can_attach_vmstate(fallback_bs);
+        }
+        return false;
+    }
+
+    return true;
+}
+
+int bdrv_snapshot_attach_vmstate(BlockDriverState *bs,
+                                 const char *snapshot_id,
+                                 uint64_t vm_state_size)
+{
+    BlockDriver *drv = bs->drv;
+    BlockDriverState *fallback_bs = bdrv_snapshot_fallback(bs);
+    int ret;
+
+    GLOBAL_STATE_CODE();
+
+    if (!drv) {
+        return -ENOMEDIUM;
+    }
+
+    bdrv_drained_begin(bs);
+
+    if (drv->bdrv_snapshot_attach_vmstate) {
+        ret = drv->bdrv_snapshot_attach_vmstate(bs, snapshot_id,
+                                                vm_state_size);
+    } else if (fallback_bs) {
+        ret = bdrv_snapshot_attach_vmstate(fallback_bs, snapshot_id,
+                                           vm_state_size);
+    } else {
+        ret = -ENOTSUP;
+    }
+
+    bdrv_drained_end(bs);
+    return ret;
+}
+
 
 static int GRAPH_RDLOCK
 bdrv_all_get_snapshot_devices(bool has_devices, strList *devices,
@@ -2169,7 +2169,8 @@ fail:
  */
 static int coroutine_fn GRAPH_RDLOCK
 vhdx_co_check(BlockDriverState *bs, BdrvCheckResult *result,
-              BdrvCheckMode fix)
+              BdrvCheckMode fix, BlockDriverCheckStatusCB *status_cb,
+              void *cb_opaque)
 {
     BDRVVHDXState *s = bs->opaque;
 
@@ -1823,3 +1823,189 @@ void AES_decrypt(const unsigned char *in, unsigned char *out,
 }
 
 #endif /* AES_ASM */
+
+/*
+ * The accelerated paths run several independent blocks through each
+ * round, so that the latency of the AES instructions overlaps.  The
+ * lanes are spelled out so that their states stay in vector registers.
+ */
+#define AES_ACCEL_LANES 8
+
+/* Convert a key schedule to the byte order of the AESState round keys */
+static void aes_key_to_state(AESState *rk, const AES_KEY *key)
+{
+    int i;
+
+    for (i = 0; i < 4 * (key->rounds + 1); i++) {
+        rk[i / 4].w[i % 4] = cpu_to_be32(key->rd_key[i]);
+    }
+}
+
+static inline void aes_load_lanes(AESState *s, const uint8_t *in,
+                                  const AESState *rk)
+{
+    memcpy(s, in, AES_ACCEL_LANES * AES_BLOCK_SIZE);
+    s[0].v ^= rk->v;
+    s[1].v ^= rk->v;
+    s[2].v ^= rk->v;
+    s[3].v ^= rk->v;
+    s[4].v ^= rk->v;
+    s[5].v ^= rk->v;
+    s[6].v ^= rk->v;
+    s[7].v ^= rk->v;
+}
+
+static inline void ATTR_AES_ACCEL
+aesenc_lanes_accel(AESState *s, const AESState *rk)
+{
+    aesenc_SB_SR_MC_AK_accel(&s[0], &s[0], rk, false);
+    aesenc_SB_SR_MC_AK_accel(&s[1], &s[1], rk, false);
+    aesenc_SB_SR_MC_AK_accel(&s[2], &s[2], rk, false);
+    aesenc_SB_SR_MC_AK_accel(&s[3], &s[3], rk, false);
+    aesenc_SB_SR_MC_AK_accel(&s[4], &s[4], rk, false);
+    aesenc_SB_SR_MC_AK_accel(&s[5], &s[5], rk, false);
+    aesenc_SB_SR_MC_AK_accel(&s[6], &s[6], rk, false);
+    aesenc_SB_SR_MC_AK_accel(&s[7], &s[7], rk, false);
+}
+
+static inline void ATTR_AES_ACCEL
+aesenc_last_lanes_accel(AESState *s, const AESState *rk)
+{
+    aesenc_SB_SR_AK_accel(&s[0], &s[0], rk, false);
+    aesenc_SB_SR_AK_accel(&s[1], &s[1], rk, false);
+    aesenc_SB_SR_AK_accel(&s[2], &s[2], rk, false);
+    aesenc_SB_SR_AK_accel(&s[3], &s[3], rk, false);
+    aesenc_SB_SR_AK_accel(&s[4], &s[4], rk, false);
+    aesenc_SB_SR_AK_accel(&s[5], &s[5], rk, false);
+    aesenc_SB_SR_AK_accel(&s[6], &s[6], rk, false);
+    aesenc_SB_SR_AK_accel(&s[7], &s[7], rk, false);
+}
+
+static inline void ATTR_AES_ACCEL
+aesdec_lanes_accel(AESState *s, const AESState *rk)
+{
+    aesdec_ISB_ISR_IMC_AK_accel(&s[0], &s[0], rk, false);
+    aesdec_ISB_ISR_IMC_AK_accel(&s[1], &s[1], rk, false);
+    aesdec_ISB_ISR_IMC_AK_accel(&s[2], &s[2], rk, false);
+    aesdec_ISB_ISR_IMC_AK_accel(&s[3], &s[3], rk, false);
+    aesdec_ISB_ISR_IMC_AK_accel(&s[4], &s[4], rk, false);
+    aesdec_ISB_ISR_IMC_AK_accel(&s[5], &s[5], rk, false);
+    aesdec_ISB_ISR_IMC_AK_accel(&s[6], &s[6], rk, false);
+    aesdec_ISB_ISR_IMC_AK_accel(&s[7], &s[7], rk, false);
+}
+
+static inline void ATTR_AES_ACCEL
+aesdec_last_lanes_accel(AESState *s, const AESState *rk)
+{
+    aesdec_ISB_ISR_AK_accel(&s[0], &s[0], rk, false);
+    aesdec_ISB_ISR_AK_accel(&s[1], &s[1], rk, false);
+    aesdec_ISB_ISR_AK_accel(&s[2], &s[2], rk, false);
+    aesdec_ISB_ISR_AK_accel(&s[3], &s[3], rk, false);
+    aesdec_ISB_ISR_AK_accel(&s[4], &s[4], rk, false);
+    aesdec_ISB_ISR_AK_accel(&s[5], &s[5], rk, false);
+    aesdec_ISB_ISR_AK_accel(&s[6], &s[6], rk, false);
+    aesdec_ISB_ISR_AK_accel(&s[7], &s[7], rk, false);
+}
+
+static inline void ATTR_AES_ACCEL
+aes_encrypt_blocks_accel(const uint8_t *in, uint8_t *out, size_t nblocks,
+                         const AESState *rk, int rounds)
+{
+    AESState s[AES_ACCEL_LANES];
+    int r;
+
+    for (; nblocks >= AES_ACCEL_LANES; nblocks -= AES_ACCEL_LANES) {
+        aes_load_lanes(s, in, &rk[0]);
+        for (r = 1; r < rounds; r++) {
+            aesenc_lanes_accel(s, &rk[r]);
+        }
+        aesenc_last_lanes_accel(s, &rk[rounds]);
+        memcpy(out, s, sizeof(s));
+        in += sizeof(s);
+        out += sizeof(s);
+    }
+
+    for (; nblocks; nblocks--) {
+        memcpy(&s[0], in, AES_BLOCK_SIZE);
+        s[0].v ^= rk[0].v;
+        for (r = 1; r < rounds; r++) {
+            aesenc_SB_SR_MC_AK_accel(&s[0], &s[0], &rk[r], false);
+        }
+        aesenc_SB_SR_AK_accel(&s[0], &s[0], &rk[rounds], false);
+        memcpy(out, &s[0], AES_BLOCK_SIZE);
+        in += AES_BLOCK_SIZE;
+        out += AES_BLOCK_SIZE;
+    }
+}
+
+static inline void ATTR_AES_ACCEL
+aes_decrypt_blocks_accel(const uint8_t *in, uint8_t *out, size_t nblocks,
+                         const AESState *rk, int rounds)
+{
+    AESState s[AES_ACCEL_LANES];
+    int r;
+
+    for (; nblocks >= AES_ACCEL_LANES; nblocks -= AES_ACCEL_LANES) {
+        aes_load_lanes(s, in, &rk[0]);
+        for (r = 1; r < rounds; r++) {
+            aesdec_lanes_accel(s, &rk[r]);
+        }
+        aesdec_last_lanes_accel(s, &rk[rounds]);
+        memcpy(out, s, sizeof(s));
+        in += sizeof(s);
+        out += sizeof(s);
+    }
+
+    for (; nblocks; nblocks--) {
+        memcpy(&s[0], in, AES_BLOCK_SIZE);
+        s[0].v ^= rk[0].v;
+        for (r = 1; r < rounds; r++) {
+            aesdec_ISB_ISR_IMC_AK_accel(&s[0], &s[0], &rk[r], false);
+        }
+        aesdec_ISB_ISR_AK_accel(&s[0], &s[0], &rk[rounds], false);
+        memcpy(out, &s[0], AES_BLOCK_SIZE);
+        in += AES_BLOCK_SIZE;
+        out += AES_BLOCK_SIZE;
+    }
+}
+
+void AES_encrypt_blocks(const unsigned char *in, unsigned char *out,
+                        size_t nblocks, const AES_KEY *key)
+{
+    if (HAVE_AES_ACCEL) {
+        AESState rk[AES_MAXNR + 1];
+
+        aes_key_to_state(rk, key);
+        aes_encrypt_blocks_accel(in, out, nblocks, rk, key->rounds);
+        return;
+    }
+
+    while (nblocks--) {
+        AES_encrypt(in, out, key);
+        in += AES_BLOCK_SIZE;
+        out += AES_BLOCK_SIZE;
+    }
+}
+
+void AES_decrypt_blocks(const unsigned char *in, unsigned char *out,
+                        size_t nblocks, const AES_KEY *key)
+{
+    if (HAVE_AES_ACCEL) {
+        AESState rk[AES_MAXNR + 1];
+
+        /*
+         * The decryption schedule has the InvMixColumns already applied
+         * to the inner round keys, as the equivalent inverse cipher of
+         * the AES instructions expects.
+         */
+        aes_key_to_state(rk, key);
+        aes_decrypt_blocks_accel(in, out, nblocks, rk, key->rounds);
+        return;
+    }
+
+    while (nblocks--) {
+        AES_decrypt(in, out, key);
+        in += AES_BLOCK_SIZE;
+        out += AES_BLOCK_SIZE;
+    }
+}
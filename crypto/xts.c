@@ -99,6 +99,66 @@ static inline void xts_tweak_encdec(const void *ctx,
 }
 
 
+/*
+ * Number of blocks whose tweaks are applied ahead of a single call to the
+ * cipher function, which can then process them all at once
+ */
+#define XTS_BATCH_BLOCKS 32
+
+/**
+ * xts_batch_encdec:
+ * @param ctxt: the cipher context
+ * @param func: the cipher function
+ * @src: buffer providing the input text of @nblocks blocks
+ * @dst: buffer to output the output text of @nblocks blocks
+ * @nblocks: the number of XTS_BLOCK_SIZE blocks to process
+ * @iv: the initialization vector tweak of XTS_BLOCK_SIZE bytes
+ *
+ * Encrypt/decrypt data with a tweak, @src and @dst may be the same
+ * buffer and don't need to be aligned
+ */
+static void xts_batch_encdec(const void *ctx,
+                             xts_cipher_func *func,
+                             const uint8_t *src,
+                             uint8_t *dst,
+                             size_t nblocks,
+                             xts_uint128 *iv)
+{
+    xts_uint128 tweak[XTS_BATCH_BLOCKS];
+    xts_uint128 T = *iv;
+    xts_uint128 D;
+    size_t i, n;
+
+    while (nblocks) {
+        n = MIN(nblocks, XTS_BATCH_BLOCKS);
+
+        for (i = 0; i < n; i++) {
+            tweak[i] = T;
+            memcpy(&D, src + i * XTS_BLOCK_SIZE, XTS_BLOCK_SIZE);
+            xts_uint128_xor(&D, &D, &T);
+            memcpy(dst + i * XTS_BLOCK_SIZE, &D, XTS_BLOCK_SIZE);
+
+            /* LFSR the tweak */
+            xts_mult_x(&T);
+        }
+
+        func(ctx, n * XTS_BLOCK_SIZE, dst, dst);
+
+        for (i = 0; i < n; i++) {
+            memcpy(&D, dst + i * XTS_BLOCK_SIZE, XTS_BLOCK_SIZE);
+            xts_uint128_xor(&D, &D, &tweak[i]);
+            memcpy(dst + i * XTS_BLOCK_SIZE, &D, XTS_BLOCK_SIZE);
+        }
+
+        src += n * XTS_BLOCK_SIZE;
+        dst += n * XTS_BLOCK_SIZE;
+        nblocks -= n;
+    }
+
+    *iv = T;
+}
+
+
 void xts_decrypt(const void *datactx,
                  const void *tweakctx,
                  xts_cipher_func *encfunc,
@@ -127,24 +187,9 @@ void xts_decrypt(const void *datactx,
     /* encrypt the iv */
     encfunc(tweakctx, XTS_BLOCK_SIZE, T.b, iv);
 
-    if (QEMU_PTR_IS_ALIGNED(src, sizeof(uint64_t)) &&
-        QEMU_PTR_IS_ALIGNED(dst, sizeof(uint64_t))) {
-        xts_uint128 *S = (xts_uint128 *)src;
-        xts_uint128 *D = (xts_uint128 *)dst;
-        for (i = 0; i < lim; i++, S++, D++) {
-            xts_tweak_encdec(datactx, decfunc, S, D, &T);
-        }
-    } else {
-        xts_uint128 D;
-
-        for (i = 0; i < lim; i++) {
-            memcpy(&D, src, XTS_BLOCK_SIZE);
-            xts_tweak_encdec(datactx, decfunc, &D, &D, &T);
-            memcpy(dst, &D, XTS_BLOCK_SIZE);
-            src += XTS_BLOCK_SIZE;
-            dst += XTS_BLOCK_SIZE;
-        }
-    }
+    xts_batch_encdec(datactx, decfunc, src, dst, lim, &T);
+    src += lim * XTS_BLOCK_SIZE;
+    dst += lim * XTS_BLOCK_SIZE;
 
     /* if length is not a multiple of XTS_BLOCK_SIZE then */
     if (mo > 0) {
@@ -203,25 +248,9 @@ void xts_encrypt(const void *datactx,
     /* encrypt the iv */
     encfunc(tweakctx, XTS_BLOCK_SIZE, T.b, iv);
 
-    if (QEMU_PTR_IS_ALIGNED(src, sizeof(uint64_t)) &&
-        QEMU_PTR_IS_ALIGNED(dst, sizeof(uint64_t))) {
-        xts_uint128 *S = (xts_uint128 *)src;
-        xts_uint128 *D = (xts_uint128 *)dst;
-        for (i = 0; i < lim; i++, S++, D++) {
-            xts_tweak_encdec(datactx, encfunc, S, D, &T);
-        }
-    } else {
-        xts_uint128 D;
-
-        for (i = 0; i < lim; i++) {
-            memcpy(&D, src, XTS_BLOCK_SIZE);
-            xts_tweak_encdec(datactx, encfunc, &D, &D, &T);
-            memcpy(dst, &D, XTS_BLOCK_SIZE);
-
-            dst += XTS_BLOCK_SIZE;
-            src += XTS_BLOCK_SIZE;
-        }
-    }
+    xts_batch_encdec(datactx, encfunc, src, dst, lim, &T);
+    src += lim * XTS_BLOCK_SIZE;
+    dst += lim * XTS_BLOCK_SIZE;
 
     /* if length is not a multiple of XTS_BLOCK_SIZE then */
     if (mo > 0) {
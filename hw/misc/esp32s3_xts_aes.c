@@ -39,7 +39,7 @@ static void xts_aes_encrypt(const void *ctx,
 {
     const struct xts_aes_keys_ctx *aesctx = ctx;
 
-    AES_encrypt(src, dst, &aesctx->enc);
+    AES_encrypt_blocks(src, dst, length / AES_BLOCK_SIZE, &aesctx->enc);
 }
 
 static void xts_aes_decrypt(const void *ctx,
@@ -49,7 +49,7 @@ static void xts_aes_decrypt(const void *ctx,
 {
     const struct xts_aes_keys_ctx *aesctx = ctx;
 
-    AES_decrypt(src, dst, &aesctx->dec);
+    AES_decrypt_blocks(src, dst, length / AES_BLOCK_SIZE, &aesctx->dec);
 }
 
 static bool esp32s3_xts_aes_is_ciphertext_spi_visible(ESP32S3XtsAesState *s)
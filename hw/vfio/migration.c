@@ -12,6 +12,8 @@
 #include "qemu/cutils.h"
 #include "qemu/units.h"
 #include "qemu/error-report.h"
+#include "qemu/lockable.h"
+#include "qemu/stats64.h"
 #include <linux/vfio.h>
 #include <sys/ioctl.h>
 
@@ -46,6 +48,7 @@
 #define VFIO_MIG_FLAG_DEV_SETUP_STATE   (0xffffffffef100003ULL)
 #define VFIO_MIG_FLAG_DEV_DATA_STATE    (0xffffffffef100004ULL)
 #define VFIO_MIG_FLAG_DEV_INIT_DATA_SENT (0xffffffffef100005ULL)
+#define VFIO_MIG_FLAG_DEV_MULTIFD_STATE (0xffffffffef100006ULL)
 
 /*
  * This is an arbitrary size based on migration of mlx5 devices, where typically
@@ -54,7 +57,53 @@
  */
 #define VFIO_MIG_DEFAULT_DATA_BUFFER_SIZE (1 * MiB)
 
-static int64_t bytes_transferred;
+/*
+ * With x-migration-multifd-transfer, the stop-copy device state is sent
+ * through multifd channels as a sequence of these packets, the last one
+ * carrying VFIO_DEVICE_STATE_PACKET_FLAG_END and no data.  The packets can
+ * arrive in any order, @idx tells where each one goes.
+ */
+#define VFIO_DEVICE_STATE_PACKET_VER_CURRENT 0
+#define VFIO_DEVICE_STATE_PACKET_FLAG_END (1 << 0)
+
+typedef struct VFIODeviceStatePacket {
+    uint32_t version;
+    uint32_t idx;
+    uint32_t flags;
+    uint8_t data[];
+} QEMU_PACKED VFIODeviceStatePacket;
+
+/*
+ * Upper bound on how far ahead of the device the received packets may be,
+ * and so on the size of the array holding them.  The data they carry is
+ * limited separately by x-migration-max-queued-size.
+ */
+#define VFIO_MULTIFD_MAX_QUEUED_PACKETS 4096
+
+typedef struct VFIOStateBuffer {
+    bool is_present;
+    VFIODeviceStatePacket *packet;
+    size_t len;
+} VFIOStateBuffer;
+
+struct VFIOMultifd {
+    QemuThread load_bufs_thread;
+    QemuMutex load_bufs_mutex;
+    QemuCond load_bufs_cond;
+    /* VFIOStateBuffer entries, indexed by packet idx */
+    GArray *load_bufs;
+    /* next packet to write to the device */
+    uint32_t load_buf_idx;
+    /* bytes received but not yet written to the device */
+    uint64_t load_bufs_queued_size;
+    /* the main stream data preceding the packets has been loaded */
+    bool load_bufs_allowed;
+    bool load_bufs_exit;
+    bool load_bufs_done;
+    int load_bufs_ret;
+};
+
+static Stat64 bytes_transferred;
 
 static const char *mig_state_to_str(enum vfio_device_mig_state state)
 {
@@ -305,7 +354,7 @@ static ssize_t vfio_save_block(QEMUFile *f, VFIOMigration *migration)
     qemu_put_be64(f, VFIO_MIG_FLAG_DEV_DATA_STATE);
     qemu_put_be64(f, data_size);
     qemu_put_buffer(f, migration->data_buffer, data_size);
-    bytes_transferred += data_size;
+    stat64_add(&bytes_transferred, data_size);
 
     trace_vfio_save_block(migration->vbasedev->name, data_size);
 
@@ -344,6 +393,157 @@ static bool vfio_precopy_supported(VFIODevice *vbasedev)
     return migration->mig_flags & VFIO_MIGRATION_PRE_COPY;
 }
 
+static bool vfio_multifd_transfer_enabled(VFIODevice *vbasedev)
+{
+    return vbasedev->migration_multifd_transfer &&
+           multifd_device_state_supported();
+}
+
+static void vfio_state_buffer_clear(gpointer data)
+{
+    VFIOStateBuffer *lb = data;
+
+    g_free(lb->packet);
+    lb->packet = NULL;
+}
+
+/*
+ * Destination side: write the packets received through multifd to the
+ * device in order, as soon as the main stream says it's safe to do so and
+ * the device set in x-migration-load-after is done.
+ */
+static void *vfio_load_bufs_thread(void *opaque)
+{
+    VFIODevice *vbasedev = opaque;
+    VFIOMigration *migration = vbasedev->migration;
+    VFIOMultifd *multifd = migration->multifd;
+    int ret;
+
+    /* The devices this one must be loaded after go first */
+    ret = qemu_loadvm_state_buffers_wait_deps(vbasedev);
+
+    qemu_mutex_lock(&multifd->load_bufs_mutex);
+    while (!ret) {
+        VFIOStateBuffer *lb = NULL;
+        VFIODeviceStatePacket *packet;
+        size_t data_size;
+        uint32_t flags;
+
+        while (!multifd->load_bufs_exit) {
+            if (multifd->load_bufs_allowed &&
+                multifd->load_buf_idx < multifd->load_bufs->len) {
+                lb = &g_array_index(multifd->load_bufs, VFIOStateBuffer,
+                                    multifd->load_buf_idx);
+                if (lb->is_present) {
+                    break;
+                }
+            }
+            qemu_cond_wait(&multifd->load_bufs_cond,
+                           &multifd->load_bufs_mutex);
+        }
+
+        if (multifd->load_bufs_exit) {
+            ret = -ECANCELED;
+            break;
+        }
+
+        packet = lb->packet;
+        data_size = lb->len - sizeof(*packet);
+        lb->packet = NULL;
+        multifd->load_bufs_queued_size -= lb->len;
+        multifd->load_buf_idx++;
+        qemu_mutex_unlock(&multifd->load_bufs_mutex);
+
+        flags = be32_to_cpu(packet->flags);
+        if (data_size &&
+            qemu_write_full(migration->data_fd, packet->data,
+                            data_size) != data_size) {
+            ret = -errno;
+        }
+        trace_vfio_load_bufs_thread_write(vbasedev->name,
+                                          be32_to_cpu(packet->idx),
+                                          data_size, ret);
+        g_free(packet);
+
+        qemu_mutex_lock(&multifd->load_bufs_mutex);
+        if (ret || flags & VFIO_DEVICE_STATE_PACKET_FLAG_END) {
+            break;
+        }
+    }
+
+    multifd->load_bufs_ret = ret;
+    multifd->load_bufs_done = true;
+    qemu_cond_broadcast(&multifd->load_bufs_cond);
+    qemu_mutex_unlock(&multifd->load_bufs_mutex);
+
+    qemu_loadvm_state_buffers_done(vbasedev, ret);
+
+    return NULL;
+}
+
+static void vfio_multifd_load_setup(VFIODevice *vbasedev)
+{
+    VFIOMultifd *multifd = g_new0(VFIOMultifd, 1);
+
+    qemu_mutex_init(&multifd->load_bufs_mutex);
+    qemu_cond_init(&multifd->load_bufs_cond);
+    multifd->load_bufs = g_array_new(false, true, sizeof(VFIOStateBuffer));
+    g_array_set_clear_func(multifd->load_bufs, vfio_state_buffer_clear);
+    vbasedev->migration->multifd = multifd;
+
+    qemu_thread_create(&multifd->load_bufs_thread, "vfio/load",
+                       vfio_load_bufs_thread, vbasedev, QEMU_THREAD_JOINABLE);
+}
+
+static void vfio_multifd_load_cleanup(VFIODevice *vbasedev)
+{
+    VFIOMultifd *multifd = vbasedev->migration->multifd;
+
+    WITH_QEMU_LOCK_GUARD(&multifd->load_bufs_mutex) {
+        multifd->load_bufs_exit = true;
+        qemu_cond_broadcast(&multifd->load_bufs_cond);
+    }
+    qemu_thread_join(&multifd->load_bufs_thread);
+
+    g_array_unref(multifd->load_bufs);
+    qemu_cond_destroy(&multifd->load_bufs_cond);
+    qemu_mutex_destroy(&multifd->load_bufs_mutex);
+    g_free(multifd);
+    vbasedev->migration->multifd = NULL;
+}
+
+/* Wait until all the packets have been written to the device */
+static int vfio_multifd_load_wait(VFIODevice *vbasedev)
+{
+    VFIOMultifd *multifd = vbasedev->migration->multifd;
+
+    QEMU_LOCK_GUARD(&multifd->load_bufs_mutex);
+    if (!multifd->load_bufs_allowed) {
+        /*
+         * The source didn't say it sent the device state through multifd,
+         * so no END packet may ever come.  Packets without that marker
+         * mean the stream is inconsistent.
+         */
+        if (multifd->load_bufs->len) {
+            error_report("%s: Received multifd device state without the "
+                         "main stream marker", vbasedev->name);
+            return -EINVAL;
+        }
+        return 0;
+    }
+
+    while (!multifd->load_bufs_done) {
+        qemu_cond_wait(&multifd->load_bufs_cond, &multifd->load_bufs_mutex);
+    }
+
+    if (multifd->load_bufs_ret) {
+        error_report("%s: Failed loading multifd device state, err: %s",
+                     vbasedev->name, strerror(-multifd->load_bufs_ret));
+    }
+
+    return multifd->load_bufs_ret;
+}
+
 /* ---------------------------------------------------------------------- */
 
 static int vfio_save_prepare(void *opaque, Error **errp)
@@ -384,6 +584,7 @@ static int vfio_save_setup(QEMUFile *f, void *opaque)
 
     qemu_put_be64(f, VFIO_MIG_FLAG_DEV_SETUP_STATE);
 
+    migration->multifd_transfer = vfio_multifd_transfer_enabled(vbasedev);
     vfio_query_stop_copy_size(vbasedev, &stop_copy_size);
     migration->data_buffer_size = MIN(VFIO_MIG_DEFAULT_DATA_BUFFER_SIZE,
                                       stop_copy_size);
@@ -542,6 +743,17 @@ static int vfio_save_complete_precopy(QEMUFile *f, void *opaque)
     ssize_t data_size;
     int ret;
 
+    if (vbasedev->migration->multifd_transfer) {
+        /*
+         * The stop-copy data goes through multifd, from
+         * vfio_save_complete_precopy_thread().  Just tell the destination
+         * it can start loading it.
+         */
+        qemu_put_be64(f, VFIO_MIG_FLAG_DEV_MULTIFD_STATE);
+        qemu_put_be64(f, VFIO_MIG_FLAG_END_OF_STATE);
+        return qemu_file_get_error(f);
+    }
+
     /* We reach here with device state STOP or STOP_COPY only */
     ret = vfio_migration_set_state(vbasedev, VFIO_DEVICE_STATE_STOP_COPY,
                                    VFIO_DEVICE_STATE_STOP);
@@ -567,6 +779,78 @@ static int vfio_save_complete_precopy(QEMUFile *f, void *opaque)
     return ret;
 }
 
+static int vfio_save_complete_precopy_thread(const char *idstr,
+                                             uint32_t instance_id,
+                                             void *opaque, Error **errp)
+{
+    VFIODevice *vbasedev = opaque;
+    VFIOMigration *migration = vbasedev->migration;
+    VFIODeviceStatePacket *packet;
+    uint32_t idx = 0;
+    int ret;
+
+    if (!migration->multifd_transfer) {
+        return 0;
+    }
+
+    /* We reach here with device state STOP or STOP_COPY only */
+    ret = vfio_migration_set_state(vbasedev, VFIO_DEVICE_STATE_STOP_COPY,
+                                   VFIO_DEVICE_STATE_STOP);
+    if (ret) {
+        error_setg_errno(errp, -ret, "%s: Failed to enter STOP_COPY",
+                         vbasedev->name);
+        return ret;
+    }
+
+    while (true) {
+        ssize_t data_size;
+
+        packet = g_malloc(sizeof(*packet) + migration->data_buffer_size);
+        data_size = read(migration->data_fd, packet->data,
+                         migration->data_buffer_size);
+        if (data_size < 0) {
+            ret = -errno;
+            g_free(packet);
+            error_setg_errno(errp, -ret, "%s: Failed reading device state",
+                             vbasedev->name);
+            return ret;
+        }
+        if (data_size == 0) {
+            g_free(packet);
+            break;
+        }
+
+        packet->version = cpu_to_be32(VFIO_DEVICE_STATE_PACKET_VER_CURRENT);
+        packet->idx = cpu_to_be32(idx);
+        packet->flags = 0;
+        if (!multifd_queue_device_state(idstr, instance_id, (char *)packet,
+                                        sizeof(*packet) + data_size)) {
+            error_setg(errp, "%s: Failed queuing device state",
+                       vbasedev->name);
+            return -EIO;
+        }
+
+        stat64_add(&bytes_transferred, data_size);
+        trace_vfio_save_complete_precopy_thread_block(vbasedev->name, idx,
+                                                      data_size);
+        idx++;
+    }
+
+    packet = g_new0(VFIODeviceStatePacket, 1);
+    packet->version = cpu_to_be32(VFIO_DEVICE_STATE_PACKET_VER_CURRENT);
+    packet->idx = cpu_to_be32(idx);
+    packet->flags = cpu_to_be32(VFIO_DEVICE_STATE_PACKET_FLAG_END);
+    if (!multifd_queue_device_state(idstr, instance_id, (char *)packet,
+                                    sizeof(*packet))) {
+        error_setg(errp, "%s: Failed queuing device state", vbasedev->name);
+        return -EIO;
+    }
+
+    trace_vfio_save_complete_precopy_thread(vbasedev->name, idx);
+
+    return 0;
+}
+
 static void vfio_save_state(QEMUFile *f, void *opaque)
 {
     VFIODevice *vbasedev = opaque;
@@ -583,15 +867,30 @@ static void vfio_save_state(QEMUFile *f, void *opaque)
 static int vfio_load_setup(QEMUFile *f, void *opaque)
 {
     VFIODevice *vbasedev = opaque;
+    VFIOMigration *migration = vbasedev->migration;
+    int ret;
 
-    return vfio_migration_set_state(vbasedev, VFIO_DEVICE_STATE_RESUMING,
-                                   vbasedev->migration->device_state);
+    ret = vfio_migration_set_state(vbasedev, VFIO_DEVICE_STATE_RESUMING,
+                                   migration->device_state);
+    if (ret) {
+        return ret;
+    }
+
+    migration->multifd_transfer = vfio_multifd_transfer_enabled(vbasedev);
+    if (migration->multifd_transfer) {
+        vfio_multifd_load_setup(vbasedev);
+    }
+
+    return 0;
 }
 
 static int vfio_load_cleanup(void *opaque)
 {
     VFIODevice *vbasedev = opaque;
 
+    if (vbasedev->migration->multifd) {
+        vfio_multifd_load_cleanup(vbasedev);
+    }
     vfio_migration_cleanup(vbasedev);
     trace_vfio_load_cleanup(vbasedev->name);
 
@@ -612,6 +911,13 @@ static int vfio_load_state(QEMUFile *f, void *opaque, int version_id)
         switch (data) {
         case VFIO_MIG_FLAG_DEV_CONFIG_STATE:
         {
+            /* The config must be loaded on top of the device state */
+            if (vbasedev->migration->multifd) {
+                ret = vfio_multifd_load_wait(vbasedev);
+                if (ret) {
+                    return ret;
+                }
+            }
             return vfio_load_device_config_state(f, opaque);
         }
         case VFIO_MIG_FLAG_DEV_SETUP_STATE:
@@ -638,6 +944,23 @@ static int vfio_load_state(QEMUFile *f, void *opaque, int version_id)
             }
             break;
         }
+        case VFIO_MIG_FLAG_DEV_MULTIFD_STATE:
+        {
+            VFIOMultifd *multifd = vbasedev->migration->multifd;
+
+            if (!multifd) {
+                error_report("%s: Received multifd device state but "
+                             "x-migration-multifd-transfer is off",
+                             vbasedev->name);
+                return -EINVAL;
+            }
+
+            WITH_QEMU_LOCK_GUARD(&multifd->load_bufs_mutex) {
+                multifd->load_bufs_allowed = true;
+                qemu_cond_signal(&multifd->load_bufs_cond);
+            }
+            break;
+        }
         case VFIO_MIG_FLAG_DEV_INIT_DATA_SENT:
         {
             if (!vfio_precopy_supported(vbasedev) ||
@@ -670,6 +993,94 @@ static int vfio_load_state(QEMUFile *f, void *opaque, int version_id)
     return ret;
 }
 
+static int vfio_load_state_buffer(void *opaque, char *buf, size_t len,
+                                  Error **errp)
+{
+    VFIODevice *vbasedev = opaque;
+    VFIOMultifd *multifd = vbasedev->migration->multifd;
+    VFIODeviceStatePacket *packet = (VFIODeviceStatePacket *)buf;
+    VFIOStateBuffer *lb;
+    uint32_t idx;
+
+    if (!multifd) {
+        error_setg(errp, "%s: Received multifd device state but "
+                   "x-migration-multifd-transfer is off", vbasedev->name);
+        goto err;
+    }
+
+    if (len < sizeof(*packet) ||
+        be32_to_cpu(packet->version) != VFIO_DEVICE_STATE_PACKET_VER_CURRENT) {
+        error_setg(errp, "%s: Invalid device state packet", vbasedev->name);
+        goto err;
+    }
+
+    idx = be32_to_cpu(packet->idx);
+    trace_vfio_load_state_buffer(vbasedev->name, idx, len);
+
+    qemu_mutex_lock(&multifd->load_bufs_mutex);
+
+    if (idx < multifd->load_buf_idx ||
+        idx - multifd->load_buf_idx >= VFIO_MULTIFD_MAX_QUEUED_PACKETS) {
+        error_setg(errp, "%s: Unexpected device state packet %"PRIu32,
+                   vbasedev->name, idx);
+        goto err_unlock;
+    }
+
+    if (idx >= multifd->load_bufs->len) {
+        g_array_set_size(multifd->load_bufs, idx + 1);
+    }
+
+    lb = &g_array_index(multifd->load_bufs, VFIOStateBuffer, idx);
+    if (lb->is_present) {
+        error_setg(errp, "%s: Duplicate device state packet %"PRIu32,
+                   vbasedev->name, idx);
+        goto err_unlock;
+    }
+
+    /*
+     * Packets pile up until the main stream allows loading them and while
+     * an earlier one is missing.  Waiting for room would stall the channel
+     * and the RAM behind it, which may be what unblocks the device, so
+     * fail instead of queuing without bound.
+     */
+    if (multifd->load_bufs_queued_size + len >
+        vbasedev->migration_max_queued_size) {
+        error_setg(errp, "%s: More than %"PRIu64" bytes of device state "
+                   "queued, raise x-migration-max-queued-size",
+                   vbasedev->name, vbasedev->migration_max_queued_size);
+        goto err_unlock;
+    }
+
+    lb->is_present = true;
+    lb->packet = packet;
+    lb->len = len;
+    multifd->load_bufs_queued_size += len;
+    qemu_cond_signal(&multifd->load_bufs_cond);
+    qemu_mutex_unlock(&multifd->load_bufs_mutex);
+
+    return 0;
+
+err_unlock:
+    qemu_mutex_unlock(&multifd->load_bufs_mutex);
+err:
+    g_free(buf);
+    return -EINVAL;
+}
+
+static bool vfio_load_state_buffer_depends(void *opaque,
+                                           const SaveVMHandlers *other_ops,
+                                           void *other_opaque)
+{
+    VFIODevice *vbasedev = opaque;
+    VFIODevice *other = other_opaque;
+
+    /* Only a device that sends its state through multifd will be done */
+    return other_ops->load_state_buffer == vfio_load_state_buffer &&
+           vbasedev->migration_load_after &&
+           vbasedev->migration_load_after == other->dev &&
+           other->migration->multifd;
+}
+
 static bool vfio_switchover_ack_needed(void *opaque)
 {
     VFIODevice *vbasedev = opaque;
@@ -686,10 +1097,13 @@ static const SaveVMHandlers savevm_vfio_handlers = {
     .is_active_iterate = vfio_is_active_iterate,
     .save_live_iterate = vfio_save_iterate,
     .save_live_complete_precopy = vfio_save_complete_precopy,
+    .save_live_complete_precopy_thread = vfio_save_complete_precopy_thread,
     .save_state = vfio_save_state,
     .load_setup = vfio_load_setup,
     .load_cleanup = vfio_load_cleanup,
     .load_state = vfio_load_state,
+    .load_state_buffer = vfio_load_state_buffer,
+    .load_state_buffer_depends = vfio_load_state_buffer_depends,
     .switchover_ack_needed = vfio_switchover_ack_needed,
 };
 
@@ -892,12 +1306,12 @@ static int vfio_block_migration(VFIODevice *vbasedev, Error *err, Error **errp)
 
 int64_t vfio_mig_bytes_transferred(void)
 {
-    return bytes_transferred;
+    return stat64_get(&bytes_transferred);
 }
 
 void vfio_reset_bytes_transferred(void)
 {
-    bytes_transferred = 0;
+    stat64_set(&bytes_transferred, 0);
 }
 
 /*
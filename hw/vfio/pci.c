@@ -3362,6 +3362,14 @@ static Property vfio_pci_dev_properties[] = {
                     VFIO_FEATURE_ENABLE_IGD_OPREGION_BIT, false),
     DEFINE_PROP_ON_OFF_AUTO("enable-migration", VFIOPCIDevice,
                             vbasedev.enable_migration, ON_OFF_AUTO_AUTO),
+    DEFINE_PROP_BOOL("x-migration-multifd-transfer", VFIOPCIDevice,
+                     vbasedev.migration_multifd_transfer, false),
+    DEFINE_PROP_LINK("x-migration-load-after", VFIOPCIDevice,
+                     vbasedev.migration_load_after, TYPE_DEVICE,
+                     DeviceState *),
+    DEFINE_PROP_SIZE("x-migration-max-queued-size", VFIOPCIDevice,
+                     vbasedev.migration_max_queued_size,
+                     VFIO_MIG_DEFAULT_MAX_QUEUED_SIZE),
     DEFINE_PROP_BOOL("x-no-mmap", VFIOPCIDevice, vbasedev.no_mmap, false),
     DEFINE_PROP_BOOL("x-balloon-allowed", VFIOPCIDevice,
                      vbasedev.ram_block_discard_allowed, false),
@@ -57,6 +57,16 @@ struct ThreadPool;
 struct LinuxAioState;
 typedef struct LuringState LuringState;
 
+/* The io_uring instances for block I/O that an AioContext can have */
+typedef enum {
+    LURING_RING_DEFAULT,
+    /* Requests are submitted by a kernel thread that polls the ring */
+    LURING_RING_SQPOLL,
+    /* Completions are polled from the device, only for O_DIRECT I/O */
+    LURING_RING_IOPOLL,
+    LURING_RING__MAX,
+} LuringRingType;
+
 /* Is polling disabled? */
 bool aio_poll_disabled(AioContext *ctx);
 
@@ -212,7 +222,7 @@ struct AioContext {
     struct LinuxAioState *linux_aio;
 #endif
 #ifdef CONFIG_LINUX_IO_URING
-    LuringState *linux_io_uring;
+    LuringState *linux_io_uring[LURING_RING__MAX];
 
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
@@ -508,11 +518,12 @@ struct LinuxAioState *aio_setup_linux_aio(AioContext *ctx, Error **errp);
 /* Return the LinuxAioState bound to this AioContext */
 struct LinuxAioState *aio_get_linux_aio(AioContext *ctx);
 
-/* Setup the LuringState bound to this AioContext */
-LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
+/* Setup the LuringState of type @type bound to this AioContext */
+LuringState *aio_setup_linux_io_uring(AioContext *ctx, LuringRingType type,
+                                      Error **errp);
 
-/* Return the LuringState bound to this AioContext */
-LuringState *aio_get_linux_io_uring(AioContext *ctx);
+/* Return the LuringState of type @type bound to this AioContext */
+LuringState *aio_get_linux_io_uring(AioContext *ctx, LuringRingType type);
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
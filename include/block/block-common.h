@@ -155,6 +155,7 @@ typedef struct BlockFragInfo {
     uint64_t total_clusters;
     uint64_t fragmented_clusters;
     uint64_t compressed_clusters;
+    uint64_t extents;
 } BlockFragInfo;
 
 typedef enum {
@@ -524,6 +525,9 @@ typedef enum {
     BDRV_FIX_ERRORS   = 2,
 } BdrvCheckMode;
 
+typedef void BlockDriverCheckStatusCB(BlockDriverState *bs, int64_t done,
+                                      int64_t total_work_size, void *opaque);
+
 typedef struct BlockSizes {
     uint32_t phys;
     uint32_t log;
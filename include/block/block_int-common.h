@@ -28,6 +28,7 @@
 #include "block/block-common.h"
 #include "block/block-global-state.h"
 #include "block/snapshot.h"
+#include "qemu/interval-tree.h"
 #include "qemu/iov.h"
 #include "qemu/rcu.h"
 #include "qemu/stats64.h"
@@ -56,6 +57,7 @@
 #define BLOCK_OPT_DATA_FILE         "data_file"
 #define BLOCK_OPT_DATA_FILE_RAW     "data_file_raw"
 #define BLOCK_OPT_COMPRESSION_TYPE  "compression_type"
+#define BLOCK_OPT_COMPRESSION_DICT  "compression_dictionary"
 #define BLOCK_OPT_EXTL2             "extended_l2"
 
 #define BLOCK_PROBE_BUF_SIZE        512
@@ -331,6 +333,15 @@ struct BlockDriver {
         BlockDriverState *bs, const char *snapshot_id, const char *name,
         Error **errp);
 
+    /*
+     * Move the VM state written with bdrv_writev_vmstate() into an existing
+     * snapshot, for live snapshots whose VM state is saved after the disk
+     * state was captured.
+     */
+    int GRAPH_RDLOCK_PTR (*bdrv_snapshot_attach_vmstate)(
+        BlockDriverState *bs, const char *snapshot_id,
+        uint64_t vm_state_size);
+
     int coroutine_fn GRAPH_RDLOCK_PTR (*bdrv_co_change_backing_file)(
         BlockDriverState *bs, const char *backing_file,
         const char *backing_fmt);
@@ -768,10 +779,13 @@ struct BlockDriver {
 
     /*
      * Returns 0 for completed check, -errno for internal errors.
-     * The check results are stored in result.
+     * The check results are stored in result.  Drivers may call
+     * @status_cb from time to time to report how far the check went;
+     * @status_cb may be NULL.
      */
     int coroutine_fn GRAPH_RDLOCK_PTR (*bdrv_co_check)(
-        BlockDriverState *bs, BdrvCheckResult *result, BdrvCheckMode fix);
+        BlockDriverState *bs, BdrvCheckResult *result, BdrvCheckMode fix,
+        BlockDriverCheckStatusCB *status_cb, void *cb_opaque);
 
     void coroutine_fn GRAPH_RDLOCK_PTR (*bdrv_co_debug_event)(
         BlockDriverState *bs, BlkdebugEvent event);
@@ -1069,6 +1083,31 @@ typedef struct BdrvBlockStatusCache {
     int64_t data_end;
 } BdrvBlockStatusCache;
 
+/*
+ * Remembers for which ranges the first layers of the backing chain of a
+ * node, starting with the node itself, do not allocate the data, so that
+ * bdrv_co_common_block_status_above() can go straight to the first layer
+ * that may own it instead of asking every layer in turn.
+ *
+ * @lock: Protects the fields below
+ * @extents: Non-overlapping ranges, see block/chain-map.c
+ * @nb_extents: Number of ranges in @extents
+ * @gen: Incremented whenever ranges are invalidated, so that information
+ *       that was gathered before cannot be added afterwards
+ * @graph_gen: bdrv_graph_generation() when the ranges were added
+ * @active: Whether the map has ranges or a lookup may be about to add some.
+ *          Invalidation skips maps that are not active without taking @lock.
+ *          Written under @lock, read atomically.
+ */
+typedef struct BdrvChainMap {
+    QemuMutex lock;
+    IntervalTreeRoot extents;
+    unsigned int nb_extents;
+    uint64_t gen;
+    uint64_t graph_gen;
+    bool active;
+} BdrvChainMap;
+
 struct BlockDriverState {
     /*
      * Protected by big QEMU lock or read-only after opening.  No special
@@ -1255,6 +1294,9 @@ struct BlockDriverState {
     /* Always non-NULL, but must only be dereferenced under an RCU read guard */
     BdrvBlockStatusCache *block_status_cache;
 
+    /* Which layers of the backing chain don't allocate which ranges */
+    BdrvChainMap chain_map;
+
     /* array of write pointers' location of each zone in the zoned device. */
     BlockZoneWps *wps;
 };
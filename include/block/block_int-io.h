@@ -191,4 +191,42 @@ void bdrv_bsc_invalidate_range(BlockDriverState *bs,
  */
 void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes);
 
+void bdrv_chain_map_init(BlockDriverState *bs);
+void bdrv_chain_map_cleanup(BlockDriverState *bs);
+
+/**
+ * Return how many layers of the backing chain of @bs, starting with @bs
+ * itself, are known not to allocate the data at @offset, and limit
+ * *@bytes to the range for which this is true.  Returns 0 and leaves
+ * *@bytes alone if nothing is known.
+ *
+ * *@gen is set to the value to pass to bdrv_chain_map_fill() for the
+ * result of the block status query that follows.
+ */
+int GRAPH_RDLOCK bdrv_chain_map_lookup(BlockDriverState *bs, int64_t offset,
+                                       int64_t *bytes, uint64_t *gen);
+
+/**
+ * Record that the first @skip layers of the backing chain of @bs do not
+ * allocate [offset, offset + bytes).  Nothing is recorded if the map was
+ * invalidated since the bdrv_chain_map_lookup() call that returned @gen.
+ */
+void GRAPH_RDLOCK bdrv_chain_map_fill(BlockDriverState *bs, int64_t offset,
+                                      int64_t bytes, int skip, uint64_t gen);
+
+/**
+ * Forget what is known about [offset, offset + bytes) in the map of @bs
+ * and in those of all nodes that have @bs in their backing chain.
+ *
+ * To be used by all paths that may allocate data in @bs.
+ */
+void GRAPH_RDLOCK bdrv_chain_map_invalidate_range(BlockDriverState *bs,
+                                                  int64_t offset,
+                                                  int64_t bytes);
+
+/**
+ * Like bdrv_chain_map_invalidate_range(), for the whole node.
+ */
+void GRAPH_RDLOCK bdrv_chain_map_invalidate(BlockDriverState *bs);
+
 #endif /* BLOCK_INT_IO_H */
@@ -122,6 +122,15 @@ bdrv_graph_wrlock(void);
 void no_coroutine_fn TSA_RELEASE(graph_lock) TSA_NO_TSA
 bdrv_graph_wrunlock(void);
 
+/*
+ * bdrv_graph_generation:
+ * Return a counter that is incremented every time the writer lock is
+ * taken. While the caller holds the reader lock, the graph can't change
+ * and neither does the counter, so comparing it with a value read earlier
+ * tells whether the graph may have changed in between.
+ */
+uint64_t GRAPH_RDLOCK bdrv_graph_generation(void);
+
 /*
  * bdrv_graph_co_rdlock:
  * Read the bs graph. This usually means traversing all nodes in
@@ -65,12 +65,32 @@ void laio_attach_aio_context(LinuxAioState *s, AioContext *new_context);
 #endif
 /* io_uring.c - Linux io_uring implementation */
 #ifdef CONFIG_LINUX_IO_URING
-LuringState *luring_init(Error **errp);
+LuringState *luring_init(LuringRingType type, Error **errp);
 void luring_cleanup(LuringState *s);
 
-/* luring_co_submit: submit I/O requests in the thread's current AioContext. */
-int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
+/*
+ * luring_co_submit: submit I/O requests in the thread's current AioContext,
+ * using its ring of type @ring. @file_index is the fixed file slot returned
+ * by luring_register_file() for @fd, or -1.
+ */
+int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringRingType ring,
+                                  int fd, int file_index, uint64_t offset,
                                   QEMUIOVector *qiov, int type);
+
+/*
+ * luring_register_file: register @fd with all rings, so that requests skip
+ * the lookup of the file. Returns the fixed file slot, or -ENOSPC.
+ */
+int luring_register_file(int fd);
+void luring_unregister_file(int index);
+
+/*
+ * luring_register_buf: register memory with the rings that do I/O on it,
+ * so that requests on a single buffer inside it skip the mapping of its
+ * pages.  Fails if it would take more than the kernel limit of buffers.
+ */
+bool luring_register_buf(void *host, size_t size, Error **errp);
+void luring_unregister_buf(void *host, size_t size);
 void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
 #endif
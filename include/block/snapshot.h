@@ -83,6 +83,11 @@ int bdrv_snapshot_load_tmp_by_id_or_name(BlockDriverState *bs,
                                          const char *id_or_name,
                                          Error **errp);
 
+bool GRAPH_RDLOCK bdrv_snapshot_can_attach_vmstate(BlockDriverState *bs);
+int GRAPH_RDLOCK
+bdrv_snapshot_attach_vmstate(BlockDriverState *bs, const char *snapshot_id,
+                             uint64_t vm_state_size);
+
 
 /*
  * Group operations. All block drivers are involved.
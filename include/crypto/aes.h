@@ -16,6 +16,8 @@ typedef struct aes_key_st AES_KEY;
 #define AES_set_decrypt_key QEMU_AES_set_decrypt_key
 #define AES_encrypt QEMU_AES_encrypt
 #define AES_decrypt QEMU_AES_decrypt
+#define AES_encrypt_blocks QEMU_AES_encrypt_blocks
+#define AES_decrypt_blocks QEMU_AES_decrypt_blocks
 
 int AES_set_encrypt_key(const unsigned char *userKey, const int bits,
                         AES_KEY *key);
@@ -27,6 +29,16 @@ void AES_encrypt(const unsigned char *in, unsigned char *out,
 void AES_decrypt(const unsigned char *in, unsigned char *out,
                  const AES_KEY *key);
 
+/*
+ * Encrypt/decrypt @nblocks consecutive blocks independently of each other,
+ * using the AES instructions of the host when available.
+ * in and out can be the same buffer, but must not overlap otherwise.
+ */
+void AES_encrypt_blocks(const unsigned char *in, unsigned char *out,
+                        size_t nblocks, const AES_KEY *key);
+void AES_decrypt_blocks(const unsigned char *in, unsigned char *out,
+                        size_t nblocks, const AES_KEY *key);
+
 extern const uint8_t AES_sbox[256];
 extern const uint8_t AES_isbox[256];
 
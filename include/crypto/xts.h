@@ -29,6 +29,11 @@
 
 #define XTS_BLOCK_SIZE 16
 
+/*
+ * The cipher function processes @length bytes, a multiple of
+ * XTS_BLOCK_SIZE, as independent blocks (ECB).  Several blocks are
+ * passed in one call, so it must not assume a single block.
+ */
 typedef void xts_cipher_func(const void *ctx,
                              size_t length,
                              uint8_t *dst,
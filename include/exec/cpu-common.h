@@ -60,6 +60,12 @@ typedef uintptr_t ram_addr_t;
 /* memory API */
 
 void qemu_ram_remap(ram_addr_t addr, ram_addr_t length);
+/*
+ * Replace the memory of a shared, fd-backed RAMBlock with @fd mapped at
+ * @fd_offset, keeping the host address.  On success the block owns @fd.
+ */
+int qemu_ram_remap_fd(RAMBlock *block, int fd, uint64_t fd_offset,
+                      Error **errp);
 /* This should not be used by devices.  */
 ram_addr_t qemu_ram_addr_from_host(void *ptr);
 ram_addr_t qemu_ram_addr_from_host_nofail(void *ptr);
@@ -506,6 +506,10 @@ uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
                 dest[k] |= bits;
                 new_dirty &= bits;
                 num_dirty += ctpopl(new_dirty);
+                if (rb->dirty_chunk_bmap) {
+                    set_bit((k * BITS_PER_LONG) >> DIRTY_FREQ_CHUNK_SHIFT,
+                            rb->dirty_chunk_bmap);
+                }
             }
 
             if (++offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
@@ -541,6 +545,9 @@ uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
                 if (!test_and_set_bit(k, dest)) {
                     num_dirty++;
                 }
+                if (rb->dirty_chunk_bmap) {
+                    set_bit(k >> DIRTY_FREQ_CHUNK_SHIFT, rb->dirty_chunk_bmap);
+                }
             }
         }
     }
@@ -24,6 +24,9 @@
 #include "qemu/rcu.h"
 #include "exec/ramlist.h"
 
+/* Granularity (in target pages) of the dirty frequency tracking */
+#define DIRTY_FREQ_CHUNK_SHIFT 9
+
 struct RAMBlock {
     struct rcu_head rcu;
     struct MemoryRegion *mr;
@@ -79,6 +82,17 @@ struct RAMBlock {
     unsigned long *clear_bmap;
     uint8_t clear_bmap_shift;
 
+    /*
+     * Dirty frequency tracking used to defer hot pages during precopy,
+     * one entry per (1 << DIRTY_FREQ_CHUNK_SHIFT) target pages.
+     * dirty_chunk_bmap marks the chunks written to since the last global
+     * sync, and dirty_freq counts how many recent syncs found them written.
+     * Only used on the migration source, protected by the global
+     * ram_state.bitmap_mutex.  NULL unless defer-hot-pages is enabled.
+     */
+    unsigned long *dirty_chunk_bmap;
+    uint8_t *dirty_freq;
+
     /*
      * RAM block length that corresponds to the used_length on the migration
      * source (after RAM block sizes were synchronized). Especially, after
@@ -34,6 +34,9 @@
 
 #define VFIO_MSG_PREFIX "vfio %s: "
 
+/* Device state that multifd may queue on the destination, per device */
+#define VFIO_MIG_DEFAULT_MAX_QUEUED_SIZE (1 * GiB)
+
 enum {
     VFIO_DEVICE_TYPE_PCI = 0,
     VFIO_DEVICE_TYPE_PLATFORM = 1,
@@ -59,6 +62,8 @@ typedef struct VFIORegion {
     uint8_t nr; /* cache the region number for debug */
 } VFIORegion;
 
+typedef struct VFIOMultifd VFIOMultifd;
+
 typedef struct VFIOMigration {
     struct VFIODevice *vbasedev;
     VMChangeStateEntry *vm_state;
@@ -71,6 +76,8 @@ typedef struct VFIOMigration {
     uint64_t precopy_init_size;
     uint64_t precopy_dirty_size;
     bool initial_data_sent;
+    bool multifd_transfer;
+    VFIOMultifd *multifd;
 } VFIOMigration;
 
 struct VFIOGroup;
@@ -115,6 +122,9 @@ typedef struct VFIODevice {
     bool no_mmap;
     bool ram_block_discard_allowed;
     OnOffAuto enable_migration;
+    bool migration_multifd_transfer;
+    DeviceState *migration_load_after;
+    uint64_t migration_max_queued_size;
     VFIODeviceOps *ops;
     unsigned int num_irqs;
     unsigned int num_regions;
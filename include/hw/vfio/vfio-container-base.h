@@ -50,6 +50,7 @@ typedef struct VFIOContainerBase {
     QLIST_HEAD(, VFIODevice) device_list;
     GList *iova_ranges;
     NotifierWithReturn cpr_reboot_notifier;
+    Error *cpr_transfer_blocker;
 } VFIOContainerBase;
 
 typedef struct VFIOGuestIOMMU {
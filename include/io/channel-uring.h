@@ -0,0 +1,135 @@
+/*
+ * QEMU I/O channels io_uring driver
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef QIO_CHANNEL_URING_H
+#define QIO_CHANNEL_URING_H
+
+#include "io/channel.h"
+#include "qom/object.h"
+
+#define TYPE_QIO_CHANNEL_URING "qio-channel-uring"
+OBJECT_DECLARE_SIMPLE_TYPE(QIOChannelUring, QIO_CHANNEL_URING)
+
+struct io_uring;
+
+/**
+ * QIOChannelUring:
+ *
+ * The QIOChannelUring object performs the I/O of a file channel
+ * through its own io_uring instance. The file descriptor is
+ * registered with the ring, and so can be memory buffers, which saves
+ * the kernel from looking them up on every request. Positioned writes
+ * can be queued and submitted together with a single system call.
+ * Socket channels are not supported: their I/O is one request at a
+ * time, which io_uring can't do with fewer system calls than
+ * sendmsg() and recvmsg().
+ *
+ * The channel has no internal locking, it is meant to be used by a
+ * single thread at a time, such as a multifd migration thread.
+ * File descriptor passing, peek reads and zero copy writes are not
+ * supported and fail with EINVAL.
+ */
+
+struct QIOChannelUring {
+    QIOChannel parent;
+    QIOChannel *master;
+    int fd;
+    struct io_uring *ring;
+    bool fixed_file;
+    struct iovec *buffers;
+    unsigned int nr_buffers;
+    /* QIOChannelUringWrite queued by qio_channel_uring_pwritev_queue() */
+    GArray *queued;
+};
+
+
+/**
+ * qio_channel_uring_new:
+ * @master: the file channel to perform I/O for
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Create a new IO channel that performs the I/O of @master with
+ * io_uring. The new channel holds a reference on @master, and
+ * closing or shutting down the new channel does the same to @master.
+ *
+ * Returns: the new channel object, or NULL if io_uring is not
+ * available or @master is not a file channel
+ */
+QIOChannelUring *
+qio_channel_uring_new(QIOChannel *master,
+                      Error **errp);
+
+/**
+ * qio_channel_uring_register_buffers:
+ * @ioc: the channel object
+ * @iov: the memory regions to register
+ * @niov: the length of the @iov array
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Register memory regions with the ring of @ioc, reads and writes
+ * of a single buffer that lies within one of them then skip the
+ * mapping of the pages by the kernel. The pages of the regions are
+ * pinned in memory, which counts against RLIMIT_MEMLOCK, and each
+ * region can be at most 1 GiB long.
+ *
+ * Buffers can only be registered once per channel.
+ *
+ * Returns: true on success, false on error
+ */
+bool qio_channel_uring_register_buffers(QIOChannelUring *ioc,
+                                        const struct iovec *iov,
+                                        unsigned int niov,
+                                        Error **errp);
+
+/**
+ * qio_channel_uring_pwritev_queue:
+ * @ioc: the channel object
+ * @iov: the array of memory regions to write data from
+ * @niov: the length of the @iov array
+ * @offset: the position in the file to write at
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Queue a positioned write of @iov to be submitted by the next
+ * call to qio_channel_uring_flush(). The @iov array and the memory
+ * it points to must remain valid until then. When the queue is
+ * full it is flushed first.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int qio_channel_uring_pwritev_queue(QIOChannelUring *ioc,
+                                    const struct iovec *iov,
+                                    size_t niov,
+                                    off_t offset,
+                                    Error **errp);
+
+/**
+ * qio_channel_uring_flush:
+ * @ioc: the channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Submit the writes queued by qio_channel_uring_pwritev_queue()
+ * with a single system call and wait until all of them completed.
+ * Writes that completed partially are finished synchronously.
+ * The channel can't be used anymore after a failure.
+ *
+ * Returns: 0 on success, -1 if any write failed
+ */
+int qio_channel_uring_flush(QIOChannelUring *ioc,
+                            Error **errp);
+
+#endif /* QIO_CHANNEL_URING_H */
@@ -102,6 +102,27 @@ typedef struct SaveVMHandlers {
      */
     int (*save_live_complete_precopy)(QEMUFile *f, void *opaque);
 
+    /**
+     * @save_live_complete_precopy_thread
+     *
+     * Runs in a dedicated thread, without the BQL, in parallel with
+     * @save_live_complete_precopy and @save_state of all devices.  Used
+     * to push large device state through multifd channels with
+     * multifd_queue_device_state() instead of the main migration stream.
+     * Only called when multifd_device_state_supported() is true.
+     *
+     * @idstr: state section identifier, to pass to
+     *         multifd_queue_device_state()
+     * @instance_id: instance id, to pass to multifd_queue_device_state()
+     * @opaque: data pointer passed to register_savevm_live()
+     * @errp: pointer to Error*, to store an error if it happens.
+     *
+     * Returns zero to indicate success and negative for error
+     */
+    int (*save_live_complete_precopy_thread)(const char *idstr,
+                                             uint32_t instance_id,
+                                             void *opaque, Error **errp);
+
     /* This runs both outside and inside the BQL.  */
 
     /**
@@ -226,6 +247,48 @@ typedef struct SaveVMHandlers {
      */
     int (*load_state)(QEMUFile *f, void *opaque, int version_id);
 
+    /**
+     * @load_state_buffer
+     *
+     * Load a device state buffer queued on the source with
+     * multifd_queue_device_state().  Called from a multifd receive
+     * thread, without the BQL, concurrently with the main stream being
+     * loaded.  Buffers may arrive in any order and interleaved with the
+     * device's main stream sections; the handler must make sure they
+     * have all been loaded before its last main stream section finishes
+     * loading.
+     *
+     * @opaque: data pointer passed to register_savevm_live()
+     * @buf: the buffer, now owned by the handler
+     * @len: size of @buf
+     * @errp: pointer to Error*, to store an error if it happens.
+     *
+     * Returns zero to indicate success and negative for error
+     */
+    int (*load_state_buffer)(void *opaque, char *buf, size_t len,
+                             Error **errp);
+
+    /**
+     * @load_state_buffer_depends
+     *
+     * Declares that the state buffers of the device at @opaque may only
+     * be loaded after all the state buffers of another device accepting
+     * them.  The device enforces this by calling
+     * qemu_loadvm_state_buffers_wait_deps() before loading its first
+     * buffer, and tells the devices depending on it that it is done with
+     * qemu_loadvm_state_buffers_done().  Dependencies must not form a
+     * cycle.  Without this handler, buffers are loaded as they arrive.
+     *
+     * @opaque: data pointer passed to register_savevm_live()
+     * @other_ops: handlers of the other device
+     * @other_opaque: data pointer of the other device
+     *
+     * Returns true if the device depends on the other one
+     */
+    bool (*load_state_buffer_depends)(void *opaque,
+                                      const struct SaveVMHandlers *other_ops,
+                                      void *other_opaque);
+
     /**
      * @load_setup
      *
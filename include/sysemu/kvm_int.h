@@ -56,6 +56,19 @@ enum KVMDirtyRingReaperState {
     KVM_DIRTY_RING_REAPER_REAPING,
 };
 
+/*
+ * Helper thread harvesting the dirty rings of a subset of the vCPUs
+ * (those with cpu_index % nr_shards == index) on behalf of whoever is
+ * reaping all the rings.
+ */
+struct KVMDirtyRingReapShard {
+    QemuThread thread;
+    QemuSemaphore sem;          /* posted to start one harvest round */
+    int index;
+    uint64_t total;             /* pages collected in the last round */
+    struct KVMState *s;
+};
+
 /*
  * KVM reaper instance, responsible for collecting the KVM dirty bits
  * via the dirty ring.
@@ -65,6 +78,13 @@ struct KVMDirtyRingReaper {
     QemuThread reaper_thr;
     volatile uint64_t reaper_iteration; /* iteration number of reaper thr */
     volatile enum KVMDirtyRingReaperState reaper_state; /* reap thr state */
+    /* Parallel harvesting, only used when nr_shards > 1 */
+    uint32_t nr_shards;
+    struct KVMDirtyRingReapShard *shards;
+    int shards_pending;         /* shards still harvesting this round */
+    QemuEvent shards_done;
+    bool shards_stop;           /* set at exit, the shards then return */
+    Notifier shards_exit;
 };
 struct KVMState
 {
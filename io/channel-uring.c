@@ -0,0 +1,536 @@
+/*
+ * QEMU I/O channels io_uring driver
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include <liburing.h>
+#include "io/channel-uring.h"
+#include "io/channel-file.h"
+#include "io/channel-util.h"
+#include "io/channel-watch.h"
+#include "qapi/error.h"
+#include "qemu/iov.h"
+#include "qemu/module.h"
+#include "trace.h"
+
+/* Size of the submission queue, and so of the write queue */
+#define QIO_CHANNEL_URING_ENTRIES 64
+
+typedef struct QIOChannelUringWrite {
+    const struct iovec *iov;
+    size_t niov;
+    off_t offset;
+    size_t len;
+} QIOChannelUringWrite;
+
+QIOChannelUring *
+qio_channel_uring_new(QIOChannel *master,
+                      Error **errp)
+{
+    QIOChannelUring *uioc;
+    int fd, ret;
+
+    if (!object_dynamic_cast(OBJECT(master), TYPE_QIO_CHANNEL_FILE)) {
+        error_setg(errp, "io_uring is only supported for file channels, "
+                   "not %s", object_get_typename(OBJECT(master)));
+        return NULL;
+    }
+    fd = QIO_CHANNEL_FILE(master)->fd;
+
+    uioc = QIO_CHANNEL_URING(object_new(TYPE_QIO_CHANNEL_URING));
+
+    uioc->ring = g_new0(struct io_uring, 1);
+    ret = io_uring_queue_init(QIO_CHANNEL_URING_ENTRIES, uioc->ring, 0);
+    if (ret < 0) {
+        g_clear_pointer(&uioc->ring, g_free);
+        object_unref(OBJECT(uioc));
+        error_setg_errno(errp, -ret, "Failed to initialize io_uring");
+        return NULL;
+    }
+
+    /* Optional, requests just use the plain descriptor without it */
+    uioc->fixed_file = io_uring_register_files(uioc->ring, &fd, 1) == 0;
+
+    uioc->master = master;
+    object_ref(OBJECT(master));
+    uioc->fd = fd;
+
+    if (qio_channel_has_feature(master, QIO_CHANNEL_FEATURE_SHUTDOWN)) {
+        qio_channel_set_feature(QIO_CHANNEL(uioc),
+                                QIO_CHANNEL_FEATURE_SHUTDOWN);
+    }
+    if (qio_channel_has_feature(master, QIO_CHANNEL_FEATURE_SEEKABLE)) {
+        qio_channel_set_feature(QIO_CHANNEL(uioc),
+                                QIO_CHANNEL_FEATURE_SEEKABLE);
+    }
+    qio_channel_set_name(QIO_CHANNEL(uioc), master->name);
+
+    trace_qio_channel_uring_new(uioc, master, fd, uioc->fixed_file);
+
+    return uioc;
+}
+
+bool qio_channel_uring_register_buffers(QIOChannelUring *ioc,
+                                        const struct iovec *iov,
+                                        unsigned int niov,
+                                        Error **errp)
+{
+    int ret;
+
+    assert(!ioc->nr_buffers);
+
+    ret = io_uring_register_buffers(ioc->ring, iov, niov);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to register io_uring buffers");
+        return false;
+    }
+
+    ioc->buffers = g_memdup2(iov, niov * sizeof(*iov));
+    ioc->nr_buffers = niov;
+    trace_qio_channel_uring_register_buffers(ioc, niov);
+
+    return true;
+}
+
+/* Returns the index of the registered buffer that contains @iov, or -1 */
+static int qio_channel_uring_find_buffer(QIOChannelUring *uioc,
+                                         const struct iovec *iov)
+{
+    uintptr_t start = (uintptr_t)iov->iov_base;
+    unsigned int i;
+
+    for (i = 0; i < uioc->nr_buffers; i++) {
+        uintptr_t base = (uintptr_t)uioc->buffers[i].iov_base;
+
+        if (start >= base &&
+            iov->iov_len <= uioc->buffers[i].iov_len - (start - base)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void qio_channel_uring_prep_rw(QIOChannelUring *uioc,
+                                      struct io_uring_sqe *sqe,
+                                      bool is_write,
+                                      const struct iovec *iov,
+                                      size_t niov,
+                                      off_t offset)
+{
+    int fd = uioc->fixed_file ? 0 : uioc->fd;
+    int index = niov == 1 ? qio_channel_uring_find_buffer(uioc, iov) : -1;
+
+    if (index >= 0 && is_write) {
+        io_uring_prep_write_fixed(sqe, fd, iov->iov_base, iov->iov_len,
+                                  offset, index);
+    } else if (index >= 0) {
+        io_uring_prep_read_fixed(sqe, fd, iov->iov_base, iov->iov_len,
+                                 offset, index);
+    } else if (is_write) {
+        io_uring_prep_writev(sqe, fd, iov, niov, offset);
+    } else {
+        io_uring_prep_readv(sqe, fd, iov, niov, offset);
+    }
+
+    if (uioc->fixed_file) {
+        io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+    }
+}
+
+static int qio_channel_uring_wait_cqe(QIOChannelUring *uioc,
+                                      struct io_uring_cqe **cqe,
+                                      Error **errp)
+{
+    int ret;
+
+    do {
+        ret = io_uring_wait_cqe(uioc->ring, cqe);
+    } while (ret == -EINTR);
+
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to wait for io_uring completion");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Performs a single request and waits for it. @offset is -1 to use
+ * the file position, as readv() and writev() do.
+ */
+static ssize_t qio_channel_uring_rw(QIOChannelUring *uioc,
+                                    bool is_write,
+                                    const struct iovec *iov,
+                                    size_t niov,
+                                    off_t offset,
+                                    Error **errp)
+{
+    struct io_uring_cqe *cqe;
+    ssize_t ret;
+
+    if (qio_channel_uring_flush(uioc, errp) < 0) {
+        return -1;
+    }
+
+ retry:
+    /* The ring is empty after the flush */
+    qio_channel_uring_prep_rw(uioc, io_uring_get_sqe(uioc->ring), is_write,
+                              iov, niov, offset);
+
+    /* A single system call, the completion is then already there */
+    do {
+        ret = io_uring_submit_and_wait(uioc->ring, 1);
+    } while (ret == -EINTR);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to submit io_uring request");
+        return -1;
+    }
+    if (qio_channel_uring_wait_cqe(uioc, &cqe, errp) < 0) {
+        return -1;
+    }
+    ret = cqe->res;
+    io_uring_cqe_seen(uioc->ring, cqe);
+
+    if (ret == -EINTR) {
+        goto retry;
+    }
+    if (ret == -EAGAIN) {
+        return QIO_CHANNEL_ERR_BLOCK;
+    }
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, is_write ?
+                         "Unable to write to io_uring channel" :
+                         "Unable to read from io_uring channel");
+        return -1;
+    }
+
+    return ret;
+}
+
+/* Writes what a queued write left over, starting @done bytes into it */
+static int qio_channel_uring_finish_write(QIOChannelUring *uioc,
+                                          QIOChannelUringWrite *w,
+                                          size_t done,
+                                          Error **errp)
+{
+    g_autofree struct iovec *local = g_new(struct iovec, w->niov);
+
+    while (done < w->len) {
+        size_t nlocal = iov_copy(local, w->niov, w->iov, w->niov,
+                                 done, w->len - done);
+        ssize_t ret = qio_channel_uring_rw(uioc, true, local, nlocal,
+                                           w->offset + done, errp);
+
+        if (ret == QIO_CHANNEL_ERR_BLOCK) {
+            continue;
+        }
+        if (ret < 0) {
+            return -1;
+        }
+        if (ret == 0) {
+            error_setg(errp, "Unable to write to io_uring channel: "
+                       "no progress at offset %" PRId64,
+                       (int64_t)(w->offset + done));
+            return -1;
+        }
+        done += ret;
+    }
+
+    return 0;
+}
+
+int qio_channel_uring_pwritev_queue(QIOChannelUring *ioc,
+                                    const struct iovec *iov,
+                                    size_t niov,
+                                    off_t offset,
+                                    Error **errp)
+{
+    QIOChannelUringWrite w = {
+        .iov = iov,
+        .niov = niov,
+        .offset = offset,
+        .len = iov_size(iov, niov),
+    };
+    struct io_uring_sqe *sqe;
+
+    if (ioc->queued->len == QIO_CHANNEL_URING_ENTRIES &&
+        qio_channel_uring_flush(ioc, errp) < 0) {
+        return -1;
+    }
+
+    sqe = io_uring_get_sqe(ioc->ring);
+    qio_channel_uring_prep_rw(ioc, sqe, true, iov, niov, offset);
+    io_uring_sqe_set_data(sqe, (void *)(uintptr_t)ioc->queued->len);
+    g_array_append_val(ioc->queued, w);
+
+    return 0;
+}
+
+int qio_channel_uring_flush(QIOChannelUring *ioc,
+                            Error **errp)
+{
+    g_autoptr(GArray) queued = ioc->queued;
+    g_autofree ssize_t *res = NULL;
+    struct io_uring_cqe *cqe;
+    unsigned int i, submitted = 0;
+    int ret;
+
+    if (!queued->len) {
+        return 0;
+    }
+
+    trace_qio_channel_uring_flush(ioc, queued->len);
+
+    /* Requests are reissued below and may need the queue */
+    ioc->queued = g_array_new(false, false, sizeof(QIOChannelUringWrite));
+    res = g_new(ssize_t, queued->len);
+
+    while (submitted < queued->len) {
+        ret = io_uring_submit(ioc->ring);
+        if (ret == -EINTR || ret == -EAGAIN) {
+            continue;
+        }
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Failed to submit io_uring requests");
+            break;
+        }
+        submitted += ret;
+    }
+
+    /* Completions must be reaped before the ring is used again */
+    for (i = 0; i < submitted; i++) {
+        if (qio_channel_uring_wait_cqe(ioc, &cqe,
+                                       submitted < queued->len ?
+                                       NULL : errp) < 0) {
+            return -1;
+        }
+        res[(uintptr_t)io_uring_cqe_get_data(cqe)] = cqe->res;
+        io_uring_cqe_seen(ioc->ring, cqe);
+    }
+    if (submitted < queued->len) {
+        return -1;
+    }
+
+    for (i = 0; i < queued->len; i++) {
+        QIOChannelUringWrite *w = &g_array_index(queued, QIOChannelUringWrite,
+                                                 i);
+
+        if (res[i] == -EINTR || res[i] == -EAGAIN) {
+            res[i] = 0;
+        }
+        if (res[i] < 0) {
+            error_setg_errno(errp, -res[i],
+                             "Unable to write to io_uring channel");
+            return -1;
+        }
+        if (res[i] < w->len &&
+            qio_channel_uring_finish_write(ioc, w, res[i], errp) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static void qio_channel_uring_init(Object *obj)
+{
+    QIOChannelUring *uioc = QIO_CHANNEL_URING(obj);
+
+    uioc->fd = -1;
+    uioc->queued = g_array_new(false, false, sizeof(QIOChannelUringWrite));
+}
+
+static void qio_channel_uring_finalize(Object *obj)
+{
+    QIOChannelUring *uioc = QIO_CHANNEL_URING(obj);
+
+    if (uioc->ring) {
+        io_uring_queue_exit(uioc->ring);
+        g_free(uioc->ring);
+    }
+    g_free(uioc->buffers);
+    g_array_unref(uioc->queued);
+    if (uioc->master) {
+        object_unref(OBJECT(uioc->master));
+    }
+}
+
+
+static ssize_t qio_channel_uring_readv(QIOChannel *ioc,
+                                       const struct iovec *iov,
+                                       size_t niov,
+                                       int **fds,
+                                       size_t *nfds,
+                                       int flags,
+                                       Error **errp)
+{
+    if (fds || nfds) {
+        error_setg_errno(errp, EINVAL,
+                         "Channel does not support file descriptor passing");
+        return -1;
+    }
+    if (flags) {
+        error_setg_errno(errp, EINVAL, "Channel does not support peek read");
+        return -1;
+    }
+
+    return qio_channel_uring_rw(QIO_CHANNEL_URING(ioc), false, iov, niov,
+                                -1, errp);
+}
+
+static ssize_t qio_channel_uring_writev(QIOChannel *ioc,
+                                        const struct iovec *iov,
+                                        size_t niov,
+                                        int *fds,
+                                        size_t nfds,
+                                        int flags,
+                                        Error **errp)
+{
+    if (fds || nfds) {
+        error_setg_errno(errp, EINVAL,
+                         "Channel does not support file descriptor passing");
+        return -1;
+    }
+    if (flags) {
+        error_setg_errno(errp, EINVAL,
+                         "Requested Zero Copy feature is not available");
+        return -1;
+    }
+
+    return qio_channel_uring_rw(QIO_CHANNEL_URING(ioc), true, iov, niov,
+                                -1, errp);
+}
+
+static ssize_t qio_channel_uring_preadv(QIOChannel *ioc,
+                                        const struct iovec *iov,
+                                        size_t niov,
+                                        off_t offset,
+                                        Error **errp)
+{
+    return qio_channel_uring_rw(QIO_CHANNEL_URING(ioc), false, iov, niov,
+                                offset, errp);
+}
+
+static ssize_t qio_channel_uring_pwritev(QIOChannel *ioc,
+                                         const struct iovec *iov,
+                                         size_t niov,
+                                         off_t offset,
+                                         Error **errp)
+{
+    return qio_channel_uring_rw(QIO_CHANNEL_URING(ioc), true, iov, niov,
+                                offset, errp);
+}
+
+static int qio_channel_uring_set_blocking(QIOChannel *ioc,
+                                          bool enabled,
+                                          Error **errp)
+{
+    QIOChannelUring *uioc = QIO_CHANNEL_URING(ioc);
+
+    return qio_channel_set_blocking(uioc->master, enabled, errp);
+}
+
+static off_t qio_channel_uring_seek(QIOChannel *ioc,
+                                    off_t offset,
+                                    int whence,
+                                    Error **errp)
+{
+    QIOChannelUring *uioc = QIO_CHANNEL_URING(ioc);
+
+    return qio_channel_io_seek(uioc->master, offset, whence, errp);
+}
+
+static int qio_channel_uring_close(QIOChannel *ioc,
+                                   Error **errp)
+{
+    QIOChannelUring *uioc = QIO_CHANNEL_URING(ioc);
+
+    /* The registered file would otherwise keep it open */
+    if (uioc->fixed_file) {
+        io_uring_unregister_files(uioc->ring);
+        uioc->fixed_file = false;
+    }
+
+    return qio_channel_close(uioc->master, errp);
+}
+
+static int qio_channel_uring_shutdown(QIOChannel *ioc,
+                                      QIOChannelShutdown how,
+                                      Error **errp)
+{
+    QIOChannelUring *uioc = QIO_CHANNEL_URING(ioc);
+
+    return qio_channel_shutdown(uioc->master, how, errp);
+}
+
+static void qio_channel_uring_set_aio_fd_handler(QIOChannel *ioc,
+                                                 AioContext *read_ctx,
+                                                 IOHandler *io_read,
+                                                 AioContext *write_ctx,
+                                                 IOHandler *io_write,
+                                                 void *opaque)
+{
+    QIOChannelUring *uioc = QIO_CHANNEL_URING(ioc);
+
+    qio_channel_util_set_aio_fd_handler(uioc->fd, read_ctx, io_read,
+                                        uioc->fd, write_ctx, io_write,
+                                        opaque);
+}
+
+static GSource *qio_channel_uring_create_watch(QIOChannel *ioc,
+                                               GIOCondition condition)
+{
+    QIOChannelUring *uioc = QIO_CHANNEL_URING(ioc);
+
+    return qio_channel_create_fd_watch(ioc, uioc->fd, condition);
+}
+
+static void qio_channel_uring_class_init(ObjectClass *klass,
+                                         void *class_data G_GNUC_UNUSED)
+{
+    QIOChannelClass *ioc_klass = QIO_CHANNEL_CLASS(klass);
+
+    ioc_klass->io_writev = qio_channel_uring_writev;
+    ioc_klass->io_readv = qio_channel_uring_readv;
+    ioc_klass->io_pwritev = qio_channel_uring_pwritev;
+    ioc_klass->io_preadv = qio_channel_uring_preadv;
+    ioc_klass->io_set_blocking = qio_channel_uring_set_blocking;
+    ioc_klass->io_seek = qio_channel_uring_seek;
+    ioc_klass->io_close = qio_channel_uring_close;
+    ioc_klass->io_shutdown = qio_channel_uring_shutdown;
+    ioc_klass->io_create_watch = qio_channel_uring_create_watch;
+    ioc_klass->io_set_aio_fd_handler = qio_channel_uring_set_aio_fd_handler;
+}
+
+static const TypeInfo qio_channel_uring_info = {
+    .parent = TYPE_QIO_CHANNEL,
+    .name = TYPE_QIO_CHANNEL_URING,
+    .instance_size = sizeof(QIOChannelUring),
+    .instance_init = qio_channel_uring_init,
+    .instance_finalize = qio_channel_uring_finalize,
+    .class_init = qio_channel_uring_class_init,
+};
+
+static void qio_channel_uring_register_types(void)
+{
+    type_register_static(&qio_channel_uring_info);
+}
+
+type_init(qio_channel_uring_register_types);
@@ -0,0 +1,203 @@
+/*
+ * Migration auto-tuner
+ *
+ * Throttles the guest as much as the running migration needs to reach
+ * the downtime limit, from what it measures: the rate at which the guest
+ * dirties memory, the throughput of the migration stream and the
+ * compression ratio of the multifd channels.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "qemu/lockable.h"
+#include "qapi/clone-visitor.h"
+#include "qapi/qapi-visit-migration.h"
+#include "exec/target_page.h"
+#include "sysemu/cpu-throttle.h"
+#include "migration.h"
+#include "migration-stats.h"
+#include "options.h"
+#include "auto-tune.h"
+#include "trace.h"
+
+/* How often the tuner looks at the measurements, in milliseconds */
+#define AUTO_TUNE_INTERVAL      1000
+/* Number of decisions reported by query-migrate */
+#define AUTO_TUNE_MAX_DECISIONS 64
+/* Periods the guest must outrun the migration before throttling it */
+#define AUTO_TUNE_DIRTY_SAMPLES 2
+
+static struct {
+    /* Protects everything below, query-migrate reads it */
+    QemuMutex lock;
+    uint64_t dirty_rate;
+    uint64_t throughput;
+    double compression_ratio;
+    /* Oldest first, holds MigrationAutoTuneDecision */
+    GQueue decisions;
+    int64_t last_tune_time;
+    unsigned int dirty_samples;
+} auto_tune;
+
+void migration_auto_tune_init(void)
+{
+    qemu_mutex_init(&auto_tune.lock);
+    g_queue_init(&auto_tune.decisions);
+}
+
+static void auto_tune_free_decision(gpointer data)
+{
+    qapi_free_MigrationAutoTuneDecision(data);
+}
+
+void migration_auto_tune_reset(void)
+{
+    QEMU_LOCK_GUARD(&auto_tune.lock);
+
+    g_queue_clear_full(&auto_tune.decisions, auto_tune_free_decision);
+    auto_tune.dirty_rate = 0;
+    auto_tune.throughput = 0;
+    auto_tune.compression_ratio = 1;
+    auto_tune.last_tune_time = 0;
+    auto_tune.dirty_samples = 0;
+}
+
+/* Records a decision, takes ownership of @value */
+static void G_GNUC_PRINTF(5, 6)
+auto_tune_decide(MigrationState *s, int64_t now, const char *parameter,
+                 char *value, const char *fmt, ...)
+{
+    MigrationAutoTuneDecision *d = g_new0(MigrationAutoTuneDecision, 1);
+    va_list ap;
+
+    va_start(ap, fmt);
+    d->reason = g_strdup_vprintf(fmt, ap);
+    va_end(ap);
+
+    d->time = now - s->start_time;
+    d->parameter = g_strdup(parameter);
+    d->value = value;
+
+    trace_migration_auto_tune_decision(d->parameter, d->value, d->reason);
+
+    g_queue_push_tail(&auto_tune.decisions, d);
+    if (g_queue_get_length(&auto_tune.decisions) > AUTO_TUNE_MAX_DECISIONS) {
+        qapi_free_MigrationAutoTuneDecision(
+            g_queue_pop_head(&auto_tune.decisions));
+    }
+}
+
+void migration_auto_tune(MigrationState *s, double bandwidth, int64_t now)
+{
+    uint64_t page_size = qemu_target_page_size();
+    uint64_t multifd_bytes = stat64_get(&mig_stats.multifd_bytes);
+    uint64_t dirty_rate, throughput, effective_bw;
+    bool over_limit = s->expected_downtime > migrate_downtime_limit();
+    double ratio = 1;
+
+    if (now < auto_tune.last_tune_time + AUTO_TUNE_INTERVAL) {
+        return;
+    }
+    /* The dirty rate is only known after the first bitmap sync */
+    if (stat64_get(&mig_stats.dirty_sync_count) < 2 ||
+        migration_in_postcopy()) {
+        return;
+    }
+
+    dirty_rate = stat64_get(&mig_stats.dirty_pages_rate) * page_size;
+    throughput = bandwidth * 1000;
+    if (migrate_multifd() &&
+        migrate_multifd_compression() != MULTIFD_COMPRESSION_NONE &&
+        multifd_bytes) {
+        ratio = (double)stat64_get(&mig_stats.normal_pages) * page_size /
+                multifd_bytes;
+    }
+    /* Guest memory that can be moved per second at this throughput */
+    effective_bw = throughput * ratio;
+
+    trace_migration_auto_tune(dirty_rate, throughput, ratio * 100,
+                              s->expected_downtime);
+
+    QEMU_LOCK_GUARD(&auto_tune.lock);
+
+    auto_tune.last_tune_time = now;
+    auto_tune.dirty_rate = dirty_rate;
+    auto_tune.throughput = throughput;
+    auto_tune.compression_ratio = ratio;
+
+    /*
+     * Unlike auto-converge, only throttle while the downtime limit can't
+     * be met, and give the guest its CPU time back once it can.
+     */
+    if (over_limit && dirty_rate > effective_bw) {
+        if (++auto_tune.dirty_samples >= AUTO_TUNE_DIRTY_SAMPLES) {
+            int pct = cpu_throttle_get_percentage();
+            int max_pct = migrate_max_cpu_throttle();
+
+            if (!cpu_throttle_active()) {
+                pct = migrate_cpu_throttle_initial();
+            } else {
+                pct = MIN(pct + migrate_cpu_throttle_increment(), max_pct);
+            }
+            if (!cpu_throttle_active() ||
+                pct != cpu_throttle_get_percentage()) {
+                cpu_throttle_set(pct);
+                auto_tune.dirty_samples = 0;
+                auto_tune_decide(s, now, "cpu-throttle-percentage",
+                                 g_strdup_printf("%d", pct),
+                                 "expected downtime %" PRId64 " ms over "
+                                 "limit %" PRIu64 " ms, dirty rate "
+                                 "%" PRIu64 " B/s over bandwidth "
+                                 "%" PRIu64 " B/s",
+                                 s->expected_downtime,
+                                 migrate_downtime_limit(),
+                                 dirty_rate, effective_bw);
+            }
+        }
+    } else {
+        auto_tune.dirty_samples = 0;
+        if (cpu_throttle_active() &&
+            (!over_limit || dirty_rate < effective_bw / 2)) {
+            int pct = cpu_throttle_get_percentage() -
+                      migrate_cpu_throttle_increment();
+
+            if (pct < migrate_cpu_throttle_initial()) {
+                cpu_throttle_stop();
+                pct = 0;
+            } else {
+                cpu_throttle_set(pct);
+            }
+            auto_tune_decide(s, now, "cpu-throttle-percentage",
+                             g_strdup_printf("%d", pct),
+                             "expected downtime %" PRId64 " ms, dirty rate "
+                             "%" PRIu64 " B/s, bandwidth %" PRIu64 " B/s",
+                             s->expected_downtime, dirty_rate,
+                             effective_bw);
+        }
+    }
+}
+
+void migration_auto_tune_populate_info(MigrationInfo *info)
+{
+    MigrationAutoTuneInfo *at;
+    GList *l;
+
+    if (!migrate_auto_tune()) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&auto_tune.lock);
+
+    at = g_new0(MigrationAutoTuneInfo, 1);
+    at->dirty_rate = auto_tune.dirty_rate;
+    at->throughput = auto_tune.throughput;
+    at->compression_ratio = auto_tune.compression_ratio;
+    for (l = auto_tune.decisions.tail; l; l = l->prev) {
+        QAPI_LIST_PREPEND(at->decisions,
+                          QAPI_CLONE(MigrationAutoTuneDecision, l->data));
+    }
+    info->auto_tune = at;
+}
@@ -0,0 +1,32 @@
+/*
+ * Migration auto-tuner
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_AUTO_TUNE_H
+#define QEMU_MIGRATION_AUTO_TUNE_H
+
+#include "qapi/qapi-types-migration.h"
+
+void migration_auto_tune_init(void);
+
+/*
+ * migration_auto_tune_reset: Drop the measurements and decisions of the
+ * previous migration.
+ */
+void migration_auto_tune_reset(void);
+
+/*
+ * migration_auto_tune: Feed the tuner with the bandwidth measured by the
+ * migration thread over the last period, in bytes per millisecond.
+ * Adjusts the CPU throttle at most once per second.
+ *
+ * Called from the migration thread.
+ */
+void migration_auto_tune(MigrationState *s, double bandwidth, int64_t now);
+
+void migration_auto_tune_populate_info(MigrationInfo *info);
+
+#endif
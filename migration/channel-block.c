@@ -22,6 +22,8 @@
 #include "migration/channel-block.h"
 #include "qapi/error.h"
 #include "block/block.h"
+#include "block/graph-lock.h"
+#include "qemu/coroutine.h"
 #include "trace.h"
 
 QIOChannelBlock *
@@ -33,11 +35,19 @@ qio_channel_block_new(BlockDriverState *bs)
 
     bdrv_ref(bs);
     ioc->bs = bs;
+    qio_channel_set_feature(QIO_CHANNEL(ioc), QIO_CHANNEL_FEATURE_SEEKABLE);
 
     return ioc;
 }
 
 
+void
+qio_channel_block_set_aio_context(QIOChannelBlock *ioc, AioContext *ctx)
+{
+    ioc->ctx = ctx;
+}
+
+
 static void
 qio_channel_block_finalize(Object *obj)
 {
@@ -47,6 +57,74 @@ qio_channel_block_finalize(Object *obj)
 }
 
 
+typedef struct QIOChannelBlockRequest {
+    BlockDriverState *bs;
+    QEMUIOVector *qiov;
+    off_t offset;
+    bool is_write;
+    int ret;
+    QemuSemaphore done;
+} QIOChannelBlockRequest;
+
+static void coroutine_fn
+qio_channel_block_co_rw(void *opaque)
+{
+    QIOChannelBlockRequest *req = opaque;
+
+    bdrv_graph_co_rdlock();
+    if (req->is_write) {
+        req->ret = bdrv_writev_vmstate(req->bs, req->qiov, req->offset);
+    } else {
+        req->ret = bdrv_readv_vmstate(req->bs, req->qiov, req->offset);
+    }
+    bdrv_graph_co_rdunlock();
+
+    qemu_sem_post(&req->done);
+}
+
+
+static ssize_t
+qio_channel_block_rw(QIOChannelBlock *bioc,
+                     const struct iovec *iov,
+                     size_t niov,
+                     off_t offset,
+                     bool is_write,
+                     Error **errp)
+{
+    QEMUIOVector qiov;
+    int ret;
+
+    qemu_iovec_init_external(&qiov, (struct iovec *)iov, niov);
+    if (bioc->ctx) {
+        QIOChannelBlockRequest req = {
+            .bs = bioc->bs,
+            .qiov = &qiov,
+            .offset = offset,
+            .is_write = is_write,
+        };
+
+        qemu_sem_init(&req.done, 0);
+        aio_co_enter(bioc->ctx,
+                     qemu_coroutine_create(qio_channel_block_co_rw, &req));
+        qemu_sem_wait(&req.done);
+        qemu_sem_destroy(&req.done);
+        ret = req.ret;
+    } else if (is_write) {
+        ret = bdrv_writev_vmstate(bioc->bs, &qiov, offset);
+    } else {
+        ret = bdrv_readv_vmstate(bioc->bs, &qiov, offset);
+    }
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "%s failed",
+                         is_write ? "bdrv_writev_vmstate"
+                                  : "bdrv_readv_vmstate");
+        return -1;
+    }
+
+    return qiov.size;
+}
+
+
 static ssize_t
 qio_channel_block_readv(QIOChannel *ioc,
                         const struct iovec *iov,
@@ -57,18 +135,15 @@ qio_channel_block_readv(QIOChannel *ioc,
                         Error **errp)
 {
     QIOChannelBlock *bioc = QIO_CHANNEL_BLOCK(ioc);
-    QEMUIOVector qiov;
-    int ret;
+    ssize_t ret;
 
-    qemu_iovec_init_external(&qiov, (struct iovec *)iov, niov);
-    ret = bdrv_readv_vmstate(bioc->bs, &qiov, bioc->offset);
+    ret = qio_channel_block_rw(bioc, iov, niov, bioc->offset, false, errp);
     if (ret < 0) {
-        error_setg_errno(errp, -ret, "bdrv_readv_vmstate failed");
         return -1;
     }
 
-    bioc->offset += qiov.size;
-    return qiov.size;
+    bioc->offset += ret;
+    return ret;
 }
 
 
@@ -82,18 +157,41 @@ qio_channel_block_writev(QIOChannel *ioc,
                          Error **errp)
 {
     QIOChannelBlock *bioc = QIO_CHANNEL_BLOCK(ioc);
-    QEMUIOVector qiov;
-    int ret;
+    ssize_t ret;
 
-    qemu_iovec_init_external(&qiov, (struct iovec *)iov, niov);
-    ret = bdrv_writev_vmstate(bioc->bs, &qiov, bioc->offset);
+    ret = qio_channel_block_rw(bioc, iov, niov, bioc->offset, true, errp);
     if (ret < 0) {
-        error_setg_errno(errp, -ret, "bdrv_writev_vmstate failed");
         return -1;
     }
 
-    bioc->offset += qiov.size;
-    return qiov.size;
+    bioc->offset += ret;
+    return ret;
+}
+
+
+static ssize_t
+qio_channel_block_preadv(QIOChannel *ioc,
+                         const struct iovec *iov,
+                         size_t niov,
+                         off_t offset,
+                         Error **errp)
+{
+    QIOChannelBlock *bioc = QIO_CHANNEL_BLOCK(ioc);
+
+    return qio_channel_block_rw(bioc, iov, niov, offset, false, errp);
+}
+
+
+static ssize_t
+qio_channel_block_pwritev(QIOChannel *ioc,
+                          const struct iovec *iov,
+                          size_t niov,
+                          off_t offset,
+                          Error **errp)
+{
+    QIOChannelBlock *bioc = QIO_CHANNEL_BLOCK(ioc);
+
+    return qio_channel_block_rw(bioc, iov, niov, offset, true, errp);
 }
 
 
@@ -123,7 +221,7 @@ qio_channel_block_seek(QIOChannel *ioc,
         bioc->offset = offset;
         break;
     case SEEK_CUR:
-        bioc->offset += whence;
+        bioc->offset += offset;
         break;
     case SEEK_END:
         error_setg(errp, "Size of VMstate region is unknown");
@@ -176,6 +274,8 @@ qio_channel_block_class_init(ObjectClass *klass,
 
     ioc_klass->io_writev = qio_channel_block_writev;
     ioc_klass->io_readv = qio_channel_block_readv;
+    ioc_klass->io_pwritev = qio_channel_block_pwritev;
+    ioc_klass->io_preadv = qio_channel_block_preadv;
     ioc_klass->io_set_blocking = qio_channel_block_set_blocking;
     ioc_klass->io_seek = qio_channel_block_seek;
     ioc_klass->io_close = qio_channel_block_close;
@@ -40,6 +40,7 @@ struct QIOChannelBlock {
     QIOChannel parent;
     BlockDriverState *bs;
     off_t offset;
+    AioContext *ctx;
 };
 
 
@@ -56,4 +57,16 @@ struct QIOChannelBlock {
 QIOChannelBlock *
 qio_channel_block_new(BlockDriverState *bs);
 
+/**
+ * qio_channel_block_set_aio_context:
+ * @ioc: the channel object
+ * @ctx: the AioContext to do I/O from, or NULL
+ *
+ * Make reads and writes of the VMState region run in @ctx,
+ * so that they can be issued from threads that don't hold
+ * the BQL, like the migration and multifd threads.
+ */
+void
+qio_channel_block_set_aio_context(QIOChannelBlock *ioc, AioContext *ctx);
+
 #endif /* QIO_CHANNEL_BLOCK_H */
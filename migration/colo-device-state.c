@@ -0,0 +1,140 @@
+/*
+ * Incremental device state of COLO checkpoints
+ *
+ * With x-colo-incremental-state, the device state of each checkpoint is
+ * still saved as a whole, but the sections identical to the previous
+ * checkpoint are replaced on the wire by a marker, and the secondary
+ * takes them from the state it received last time.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "colo-device-state.h"
+
+/* How each section of the device state is sent */
+#define COLO_SECTION_DATA       0
+#define COLO_SECTION_UNCHANGED  1
+
+void colo_device_state_reset(COLODeviceState *ds)
+{
+    g_clear_pointer(&ds->data, g_byte_array_unref);
+    g_clear_pointer(&ds->section_ends, g_array_unref);
+}
+
+static void colo_device_state_update(COLODeviceState *ds,
+                                     const uint8_t *data, size_t size,
+                                     GArray *section_ends)
+{
+    colo_device_state_reset(ds);
+    ds->data = g_byte_array_sized_new(size);
+    g_byte_array_append(ds->data, data, size);
+    ds->section_ends = g_array_ref(section_ends);
+}
+
+static uint64_t colo_section_start(GArray *section_ends, guint i)
+{
+    return i ? g_array_index(section_ends, uint64_t, i - 1) : 0;
+}
+
+static uint64_t colo_section_size(GArray *section_ends, guint i)
+{
+    return g_array_index(section_ends, uint64_t, i) -
+           colo_section_start(section_ends, i);
+}
+
+void colo_device_state_put(QEMUFile *f, COLODeviceState *last,
+                           const uint8_t *data, size_t size,
+                           GArray *section_ends)
+{
+    guint i;
+
+    qemu_put_be32(f, section_ends->len);
+    for (i = 0; i < section_ends->len; i++) {
+        uint64_t start = colo_section_start(section_ends, i);
+        uint64_t section_size = colo_section_size(section_ends, i);
+
+        if (last->data && i < last->section_ends->len &&
+            colo_section_size(last->section_ends, i) == section_size &&
+            !memcmp(data + start,
+                    last->data->data +
+                    colo_section_start(last->section_ends, i),
+                    section_size)) {
+            qemu_put_byte(f, COLO_SECTION_UNCHANGED);
+            continue;
+        }
+
+        qemu_put_byte(f, COLO_SECTION_DATA);
+        qemu_put_be64(f, section_size);
+        qemu_put_buffer(f, data + start, section_size);
+    }
+
+    colo_device_state_update(last, data, size, section_ends);
+}
+
+bool colo_device_state_get(QEMUFile *f, COLODeviceState *last,
+                           uint8_t *buf, uint64_t size, Error **errp)
+{
+    g_autoptr(GArray) section_ends = g_array_new(false, false,
+                                                 sizeof(uint64_t));
+    uint64_t offset = 0;
+    uint32_t i, nr_sections;
+
+    nr_sections = qemu_get_be32(f);
+    for (i = 0; i < nr_sections; i++) {
+        uint8_t type = qemu_get_byte(f);
+        uint64_t section_size;
+
+        switch (type) {
+        case COLO_SECTION_UNCHANGED:
+            if (!last->data || i >= last->section_ends->len) {
+                error_setg(errp, "COLO: unchanged device state section %u "
+                           "was never received", i);
+                return false;
+            }
+            section_size = colo_section_size(last->section_ends, i);
+            if (section_size > size - offset) {
+                break;
+            }
+            memcpy(buf + offset,
+                   last->data->data + colo_section_start(last->section_ends, i),
+                   section_size);
+            break;
+        case COLO_SECTION_DATA:
+            section_size = qemu_get_be64(f);
+            if (section_size > size - offset) {
+                break;
+            }
+            if (qemu_get_buffer(f, buf + offset, section_size) !=
+                section_size) {
+                error_setg(errp, "COLO: short read of device state section "
+                           "%u", i);
+                return false;
+            }
+            break;
+        default:
+            error_setg(errp, "COLO: unknown device state section type %u",
+                       type);
+            return false;
+        }
+
+        if (section_size > size - offset) {
+            error_setg(errp, "COLO: device state section %u overflows the "
+                       "%" PRIu64 " bytes of VMState data", i, size);
+            return false;
+        }
+        offset += section_size;
+        g_array_append_val(section_ends, offset);
+    }
+
+    if (qemu_file_get_error(f) || offset != size) {
+        error_setg(errp, "Got %" PRIu64 " VMState data, expected %" PRIu64,
+                   offset, size);
+        return false;
+    }
+
+    colo_device_state_update(last, buf, size, section_ends);
+    return true;
+}
@@ -0,0 +1,41 @@
+/*
+ * Incremental device state of COLO checkpoints
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_COLO_DEVICE_STATE_H
+#define QEMU_MIGRATION_COLO_DEVICE_STATE_H
+
+#include "qemu-file.h"
+
+/* Device state of the last checkpoint, split in sections */
+typedef struct COLODeviceState {
+    GByteArray *data;
+    /* End offset in @data of each section, uint64_t */
+    GArray *section_ends;
+} COLODeviceState;
+
+void colo_device_state_reset(COLODeviceState *ds);
+
+/*
+ * colo_device_state_put: Send the @size bytes of device state in @data,
+ * ending at @section_ends, replacing the sections that are identical in
+ * @last with a marker.  @last becomes the new state.
+ */
+void colo_device_state_put(QEMUFile *f, COLODeviceState *last,
+                           const uint8_t *data, size_t size,
+                           GArray *section_ends);
+
+/*
+ * colo_device_state_get: Receive @size bytes of device state sent by
+ * colo_device_state_put() into @buf, taking the unchanged sections from
+ * @last.  @last becomes the new state.
+ *
+ * Returns false and sets @errp on error.
+ */
+bool colo_device_state_get(QEMUFile *f, COLODeviceState *last,
+                           uint8_t *buf, uint64_t size, Error **errp);
+
+#endif
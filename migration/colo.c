@@ -17,6 +17,7 @@
 #include "migration.h"
 #include "qemu-file.h"
 #include "savevm.h"
+#include "colo-device-state.h"
 #include "migration/colo.h"
 #include "block.h"
 #include "io/channel-buffer.h"
@@ -24,6 +25,7 @@
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/rcu.h"
+#include "qemu/stats64.h"
 #include "migration/failover.h"
 #include "migration/ram.h"
 #include "block/replication.h"
@@ -44,6 +46,18 @@ static COLOMode last_colo_mode;
 
 #define COLO_BUFFER_BASE_SIZE (4 * 1024 * 1024)
 
+/*
+ * Device state of the last checkpoint with x-colo-incremental-state,
+ * only used by the thread doing the checkpoints.
+ */
+static COLODeviceState colo_last_state;
+
+/* Upper bounds of the checkpoint latency histogram, in microseconds */
+static const uint64_t colo_latency_boundaries[] = {
+    1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000,
+};
+static Stat64 colo_latency_bins[ARRAY_SIZE(colo_latency_boundaries) + 1];
+
 bool migration_in_colo_state(void)
 {
     MigrationState *s = migrate_get_current();
@@ -63,6 +77,55 @@ static bool colo_runstate_is_stopped(void)
     return runstate_check(RUN_STATE_COLO) || !runstate_is_running();
 }
 
+static void colo_checkpoint_latency_reset(void)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(colo_latency_bins); i++) {
+        stat64_set(&colo_latency_bins[i], 0);
+    }
+}
+
+/* Accounts a checkpoint during which the VM was stopped since @start_us */
+static void colo_checkpoint_latency_add(int64_t start_us)
+{
+    uint64_t latency = qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start_us;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(colo_latency_boundaries); i++) {
+        if (latency < colo_latency_boundaries[i]) {
+            break;
+        }
+    }
+    stat64_add(&colo_latency_bins[i], 1);
+    trace_colo_checkpoint_latency(latency);
+}
+
+static COLOCheckpointLatency *colo_checkpoint_latency_info(void)
+{
+    COLOCheckpointLatency *info = g_new0(COLOCheckpointLatency, 1);
+    uint64List **boundaries = &info->boundaries;
+    uint64List **bins = &info->bins;
+    uint64_t total = 0;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(colo_latency_boundaries); i++) {
+        QAPI_LIST_APPEND(boundaries, colo_latency_boundaries[i]);
+    }
+    for (i = 0; i < ARRAY_SIZE(colo_latency_bins); i++) {
+        uint64_t count = stat64_get(&colo_latency_bins[i]);
+
+        QAPI_LIST_APPEND(bins, count);
+        total += count;
+    }
+
+    if (!total) {
+        qapi_free_COLOCheckpointLatency(info);
+        return NULL;
+    }
+    return info;
+}
+
 static void colo_checkpoint_notify(void)
 {
     MigrationState *s = migrate_get_current();
@@ -306,6 +369,8 @@ COLOStatus *qmp_query_colo_status(Error **errp)
         }
     }
 
+    s->checkpoint_latency = colo_checkpoint_latency_info();
+
     return s;
 }
 
@@ -403,11 +468,35 @@ static uint64_t colo_receive_message_value(QEMUFile *f, uint32_t expect_msg,
     return value;
 }
 
+typedef struct COLOSaveSections {
+    QEMUFile *fb;
+    QIOChannelBuffer *bioc;
+    GArray *section_ends;
+} COLOSaveSections;
+
+static void colo_save_section_end(void *opaque)
+{
+    COLOSaveSections *ss = opaque;
+    uint64_t end;
+
+    qemu_fflush(ss->fb);
+    end = ss->bioc->usage;
+    g_array_append_val(ss->section_ends, end);
+}
+
 static int colo_do_checkpoint_transaction(MigrationState *s,
                                           QIOChannelBuffer *bioc,
                                           QEMUFile *fb)
 {
+    g_autoptr(GArray) section_ends = g_array_new(false, false,
+                                                 sizeof(uint64_t));
+    COLOSaveSections ss = {
+        .fb = fb,
+        .bioc = bioc,
+        .section_ends = section_ends,
+    };
     Error *local_err = NULL;
+    int64_t stop_time;
     int ret = -1;
 
     colo_send_message(s->to_dst_file, COLO_MESSAGE_CHECKPOINT_REQUEST,
@@ -432,6 +521,7 @@ static int colo_do_checkpoint_transaction(MigrationState *s,
     }
     vm_stop_force_state(RUN_STATE_COLO);
     bql_unlock();
+    stop_time = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     trace_colo_vm_state_change("run", "stop");
     /*
      * Failover request bh could be called after vm_stop_force_state(),
@@ -454,7 +544,11 @@ static int colo_do_checkpoint_transaction(MigrationState *s,
         goto out;
     }
     /* Note: device state is saved into buffer */
-    ret = qemu_save_device_state(fb);
+    if (migrate_colo_incremental_state()) {
+        ret = qemu_save_device_state_sections(fb, colo_save_section_end, &ss);
+    } else {
+        ret = qemu_save_device_state(fb);
+    }
 
     bql_unlock();
     if (ret < 0) {
@@ -483,7 +577,12 @@ static int colo_do_checkpoint_transaction(MigrationState *s,
         goto out;
     }
 
-    qemu_put_buffer(s->to_dst_file, bioc->data, bioc->usage);
+    if (migrate_colo_incremental_state()) {
+        colo_device_state_put(s->to_dst_file, &colo_last_state, bioc->data,
+                              bioc->usage, section_ends);
+    } else {
+        qemu_put_buffer(s->to_dst_file, bioc->data, bioc->usage);
+    }
     ret = qemu_fflush(s->to_dst_file);
     if (ret < 0) {
         goto out;
@@ -509,6 +608,7 @@ static int colo_do_checkpoint_transaction(MigrationState *s,
 
     ret = 0;
 
+    colo_checkpoint_latency_add(stop_time);
     bql_lock();
     vm_start();
     bql_unlock();
@@ -539,6 +639,7 @@ static void colo_process_checkpoint(MigrationState *s)
     }
 
     failover_init_state();
+    colo_checkpoint_latency_reset();
 
     s->rp_state.from_dst_file = qemu_file_get_return_path(s->to_dst_file);
     if (!s->rp_state.from_dst_file) {
@@ -602,6 +703,7 @@ out:
     if (fb) {
         qemu_fclose(fb);
     }
+    colo_device_state_reset(&colo_last_state);
 
     /*
      * There are only two reasons we can get here, some error happened
@@ -659,12 +761,14 @@ static void colo_incoming_process_checkpoint(MigrationIncomingState *mis,
 {
     uint64_t total_size;
     uint64_t value;
+    int64_t stop_time;
     Error *local_err = NULL;
     int ret;
 
     bql_lock();
     vm_stop_force_state(RUN_STATE_COLO);
     bql_unlock();
+    stop_time = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     trace_colo_vm_state_change("run", "stop");
 
     /* FIXME: This is unnecessary for periodic checkpoint mode */
@@ -708,11 +812,19 @@ static void colo_incoming_process_checkpoint(MigrationIncomingState *mis,
         bioc->capacity = value;
         bioc->data = g_realloc(bioc->data, bioc->capacity);
     }
-    total_size = qemu_get_buffer(mis->from_src_file, bioc->data, value);
-    if (total_size != value) {
-        error_setg(errp, "Got %" PRIu64 " VMState data, less than expected"
-                    " %" PRIu64, total_size, value);
-        return;
+    if (migrate_colo_incremental_state()) {
+        if (!colo_device_state_get(mis->from_src_file, &colo_last_state,
+                                   bioc->data, value, errp)) {
+            return;
+        }
+        total_size = value;
+    } else {
+        total_size = qemu_get_buffer(mis->from_src_file, bioc->data, value);
+        if (total_size != value) {
+            error_setg(errp, "Got %" PRIu64 " VMState data, less than "
+                       "expected %" PRIu64, total_size, value);
+            return;
+        }
     }
     bioc->usage = total_size;
     qio_channel_io_seek(QIO_CHANNEL(bioc), 0, 0, NULL);
@@ -762,6 +874,7 @@ static void colo_incoming_process_checkpoint(MigrationIncomingState *mis,
     }
 
     vmstate_loading = false;
+    colo_checkpoint_latency_add(stop_time);
     vm_start();
     bql_unlock();
     trace_colo_vm_state_change("stop", "run");
@@ -836,6 +949,7 @@ static void *colo_process_incoming_thread(void *opaque)
     }
 
     failover_init_state();
+    colo_checkpoint_latency_reset();
 
     mis->to_src_file = qemu_file_get_return_path(mis->from_src_file);
     if (!mis->to_src_file) {
@@ -910,6 +1024,7 @@ out:
     if (fb) {
         qemu_fclose(fb);
     }
+    colo_device_state_reset(&colo_last_state);
 
     /* Hope this not to be too long to loop here */
     qemu_sem_wait(&mis->colo_incoming_sem);
@@ -16,7 +16,11 @@
 #include "io/channel-file.h"
 #include "io/channel-socket.h"
 #include "io/channel-util.h"
+#ifdef CONFIG_LINUX_IO_URING
+#include "io/channel-uring.h"
+#endif
 #include "options.h"
+#include "ram.h"
 #include "trace.h"
 
 #define OFFSET_OPTION ",offset="
@@ -80,16 +84,31 @@ void file_start_outgoing_migration(MigrationState *s,
     g_autoptr(QIOChannelFile) fioc = NULL;
     g_autofree char *filename = g_strdup(file_args->filename);
     uint64_t offset = file_args->offset;
+    int flags = O_CREAT | O_WRONLY;
     QIOChannel *ioc;
 
     trace_migration_file_outgoing(filename);
 
-    fioc = qio_channel_file_new_path(filename, O_CREAT | O_WRONLY | O_TRUNC,
-                                     0600, errp);
+    if (!migrate_mapped_ram()) {
+        flags |= O_TRUNC;
+    }
+
+    fioc = qio_channel_file_new_path(filename, flags, 0600, errp);
     if (!fioc) {
         return;
     }
 
+    /*
+     * An incremental checkpoint rewrites the previous one in place, if
+     * the file is still the one it left
+     */
+    if (migrate_mapped_ram() &&
+        !ram_mapped_ram_checkpoint_start(filename, offset, fioc->fd) &&
+        ftruncate(fioc->fd, 0) < 0) {
+        error_setg_errno(errp, errno, "Failed to truncate migration file");
+        return;
+    }
+
     outgoing_args.fname = g_strdup(filename);
 
     ioc = QIO_CHANNEL(fioc);
@@ -166,6 +185,19 @@ void file_start_incoming_migration(FileMigrationArgs *file_args, Error **errp)
     file_create_incoming_channels(QIO_CHANNEL(fioc), errp);
 }
 
+static ssize_t file_write_slice(QIOChannel *ioc, const struct iovec *iov,
+                                int niov, off_t offset, Error **errp)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    /* Only queued, the caller submits the writes of all slices at once */
+    if (object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_URING)) {
+        return qio_channel_uring_pwritev_queue(QIO_CHANNEL_URING(ioc), iov,
+                                               niov, offset, errp);
+    }
+#endif
+    return qio_channel_pwritev(ioc, iov, niov, offset, errp);
+}
+
 int file_write_ramblock_iov(QIOChannel *ioc, const struct iovec *iov,
                             int niov, RAMBlock *block, Error **errp)
 {
@@ -207,8 +239,8 @@ int file_write_ramblock_iov(QIOChannel *ioc, const struct iovec *iov,
             break;
         }
 
-        ret = qio_channel_pwritev(ioc, &iov[slice_idx], slice_num,
-                                  block->pages_offset + offset, errp);
+        ret = file_write_slice(ioc, &iov[slice_idx], slice_num,
+                               block->pages_offset + offset, errp);
         if (ret < 0) {
             break;
         }
@@ -217,6 +249,12 @@ int file_write_ramblock_iov(QIOChannel *ioc, const struct iovec *iov,
         slice_num = 0;
     }
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (ret >= 0 && object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_URING)) {
+        ret = qio_channel_uring_flush(QIO_CHANNEL_URING(ioc), errp);
+    }
+#endif
+
     return (ret < 0) ? ret : 0;
 }
 
@@ -217,6 +217,11 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
         g_free(str);
         visit_free(v);
     }
+
+    if (info->has_postcopy_prefetched_pages) {
+        monitor_printf(mon, "postcopy prefetched pages: %" PRIu64 "\n",
+                       info->postcopy_prefetched_pages);
+    }
     if (info->has_socket_address) {
         SocketAddressList *addr;
 
@@ -397,6 +402,11 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "%s: %s\n",
             MigrationParameter_str(MIGRATION_PARAMETER_MODE),
             qapi_enum_lookup(&MigMode_lookup, params->mode));
+
+        assert(params->has_postcopy_prefetch_window);
+        monitor_printf(mon, "%s: %u pages\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_POSTCOPY_PREFETCH_WINDOW),
+            params->postcopy_prefetch_window);
     }
 
     qapi_free_MigrationParameters(params);
@@ -690,6 +700,10 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_mode = true;
         visit_type_MigMode(v, param, &p->mode, &err);
         break;
+    case MIGRATION_PARAMETER_POSTCOPY_PREFETCH_WINDOW:
+        p->has_postcopy_prefetch_window = true;
+        visit_type_uint32(v, param, &p->postcopy_prefetch_window, &err);
+        break;
     default:
         assert(0);
     }
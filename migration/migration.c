@@ -32,6 +32,7 @@
 #include "migration/misc.h"
 #include "migration.h"
 #include "migration-stats.h"
+#include "auto-tune.h"
 #include "savevm.h"
 #include "qemu-file.h"
 #include "channel.h"
@@ -75,6 +76,7 @@
 static NotifierWithReturnList migration_state_notifiers[] = {
     NOTIFIER_ELEM_INIT(migration_state_notifiers, MIG_MODE_NORMAL),
     NOTIFIER_ELEM_INIT(migration_state_notifiers, MIG_MODE_CPR_REBOOT),
+    NOTIFIER_ELEM_INIT(migration_state_notifiers, MIG_MODE_CPR_TRANSFER),
 };
 
 /* Messages sent on the return path from destination to source */
@@ -150,6 +152,23 @@ static bool transport_supports_multi_channels(MigrationAddress *addr)
     }
 }
 
+static bool migration_needs_fd_passing(void)
+{
+    return migrate_mode() == MIG_MODE_CPR_TRANSFER;
+}
+
+static bool transport_supports_fd_passing(MigrationAddress *addr)
+{
+    if (addr->transport == MIGRATION_ADDRESS_TYPE_SOCKET) {
+        SocketAddress *saddr = &addr->u.socket;
+
+        return (saddr->type == SOCKET_ADDRESS_TYPE_UNIX ||
+                saddr->type == SOCKET_ADDRESS_TYPE_FD);
+    }
+
+    return false;
+}
+
 static bool migration_needs_seekable_channel(void)
 {
     return migrate_mapped_ram();
@@ -180,6 +199,13 @@ migration_channels_and_transport_compatible(MigrationAddress *addr,
         return false;
     }
 
+    if (migration_needs_fd_passing() &&
+        !transport_supports_fd_passing(addr)) {
+        error_setg(errp, "Migration requires a UNIX socket transport "
+                   "(e.g. unix)");
+        return false;
+    }
+
     return true;
 }
 
@@ -238,6 +264,7 @@ void migration_object_init(void)
 
     blk_mig_init();
     ram_mig_init();
+    migration_auto_tune_init();
     dirty_bitmap_mig_init();
 }
 
@@ -431,15 +458,17 @@ static int migrate_send_rp_message(MigrationIncomingState *mis,
  *   Len: Length in bytes required - must be a multiple of pagesize
  */
 int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
-                                      RAMBlock *rb, ram_addr_t start)
+                                      RAMBlock *rb, ram_addr_t start,
+                                      size_t len)
 {
     uint8_t bufc[12 + 1 + 255]; /* start (8), len (4), rbname up to 256 */
     size_t msglen = 12; /* start + len */
-    size_t len = qemu_ram_pagesize(rb);
     enum mig_rp_message_type msg_type;
     const char *rbname;
     int rbname_len;
 
+    assert(len <= UINT32_MAX && QEMU_IS_ALIGNED(len, qemu_ram_pagesize(rb)));
+
     *(uint64_t *)bufc = cpu_to_be64((uint64_t)start);
     *(uint32_t *)(bufc + 8) = cpu_to_be32((uint32_t)len);
 
@@ -495,7 +524,8 @@ int migrate_send_rp_req_pages(MigrationIncomingState *mis,
         return 0;
     }
 
-    return migrate_send_rp_message_req_pages(mis, rb, start);
+    return migrate_send_rp_message_req_pages(mis, rb, start,
+                                             qemu_ram_pagesize(rb));
 }
 
 static bool migration_colo_enabled;
@@ -817,6 +847,10 @@ static void migration_incoming_setup(QEMUFile *f)
 
     if (!mis->from_src_file) {
         mis->from_src_file = f;
+        /* Only cpr-transfer hands over fds, with the RAM blocks */
+        if (migrate_mode() == MIG_MODE_CPR_TRANSFER) {
+            qemu_file_accept_fds(f);
+        }
     }
     qemu_file_set_blocking(f, false);
 }
@@ -1255,6 +1289,7 @@ static void fill_source_migration_info(MigrationInfo *info)
         populate_ram_info(info, s);
         populate_disk_info(info);
         migration_populate_vfio_info(info);
+        migration_auto_tune_populate_info(info);
         break;
     case MIGRATION_STATUS_COLO:
         info->has_status = true;
@@ -1264,6 +1299,7 @@ static void fill_source_migration_info(MigrationInfo *info)
         populate_time_info(info, s);
         populate_ram_info(info, s);
         migration_populate_vfio_info(info);
+        migration_auto_tune_populate_info(info);
         break;
     case MIGRATION_STATUS_FAILED:
         info->has_status = true;
@@ -1411,6 +1447,8 @@ static void migrate_fd_cleanup(MigrationState *s)
     migration_call_notifiers(s, type, NULL);
     block_cleanup_parameters();
     yank_unregister_instance(MIGRATION_YANK_INSTANCE);
+    s->savevm_live_snapshot = NULL;
+    s->savevm_live_opaque = NULL;
 }
 
 static void migrate_fd_cleanup_bh(void *opaque)
@@ -1640,7 +1678,8 @@ bool migration_thread_is_self(void)
 
 bool migrate_mode_is_cpr(MigrationState *s)
 {
-    return s->parameters.mode == MIG_MODE_CPR_REBOOT;
+    return s->parameters.mode == MIG_MODE_CPR_REBOOT ||
+           s->parameters.mode == MIG_MODE_CPR_TRANSFER;
 }
 
 int migrate_init(MigrationState *s, Error **errp)
@@ -1685,6 +1724,7 @@ int migrate_init(MigrationState *s, Error **errp)
      */
     memset(&mig_stats, 0, sizeof(mig_stats));
     migration_reset_vfio_bytes_transferred();
+    migration_auto_tune_reset();
 
     return 0;
 }
@@ -3188,6 +3228,10 @@ static void migration_update_counters(MigrationState *s,
                               /* Both in unit bytes/ms */
                               bandwidth, switchover_bw / 1000,
                               s->threshold_size);
+
+    if (migrate_auto_tune()) {
+        migration_auto_tune(s, bandwidth, current_time);
+    }
 }
 
 static bool migration_can_switchover(MigrationState *s)
@@ -3615,6 +3659,18 @@ static void *bg_migration_thread(void *opaque)
      */
     qemu_fflush(fb);
 
+    /* A live snapshot takes the disk snapshots at this point in time */
+    if (s->savevm_live_snapshot) {
+        Error *local_err = NULL;
+
+        if (!s->savevm_live_snapshot(s->savevm_live_opaque, &local_err)) {
+            migrate_set_error(s, local_err);
+            error_free(local_err);
+            vm_resume(s->vm_old_state);
+            goto fail;
+        }
+    }
+
     /* Now initialize UFFD context and start tracking RAM writes */
     if (ram_write_tracking_start()) {
         goto fail;
@@ -3669,6 +3725,51 @@ fail:
     return NULL;
 }
 
+/*
+ * Save the VM state of a live snapshot into @ioc.  RAM is saved like a
+ * background snapshot, with the VM running.  @snapshot is called from the
+ * migration thread with the VM stopped and the BQL held, at the point in
+ * time the VM state is saved for.  The end of the save is reported to the
+ * migration notifiers.
+ */
+bool migrate_savevm_live(QIOChannel *ioc,
+                         bool (*snapshot)(void *opaque, Error **errp),
+                         void *opaque, Error **errp)
+{
+    MigrationState *s = migrate_get_current();
+    bool new_caps[MIGRATION_CAPABILITY__MAX];
+    QEMUFile *f;
+
+    if (migrate_return_path() || migrate_mapped_ram() ||
+        migrate_mode_is_cpr(s)) {
+        error_setg(errp, "Live snapshots can't use the return-path or "
+                   "mapped-ram capabilities, or CPR");
+        return false;
+    }
+
+    memcpy(new_caps, s->capabilities, sizeof(new_caps));
+    new_caps[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT] = true;
+    if (!migrate_caps_check(s->capabilities, new_caps, errp)) {
+        return false;
+    }
+
+    if (!migrate_prepare(s, false, false, false, errp) ||
+        !yank_register_instance(MIGRATION_YANK_INSTANCE, errp)) {
+        return false;
+    }
+
+    s->savevm_live_snapshot = snapshot;
+    s->savevm_live_opaque = opaque;
+
+    f = qemu_file_new_output(ioc);
+    qemu_mutex_lock(&s->qemu_file_lock);
+    s->to_dst_file = f;
+    qemu_mutex_unlock(&s->qemu_file_lock);
+
+    migrate_fd_connect(s, NULL);
+    return true;
+}
+
 void migrate_fd_connect(MigrationState *s, Error *error_in)
 {
     Error *local_err = NULL;
@@ -19,6 +19,7 @@
 #include "qapi/qapi-types-migration.h"
 #include "qapi/qmp/json-writer.h"
 #include "qemu/thread.h"
+#include "qemu/stats64.h"
 #include "qemu/coroutine_int.h"
 #include "io/channel.h"
 #include "io/channel-buffer.h"
@@ -179,6 +180,9 @@ struct MigrationIncomingState {
      * */
     struct PostcopyBlocktimeContext *blocktime_ctx;
 
+    /* Pages requested ahead of postcopy fault streams */
+    Stat64 postcopy_prefetched_pages;
+
     /* notify PAUSED postcopy incoming migrations to try to continue */
     QemuSemaphore postcopy_pause_sem_dst;
     QemuSemaphore postcopy_pause_sem_fault;
@@ -266,6 +270,13 @@ struct MigrationState {
      */
     QemuSemaphore postcopy_qemufile_src_sem;
     QIOChannelBuffer *bioc;
+    /*
+     * With multifd and mapped-ram, the node holding the VM state of the
+     * snapshot being saved or loaded, and the IOThread doing the block
+     * I/O of its multifd channels.  NULL otherwise.
+     */
+    BlockDriverState *savevm_multifd_bs;
+    struct IOThread *savevm_multifd_iothread;
     /*
      * Protects to_dst_file/from_dst_file pointers.  We need to make sure we
      * won't yield or hang during the critical section, since this lock will be
@@ -465,6 +476,14 @@ struct MigrationState {
     bool switchover_acked;
     /* Is this a rdma migration */
     bool rdma_migration;
+
+    /*
+     * Set while snapshot-save saves the VM state of a live snapshot, which
+     * runs as a background snapshot.  Called from the migration thread
+     * with the VM stopped, to snapshot the disks at the same point in time.
+     */
+    bool (*savevm_live_snapshot)(void *opaque, Error **errp);
+    void *savevm_live_opaque;
 };
 
 void migrate_set_state(int *state, int old_state, int new_state);
@@ -479,6 +498,9 @@ void migrate_set_error(MigrationState *s, const Error *error);
 bool migrate_has_error(MigrationState *s);
 
 void migrate_fd_connect(MigrationState *s, Error *error_in);
+bool migrate_savevm_live(QIOChannel *ioc,
+                         bool (*snapshot)(void *opaque, Error **errp),
+                         void *opaque, Error **errp);
 
 int migration_call_notifiers(MigrationState *s, MigrationEventType type,
                              Error **errp);
@@ -502,7 +524,8 @@ void migrate_send_rp_pong(MigrationIncomingState *mis,
 int migrate_send_rp_req_pages(MigrationIncomingState *mis, RAMBlock *rb,
                               ram_addr_t start, uint64_t haddr);
 int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
-                                      RAMBlock *rb, ram_addr_t start);
+                                      RAMBlock *rb, ram_addr_t start,
+                                      size_t len);
 void migrate_send_rp_recv_bitmap(MigrationIncomingState *mis,
                                  char *block_name);
 void migrate_send_rp_resume_ack(MigrationIncomingState *mis, uint32_t value);
@@ -12,8 +12,10 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "qemu/rcu.h"
 #include "exec/target_page.h"
+#include "sysemu/runstate.h"
 #include "sysemu/sysemu.h"
 #include "exec/ramblock.h"
 #include "qemu/error-report.h"
@@ -26,11 +28,17 @@
 #include "qemu-file.h"
 #include "trace.h"
 #include "multifd.h"
+#include "ram.h"
+#include "migration/colo.h"
 #include "threadinfo.h"
+#include "savevm.h"
 #include "options.h"
 #include "qemu/yank.h"
 #include "io/channel-file.h"
 #include "io/channel-socket.h"
+#ifdef CONFIG_LINUX_IO_URING
+#include "io/channel-uring.h"
+#endif
 #include "yank_functions.h"
 
 /* Multiple fd's */
@@ -71,6 +79,11 @@ struct {
     QemuSemaphore channels_created;
     /* send channels ready */
     QemuSemaphore channels_ready;
+    /*
+     * Serializes job submission between the migration thread and the
+     * device state threads, which may queue buffers concurrently.
+     */
+    QemuMutex queue_job_mutex;
     /*
      * Have we already run terminate threads.  There is a race when it
      * happens that we got one error while we are exiting.
@@ -485,6 +498,20 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
     p->next_packet_size = be32_to_cpu(packet->next_packet_size);
     p->packet_num = be64_to_cpu(packet->packet_num);
     p->packets_recved++;
+
+    if (p->flags & MULTIFD_FLAG_DEVICE_STATE) {
+        if (p->normal_num || p->zero_num ||
+            p->next_packet_size > MULTIFD_DEVICE_STATE_MAX_SIZE) {
+            error_setg(errp, "multifd: received malformed device state "
+                       "packet of size %u", p->next_packet_size);
+            return -1;
+        }
+        /* make sure that the idstr is 0 terminated */
+        packet->ramblock[255] = 0;
+        packet->instance_id = be32_to_cpu(packet->instance_id);
+        return 0;
+    }
+
     p->total_normal_pages += p->normal_num;
     p->total_zero_pages += p->zero_num;
 
@@ -505,6 +532,16 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
     }
 
     p->host = p->block->host;
+    /* In COLO stage, the pages go to the cache first, see ram_load_precopy() */
+    if (migration_incoming_colo_enabled() &&
+        migration_incoming_in_colo_state()) {
+        if (!p->block->colo_cache) {
+            error_setg(errp, "multifd: colo_cache is NULL in block %s",
+                       p->block->idstr);
+            return -1;
+        }
+        p->host = p->block->colo_cache;
+    }
     for (i = 0; i < p->normal_num; i++) {
         uint64_t offset = be64_to_cpu(packet->offset[i]);
 
@@ -573,15 +610,14 @@ static void multifd_send_kick_main(MultiFDSendParams *p)
  *
  * Returns true if succeed, false otherwise.
  */
-static bool multifd_send_pages(void)
+static MultiFDSendParams *multifd_send_get_free_channel(void)
 {
     int i;
     static int next_channel;
     MultiFDSendParams *p = NULL; /* make happy gcc */
-    MultiFDPages_t *pages = multifd_send_state->pages;
 
     if (multifd_send_should_exit()) {
-        return false;
+        return NULL;
     }
 
     /* We wait here, until at least one channel is ready */
@@ -595,7 +631,7 @@ static bool multifd_send_pages(void)
     next_channel %= migrate_multifd_channels();
     for (i = next_channel;; i = (i + 1) % migrate_multifd_channels()) {
         if (multifd_send_should_exit()) {
-            return false;
+            return NULL;
         }
         p = &multifd_send_state->params[i];
         /*
@@ -613,7 +649,24 @@ static bool multifd_send_pages(void)
      * qatomic_store_release() in multifd_send_thread().
      */
     smp_mb_acquire();
+
+    return p;
+}
+
+static bool multifd_send_pages(void)
+{
+    MultiFDSendParams *p;
+    MultiFDPages_t *pages = multifd_send_state->pages;
+
+    QEMU_LOCK_GUARD(&multifd_send_state->queue_job_mutex);
+
+    p = multifd_send_get_free_channel();
+    if (!p) {
+        return false;
+    }
+
     assert(!p->pages->num);
+    assert(!p->device_state);
     multifd_send_state->pages = p->pages;
     p->pages = pages;
     /*
@@ -779,6 +832,11 @@ static bool multifd_send_cleanup_channel(MultiFDSendParams *p, Error **errp)
     p->name = NULL;
     multifd_pages_clear(p->pages);
     p->pages = NULL;
+    if (p->device_state) {
+        g_free(p->device_state->buf);
+        g_free(p->device_state);
+        p->device_state = NULL;
+    }
     p->packet_len = 0;
     g_free(p->packet);
     p->packet = NULL;
@@ -795,6 +853,7 @@ static void multifd_send_cleanup_state(void)
     socket_cleanup_outgoing_migration();
     qemu_sem_destroy(&multifd_send_state->channels_created);
     qemu_sem_destroy(&multifd_send_state->channels_ready);
+    qemu_mutex_destroy(&multifd_send_state->queue_job_mutex);
     g_free(multifd_send_state->params);
     multifd_send_state->params = NULL;
     multifd_pages_clear(multifd_send_state->pages);
@@ -860,6 +919,9 @@ int multifd_send_sync_main(void)
 
     flush_zero_copy = migrate_zero_copy_send();
 
+    /* Keep device state threads from grabbing channels mid-sync */
+    QEMU_LOCK_GUARD(&multifd_send_state->queue_job_mutex);
+
     for (i = 0; i < migrate_multifd_channels(); i++) {
         MultiFDSendParams *p = &multifd_send_state->params[i];
 
@@ -897,6 +959,132 @@ int multifd_send_sync_main(void)
     return 0;
 }
 
+/*
+ * Device state travels in regular multifd packets, which mapped-ram
+ * doesn't use.  Postcopy completes devices outside of the precopy
+ * completion path and snapshots don't create multifd channels at all.
+ */
+bool multifd_device_state_supported(void)
+{
+    return migrate_multifd() && !migrate_mapped_ram() &&
+           !migrate_postcopy_ram() &&
+           !runstate_check(RUN_STATE_SAVE_VM) &&
+           !runstate_check(RUN_STATE_RESTORE_VM);
+}
+
+/*
+ * Queue a device state buffer on the next free channel.  Can be called
+ * from any thread.  Takes ownership of @data, which is freed once it has
+ * been written out, or right away on failure.
+ *
+ * Returns true if succeed, false otherwise.
+ */
+bool multifd_queue_device_state(const char *idstr, uint32_t instance_id,
+                                char *data, size_t len)
+{
+    MultiFDDeviceState_t *state;
+    MultiFDSendParams *p;
+
+    assert(multifd_device_state_supported());
+    assert(len <= MULTIFD_DEVICE_STATE_MAX_SIZE);
+
+    state = g_new0(MultiFDDeviceState_t, 1);
+    pstrcpy(state->idstr, sizeof(state->idstr), idstr);
+    state->instance_id = instance_id;
+    state->buf = data;
+    state->buf_len = len;
+
+    QEMU_LOCK_GUARD(&multifd_send_state->queue_job_mutex);
+
+    p = multifd_send_get_free_channel();
+    if (!p) {
+        g_free(state->buf);
+        g_free(state);
+        return false;
+    }
+
+    assert(!p->pages->num);
+    p->device_state = state;
+    /*
+     * Making sure p->device_state is setup before marking pending_job=true.
+     * Pairs with the qatomic_load_acquire() in multifd_send_thread().
+     */
+    qatomic_store_release(&p->pending_job, true);
+    qemu_sem_post(&p->sem);
+
+    return true;
+}
+
+/*
+ * Wait until every channel has written out the jobs queued so far.  Each
+ * idle channel holds exactly one channels_ready token, so collecting all
+ * of them means nothing is in flight anymore.
+ */
+int multifd_send_flush_device_state(void)
+{
+    int i, n = migrate_multifd_channels();
+
+    if (!multifd_device_state_supported()) {
+        return 0;
+    }
+
+    QEMU_LOCK_GUARD(&multifd_send_state->queue_job_mutex);
+
+    for (i = 0; i < n && !multifd_send_should_exit(); i++) {
+        qemu_sem_wait(&multifd_send_state->channels_ready);
+    }
+    while (i--) {
+        qemu_sem_post(&multifd_send_state->channels_ready);
+    }
+
+    trace_multifd_send_flush_device_state(multifd_send_state->packet_num);
+
+    return multifd_send_should_exit() ? -1 : 0;
+}
+
+static int multifd_send_device_state(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDDeviceState_t *state = p->device_state;
+    MultiFDPacket_t *packet = p->packet;
+    struct iovec iov[2];
+    uint64_t packet_num;
+    int ret;
+
+    packet->flags = cpu_to_be32(MULTIFD_FLAG_DEVICE_STATE);
+    packet->pages_alloc = 0;
+    packet->normal_pages = 0;
+    packet->zero_pages = 0;
+    packet->next_packet_size = cpu_to_be32(state->buf_len);
+    packet->instance_id = cpu_to_be32(state->instance_id);
+    strncpy(packet->ramblock, state->idstr, 256);
+
+    packet_num = qatomic_fetch_inc(&multifd_send_state->packet_num);
+    packet->packet_num = cpu_to_be64(packet_num);
+
+    iov[0].iov_base = packet;
+    iov[0].iov_len = p->packet_len;
+    iov[1].iov_base = state->buf;
+    iov[1].iov_len = state->buf_len;
+
+    /* The buffer is freed right below, so never use zero copy here */
+    ret = qio_channel_writev_full_all(p->c, iov, 2, NULL, 0, 0, errp);
+
+    packet->instance_id = 0;
+    p->packets_sent++;
+    trace_multifd_send_device_state(p->id, packet_num, state->idstr,
+                                    state->instance_id, state->buf_len);
+
+    if (!ret) {
+        stat64_add(&mig_stats.multifd_bytes, p->packet_len + state->buf_len);
+    }
+
+    g_free(state->buf);
+    g_free(state);
+    p->device_state = NULL;
+
+    return ret;
+}
+
 static void *multifd_send_thread(void *opaque)
 {
     MultiFDSendParams *p = opaque;
@@ -918,6 +1106,8 @@ static void *multifd_send_thread(void *opaque)
     }
 
     while (true) {
+        bool pending_job;
+
         qemu_sem_post(&multifd_send_state->channels_ready);
         qemu_sem_wait(&p->sem);
 
@@ -926,10 +1116,19 @@ static void *multifd_send_thread(void *opaque)
         }
 
         /*
-         * Read pending_job flag before p->pages.  Pairs with the
-         * qatomic_store_release() in multifd_send_pages().
+         * Read pending_job flag before p->pages and p->device_state.
+         * Pairs with the qatomic_store_release() in multifd_send_pages()
+         * and multifd_queue_device_state().
          */
-        if (qatomic_load_acquire(&p->pending_job)) {
+        pending_job = qatomic_load_acquire(&p->pending_job);
+        if (pending_job && p->device_state) {
+            ret = multifd_send_device_state(p, &local_err);
+            if (ret != 0) {
+                break;
+            }
+
+            qatomic_store_release(&p->pending_job, false);
+        } else if (pending_job) {
             MultiFDPages_t *pages = p->pages;
 
             p->iovs_num = 0;
@@ -1064,10 +1263,96 @@ static bool multifd_tls_channel_connect(MultiFDSendParams *p,
     return true;
 }
 
+/*
+ * Returns a channel performing the I/O of @ioc with io_uring, or @ioc
+ * itself if the channel can't use it, like socket and TLS channels.
+ */
+static QIOChannel *multifd_channel_uring(QIOChannel *ioc)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    QIOChannelUring *uioc;
+    Error *local_err = NULL;
+
+    if (!migrate_io_uring() ||
+        !object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_FILE)) {
+        return ioc;
+    }
+
+    uioc = qio_channel_uring_new(ioc, &local_err);
+    if (!uioc) {
+        warn_report_err(local_err);
+        return ioc;
+    }
+
+    return QIO_CHANNEL(uioc);
+#else
+    return ioc;
+#endif
+}
+
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * Registered buffers are pinned, so guest RAM is split between the
+ * channels rather than registered by each of them: the channel that
+ * owns an address is picked by the 1 GiB window of the address space
+ * it falls in, which is also the largest buffer the kernel registers.
+ */
+static int multifd_uring_ram_owner(const void *host)
+{
+    return ((uintptr_t)host / GiB) % migrate_multifd_channels();
+}
+
+/*
+ * Lets mapped-ram reads into the guest RAM owned by channel @id go
+ * straight into it.
+ */
+static void multifd_channel_uring_register_ram(QIOChannel *ioc, int id)
+{
+    QIOChannelUring *uioc = QIO_CHANNEL_URING(ioc);
+    g_autoptr(GArray) iov = g_array_new(false, false, sizeof(struct iovec));
+    Error *local_err = NULL;
+    RAMBlock *block;
+
+    RCU_READ_LOCK_GUARD();
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        uintptr_t end = (uintptr_t)block->host + block->used_length;
+        uintptr_t addr, next;
+
+        for (addr = (uintptr_t)block->host; addr < end; addr = next) {
+            struct iovec v;
+
+            next = MIN(QEMU_ALIGN_DOWN(addr, GiB) + GiB, end);
+            v = (struct iovec) {
+                .iov_base = (void *)addr,
+                .iov_len = next - addr,
+            };
+            if (multifd_uring_ram_owner(v.iov_base) == id) {
+                g_array_append_val(iov, v);
+            }
+        }
+    }
+
+    if (iov->len &&
+        !qio_channel_uring_register_buffers(uioc, (struct iovec *)iov->data,
+                                            iov->len, &local_err)) {
+        trace_multifd_uring_register_ram_fail(error_get_pretty(local_err));
+        error_free(local_err);
+    }
+}
+#endif
+
 void multifd_channel_connect(MultiFDSendParams *p, QIOChannel *ioc)
 {
+    QIOChannel *uioc;
+
     qio_channel_set_delay(ioc, false);
 
+    uioc = multifd_channel_uring(ioc);
+    if (uioc != ioc) {
+        object_unref(OBJECT(ioc));
+        ioc = uioc;
+    }
+
     migration_ioc_register_yank(ioc);
     /* Setup p->c only if the channel is completely setup */
     p->c = ioc;
@@ -1135,6 +1420,9 @@ out:
 static bool multifd_new_send_channel_create(gpointer opaque, Error **errp)
 {
     if (!multifd_use_packets()) {
+        if (savevm_multifd_active()) {
+            return savevm_send_channel_create(opaque, errp);
+        }
         return file_send_channel_create(opaque, errp);
     }
 
@@ -1161,6 +1449,7 @@ bool multifd_send_setup(void)
     multifd_send_state->pages = multifd_pages_init(page_count);
     qemu_sem_init(&multifd_send_state->channels_created, 0);
     qemu_sem_init(&multifd_send_state->channels_ready, 0);
+    qemu_mutex_init(&multifd_send_state->queue_job_mutex);
     qatomic_set(&multifd_send_state->exiting, 0);
     multifd_send_state->ops = multifd_ops[migrate_multifd_compression()];
 
@@ -1223,12 +1512,15 @@ bool multifd_send_setup(void)
     return true;
 }
 
-bool multifd_recv(void)
+/*
+ * Returns the next channel without a pending job, polling the channels
+ * until one is free, or NULL if the channels are exiting.
+ */
+static MultiFDRecvParams *multifd_recv_next_free_channel(void)
 {
     int i;
     static int next_recv_channel;
-    MultiFDRecvParams *p = NULL;
-    MultiFDRecvData *data = multifd_recv_state->data;
+    MultiFDRecvParams *p;
 
     /*
      * next_channel can remain from a previous migration that was
@@ -1238,14 +1530,37 @@ bool multifd_recv(void)
     next_recv_channel %= migrate_multifd_channels();
     for (i = next_recv_channel;; i = (i + 1) % migrate_multifd_channels()) {
         if (multifd_recv_should_exit()) {
-            return false;
+            return NULL;
         }
 
         p = &multifd_recv_state->params[i];
 
         if (qatomic_read(&p->pending_job) == false) {
             next_recv_channel = (i + 1) % migrate_multifd_channels();
-            break;
+            return p;
+        }
+    }
+}
+
+bool multifd_recv(void)
+{
+    MultiFDRecvParams *p = NULL;
+    MultiFDRecvData *data = multifd_recv_state->data;
+
+#ifdef CONFIG_LINUX_IO_URING
+    /* Prefer the channel that registered the destination memory, if free */
+    if (migrate_io_uring()) {
+        p = &multifd_recv_state->params[multifd_uring_ram_owner(data->opaque)];
+        if (qatomic_read(&p->pending_job)) {
+            p = NULL;
+        }
+    }
+#endif
+
+    if (!p) {
+        p = multifd_recv_next_free_channel();
+        if (!p) {
+            return false;
         }
     }
 
@@ -1455,6 +1770,56 @@ void multifd_recv_sync_main(void)
     trace_multifd_recv_sync_main(multifd_recv_state->packet_num);
 }
 
+/*
+ * Read the device state buffer following a MULTIFD_FLAG_DEVICE_STATE
+ * packet and hand it over to its owner.
+ */
+static int multifd_recv_device_state(MultiFDRecvParams *p, Error **errp)
+{
+    MultiFDPacket_t *packet = p->packet;
+    char *buf = g_malloc(p->next_packet_size);
+
+    if (qio_channel_read_all(p->c, buf, p->next_packet_size, errp)) {
+        g_free(buf);
+        return -1;
+    }
+
+    trace_multifd_recv_device_state(p->id, p->packet_num, packet->ramblock,
+                                    packet->instance_id, p->next_packet_size);
+
+    return qemu_loadvm_load_state_buffer(packet->ramblock,
+                                         packet->instance_id, buf,
+                                         p->next_packet_size, errp);
+}
+
+/*
+ * Pages loaded into the COLO cache must be flushed into the VM at the
+ * next checkpoint, pages loaded before COLO stage need a copy in the
+ * cache.
+ */
+static void multifd_recv_colo(MultiFDRecvParams *p)
+{
+    uint32_t i;
+
+    if (p->host == p->block->colo_cache) {
+        colo_record_bitmap(p->block, p->normal, p->normal_num);
+        colo_record_bitmap(p->block, p->zero, p->zero_num);
+        return;
+    }
+
+    if (!p->block->colo_cache) {
+        return;
+    }
+    for (i = 0; i < p->normal_num; i++) {
+        memcpy(p->block->colo_cache + p->normal[i], p->host + p->normal[i],
+               p->page_size);
+    }
+    for (i = 0; i < p->zero_num; i++) {
+        memcpy(p->block->colo_cache + p->zero[i], p->host + p->zero[i],
+               p->page_size);
+    }
+}
+
 static void *multifd_recv_thread(void *opaque)
 {
     MultiFDRecvParams *p = opaque;
@@ -1493,6 +1858,13 @@ static void *multifd_recv_thread(void *opaque)
             p->flags &= ~MULTIFD_FLAG_SYNC;
             has_data = p->normal_num || p->zero_num;
             qemu_mutex_unlock(&p->mutex);
+
+            if (flags & MULTIFD_FLAG_DEVICE_STATE) {
+                ret = multifd_recv_device_state(p, &local_err);
+                if (ret != 0) {
+                    break;
+                }
+            }
         } else {
             /*
              * No packets, so we need to wait for the vmstate code to
@@ -1524,6 +1896,9 @@ static void *multifd_recv_thread(void *opaque)
             if (ret != 0) {
                 break;
             }
+            if (use_packets && migration_incoming_colo_enabled()) {
+                multifd_recv_colo(p);
+            }
         }
 
         if (use_packets) {
@@ -1670,8 +2045,19 @@ void multifd_recv_new_channel(QIOChannel *ioc, Error **errp)
         error_propagate(errp, local_err);
         return;
     }
-    p->c = ioc;
-    object_ref(OBJECT(ioc));
+    p->c = multifd_channel_uring(ioc);
+    if (p->c == ioc) {
+        object_ref(OBJECT(ioc));
+    } else {
+        /* Shutting down the new channel shuts down @ioc */
+        migration_ioc_unregister_yank(ioc);
+        migration_ioc_register_yank(p->c);
+#ifdef CONFIG_LINUX_IO_URING
+        if (!use_packets) {
+            multifd_channel_uring_register_ram(p->c, id);
+        }
+#endif
+    }
 
     p->thread_created = true;
     qemu_thread_create(&p->thread, p->name, multifd_recv_thread, p,
@@ -13,6 +13,7 @@
 #ifndef QEMU_MIGRATION_MULTIFD_H
 #define QEMU_MIGRATION_MULTIFD_H
 
+#include "qemu/units.h"
 #include "ram.h"
 
 typedef struct MultiFDRecvData MultiFDRecvData;
@@ -27,6 +28,7 @@ bool multifd_recv_all_channels_created(void);
 void multifd_recv_new_channel(QIOChannel *ioc, Error **errp);
 void multifd_recv_sync_main(void);
 int multifd_send_sync_main(void);
+int multifd_send_flush_device_state(void);
 bool multifd_queue_page(RAMBlock *block, ram_addr_t offset);
 bool multifd_recv(void);
 MultiFDRecvData *multifd_get_recv_data(void);
@@ -41,6 +43,16 @@ MultiFDRecvData *multifd_get_recv_data(void);
 #define MULTIFD_FLAG_ZLIB (1 << 1)
 #define MULTIFD_FLAG_ZSTD (2 << 1)
 
+/*
+ * The packet carries a device state buffer instead of pages: @ramblock
+ * holds the device idstr, @instance_id its instance and @next_packet_size
+ * the length of the buffer that follows the packet header.
+ */
+#define MULTIFD_FLAG_DEVICE_STATE (1 << 4)
+
+/* Largest device state buffer that fits in a single packet */
+#define MULTIFD_DEVICE_STATE_MAX_SIZE (16 * MiB)
+
 /* This value needs to be a multiple of qemu_target_page_size() */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
 
@@ -57,7 +69,8 @@ typedef struct {
     uint64_t packet_num;
     /* zero pages */
     uint32_t zero_pages;
-    uint32_t unused32[1];    /* Reserved for future use */
+    /* device instance, only for MULTIFD_FLAG_DEVICE_STATE packets */
+    uint32_t instance_id;
     uint64_t unused64[3];    /* Reserved for future use */
     char ramblock[256];
     /*
@@ -80,6 +93,13 @@ typedef struct {
     RAMBlock *block;
 } MultiFDPages_t;
 
+typedef struct {
+    char idstr[256];
+    uint32_t instance_id;
+    char *buf;
+    size_t buf_len;
+} MultiFDDeviceState_t;
+
 struct MultiFDRecvData {
     void *opaque;
     size_t size;
@@ -135,6 +155,11 @@ typedef struct {
      * pending_job != 0 -> multifd_channel can use it.
      */
     MultiFDPages_t *pages;
+    /*
+     * Device state buffer to send instead of 'pages', owned by the
+     * channel while pending_job is set.
+     */
+    MultiFDDeviceState_t *device_state;
 
     /* thread local variables. No locking required */
 
@@ -85,6 +85,9 @@
 #define DEFAULT_MIGRATE_VCPU_DIRTY_LIMIT_PERIOD     1000    /* milliseconds */
 #define DEFAULT_MIGRATE_VCPU_DIRTY_LIMIT            1       /* MB/s */
 
+/* Maximum number of host pages prefetched ahead of a postcopy fault stream */
+#define MAX_POSTCOPY_PREFETCH_WINDOW 1024
+
 Property migration_properties[] = {
     DEFINE_PROP_BOOL("store-global-state", MigrationState,
                      store_global_state, true),
@@ -182,6 +185,8 @@ Property migration_properties[] = {
     DEFINE_PROP_ZERO_PAGE_DETECTION("zero-page-detection", MigrationState,
                        parameters.zero_page_detection,
                        ZERO_PAGE_DETECTION_MULTIFD),
+    DEFINE_PROP_UINT32("postcopy-prefetch-window", MigrationState,
+                       parameters.postcopy_prefetch_window, 0),
 
     /* Migration capabilities */
     DEFINE_PROP_MIG_CAP("x-xbzrle", MIGRATION_CAPABILITY_XBZRLE),
@@ -208,6 +213,14 @@ Property migration_properties[] = {
                         MIGRATION_CAPABILITY_SWITCHOVER_ACK),
     DEFINE_PROP_MIG_CAP("x-dirty-limit", MIGRATION_CAPABILITY_DIRTY_LIMIT),
     DEFINE_PROP_MIG_CAP("mapped-ram", MIGRATION_CAPABILITY_MAPPED_RAM),
+    DEFINE_PROP_MIG_CAP("x-defer-hot-pages",
+                        MIGRATION_CAPABILITY_DEFER_HOT_PAGES),
+    DEFINE_PROP_MIG_CAP("x-mapped-ram-incremental",
+                        MIGRATION_CAPABILITY_MAPPED_RAM_INCREMENTAL),
+    DEFINE_PROP_MIG_CAP("x-auto-tune", MIGRATION_CAPABILITY_AUTO_TUNE),
+    DEFINE_PROP_MIG_CAP("x-colo-incremental-state",
+                        MIGRATION_CAPABILITY_X_COLO_INCREMENTAL_STATE),
+    DEFINE_PROP_MIG_CAP("x-io-uring", MIGRATION_CAPABILITY_IO_URING),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -218,11 +231,19 @@ bool migrate_auto_converge(void)
     return s->capabilities[MIGRATION_CAPABILITY_AUTO_CONVERGE];
 }
 
+bool migrate_auto_tune(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_AUTO_TUNE];
+}
+
 bool migrate_background_snapshot(void)
 {
     MigrationState *s = migrate_get_current();
 
-    return s->capabilities[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT];
+    return s->capabilities[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT] ||
+           s->savevm_live_snapshot;
 }
 
 bool migrate_block(void)
@@ -239,6 +260,13 @@ bool migrate_colo(void)
     return s->capabilities[MIGRATION_CAPABILITY_X_COLO];
 }
 
+bool migrate_colo_incremental_state(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_X_COLO_INCREMENTAL_STATE];
+}
+
 bool migrate_compress(void)
 {
     MigrationState *s = migrate_get_current();
@@ -246,6 +274,13 @@ bool migrate_compress(void)
     return s->capabilities[MIGRATION_CAPABILITY_COMPRESS];
 }
 
+bool migrate_defer_hot_pages(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_DEFER_HOT_PAGES];
+}
+
 bool migrate_dirty_bitmaps(void)
 {
     MigrationState *s = migrate_get_current();
@@ -267,6 +302,13 @@ bool migrate_events(void)
     return s->capabilities[MIGRATION_CAPABILITY_EVENTS];
 }
 
+bool migrate_io_uring(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_IO_URING];
+}
+
 bool migrate_mapped_ram(void)
 {
     MigrationState *s = migrate_get_current();
@@ -274,6 +316,13 @@ bool migrate_mapped_ram(void)
     return s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
 }
 
+bool migrate_mapped_ram_incremental(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM_INCREMENTAL];
+}
+
 bool migrate_ignore_shared(void)
 {
     MigrationState *s = migrate_get_current();
@@ -463,7 +512,12 @@ INITIALIZE_MIGRATE_CAPS_SET(check_caps_background_snapshot,
     MIGRATION_CAPABILITY_XBZRLE,
     MIGRATION_CAPABILITY_X_COLO,
     MIGRATION_CAPABILITY_VALIDATE_UUID,
-    MIGRATION_CAPABILITY_ZERO_COPY_SEND);
+    MIGRATION_CAPABILITY_ZERO_COPY_SEND,
+    MIGRATION_CAPABILITY_DEFER_HOT_PAGES,
+    MIGRATION_CAPABILITY_MAPPED_RAM_INCREMENTAL,
+    MIGRATION_CAPABILITY_AUTO_TUNE,
+    MIGRATION_CAPABILITY_X_COLO_INCREMENTAL_STATE,
+    MIGRATION_CAPABILITY_IO_URING);
 
 static bool migrate_incoming_started(void)
 {
@@ -586,6 +640,26 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
     }
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (new_caps[MIGRATION_CAPABILITY_IO_URING]) {
+        if (!new_caps[MIGRATION_CAPABILITY_MULTIFD]) {
+            error_setg(errp, "Capability 'io-uring' requires capability "
+                       "'multifd'");
+            return false;
+        }
+
+        if (new_caps[MIGRATION_CAPABILITY_ZERO_COPY_SEND]) {
+            error_setg(errp, "io_uring is incompatible with zero copy");
+            return false;
+        }
+    }
+#else
+    if (new_caps[MIGRATION_CAPABILITY_IO_URING]) {
+        error_setg(errp, "io_uring support is not compiled in");
+        return false;
+    }
+#endif
+
     if (new_caps[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT]) {
         if (!new_caps[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
             error_setg(errp, "Postcopy preempt requires postcopy-ram");
@@ -642,6 +716,14 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
         }
     }
 
+    if (new_caps[MIGRATION_CAPABILITY_AUTO_TUNE] &&
+        (new_caps[MIGRATION_CAPABILITY_AUTO_CONVERGE] ||
+         new_caps[MIGRATION_CAPABILITY_DIRTY_LIMIT])) {
+        error_setg(errp, "auto-tune conflicts with auto-converge and "
+                   "dirty-limit, they all throttle the guest");
+        return false;
+    }
+
     if (new_caps[MIGRATION_CAPABILITY_MULTIFD]) {
         if (new_caps[MIGRATION_CAPABILITY_XBZRLE]) {
             error_setg(errp, "Multifd is not compatible with xbzrle");
@@ -676,6 +758,20 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
         }
     }
 
+    if (new_caps[MIGRATION_CAPABILITY_MAPPED_RAM_INCREMENTAL] &&
+        !new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+        error_setg(errp, "Capability 'mapped-ram-incremental' requires "
+                   "capability 'mapped-ram'");
+        return false;
+    }
+
+    if (new_caps[MIGRATION_CAPABILITY_X_COLO_INCREMENTAL_STATE] &&
+        !new_caps[MIGRATION_CAPABILITY_X_COLO]) {
+        error_setg(errp, "Capability 'x-colo-incremental-state' requires "
+                   "capability 'x-colo'");
+        return false;
+    }
+
     return true;
 }
 
@@ -745,6 +841,10 @@ void qmp_migrate_set_capabilities(MigrationCapabilityStatusList *params,
     for (cap = params; cap; cap = cap->next) {
         s->capabilities[cap->value->capability] = cap->value->state;
     }
+
+    if (!migrate_mapped_ram_incremental()) {
+        ram_mapped_ram_checkpoint_drop();
+    }
 }
 
 /* parameters */
@@ -861,6 +961,13 @@ uint64_t migrate_max_postcopy_bandwidth(void)
     return s->parameters.max_postcopy_bandwidth;
 }
 
+uint32_t migrate_postcopy_prefetch_window(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->parameters.postcopy_prefetch_window;
+}
+
 MigMode migrate_mode(void)
 {
     MigrationState *s = migrate_get_current();
@@ -1060,6 +1167,8 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->mode = s->parameters.mode;
     params->has_zero_page_detection = true;
     params->zero_page_detection = s->parameters.zero_page_detection;
+    params->has_postcopy_prefetch_window = true;
+    params->postcopy_prefetch_window = s->parameters.postcopy_prefetch_window;
 
     return params;
 }
@@ -1097,6 +1206,7 @@ void migrate_params_init(MigrationParameters *params)
     params->has_vcpu_dirty_limit = true;
     params->has_mode = true;
     params->has_zero_page_detection = true;
+    params->has_postcopy_prefetch_window = true;
 }
 
 /*
@@ -1292,6 +1402,15 @@ bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->has_postcopy_prefetch_window &&
+        params->postcopy_prefetch_window > MAX_POSTCOPY_PREFETCH_WINDOW) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "postcopy_prefetch_window",
+                   "a value between 0 and "
+                   stringify(MAX_POSTCOPY_PREFETCH_WINDOW));
+        return false;
+    }
+
     return true;
 }
 
@@ -1417,6 +1536,10 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
     if (params->has_zero_page_detection) {
         dest->zero_page_detection = params->zero_page_detection;
     }
+
+    if (params->has_postcopy_prefetch_window) {
+        dest->postcopy_prefetch_window = params->postcopy_prefetch_window;
+    }
 }
 
 static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
@@ -1571,6 +1694,11 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
     if (params->has_zero_page_detection) {
         s->parameters.zero_page_detection = params->zero_page_detection;
     }
+
+    if (params->has_postcopy_prefetch_window) {
+        s->parameters.postcopy_prefetch_window =
+            params->postcopy_prefetch_window;
+    }
 }
 
 void qmp_migrate_set_parameters(MigrateSetParameters *params, Error **errp)
@@ -25,12 +25,17 @@ extern Property migration_properties[];
 /* capabilities */
 
 bool migrate_auto_converge(void);
+bool migrate_auto_tune(void);
 bool migrate_block(void);
 bool migrate_colo(void);
+bool migrate_colo_incremental_state(void);
 bool migrate_compress(void);
+bool migrate_defer_hot_pages(void);
 bool migrate_dirty_bitmaps(void);
 bool migrate_events(void);
+bool migrate_io_uring(void);
 bool migrate_mapped_ram(void);
+bool migrate_mapped_ram_incremental(void);
 bool migrate_ignore_shared(void);
 bool migrate_late_block_activate(void);
 bool migrate_multifd(void);
@@ -81,6 +86,7 @@ uint8_t migrate_max_cpu_throttle(void);
 uint64_t migrate_max_bandwidth(void);
 uint64_t migrate_avail_switchover_bandwidth(void);
 uint64_t migrate_max_postcopy_bandwidth(void);
+uint32_t migrate_postcopy_prefetch_window(void);
 int migrate_multifd_channels(void);
 MultiFDCompression migrate_multifd_compression(void);
 int migrate_multifd_zlib_level(void);
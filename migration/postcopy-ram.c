@@ -186,6 +186,12 @@ void fill_destination_postcopy_migration_info(MigrationInfo *info)
     MigrationIncomingState *mis = migration_incoming_get_current();
     PostcopyBlocktimeContext *bc = mis->blocktime_ctx;
 
+    if (migrate_postcopy_ram()) {
+        info->has_postcopy_prefetched_pages = true;
+        info->postcopy_prefetched_pages =
+            stat64_get(&mis->postcopy_prefetched_pages);
+    }
+
     if (!bc) {
         return;
     }
@@ -951,6 +957,168 @@ static void mark_postcopy_blocktime_end(uintptr_t addr)
                                       affected_cpu);
 }
 
+/*
+ * Number of times a stride between two faults of a vCPU has to be
+ * repeated by the following faults before we start prefetching ahead.
+ */
+#define POSTCOPY_PREFETCH_MIN_HITS  2
+/* Largest stride (in host pages) still considered a fault stream */
+#define POSTCOPY_PREFETCH_MAX_STRIDE  64
+
+/*
+ * Per-vCPU page fault history, used to detect sequential or strided
+ * access patterns and request pages before the vCPU faults on them.
+ * Only ever touched by the fault thread.
+ */
+typedef struct PostcopyFaultStream {
+    RAMBlock *rb;
+    /* Offset of the last fault taken by this vCPU */
+    ram_addr_t last_offset;
+    /* Distance in bytes between the last two faults, 0 if unknown */
+    int64_t stride;
+    /* Number of consecutive faults matching @stride */
+    unsigned int hits;
+    /* Number of strides ahead of @last_offset already requested */
+    unsigned int prefetched;
+} PostcopyFaultStream;
+
+/*
+ * Update the fault stream of a vCPU with a new fault.  A fault landing on
+ * a page we already prefetched but which hasn't arrived yet still counts
+ * as a continuation of the stream.
+ */
+static void postcopy_fault_stream_update(PostcopyFaultStream *fs,
+                                         RAMBlock *rb, ram_addr_t rb_offset)
+{
+    size_t pagesize = qemu_ram_pagesize(rb);
+    int64_t delta = (int64_t)rb_offset - (int64_t)fs->last_offset;
+
+    if (fs->rb == rb && fs->stride && delta && delta % fs->stride == 0 &&
+        delta / fs->stride > 0 && delta / fs->stride <= fs->prefetched + 1) {
+        unsigned int steps = delta / fs->stride;
+
+        fs->hits++;
+        fs->prefetched = fs->prefetched >= steps ? fs->prefetched - steps : 0;
+    } else if (fs->rb == rb && delta &&
+               ABS(delta) <= POSTCOPY_PREFETCH_MAX_STRIDE * pagesize) {
+        /* New candidate stride, needs to be confirmed by further faults */
+        fs->stride = delta;
+        fs->hits = 0;
+        fs->prefetched = 0;
+    } else {
+        fs->stride = 0;
+        fs->hits = 0;
+        fs->prefetched = 0;
+    }
+
+    fs->rb = rb;
+    fs->last_offset = rb_offset;
+}
+
+/*
+ * Ask the source for the pages of a fault stream that haven't been
+ * requested or received yet, coalescing contiguous pages into a single
+ * request.
+ */
+static int postcopy_fault_stream_prefetch(MigrationIncomingState *mis,
+                                          PostcopyFaultStream *fs,
+                                          uint32_t window)
+{
+    RAMBlock *rb = fs->rb;
+    size_t pagesize = qemu_ram_pagesize(rb);
+    ram_addr_t used_length = qemu_ram_get_used_length(rb);
+    ram_addr_t run_start = 0;
+    size_t run_len = 0, max_run = ROUND_DOWN(UINT32_MAX, pagesize);
+    unsigned int i;
+    int ret;
+
+    for (i = fs->prefetched + 1; i <= window; i++) {
+        int64_t offset = (int64_t)fs->last_offset + i * fs->stride;
+
+        if (offset < 0 || offset >= used_length) {
+            break;
+        }
+        fs->prefetched = i;
+
+        if (ramblock_recv_bitmap_test_byte_offset(rb, offset) ||
+            ramblock_page_is_discarded(rb, offset)) {
+            continue;
+        }
+
+        if (run_len && offset == run_start + run_len && run_len < max_run) {
+            run_len += pagesize;
+            continue;
+        }
+
+        if (run_len) {
+            trace_postcopy_fault_stream_prefetch(qemu_ram_get_idstr(rb),
+                                                 run_start, run_len);
+            ret = migrate_send_rp_message_req_pages(mis, rb, run_start,
+                                                    run_len);
+            if (ret) {
+                return ret;
+            }
+            stat64_add(&mis->postcopy_prefetched_pages, run_len / pagesize);
+        }
+        run_start = offset;
+        run_len = pagesize;
+    }
+
+    if (run_len) {
+        trace_postcopy_fault_stream_prefetch(qemu_ram_get_idstr(rb),
+                                             run_start, run_len);
+        ret = migrate_send_rp_message_req_pages(mis, rb, run_start, run_len);
+        if (ret) {
+            return ret;
+        }
+        stat64_add(&mis->postcopy_prefetched_pages, run_len / pagesize);
+    }
+
+    return 0;
+}
+
+/*
+ * Called by the fault thread after the faulting page itself has been
+ * requested: feeds the fault into the per-vCPU stream detector and, once
+ * a sequential or strided pattern is established, requests the next
+ * @postcopy-prefetch-window pages of the stream so that the source can
+ * send them ahead of the background stream.
+ *
+ * @ptid: faulted process thread id
+ */
+static int postcopy_fault_prefetch(MigrationIncomingState *mis,
+                                   PostcopyFaultStream **streams,
+                                   unsigned int nr_streams,
+                                   RAMBlock *rb, ram_addr_t rb_offset,
+                                   uint32_t ptid)
+{
+    uint32_t window = migrate_postcopy_prefetch_window();
+    PostcopyFaultStream *fs;
+    int cpu;
+
+    if (!window || ptid == 0) {
+        return 0;
+    }
+
+    cpu = get_mem_fault_cpu_index(ptid);
+    if (cpu < 0 || cpu >= nr_streams) {
+        return 0;
+    }
+
+    /* The window may be set at any time, also after postcopy started */
+    if (!*streams) {
+        *streams = g_new0(PostcopyFaultStream, nr_streams);
+    }
+
+    fs = &(*streams)[cpu];
+    postcopy_fault_stream_update(fs, rb, rb_offset);
+    if (fs->hits < POSTCOPY_PREFETCH_MIN_HITS || fs->prefetched >= window) {
+        return 0;
+    }
+
+    return postcopy_fault_stream_prefetch(mis, fs, window);
+}
+
 static void postcopy_pause_fault_thread(MigrationIncomingState *mis)
 {
     trace_postcopy_pause_fault_thread();
@@ -964,6 +1132,10 @@ static void postcopy_pause_fault_thread(MigrationIncomingState *mis)
 static void *postcopy_ram_fault_thread(void *opaque)
 {
     MigrationIncomingState *mis = opaque;
+    MachineState *ms = MACHINE(qdev_get_machine());
+    /* Indexed by cpu_index, which hot-plugged vCPUs take up to max_cpus */
+    unsigned int nr_streams = ms->smp.max_cpus;
+    PostcopyFaultStream *streams = NULL;
     struct uffd_msg msg;
     int ret;
     size_t index;
@@ -1092,6 +1264,13 @@ retry:
                 postcopy_pause_fault_thread(mis);
                 goto retry;
             }
+
+            /*
+             * Prefetch failures aren't fatal; a lost request will turn
+             * into a fault and be requested again after recovery.
+             */
+            postcopy_fault_prefetch(mis, &streams, nr_streams, rb, rb_offset,
+                                    msg.arg.pagefault.feat.ptid);
         }
 
         /* Now handle any requests from external processes on shared memory */
@@ -1152,6 +1331,7 @@ retry:
     }
     rcu_unregister_thread();
     trace_postcopy_ram_fault_thread_exit();
+    g_free(streams);
     g_free(pfd);
     return NULL;
 }
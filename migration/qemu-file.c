@@ -38,9 +38,17 @@
 #define IO_BUF_SIZE 32768
 #define MAX_IOV_SIZE MIN_CONST(IOV_MAX, 64)
 
+typedef struct FdEntry {
+    QTAILQ_ENTRY(FdEntry) entry;
+    int fd;
+} FdEntry;
+
 struct QEMUFile {
     QIOChannel *ioc;
     bool is_writable;
+    bool can_pass_fd;
+    /* Received fds are queued, see qemu_file_accept_fds() */
+    bool accept_fds;
 
     int buf_index;
     int buf_size; /* 0 when writing */
@@ -52,6 +60,9 @@ struct QEMUFile {
 
     int last_error;
     Error *last_error_obj;
+
+    /* File descriptors received along with the buffered data */
+    QTAILQ_HEAD(, FdEntry) fds;
 };
 
 /*
@@ -110,6 +121,8 @@ static QEMUFile *qemu_file_new_impl(QIOChannel *ioc, bool is_writable)
     object_ref(ioc);
     f->ioc = ioc;
     f->is_writable = is_writable;
+    f->can_pass_fd = qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_FD_PASS);
+    QTAILQ_INIT(&f->fds);
 
     return f;
 }
@@ -326,10 +339,22 @@ static ssize_t coroutine_mixed_fn qemu_fill_buffer(QEMUFile *f)
     }
 
     do {
-        len = qio_channel_read(f->ioc,
-                               (char *)f->buf + pending,
-                               IO_BUF_SIZE - pending,
-                               &local_error);
+        struct iovec iov = { f->buf + pending, IO_BUF_SIZE - pending };
+        int *fds = NULL;
+        size_t nfd = 0;
+
+        len = qio_channel_readv_full(f->ioc, &iov, 1,
+                                     f->accept_fds ? &fds : NULL,
+                                     f->accept_fds ? &nfd : NULL,
+                                     0, &local_error);
+        for (size_t i = 0; i < nfd; i++) {
+            FdEntry *fde = g_new0(FdEntry, 1);
+
+            fde->fd = fds[i];
+            QTAILQ_INSERT_TAIL(&f->fds, fde, entry);
+        }
+        g_free(fds);
+
         if (len == QIO_CHANNEL_ERR_BLOCK) {
             if (qemu_in_coroutine()) {
                 qio_channel_yield(f->ioc, G_IO_IN);
@@ -362,11 +387,18 @@ static ssize_t coroutine_mixed_fn qemu_fill_buffer(QEMUFile *f)
  */
 int qemu_fclose(QEMUFile *f)
 {
+    FdEntry *fde, *next;
     int ret = qemu_fflush(f);
     int ret2 = qio_channel_close(f->ioc, NULL);
     if (ret >= 0) {
         ret = ret2;
     }
+    QTAILQ_FOREACH_SAFE(fde, &f->fds, entry, next) {
+        warn_report("qemu_fclose: received fd %d was never claimed", fde->fd);
+        close(fde->fd);
+        QTAILQ_REMOVE(&f->fds, fde, entry);
+        g_free(fde);
+    }
     g_clear_pointer(&f->ioc, object_unref);
     error_free(f->last_error_obj);
     g_free(f);
@@ -943,3 +975,94 @@ int qemu_file_get_to_fd(QEMUFile *f, int fd, size_t size)
 
     return 0;
 }
+
+/*
+ * Send @fd over the channel of @f with SCM_RIGHTS.
+ *
+ * A single marker byte travels with the descriptor so that the receiver
+ * sees it at the matching position of the stream.  Pending data is
+ * flushed first to preserve ordering.
+ *
+ * Returns 0 on success, negative value on error.
+ */
+int qemu_file_put_fd(QEMUFile *f, int fd)
+{
+    struct iovec iov = { (void *)"F", 1 };
+    Error *local_error = NULL;
+    int ret;
+
+    if (!f->can_pass_fd) {
+        error_setg(&local_error, "Channel %s does not support fd passing",
+                   f->ioc->name);
+        qemu_file_set_error_obj(f, -EINVAL, local_error);
+        return -EINVAL;
+    }
+
+    ret = qemu_fflush(f);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (qio_channel_writev_full_all(f->ioc, &iov, 1, &fd, 1, 0,
+                                    &local_error) < 0) {
+        qemu_file_set_error_obj(f, -EIO, local_error);
+        ret = -EIO;
+    } else {
+        stat64_add(&mig_stats.qemu_file_transferred, 1);
+    }
+
+    trace_qemu_file_put_fd(f->ioc->name, fd, ret);
+    return ret;
+}
+
+/*
+ * Let an input file receive file descriptors, if its channel can pass
+ * them.  Other files read without ancillary data, so the kernel closes
+ * any descriptors the peer sends.
+ */
+void qemu_file_accept_fds(QEMUFile *f)
+{
+    assert(!qemu_file_is_writable(f));
+
+    f->accept_fds = f->can_pass_fd;
+}
+
+/*
+ * Receive a file descriptor sent with qemu_file_put_fd().
+ *
+ * Returns the descriptor, owned by the caller, or -1 on error.
+ */
+int qemu_file_get_fd(QEMUFile *f)
+{
+    FdEntry *fde;
+    int fd = -1;
+
+    if (!f->accept_fds) {
+        Error *local_error = NULL;
+
+        error_setg(&local_error, "Channel %s does not accept fds",
+                   f->ioc->name);
+        qemu_file_set_error_obj(f, -EINVAL, local_error);
+        goto out;
+    }
+
+    /* Pull the marker byte in; its descriptor arrives along with it */
+    if (qemu_peek_byte(f, 0) != 'F' || qemu_file_get_error(f)) {
+        qemu_file_set_error(f, -EINVAL);
+        goto out;
+    }
+
+    fde = QTAILQ_FIRST(&f->fds);
+    if (!fde) {
+        qemu_file_set_error(f, -EINVAL);
+        goto out;
+    }
+    qemu_file_skip(f, 1);
+    QTAILQ_REMOVE(&f->fds, fde, entry);
+    fd = fde->fd;
+    g_free(fde);
+
+out:
+    trace_qemu_file_get_fd(f->ioc->name, fd);
+    return fd;
+}
@@ -81,6 +81,9 @@ void qemu_put_buffer_at(QEMUFile *f, const uint8_t *buf, size_t buflen,
                         off_t pos);
 size_t qemu_get_buffer_at(QEMUFile *f, const uint8_t *buf, size_t buflen,
                           off_t pos);
+int qemu_file_put_fd(QEMUFile *f, int fd);
+void qemu_file_accept_fds(QEMUFile *f);
+int qemu_file_get_fd(QEMUFile *f);
 
 QIOChannel *qemu_file_get_ioc(QEMUFile *file);
 
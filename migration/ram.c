@@ -216,11 +216,71 @@ static bool postcopy_preempt_active(void)
     return migrate_postcopy_preempt() && migration_in_postcopy();
 }
 
+/*
+ * In cpr-transfer mode shared fd-backed RAM is handed over to the new
+ * process by file descriptor, so its pages are never sent.
+ */
+static bool ramblock_is_cpr_transferred(RAMBlock *block)
+{
+    return migrate_mode() == MIG_MODE_CPR_TRANSFER &&
+           qemu_ram_is_shared(block) && qemu_ram_get_fd(block) >= 0;
+}
+
 bool migrate_ram_is_ignored(RAMBlock *block)
 {
     return !qemu_ram_is_migratable(block) ||
            (migrate_ignore_shared() && qemu_ram_is_shared(block)
-                                    && qemu_ram_is_named_file(block));
+                                    && qemu_ram_is_named_file(block)) ||
+           ramblock_is_cpr_transferred(block);
+}
+
+static int ram_cpr_transfer_save_block(QEMUFile *f, RAMBlock *block)
+{
+    bool transferred = ramblock_is_cpr_transferred(block);
+
+    qemu_put_byte(f, transferred);
+    if (!transferred) {
+        return 0;
+    }
+
+    qemu_put_be64(f, block->fd_offset);
+    trace_ram_cpr_transfer_save_block(block->idstr, block->fd,
+                                      block->fd_offset);
+    return qemu_file_put_fd(f, block->fd);
+}
+
+static int ram_cpr_transfer_load_block(QEMUFile *f, RAMBlock *block)
+{
+    Error *local_err = NULL;
+    bool transferred = qemu_get_byte(f);
+    uint64_t fd_offset;
+    int fd;
+
+    if (transferred != ramblock_is_cpr_transferred(block)) {
+        error_report("RAM block %s is %sshared on the source but %sshared "
+                     "here", block->idstr, transferred ? "" : "not ",
+                     transferred ? "not " : "");
+        return -EINVAL;
+    }
+    if (!transferred) {
+        return 0;
+    }
+
+    fd_offset = qemu_get_be64(f);
+    fd = qemu_file_get_fd(f);
+    if (fd < 0) {
+        error_report("Failed to receive fd for RAM block %s", block->idstr);
+        return -EINVAL;
+    }
+
+    trace_ram_cpr_transfer_load_block(block->idstr, fd, fd_offset);
+    if (qemu_ram_remap_fd(block, fd, fd_offset, &local_err) < 0) {
+        error_report_err(local_err);
+        close(fd);
+        return -EINVAL;
+    }
+
+    return 0;
 }
 
 #undef RAMBLOCK_FOREACH
@@ -412,6 +472,14 @@ struct RAMState {
      * RAM migration.
      */
     unsigned int postcopy_bmap_sync_requested;
+
+    /* Are we skipping hot chunks when searching for dirty pages */
+    bool defer_hot_pages;
+    /*
+     * Set when the search went once around the RAM and only found dirty
+     * pages in deferred hot chunks; reset by the next bitmap sync.
+     */
+    bool hot_pages_only;
 };
 typedef struct RAMState RAMState;
 
@@ -911,6 +979,69 @@ bool ramblock_page_is_discarded(RAMBlock *rb, ram_addr_t start)
     return false;
 }
 
+/*
+ * A chunk found written at this many more syncs than it was found idle is
+ * considered hot, and its pages are deferred to the end of the migration.
+ */
+#define DIRTY_FREQ_HOT  3
+#define DIRTY_FREQ_MAX  7
+
+/*
+ * Deferred chunks are never sent, so they can't be found idle.  Every this
+ * many syncs, hot chunks drop just below the threshold and get sent once;
+ * those that are still written become hot again at the next sync.
+ */
+#define DIRTY_FREQ_PROBE_SYNCS  8
+
+static inline unsigned long ramblock_dirty_freq_chunks(RAMBlock *rb)
+{
+    return DIV_ROUND_UP(rb->used_length >> TARGET_PAGE_BITS,
+                        1UL << DIRTY_FREQ_CHUNK_SHIFT);
+}
+
+static inline bool ramblock_chunk_is_hot(RAMBlock *rb, unsigned long page)
+{
+    return rb->dirty_freq[page >> DIRTY_FREQ_CHUNK_SHIFT] >= DIRTY_FREQ_HOT;
+}
+
+/*
+ * Update the dirty frequency of every chunk of @rb after a bitmap sync.
+ * Chunks still holding dirty pages keep their frequency, as their dirty
+ * log isn't cleared until they're sent and we can't tell whether they
+ * were written again meanwhile.  With @probe, hot chunks are demoted so
+ * that they are sent again and their frequency is measured anew.
+ */
+static void ramblock_update_dirty_freq(RAMBlock *rb, bool probe)
+{
+    unsigned long chunks = ramblock_dirty_freq_chunks(rb);
+    unsigned long size = rb->used_length >> TARGET_PAGE_BITS;
+    unsigned long i, start, end, hot = 0;
+
+    for (i = 0; i < chunks; i++) {
+        if (test_bit(i, rb->dirty_chunk_bmap)) {
+            if (rb->dirty_freq[i] < DIRTY_FREQ_MAX) {
+                rb->dirty_freq[i]++;
+            }
+        } else if (rb->dirty_freq[i]) {
+            start = i << DIRTY_FREQ_CHUNK_SHIFT;
+            end = MIN(size, start + (1UL << DIRTY_FREQ_CHUNK_SHIFT));
+            if (find_next_bit(rb->bmap, end, start) >= end) {
+                rb->dirty_freq[i]--;
+            }
+        }
+        if (rb->dirty_freq[i] >= DIRTY_FREQ_HOT) {
+            if (probe) {
+                rb->dirty_freq[i] = DIRTY_FREQ_HOT - 1;
+            } else {
+                hot++;
+            }
+        }
+    }
+    bitmap_zero(rb->dirty_chunk_bmap, chunks);
+
+    trace_ramblock_update_dirty_freq(rb->idstr, hot, chunks);
+}
+
 /* Called with RCU critical section */
 static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
 {
@@ -919,6 +1050,12 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
 
     rs->migration_dirty_pages += new_dirty_pages;
     rs->num_dirty_pages_period += new_dirty_pages;
+
+    if (rb->dirty_freq) {
+        uint64_t syncs = stat64_get(&mig_stats.dirty_sync_count);
+
+        ramblock_update_dirty_freq(rb, syncs % DIRTY_FREQ_PROBE_SYNCS == 0);
+    }
 }
 
 /**
@@ -1068,6 +1205,7 @@ static void migration_bitmap_sync(RAMState *rs, bool last_stage)
             ramblock_sync_dirty_bitmap(rs, block);
         }
         stat64_set(&mig_stats.dirty_bytes_last_sync, ram_bytes_remaining());
+        rs->hot_pages_only = false;
     }
     qemu_mutex_unlock(&rs->bitmap_mutex);
 
@@ -1328,6 +1466,26 @@ int compress_send_queued_data(CompressParam *param)
     return len;
 }
 
+/*
+ * Move pss->page past the chunks of the current block classified as hot,
+ * to the next dirty page of a cold chunk or the end of the block.
+ */
+static void pss_skip_hot_chunks(PageSearchStatus *pss)
+{
+    RAMBlock *rb = pss->block;
+    unsigned long size = rb->used_length >> TARGET_PAGE_BITS;
+    unsigned long next;
+
+    if (!rb->dirty_freq) {
+        return;
+    }
+
+    while (pss->page < size && ramblock_chunk_is_hot(rb, pss->page)) {
+        next = ROUND_UP(pss->page + 1, 1UL << DIRTY_FREQ_CHUNK_SHIFT);
+        pss->page = find_next_bit(rb->bmap, size, next);
+    }
+}
+
 #define PAGE_ALL_CLEAN 0
 #define PAGE_TRY_AGAIN 1
 #define PAGE_DIRTY_FOUND 2
@@ -1350,12 +1508,19 @@ static int find_dirty_block(RAMState *rs, PageSearchStatus *pss)
     /* Update pss->page for the next dirty bit in ramblock */
     pss_find_next_dirty(pss);
 
+    if (rs->defer_hot_pages) {
+        pss_skip_hot_chunks(pss);
+    }
+
     if (pss->complete_round && pss->block == rs->last_seen_block &&
         pss->page >= rs->last_page) {
         /*
          * We've been once around the RAM and haven't found anything.
-         * Give up.
+         * Give up.  If dirty pages are left, they're all in hot chunks.
          */
+        if (rs->defer_hot_pages && rs->migration_dirty_pages) {
+            rs->hot_pages_only = true;
+        }
         return PAGE_ALL_CLEAN;
     }
     if (!offset_in_ramblock(pss->block,
@@ -2009,14 +2174,14 @@ int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len,
             }
             /*
              * NOTE: after ram_save_host_page_urgent() succeeded, pss->page
-             * will automatically be moved and point to the next host page
-             * we're going to send, so no need to update here.
-             *
-             * Normally QEMU never sends >1 host page in requests, so
-             * logically we don't even need that as the loop should only
-             * run once, but just to be consistent.
+             * points to the next dirty page, which may be well beyond the
+             * requested range.  Requests can cover more than one host page
+             * when the destination prefetches ahead of a fault stream, so
+             * restart explicitly from the next host page of the request.
              */
             len -= page_size;
+            page_start += page_size >> TARGET_PAGE_BITS;
+            pss_init(pss, ramblock, page_start);
         };
         qemu_mutex_unlock(&rs->bitmap_mutex);
 
@@ -2438,13 +2603,133 @@ static void xbzrle_cleanup(void)
     XBZRLE_cache_unlock();
 }
 
+/*
+ * Incremental mapped-ram checkpoints.  After a successful save into a
+ * file, dirty logging and the file bitmaps are kept, so that the next
+ * save into the same file only rewrites the pages dirtied since.
+ */
+static struct {
+    /* Target of the last completed checkpoint, NULL if none */
+    char *filename;
+    uint64_t offset;
+    /* Its file as the checkpoint left it */
+    struct stat st;
+    /* Target of the save in progress */
+    char *pending_filename;
+    uint64_t pending_offset;
+    /* Whether the save in progress builds on the last checkpoint */
+    bool incremental;
+} mapped_ram_checkpoint;
+
+static bool ram_mapped_ram_incremental(void)
+{
+    return migrate_mapped_ram() && mapped_ram_checkpoint.incremental;
+}
+
+/*
+ * Whether the file opened as @fd is still the one the last checkpoint
+ * wrote, and wasn't replaced, truncated or written to since
+ */
+static bool ram_mapped_ram_checkpoint_file_unchanged(int fd)
+{
+    struct stat *old = &mapped_ram_checkpoint.st;
+    struct stat st;
+
+    if (fstat(fd, &st) < 0) {
+        return false;
+    }
+
+    return st.st_dev == old->st_dev && st.st_ino == old->st_ino &&
+           st.st_size == old->st_size && st.st_mtime == old->st_mtime;
+}
+
+/*
+ * Called when a mapped-ram migration to @filename, opened as @fd, starts.
+ * Returns whether it is incremental, in which case the file must not be
+ * truncated.
+ */
+bool ram_mapped_ram_checkpoint_start(const char *filename, uint64_t offset,
+                                     int fd)
+{
+    g_free(mapped_ram_checkpoint.pending_filename);
+    mapped_ram_checkpoint.pending_filename = g_strdup(filename);
+    mapped_ram_checkpoint.pending_offset = offset;
+    mapped_ram_checkpoint.incremental =
+        migrate_mapped_ram_incremental() &&
+        mapped_ram_checkpoint.filename &&
+        !strcmp(mapped_ram_checkpoint.filename, filename) &&
+        mapped_ram_checkpoint.offset == offset &&
+        ram_mapped_ram_checkpoint_file_unchanged(fd);
+
+    trace_ram_mapped_ram_checkpoint_start(filename,
+                                          mapped_ram_checkpoint.incremental);
+    return mapped_ram_checkpoint.incremental;
+}
+
+/*
+ * Called at the end of a migration.  Returns whether its dirty logging
+ * and file bitmaps must be kept for the next checkpoint.
+ */
+static bool ram_mapped_ram_checkpoint_finish(void)
+{
+    MigrationState *s = migrate_get_current();
+    bool keep = migrate_mapped_ram() && migrate_mapped_ram_incremental() &&
+                mapped_ram_checkpoint.pending_filename &&
+                s->state == MIGRATION_STATUS_COMPLETED &&
+                stat(mapped_ram_checkpoint.pending_filename,
+                     &mapped_ram_checkpoint.st) == 0;
+
+    g_free(mapped_ram_checkpoint.filename);
+    mapped_ram_checkpoint.filename = NULL;
+    if (keep) {
+        mapped_ram_checkpoint.filename =
+            g_steal_pointer(&mapped_ram_checkpoint.pending_filename);
+        mapped_ram_checkpoint.offset = mapped_ram_checkpoint.pending_offset;
+    }
+    g_clear_pointer(&mapped_ram_checkpoint.pending_filename, g_free);
+    mapped_ram_checkpoint.incremental = false;
+
+    return keep;
+}
+
+/*
+ * Forget the last checkpoint and stop the dirty logging kept for it.
+ * Called with the BQL held while no migration is running.
+ */
+void ram_mapped_ram_checkpoint_drop(void)
+{
+    RAMBlock *block;
+
+    if (!mapped_ram_checkpoint.filename) {
+        return;
+    }
+
+    trace_ram_mapped_ram_checkpoint_drop(mapped_ram_checkpoint.filename);
+    g_clear_pointer(&mapped_ram_checkpoint.filename, g_free);
+
+    if (global_dirty_tracking & GLOBAL_DIRTY_MIGRATION) {
+        memory_global_dirty_log_stop(GLOBAL_DIRTY_MIGRATION);
+    }
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            g_free(block->file_bmap);
+            block->file_bmap = NULL;
+        }
+    }
+}
+
 static void ram_save_cleanup(void *opaque)
 {
     RAMState **rsp = opaque;
     RAMBlock *block;
+    bool keep_checkpoint = ram_mapped_ram_checkpoint_finish();
 
-    /* We don't use dirty log with background snapshots */
-    if (!migrate_background_snapshot()) {
+    /*
+     * We don't use dirty log with background snapshots, and keep it
+     * running between incremental checkpoints.
+     */
+    if (!migrate_background_snapshot() && !keep_checkpoint) {
         /* caller have hold BQL or is in a bh, so there is
          * no writing race against the migration bitmap
          */
@@ -2463,6 +2748,14 @@ static void ram_save_cleanup(void *opaque)
         block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
+        g_free(block->dirty_chunk_bmap);
+        block->dirty_chunk_bmap = NULL;
+        g_free(block->dirty_freq);
+        block->dirty_freq = NULL;
+        if (!keep_checkpoint) {
+            g_free(block->file_bmap);
+            block->file_bmap = NULL;
+        }
     }
 
     xbzrle_cleanup();
@@ -2668,6 +2961,9 @@ void ram_postcopy_send_discard_bitmap(MigrationState *ms)
 
     RCU_READ_LOCK_GUARD();
 
+    /* Hot pages are sent along with the rest during postcopy */
+    rs->defer_hot_pages = false;
+
     /* This should be our last sync, the src is now paused */
     migration_bitmap_sync(rs, false);
 
@@ -2792,6 +3088,7 @@ static int ram_state_init(RAMState **rsp)
      * This must match with the initial values of dirty bitmap.
      */
     (*rsp)->migration_dirty_pages = (*rsp)->ram_bytes_total >> TARGET_PAGE_BITS;
+    (*rsp)->defer_hot_pages = migrate_defer_hot_pages();
     ram_state_reset(*rsp);
 
     return 0;
@@ -2829,12 +3126,30 @@ static void ram_list_init_bitmaps(void)
              * guest memory.
              */
             block->bmap = bitmap_new(pages);
-            bitmap_set(block->bmap, 0, pages);
-            if (migrate_mapped_ram()) {
-                block->file_bmap = bitmap_new(pages);
+            if (ram_mapped_ram_incremental() && block->file_bmap) {
+                /*
+                 * The file already holds this block as of the last
+                 * checkpoint, and dirty logging has been running since.
+                 * Only pages found by the bitmap syncs need rewriting.
+                 */
+            } else {
+                bitmap_set(block->bmap, 0, pages);
+                if (migrate_mapped_ram()) {
+                    g_free(block->file_bmap);
+                    block->file_bmap = bitmap_new(pages);
+                    /* No previous layout to write in place of */
+                    block->pages_offset = 0;
+                }
             }
             block->clear_bmap_shift = shift;
             block->clear_bmap = bitmap_new(clear_bmap_size(pages, shift));
+            if (migrate_defer_hot_pages()) {
+                unsigned long chunks =
+                    DIV_ROUND_UP(pages, 1UL << DIRTY_FREQ_CHUNK_SHIFT);
+
+                block->dirty_chunk_bmap = bitmap_new(chunks);
+                block->dirty_freq = g_new0(uint8_t, chunks);
+            }
         }
     }
 }
@@ -2858,6 +3173,16 @@ static void ram_init_bitmaps(RAMState *rs)
 
     WITH_RCU_READ_LOCK_GUARD() {
         ram_list_init_bitmaps();
+        if (ram_mapped_ram_incremental()) {
+            RAMBlock *block;
+
+            rs->migration_dirty_pages = 0;
+            RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+                rs->migration_dirty_pages +=
+                    bitmap_count_one(block->bmap,
+                                     block->used_length >> TARGET_PAGE_BITS);
+            }
+        }
         /* We don't use dirty log with background snapshots */
         if (!migrate_background_snapshot()) {
             memory_global_dirty_log_start(GLOBAL_DIRTY_MIGRATION);
@@ -2990,7 +3315,8 @@ struct MappedRamHeader {
 } QEMU_PACKED;
 typedef struct MappedRamHeader MappedRamHeader;
 
-static void mapped_ram_setup_ramblock(QEMUFile *file, RAMBlock *block)
+static void mapped_ram_setup_ramblock(RAMState *rs, QEMUFile *file,
+                                      RAMBlock *block)
 {
     g_autofree MappedRamHeader *header = NULL;
     size_t header_size, bitmap_size;
@@ -3008,9 +3334,27 @@ static void mapped_ram_setup_ramblock(QEMUFile *file, RAMBlock *block)
      * iterative phase, respectively.
      */
     block->bitmap_offset = qemu_get_offset(file) + header_size;
-    block->pages_offset = ROUND_UP(block->bitmap_offset +
-                                   bitmap_size,
-                                   MAPPED_RAM_FILE_OFFSET_ALIGNMENT);
+    if (ram_mapped_ram_incremental() && block->pages_offset &&
+        block->bitmap_offset + bitmap_size <= block->pages_offset) {
+        /*
+         * The pages of the last checkpoint stay where they are and only
+         * the dirty ones get rewritten.  Pages beyond a grown used_length
+         * were marked dirty by the resize.
+         */
+        trace_mapped_ram_setup_ramblock_incremental(block->idstr,
+                                                    block->pages_offset);
+    } else {
+        block->pages_offset = ROUND_UP(block->bitmap_offset +
+                                       bitmap_size,
+                                       MAPPED_RAM_FILE_OFFSET_ALIGNMENT);
+        if (ram_mapped_ram_incremental()) {
+            /* The layout moved: this block is written in full */
+            rs->migration_dirty_pages +=
+                num_pages - bitmap_count_one(block->bmap, num_pages);
+            bitmap_set(block->bmap, 0, num_pages);
+            bitmap_clear(block->file_bmap, 0, num_pages);
+        }
+    }
 
     header->version = cpu_to_be32(MAPPED_RAM_HDR_VERSION);
     header->page_size = cpu_to_be64(TARGET_PAGE_SIZE);
@@ -3107,9 +3451,15 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
             if (migrate_ignore_shared()) {
                 qemu_put_be64(f, block->mr->addr);
             }
+            if (migrate_mode() == MIG_MODE_CPR_TRANSFER) {
+                ret = ram_cpr_transfer_save_block(f, block);
+                if (ret < 0) {
+                    return ret;
+                }
+            }
 
             if (migrate_mapped_ram()) {
-                mapped_ram_setup_ramblock(f, block);
+                mapped_ram_setup_ramblock(*rsp, f, block);
             }
         }
     }
@@ -3162,6 +3512,11 @@ static void ram_save_file_bmap(QEMUFile *f)
                            block->bitmap_offset);
         ram_transferred_add(bitmap_size);
 
+        /* Kept as the base of the next incremental checkpoint */
+        if (migrate_mapped_ram_incremental()) {
+            continue;
+        }
+
         /*
          * Free the bitmap here to catch any synchronization issues
          * with multifd channels. No channels should be sending pages
@@ -3326,6 +3681,8 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
     int ret = 0;
 
     rs->last_stage = !migration_in_colo_state();
+    /* The VM is stopped, everything left has to go now */
+    rs->defer_hot_pages = false;
 
     WITH_RCU_READ_LOCK_GUARD() {
         if (!migration_in_postcopy()) {
@@ -3399,6 +3756,14 @@ static void ram_state_pending_estimate(void *opaque, uint64_t *must_precopy,
 
     uint64_t remaining_size = rs->migration_dirty_pages * TARGET_PAGE_SIZE;
 
+    /*
+     * Only deferred hot pages are left until the next bitmap sync, report
+     * that there's nothing to send so that the exact (syncing) path runs.
+     */
+    if (rs->hot_pages_only) {
+        remaining_size = 0;
+    }
+
     if (migrate_postcopy_ram()) {
         /* We can do postcopy, and all the data is postcopiable */
         *can_postcopy += remaining_size;
@@ -4000,12 +4365,35 @@ static size_t ram_load_multifd_pages(void *host_addr, size_t size,
     return size;
 }
 
+/*
+ * Pages that are not in a mapped-ram file are zero.  Incoming migration
+ * starts from zeroed RAM, but loadvm restores over a VM that already ran.
+ */
+static bool mapped_ram_zero_pages(RAMBlock *block, unsigned long start,
+                                  unsigned long end, Error **errp)
+{
+    ram_addr_t offset = (ram_addr_t)start << TARGET_PAGE_BITS;
+    void *host;
+
+    if (start >= end || !runstate_check(RUN_STATE_RESTORE_VM)) {
+        return true;
+    }
+
+    host = host_from_ram_block_offset(block, offset);
+    if (!host) {
+        error_setg(errp, "page outside of ramblock %s range", block->idstr);
+        return false;
+    }
+    ram_handle_zero(host, (ram_addr_t)(end - start) << TARGET_PAGE_BITS);
+    return true;
+}
+
 static bool read_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
                                      long num_pages, unsigned long *bitmap,
                                      Error **errp)
 {
     ERRP_GUARD();
-    unsigned long set_bit_idx, clear_bit_idx;
+    unsigned long set_bit_idx, clear_bit_idx = 0;
     ram_addr_t offset;
     void *host;
     size_t read, unread, size;
@@ -4014,6 +4402,9 @@ static bool read_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
          set_bit_idx < num_pages;
          set_bit_idx = find_next_bit(bitmap, num_pages, clear_bit_idx + 1)) {
 
+        if (!mapped_ram_zero_pages(block, clear_bit_idx, set_bit_idx, errp)) {
+            return false;
+        }
         clear_bit_idx = find_next_zero_bit(bitmap, num_pages, set_bit_idx + 1);
 
         unread = TARGET_PAGE_SIZE * (clear_bit_idx - set_bit_idx);
@@ -4045,7 +4436,7 @@ static bool read_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
         }
     }
 
-    return true;
+    return mapped_ram_zero_pages(block, clear_bit_idx, num_pages, errp);
 
 err:
     qemu_file_get_error_obj(f, errp);
@@ -4161,6 +4552,12 @@ static int parse_ramblock(QEMUFile *f, RAMBlock *block, ram_addr_t length)
             return -EINVAL;
         }
     }
+    if (migrate_mode() == MIG_MODE_CPR_TRANSFER) {
+        ret = ram_cpr_transfer_load_block(f, block);
+        if (ret < 0) {
+            return ret;
+        }
+    }
     ret = rdma_block_notification_handle(f, block->idstr);
     if (ret < 0) {
         qemu_file_set_error(f, ret);
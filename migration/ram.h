@@ -77,6 +77,9 @@ void postcopy_preempt_shutdown_file(MigrationState *s);
 void *postcopy_preempt_thread(void *opaque);
 void ramblock_set_file_bmap_atomic(RAMBlock *block, ram_addr_t offset,
                                    bool set);
+bool ram_mapped_ram_checkpoint_start(const char *filename, uint64_t offset,
+                                     int fd);
+void ram_mapped_ram_checkpoint_drop(void);
 
 /* ram cache */
 int colo_init_ram_cache(void);
@@ -38,6 +38,7 @@
 #include "migration/global_state.h"
 #include "migration/channel-block.h"
 #include "ram.h"
+#include "multifd.h"
 #include "qemu-file.h"
 #include "savevm.h"
 #include "postcopy-ram.h"
@@ -48,12 +49,14 @@
 #include "qapi/qmp/qerror.h"
 #include "qemu/error-report.h"
 #include "sysemu/cpus.h"
+#include "sysemu/iothread.h"
 #include "exec/memory.h"
 #include "exec/target_page.h"
 #include "trace.h"
 #include "qemu/iov.h"
 #include "qemu/job.h"
 #include "qemu/main-loop.h"
+#include "block/block.h"
 #include "block/snapshot.h"
 #include "qemu/cutils.h"
 #include "io/channel-buffer.h"
@@ -142,6 +145,93 @@ static QEMUFile *qemu_fopen_bdrv(BlockDriverState *bs, int is_writable)
     }
 }
 
+/*
+ * With the multifd and mapped-ram capabilities, snapshots write and read
+ * RAM at fixed offsets of the VM state area, from the multifd threads.
+ * Their channels do the block I/O from an internal IOThread.
+ */
+static bool savevm_multifd_setup(BlockDriverState *bs, Error **errp)
+{
+    MigrationState *s = migrate_get_current();
+
+    if (!migrate_multifd()) {
+        return true;
+    }
+    if (!migrate_mapped_ram()) {
+        error_setg(errp, "Snapshots can only use multifd together with "
+                   "the mapped-ram capability");
+        return false;
+    }
+
+    s->savevm_multifd_iothread = iothread_create("savevm-multifd", errp);
+    if (!s->savevm_multifd_iothread) {
+        return false;
+    }
+    s->savevm_multifd_bs = bs;
+    return true;
+}
+
+static void savevm_multifd_cleanup(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    g_clear_pointer(&s->savevm_multifd_iothread, iothread_destroy);
+    s->savevm_multifd_bs = NULL;
+}
+
+static QIOChannel *savevm_multifd_channel_new(void)
+{
+    MigrationState *s = migrate_get_current();
+    QIOChannelBlock *ioc = qio_channel_block_new(s->savevm_multifd_bs);
+
+    qio_channel_block_set_aio_context(ioc,
+        iothread_get_aio_context(s->savevm_multifd_iothread));
+    qio_channel_set_name(QIO_CHANNEL(ioc), "migration-savevm-multifd");
+    return QIO_CHANNEL(ioc);
+}
+
+bool savevm_multifd_active(void)
+{
+    return migrate_get_current()->savevm_multifd_bs;
+}
+
+bool savevm_send_channel_create(gpointer opaque, Error **errp)
+{
+    multifd_channel_connect(opaque, savevm_multifd_channel_new());
+
+    /* Channel creation is synchronous, like for the file transport */
+    multifd_send_channel_created();
+    return true;
+}
+
+static bool loadvm_multifd_setup(BlockDriverState *bs, Error **errp)
+{
+    int i;
+
+    if (!savevm_multifd_setup(bs, errp)) {
+        return false;
+    }
+    if (!migrate_multifd()) {
+        return true;
+    }
+    if (multifd_recv_setup(errp) != 0) {
+        return false;
+    }
+
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        QIOChannel *ioc = savevm_multifd_channel_new();
+        Error *local_err = NULL;
+
+        multifd_recv_new_channel(ioc, &local_err);
+        object_unref(OBJECT(ioc));
+        if (local_err) {
+            error_propagate(errp, local_err);
+            return false;
+        }
+    }
+    return true;
+}
+
 
 /* QEMUFile timer support.
  * Not in qemu-file.c to not add qemu-timer.c as dependency to qemu-file.c
@@ -217,6 +307,9 @@ typedef struct SaveStateEntry {
     void *opaque;
     CompatEntry *compat;
     int is_ram;
+    /* all state buffers were loaded, protected by loadvm_state_buffers */
+    bool state_buffers_done;
+    int state_buffers_ret;
 } SaveStateEntry;
 
 typedef struct SaveState {
@@ -239,6 +332,23 @@ static SaveState savevm_state = {
 
 static SaveStateEntry *find_se(const char *idstr, uint32_t instance_id);
 
+/*
+ * Orders the loading of device state buffers between devices that declare
+ * a dependency with load_state_buffer_depends.
+ */
+static struct {
+    QemuMutex lock;
+    QemuCond cond;
+    /* the load is being torn down, stop waiting */
+    bool cancelled;
+} loadvm_state_buffers;
+
+static void __attribute__((__constructor__)) loadvm_state_buffers_init(void)
+{
+    qemu_mutex_init(&loadvm_state_buffers.lock);
+    qemu_cond_init(&loadvm_state_buffers.cond);
+}
+
 static bool should_validate_capability(int capability)
 {
     assert(capability >= 0 && capability < MIGRATION_CAPABILITY__MAX);
@@ -246,6 +356,7 @@ static bool should_validate_capability(int capability)
     switch (capability) {
     case MIGRATION_CAPABILITY_X_IGNORE_SHARED:
     case MIGRATION_CAPABILITY_MAPPED_RAM:
+    case MIGRATION_CAPABILITY_X_COLO_INCREMENTAL_STATE:
         return true;
     default:
         return false;
@@ -1601,12 +1712,92 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
     return 0;
 }
 
+typedef struct SaveCompletePrecopyThread {
+    QemuThread thread;
+    SaveStateEntry *se;
+    Error *err;
+    int ret;
+} SaveCompletePrecopyThread;
+
+static void *qemu_savevm_state_complete_precopy_thread(void *opaque)
+{
+    SaveCompletePrecopyThread *t = opaque;
+    SaveStateEntry *se = t->se;
+
+    t->ret = se->ops->save_live_complete_precopy_thread(se->idstr,
+                                                        se->instance_id,
+                                                        se->opaque, &t->err);
+    trace_savevm_state_complete_precopy_thread(se->idstr, se->instance_id,
+                                               t->ret);
+    return NULL;
+}
+
+/*
+ * Start one thread per device that pushes its final state through multifd,
+ * so that it runs in parallel with the main stream and with each other.
+ */
+static GPtrArray *qemu_savevm_state_complete_precopy_threads_start(void)
+{
+    GPtrArray *threads = g_ptr_array_new();
+    SaveStateEntry *se;
+
+    if (!multifd_device_state_supported()) {
+        return threads;
+    }
+
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        SaveCompletePrecopyThread *t;
+
+        if (!se->ops || !se->ops->save_live_complete_precopy_thread) {
+            continue;
+        }
+        if (se->ops->is_active && !se->ops->is_active(se->opaque)) {
+            continue;
+        }
+
+        t = g_new0(SaveCompletePrecopyThread, 1);
+        t->se = se;
+        qemu_thread_create(&t->thread, "mig/src/devstate",
+                           qemu_savevm_state_complete_precopy_thread, t,
+                           QEMU_THREAD_JOINABLE);
+        g_ptr_array_add(threads, t);
+    }
+
+    return threads;
+}
+
+/* Returns the first error hit by any of the threads */
+static int qemu_savevm_state_complete_precopy_threads_join(GPtrArray *threads)
+{
+    MigrationState *ms = migrate_get_current();
+    int ret = 0;
+    guint i;
+
+    for (i = 0; i < threads->len; i++) {
+        SaveCompletePrecopyThread *t = g_ptr_array_index(threads, i);
+
+        qemu_thread_join(&t->thread);
+        if (t->ret && !ret) {
+            ret = t->ret;
+            if (t->err) {
+                migrate_set_error(ms, t->err);
+            }
+        }
+        error_free(t->err);
+        g_free(t);
+    }
+    g_ptr_array_free(threads, true);
+
+    return ret;
+}
+
 int qemu_savevm_state_complete_precopy(QEMUFile *f, bool iterable_only,
                                        bool inactivate_disks)
 {
     int ret;
     Error *local_err = NULL;
     bool in_postcopy = migration_in_postcopy();
+    GPtrArray *threads = NULL;
 
     if (precopy_notify(PRECOPY_NOTIFY_COMPLETE, &local_err)) {
         error_report_err(local_err);
@@ -1616,10 +1807,14 @@ int qemu_savevm_state_complete_precopy(QEMUFile *f, bool iterable_only,
 
     cpu_synchronize_all_states();
 
+    if (!in_postcopy && !iterable_only) {
+        threads = qemu_savevm_state_complete_precopy_threads_start();
+    }
+
     if (!in_postcopy || iterable_only) {
         ret = qemu_savevm_state_complete_precopy_iterable(f, in_postcopy);
         if (ret) {
-            return ret;
+            goto out;
         }
     }
 
@@ -1630,11 +1825,28 @@ int qemu_savevm_state_complete_precopy(QEMUFile *f, bool iterable_only,
     ret = qemu_savevm_state_complete_precopy_non_iterable(f, in_postcopy,
                                                           inactivate_disks);
     if (ret) {
-        return ret;
+        goto out;
     }
 
 flush:
-    return qemu_fflush(f);
+    ret = qemu_fflush(f);
+
+out:
+    if (threads) {
+        int thread_ret;
+
+        thread_ret = qemu_savevm_state_complete_precopy_threads_join(threads);
+        if (!ret && thread_ret) {
+            qemu_file_set_error(f, thread_ret);
+            ret = thread_ret;
+        }
+        /* Device state must be on the wire before the channels go away */
+        if (!ret && multifd_send_flush_device_state()) {
+            ret = -EIO;
+        }
+    }
+
+    return ret;
 }
 
 /* Give an estimate of the amount left to be transferred,
@@ -1722,6 +1934,15 @@ static int qemu_savevm_state(QEMUFile *f, Error **errp)
     }
     ms->to_dst_file = f;
 
+    if (savevm_multifd_active() && !multifd_send_setup()) {
+        multifd_send_shutdown();
+        error_setg(errp, "Failed to set up multifd channels");
+        migrate_set_state(&ms->state, MIGRATION_STATUS_SETUP,
+                          MIGRATION_STATUS_FAILED);
+        ms->to_dst_file = NULL;
+        return -EINVAL;
+    }
+
     qemu_savevm_state_header(f);
     qemu_savevm_state_setup(f);
 
@@ -1737,6 +1958,9 @@ static int qemu_savevm_state(QEMUFile *f, Error **errp)
         ret = qemu_file_get_error(f);
     }
     qemu_savevm_state_cleanup();
+    if (savevm_multifd_active()) {
+        multifd_send_shutdown();
+    }
     if (ret != 0) {
         error_setg_errno(errp, -ret, "Error while writing VM state");
     }
@@ -1763,6 +1987,17 @@ void qemu_savevm_live_state(QEMUFile *f)
 }
 
 int qemu_save_device_state(QEMUFile *f)
+{
+    return qemu_save_device_state_sections(f, NULL, NULL);
+}
+
+/*
+ * Like qemu_save_device_state(), calling @section_end after each section
+ * and after the EOF marker.
+ */
+int qemu_save_device_state_sections(QEMUFile *f,
+                                    void (*section_end)(void *opaque),
+                                    void *opaque)
 {
     SaveStateEntry *se;
 
@@ -1782,9 +2017,15 @@ int qemu_save_device_state(QEMUFile *f)
         if (ret) {
             return ret;
         }
+        if (section_end) {
+            section_end(opaque);
+        }
     }
 
     qemu_put_byte(f, QEMU_VM_EOF);
+    if (section_end) {
+        section_end(opaque);
+    }
 
     return qemu_file_get_error(f);
 }
@@ -1809,6 +2050,106 @@ static SaveStateEntry *find_se(const char *idstr, uint32_t instance_id)
     return NULL;
 }
 
+/*
+ * Dispatch a device state buffer received on a multifd channel.  Called
+ * without the BQL; the handler list can't change while migrating.  Takes
+ * ownership of @buf.
+ */
+int qemu_loadvm_load_state_buffer(const char *idstr, uint32_t instance_id,
+                                  char *buf, size_t len, Error **errp)
+{
+    SaveStateEntry *se = find_se(idstr, instance_id);
+
+    if (!se) {
+        error_setg(errp, "Unknown device state buffer target %s "
+                   "instance %"PRIu32, idstr, instance_id);
+        g_free(buf);
+        return -EINVAL;
+    }
+
+    if (!se->ops || !se->ops->load_state_buffer) {
+        error_setg(errp, "Device %s instance %"PRIu32" doesn't accept "
+                   "state buffers", idstr, instance_id);
+        g_free(buf);
+        return -EINVAL;
+    }
+
+    return se->ops->load_state_buffer(se->opaque, buf, len, errp);
+}
+
+static SaveStateEntry *find_se_state_buffer(void *opaque)
+{
+    SaveStateEntry *se;
+
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        if (se->opaque == opaque && se->ops && se->ops->load_state_buffer) {
+            return se;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Wait until every device that the device at @opaque depends on, as told
+ * by its load_state_buffer_depends handler, has loaded all of its state
+ * buffers.  Called by the device before it loads its first buffer, from
+ * any thread but the main one.
+ *
+ * Returns 0 when the buffers can be loaded, or negative on error: a
+ * dependency failed, or the load was cancelled.
+ */
+int qemu_loadvm_state_buffers_wait_deps(void *opaque)
+{
+    SaveStateEntry *me = find_se_state_buffer(opaque);
+    SaveStateEntry *se;
+
+    assert(me);
+    if (!me->ops->load_state_buffer_depends) {
+        return 0;
+    }
+
+    QEMU_LOCK_GUARD(&loadvm_state_buffers.lock);
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        if (se == me || !se->ops || !se->ops->load_state_buffer ||
+            !me->ops->load_state_buffer_depends(me->opaque, se->ops,
+                                                se->opaque)) {
+            continue;
+        }
+
+        trace_loadvm_state_buffers_wait_deps(me->idstr, se->idstr);
+        while (!se->state_buffers_done && !loadvm_state_buffers.cancelled) {
+            qemu_cond_wait(&loadvm_state_buffers.cond,
+                           &loadvm_state_buffers.lock);
+        }
+        if (loadvm_state_buffers.cancelled) {
+            return -ECANCELED;
+        }
+        if (se->state_buffers_ret) {
+            error_report("%s: Can't load state buffers after %s failed",
+                         me->idstr, se->idstr);
+            return se->state_buffers_ret;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Tell the devices that depend on the device at @opaque that it loaded all
+ * of its state buffers, or failed to with a negative @ret.
+ */
+void qemu_loadvm_state_buffers_done(void *opaque, int ret)
+{
+    SaveStateEntry *se = find_se_state_buffer(opaque);
+
+    assert(se);
+
+    QEMU_LOCK_GUARD(&loadvm_state_buffers.lock);
+    se->state_buffers_done = true;
+    se->state_buffers_ret = ret;
+    qemu_cond_broadcast(&loadvm_state_buffers.cond);
+}
+
 enum LoadVMExitCodes {
     /* Allow a command to quit all layers of nested loadvm loops */
     LOADVM_QUIT     =  1,
@@ -2221,7 +2562,8 @@ static gboolean postcopy_sync_page_req(gpointer key, gpointer value,
         return FALSE;
     }
 
-    ret = migrate_send_rp_message_req_pages(mis, rb, rb_offset);
+    ret = migrate_send_rp_message_req_pages(mis, rb, rb_offset,
+                                            qemu_ram_pagesize(rb));
     if (ret) {
         /* Please refer to above comment. */
         error_report("%s: send rp message failed for addr %p",
@@ -2766,6 +3108,15 @@ static int qemu_loadvm_state_setup(QEMUFile *f)
     int ret;
 
     trace_loadvm_state_setup();
+
+    WITH_QEMU_LOCK_GUARD(&loadvm_state_buffers.lock) {
+        loadvm_state_buffers.cancelled = false;
+        QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+            se->state_buffers_done = false;
+            se->state_buffers_ret = 0;
+        }
+    }
+
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
         if (!se->ops || !se->ops->load_setup) {
             continue;
@@ -2791,6 +3142,13 @@ void qemu_loadvm_state_cleanup(void)
     SaveStateEntry *se;
 
     trace_loadvm_state_cleanup();
+
+    /* Release the device threads still waiting for their dependencies */
+    WITH_QEMU_LOCK_GUARD(&loadvm_state_buffers.lock) {
+        loadvm_state_buffers.cancelled = true;
+        qemu_cond_broadcast(&loadvm_state_buffers.cond);
+    }
+
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
         if (se->ops && se->ops->load_cleanup) {
             se->ops->load_cleanup(se->opaque);
@@ -3137,13 +3495,23 @@ bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
     }
 
     /* save the VM state */
+    if (!savevm_multifd_setup(bs, errp)) {
+        goto the_end;
+    }
     f = qemu_fopen_bdrv(bs, 1);
     if (!f) {
         error_setg(errp, "Could not open VM state file");
+        savevm_multifd_cleanup();
         goto the_end;
     }
     ret = qemu_savevm_state(f, errp);
-    vm_state_size = qemu_file_transferred(f);
+    savevm_multifd_cleanup();
+    /* mapped-ram seeks past the RAM, which is not in the transferred bytes */
+    if (migrate_mapped_ram()) {
+        vm_state_size = qemu_get_offset(f);
+    } else {
+        vm_state_size = qemu_file_transferred(f);
+    }
     ret2 = qemu_fclose(f);
     if (ret < 0) {
         goto the_end;
@@ -3316,8 +3684,14 @@ bool load_snapshot(const char *name, const char *vmstate,
         ret = -EINVAL;
         goto err_drain;
     }
+    if (!loadvm_multifd_setup(bs_vm_state, errp)) {
+        migration_incoming_state_destroy();
+        savevm_multifd_cleanup();
+        goto err_drain;
+    }
     ret = qemu_loadvm_state(f);
     migration_incoming_state_destroy();
+    savevm_multifd_cleanup();
 
     bdrv_drain_all_end();
 
@@ -3391,6 +3765,14 @@ typedef struct SnapshotJob {
     Coroutine *co;
     Error **errp;
     bool ret;
+
+    /* snapshot-save with live=true */
+    bool live;
+    QEMUSnapshotInfo sn;
+    BlockDriverState *vmstate_bs;
+    IOThread *iothread;
+    NotifierWithReturn migration_notifier;
+    bool snapshot_created;
 } SnapshotJob;
 
 static void qmp_snapshot_job_free(SnapshotJob *s)
@@ -3422,14 +3804,195 @@ static void snapshot_load_job_bh(void *opaque)
     aio_co_wake(s->co);
 }
 
+/*
+ * Called from the migration thread with the VM stopped, right before RAM
+ * is write protected: the disks are snapshotted at the same point in time
+ * as the VM state.  The VM state itself is attached once it is written.
+ */
+static bool snapshot_save_live_snapshot(void *opaque, Error **errp)
+{
+    SnapshotJob *s = opaque;
+    int ret;
+
+    s->sn.vm_clock_nsec = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    bdrv_drain_all_begin();
+    ret = bdrv_all_create_snapshot(&s->sn, s->vmstate_bs, 0,
+                                   true, s->devices, errp);
+    if (ret < 0) {
+        bdrv_all_delete_snapshot(s->tag, true, s->devices, NULL);
+    }
+    bdrv_drain_all_end();
+
+    s->snapshot_created = ret == 0;
+    return ret == 0;
+}
+
+static bool snapshot_save_live_finish(SnapshotJob *s, Error **errp)
+{
+    uint64_t vm_state_size = stat64_get(&mig_stats.qemu_file_transferred);
+    QEMUSnapshotInfo sn;
+    int ret;
+
+    GRAPH_RDLOCK_GUARD_MAINLOOP();
+
+    /* Look up by name only, the tag may look like the ID of another one */
+    if (!bdrv_snapshot_find_by_id_and_name(s->vmstate_bs, NULL, s->tag,
+                                           &sn, errp)) {
+        return false;
+    }
+    ret = bdrv_snapshot_attach_vmstate(s->vmstate_bs, sn.id_str,
+                                       vm_state_size);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret,
+                         "Error while writing VM state to snapshot '%s' "
+                         "on '%s'", s->tag,
+                         bdrv_get_device_or_node_name(s->vmstate_bs));
+        return false;
+    }
+    return true;
+}
+
+static int snapshot_save_live_notify(NotifierWithReturn *notifier,
+                                     MigrationEvent *e, Error **errp)
+{
+    SnapshotJob *s = container_of(notifier, SnapshotJob, migration_notifier);
+
+    if (e->type == MIG_EVENT_PRECOPY_SETUP) {
+        return 0;
+    }
+
+    migration_remove_notifier(notifier);
+
+    if (e->type == MIG_EVENT_PRECOPY_DONE) {
+        s->ret = snapshot_save_live_finish(s, s->errp);
+    } else {
+        MigrationState *ms = migrate_get_current();
+
+        WITH_QEMU_LOCK_GUARD(&ms->error_mutex) {
+            if (ms->error) {
+                error_propagate(s->errp, error_copy(ms->error));
+            } else {
+                error_setg(s->errp, "Error while writing VM state");
+            }
+        }
+        s->ret = false;
+    }
+
+    if (!s->ret && s->snapshot_created) {
+        bdrv_all_delete_snapshot(s->tag, true, s->devices, NULL);
+    }
+
+    g_clear_pointer(&s->iothread, iothread_destroy);
+    bdrv_unref(s->vmstate_bs);
+    s->vmstate_bs = NULL;
+
+    job_progress_update(&s->common, 1);
+
+    qmp_snapshot_job_free(s);
+    aio_co_wake(s->co);
+    return 0;
+}
+
+/*
+ * Starts writing the VM state with the background-snapshot machinery.  On
+ * success the job is completed by snapshot_save_live_notify() and @s must
+ * not be touched anymore.
+ */
+static bool snapshot_save_live_start(SnapshotJob *s, Error **errp)
+{
+    g_autoptr(GDateTime) now = g_date_time_new_now_local();
+    g_autofree char *iothread_id = NULL;
+    QIOChannelBlock *ioc;
+    bool can_attach;
+    int ret;
+
+    GLOBAL_STATE_CODE();
+
+    if (replay_mode != REPLAY_MODE_NONE) {
+        error_setg(errp, "Record/replay does not support live snapshots");
+        return false;
+    }
+    if (!bdrv_all_can_snapshot(true, s->devices, errp)) {
+        return false;
+    }
+
+    ret = bdrv_all_has_snapshot(s->tag, true, s->devices, errp);
+    if (ret < 0) {
+        return false;
+    }
+    if (ret) {
+        error_setg(errp, "Snapshot '%s' already exists in one or more devices",
+                   s->tag);
+        return false;
+    }
+
+    s->vmstate_bs = bdrv_all_find_vmstate_bs(s->vmstate, true, s->devices,
+                                             errp);
+    if (!s->vmstate_bs) {
+        return false;
+    }
+
+    bdrv_graph_rdlock_main_loop();
+    can_attach = bdrv_snapshot_can_attach_vmstate(s->vmstate_bs);
+    bdrv_graph_rdunlock_main_loop();
+    if (!can_attach) {
+        error_setg(errp, "Device '%s' does not support live snapshots",
+                   bdrv_get_device_or_node_name(s->vmstate_bs));
+        s->vmstate_bs = NULL;
+        return false;
+    }
+
+    memset(&s->sn, 0, sizeof(s->sn));
+    pstrcpy(s->sn.name, sizeof(s->sn.name), s->tag);
+    s->sn.date_sec = g_date_time_to_unix(now);
+    s->sn.date_nsec = g_date_time_get_microsecond(now) * 1000;
+    s->sn.icount = -1ULL;
+
+    /* Keeps the VM state writes away from the BQL, see migrate_savevm_live */
+    iothread_id = g_strdup_printf("snapshot-save-%s", s->common.id);
+    s->iothread = iothread_create(iothread_id, errp);
+    if (!s->iothread) {
+        s->vmstate_bs = NULL;
+        return false;
+    }
+
+    bdrv_ref(s->vmstate_bs);
+    ioc = qio_channel_block_new(s->vmstate_bs);
+    qio_channel_set_name(QIO_CHANNEL(ioc), "snapshot-save-live");
+    qio_channel_block_set_aio_context(ioc,
+                                      iothread_get_aio_context(s->iothread));
+
+    migration_add_notifier(&s->migration_notifier, snapshot_save_live_notify);
+    if (!migrate_savevm_live(QIO_CHANNEL(ioc), snapshot_save_live_snapshot,
+                             s, errp)) {
+        migration_remove_notifier(&s->migration_notifier);
+        object_unref(OBJECT(ioc));
+        g_clear_pointer(&s->iothread, iothread_destroy);
+        bdrv_unref(s->vmstate_bs);
+        s->vmstate_bs = NULL;
+        return false;
+    }
+
+    object_unref(OBJECT(ioc));
+    return true;
+}
+
 static void snapshot_save_job_bh(void *opaque)
 {
     Job *job = opaque;
     SnapshotJob *s = container_of(job, SnapshotJob, common);
 
     job_progress_set_remaining(&s->common, 1);
-    s->ret = save_snapshot(s->tag, false, s->vmstate,
-                           true, s->devices, s->errp);
+    if (s->live) {
+        if (snapshot_save_live_start(s, s->errp)) {
+            return;
+        }
+        s->ret = false;
+    } else {
+        s->ret = save_snapshot(s->tag, false, s->vmstate,
+                               true, s->devices, s->errp);
+    }
     job_progress_update(&s->common, 1);
 
     qmp_snapshot_job_free(s);
@@ -3506,6 +4069,7 @@ void qmp_snapshot_save(const char *job_id,
                        const char *tag,
                        const char *vmstate,
                        strList *devices,
+                       bool has_live, bool live,
                        Error **errp)
 {
     SnapshotJob *s;
@@ -3520,6 +4084,7 @@ void qmp_snapshot_save(const char *job_id,
     s->tag = g_strdup(tag);
     s->vmstate = g_strdup(vmstate);
     s->devices = QAPI_CLONE(strList, devices);
+    s->live = has_live && live;
 
     job_start(&s->common);
 }
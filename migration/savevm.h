@@ -61,13 +61,23 @@ void qemu_savevm_send_postcopy_ram_discard(QEMUFile *f, const char *name,
 void qemu_savevm_send_colo_enable(QEMUFile *f);
 void qemu_savevm_live_state(QEMUFile *f);
 int qemu_save_device_state(QEMUFile *f);
+int qemu_save_device_state_sections(QEMUFile *f,
+                                    void (*section_end)(void *opaque),
+                                    void *opaque);
 
 int qemu_loadvm_state(QEMUFile *f);
 void qemu_loadvm_state_cleanup(void);
 int qemu_loadvm_state_main(QEMUFile *f, MigrationIncomingState *mis);
 int qemu_load_device_state(QEMUFile *f);
 int qemu_loadvm_approve_switchover(void);
+int qemu_loadvm_load_state_buffer(const char *idstr, uint32_t instance_id,
+                                  char *buf, size_t len, Error **errp);
+int qemu_loadvm_state_buffers_wait_deps(void *opaque);
+void qemu_loadvm_state_buffers_done(void *opaque, int ret);
 int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
         bool in_postcopy, bool inactivate_disks);
 
+bool savevm_multifd_active(void);
+bool savevm_send_channel_create(gpointer opaque, Error **errp);
+
 #endif
@@ -18,6 +18,7 @@
 #include "qapi/qmp/json-writer.h"
 #include "qemu-file.h"
 #include "qemu/bitops.h"
+#include "qemu/bswap.h"
 #include "qemu/error-report.h"
 #include "trace.h"
 
@@ -100,6 +101,103 @@ static void vmstate_handle_alloc(void *ptr, const VMStateField *field,
     }
 }
 
+/*
+ * Arrays of fixed-width integers (register files, MSI-X tables, per-vCPU
+ * state...) don't need to go through VMStateInfo one element at a time:
+ * their wire format is just the big endian elements back to back.  Returns
+ * the element width if @field can be moved in bulk, 0 otherwise.
+ */
+static size_t vmstate_bulk_width(const VMStateField *field, int size)
+{
+    const VMStateInfo *info = field->info;
+    size_t width;
+
+    if (field->flags & (VMS_STRUCT | VMS_VSTRUCT | VMS_ARRAY_OF_POINTER)) {
+        return 0;
+    }
+
+    if (info == &vmstate_info_uint8 || info == &vmstate_info_int8) {
+        width = 1;
+    } else if (info == &vmstate_info_uint16 || info == &vmstate_info_int16) {
+        width = 2;
+    } else if (info == &vmstate_info_uint32 || info == &vmstate_info_int32) {
+        width = 4;
+    } else if (info == &vmstate_info_uint64 || info == &vmstate_info_int64) {
+        width = 8;
+    } else {
+        return 0;
+    }
+
+    return size == width ? width : 0;
+}
+
+/*
+ * Convert @n elements of @width bytes between host and big endian.  The
+ * loops are kept trivial so that the compiler vectorizes them.
+ */
+static void vmstate_bswap_elems(void *dst, const void *src, size_t width,
+                                size_t n)
+{
+    size_t i;
+
+    switch (width) {
+    case 2:
+        for (i = 0; i < n; i++) {
+            stw_he_p(dst + i * 2, bswap16(lduw_he_p(src + i * 2)));
+        }
+        break;
+    case 4:
+        for (i = 0; i < n; i++) {
+            stl_he_p(dst + i * 4, bswap32(ldl_he_p(src + i * 4)));
+        }
+        break;
+    case 8:
+        for (i = 0; i < n; i++) {
+            stq_he_p(dst + i * 8, bswap64(ldq_he_p(src + i * 8)));
+        }
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+#define VMSTATE_BULK_CHUNK 1024
+
+static void vmstate_save_bulk(QEMUFile *f, const void *elems, size_t width,
+                              size_t n)
+{
+    uint64_t buf[VMSTATE_BULK_CHUNK / sizeof(uint64_t)];
+    size_t chunk = VMSTATE_BULK_CHUNK / width;
+
+    if (width == 1 || HOST_BIG_ENDIAN) {
+        qemu_put_buffer(f, elems, n * width);
+        return;
+    }
+
+    while (n) {
+        size_t todo = MIN(n, chunk);
+
+        vmstate_bswap_elems(buf, elems, width, todo);
+        qemu_put_buffer(f, (uint8_t *)buf, todo * width);
+        elems += todo * width;
+        n -= todo;
+    }
+}
+
+static int vmstate_load_bulk(QEMUFile *f, void *elems, size_t width,
+                             size_t n)
+{
+    if (qemu_get_buffer(f, elems, n * width) != n * width) {
+        return qemu_file_get_error(f) ?: -EIO;
+    }
+
+    if (width > 1 && !HOST_BIG_ENDIAN) {
+        vmstate_bswap_elems(elems, elems, width, n);
+    }
+
+    return qemu_file_get_error(f);
+}
+
 int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
                        void *opaque, int version_id)
 {
@@ -134,11 +232,25 @@ int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
             int i, n_elems = vmstate_n_elems(opaque, field);
             int size = vmstate_size(opaque, field);
 
+            size_t width = vmstate_bulk_width(field, size);
+
             vmstate_handle_alloc(first_elem, field, opaque);
             if (field->flags & VMS_POINTER) {
                 first_elem = *(void **)first_elem;
                 assert(first_elem || !n_elems || !size);
             }
+            if (width && n_elems > 1) {
+                ret = vmstate_load_bulk(f, first_elem, width, n_elems);
+                if (ret < 0) {
+                    qemu_file_set_error(f, ret);
+                    error_report("Failed to load %s:%s", vmsd->name,
+                                 field->name);
+                    trace_vmstate_load_field_error(field->name, ret);
+                    return ret;
+                }
+                /* Skip the per element loop */
+                n_elems = 0;
+            }
             for (i = 0; i < n_elems; i++) {
                 void *curr_elem = first_elem + size * i;
 
@@ -375,6 +487,7 @@ int vmstate_save_state_v(QEMUFile *f, const VMStateDescription *vmsd,
             void *first_elem = opaque + field->offset;
             int i, n_elems = vmstate_n_elems(opaque, field);
             int size = vmstate_size(opaque, field);
+            size_t width = vmstate_bulk_width(field, size);
             uint64_t old_offset, written_bytes;
             JSONWriter *vmdesc_loop = vmdesc;
 
@@ -383,6 +496,18 @@ int vmstate_save_state_v(QEMUFile *f, const VMStateDescription *vmsd,
                 first_elem = *(void **)first_elem;
                 assert(first_elem || !n_elems || !size);
             }
+            /*
+             * The description only holds the first element of compressible
+             * arrays, which is all the bulk path can provide.
+             */
+            if (width && n_elems > 1 &&
+                (!vmdesc || vmsd_can_compress(field))) {
+                vmsd_desc_field_start(vmsd, vmdesc, field, 0, n_elems);
+                vmstate_save_bulk(f, first_elem, width, n_elems);
+                vmsd_desc_field_end(vmsd, vmdesc, field, width, 0);
+                /* Skip the per element loop */
+                n_elems = 0;
+            }
             for (i = 0; i < n_elems; i++) {
                 void *curr_elem = first_elem + size * i;
 
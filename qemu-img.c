@@ -55,6 +55,10 @@
 #include "qemu/throttle.h"
 #include "block/throttle-groups.h"
 
+#ifdef CONFIG_ZSTD
+#include <zdict.h>
+#endif
+
 #define QEMU_IMG_VERSION "qemu-img version " QEMU_FULL_VERSION \
                           "\n" QEMU_COPYRIGHT "\n"
 
@@ -86,6 +90,10 @@ enum {
     OPTION_BITMAPS = 275,
     OPTION_FORCE = 276,
     OPTION_SKIP_BROKEN = 277,
+    OPTION_WRITE_WORKERS = 278,
+    OPTION_COMPRESS_WORKERS = 279,
+    OPTION_STAGE_STATS = 280,
+    OPTION_TRAIN_DICT = 281,
 };
 
 typedef enum OutputFormat {
@@ -207,6 +215,14 @@ void help(void)
            "  '-m' specifies how many coroutines work in parallel during the convert\n"
            "       process (defaults to 8)\n"
            "  '-W' allow to write to the target out of order rather than sequential\n"
+           "  '--write-workers' specifies how many writes to the target are in flight\n"
+           "       while the coroutines read ahead (by default each coroutine writes\n"
+           "       its own data)\n"
+           "  '--compress-workers' specifies how many clusters of a compressed qcow2\n"
+           "       target are compressed in parallel\n"
+           "  '--stage-stats' prints the time spent and throughput of each stage\n"
+           "  '--train-dictionary' trains a zstd dictionary of the given size on\n"
+           "       the source and stores it in the new compressed qcow2 target\n"
            "\n"
            "Parameters to snapshot subcommand:\n"
            "  'snapshot' is the name of the snapshot to create, apply or delete\n"
@@ -668,6 +684,13 @@ static void dump_human_image_check(ImageCheck *check, bool quiet)
     }
 }
 
+static void check_status_cb(BlockDriverState *bs,
+                            int64_t done, int64_t total_work_size,
+                            void *opaque)
+{
+    qemu_progress_print(100.f * done / total_work_size, 0);
+}
+
 static int collect_image_check(BlockDriverState *bs,
                    ImageCheck *check,
                    const char *filename,
@@ -677,7 +700,10 @@ static int collect_image_check(BlockDriverState *bs,
     int ret;
     BdrvCheckResult result;
 
-    ret = bdrv_check(bs, &result, fix);
+    qemu_progress_print(0.f, 0);
+    ret = bdrv_check(bs, &result, fix, check_status_cb, NULL);
+    qemu_progress_print(100.f, 0);
+    qemu_progress_end();
     if (ret < 0) {
         return ret;
     }
@@ -703,6 +729,8 @@ static int collect_image_check(BlockDriverState *bs,
     check->has_fragmented_clusters  = result.bfi.fragmented_clusters != 0;
     check->compressed_clusters      = result.bfi.compressed_clusters;
     check->has_compressed_clusters  = result.bfi.compressed_clusters != 0;
+    check->extents                  = result.bfi.extents;
+    check->has_extents              = result.bfi.extents != 0;
 
     return 0;
 }
@@ -730,6 +758,7 @@ static int img_check(int argc, char **argv)
     bool quiet = false;
     bool image_opts = false;
     bool force_share = false;
+    bool progress = false;
 
     fmt = NULL;
     output = NULL;
@@ -747,7 +776,7 @@ static int img_check(int argc, char **argv)
             {"force-share", no_argument, 0, 'U'},
             {0, 0, 0, 0}
         };
-        c = getopt_long(argc, argv, ":hf:r:T:qU",
+        c = getopt_long(argc, argv, ":hf:r:T:pqU",
                         long_options, &option_index);
         if (c == -1) {
             break;
@@ -783,6 +812,9 @@ static int img_check(int argc, char **argv)
         case 'T':
             cache = optarg;
             break;
+        case 'p':
+            progress = true;
+            break;
         case 'q':
             quiet = true;
             break;
@@ -802,6 +834,10 @@ static int img_check(int argc, char **argv)
     }
     filename = argv[optind++];
 
+    if (quiet) {
+        progress = false;
+    }
+
     if (output && !strcmp(output, "json")) {
         output_format = OFORMAT_JSON;
     } else if (output && !strcmp(output, "human")) {
@@ -824,6 +860,8 @@ static int img_check(int argc, char **argv)
     }
     bs = blk_bs(blk);
 
+    qemu_progress_init(progress, 1.f);
+
     check = g_new0(ImageCheck, 1);
     ret = collect_image_check(bs, check, filename, fmt, fix);
 
@@ -1665,8 +1703,22 @@ enum ImgConvertBlockStatus {
 };
 
 #define MAX_COROUTINES 16
+#define MAX_WRITE_WORKERS 64
+#define MAX_COMPRESS_WORKERS 64
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
+enum ImgConvertStage {
+    CONVERT_STAGE_STATUS,
+    CONVERT_STAGE_READ,
+    CONVERT_STAGE_WRITE,
+    CONVERT_STAGE__MAX,
+};
+
+typedef struct ImgConvertStageStats {
+    int64_t bytes;
+    int64_t busy_ns;
+} ImgConvertStageStats;
+
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1697,10 +1749,28 @@ typedef struct ImgConvertState {
     int running_coroutines;
     Coroutine *co[MAX_COROUTINES];
     int64_t wait_sector_num[MAX_COROUTINES];
+    /*
+     * If non-zero, data is written by up to write_workers coroutines of
+     * its own, so that the copying coroutines can read ahead while the
+     * target, and the compression for -c, is busy.
+     */
+    long write_workers;
+    int running_writes;
+    CoQueue write_queue;
+    bool stage_stats;
+    ImgConvertStageStats stats[CONVERT_STAGE__MAX];
     CoMutex lock;
     int ret;
 } ImgConvertState;
 
+static void convert_stage_account(ImgConvertState *s,
+                                  enum ImgConvertStage stage,
+                                  int64_t sectors, int64_t start_ns)
+{
+    s->stats[stage].bytes += sectors * BDRV_SECTOR_SIZE;
+    s->stats[stage].busy_ns += get_clock() - start_ns;
+}
+
 static void convert_select_part(ImgConvertState *s, int64_t sector_num,
                                 int *src_cur, int64_t *src_cur_offset)
 {
@@ -1938,6 +2008,60 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
     return 0;
 }
 
+typedef struct ConvertWriteTask {
+    ImgConvertState *s;
+    int64_t sector_num;
+    int nb_sectors;
+    uint8_t *buf;
+} ConvertWriteTask;
+
+static void coroutine_fn convert_co_write_task(void *opaque)
+{
+    ConvertWriteTask *t = opaque;
+    ImgConvertState *s = t->s;
+    int64_t start = get_clock();
+    int ret;
+
+    ret = convert_co_write(s, t->sector_num, t->nb_sectors, t->buf, BLK_DATA);
+    convert_stage_account(s, CONVERT_STAGE_WRITE, t->nb_sectors, start);
+    if (ret < 0) {
+        error_report("error while writing at byte %lld: %s",
+                     t->sector_num * BDRV_SECTOR_SIZE, strerror(-ret));
+        s->ret = ret;
+    }
+
+    qemu_vfree(t->buf);
+    g_free(t);
+    s->running_writes--;
+    qemu_co_queue_next(&s->write_queue);
+}
+
+/*
+ * Hand @buf over to a write worker, waiting for one to be free first.
+ * The write has been submitted to the target when this returns, so
+ * in-order writes still reach the target in order.
+ */
+static void coroutine_fn convert_co_start_write(ImgConvertState *s,
+                                                int64_t sector_num,
+                                                int nb_sectors, uint8_t *buf)
+{
+    ConvertWriteTask *t;
+
+    while (s->running_writes >= s->write_workers) {
+        qemu_co_queue_wait(&s->write_queue, NULL);
+    }
+    s->running_writes++;
+
+    t = g_new(ConvertWriteTask, 1);
+    *t = (ConvertWriteTask) {
+        .s          = s,
+        .sector_num = sector_num,
+        .nb_sectors = nb_sectors,
+        .buf        = buf,
+    };
+    qemu_coroutine_enter(qemu_coroutine_create(convert_co_write_task, t));
+}
+
 static int coroutine_fn convert_co_copy_range(ImgConvertState *s, int64_t sector_num,
                                               int nb_sectors)
 {
@@ -1985,19 +2109,24 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
     assert(index >= 0);
 
     s->running_coroutines++;
-    buf = blk_blockalign(s->target, s->buf_sectors * BDRV_SECTOR_SIZE);
 
     while (1) {
         int n;
-        int64_t sector_num;
+        int64_t sector_num, start;
         enum ImgConvertBlockStatus status;
         bool copy_range;
 
+        /* The previous buffer may still be in use by a write worker */
+        if (!buf) {
+            buf = blk_blockalign(s->target, s->buf_sectors * BDRV_SECTOR_SIZE);
+        }
+
         qemu_co_mutex_lock(&s->lock);
         if (s->ret != -EINPROGRESS || s->sector_num >= s->total_sectors) {
             qemu_co_mutex_unlock(&s->lock);
             break;
         }
+        start = get_clock();
         WITH_GRAPH_RDLOCK_GUARD() {
             n = convert_iteration_sectors(s, s->sector_num);
         }
@@ -2012,6 +2141,7 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
         if (!s->min_sparse && s->status == BLK_ZERO) {
             n = MIN(n, s->buf_sectors);
         }
+        convert_stage_account(s, CONVERT_STAGE_STATUS, n, start);
         /* increment global sector counter so that other coroutines can
          * already continue reading beyond this request */
         s->sector_num += n;
@@ -2026,7 +2156,9 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
 retry:
         copy_range = s->copy_range && s->status == BLK_DATA;
         if (status == BLK_DATA && !copy_range) {
+            start = get_clock();
             ret = convert_co_read(s, sector_num, n, buf);
+            convert_stage_account(s, CONVERT_STAGE_READ, n, start);
             if (ret < 0) {
                 error_report("error while reading at byte %lld: %s",
                              sector_num * BDRV_SECTOR_SIZE, strerror(-ret));
@@ -2055,8 +2187,14 @@ retry:
                     s->copy_range = false;
                     goto retry;
                 }
+            } else if (s->write_workers && status == BLK_DATA) {
+                convert_co_start_write(s, sector_num, n, buf);
+                buf = NULL;
+                ret = 0;
             } else {
+                start = get_clock();
                 ret = convert_co_write(s, sector_num, n, buf, status);
+                convert_stage_account(s, CONVERT_STAGE_WRITE, n, start);
             }
             if (ret < 0) {
                 error_report("error while writing at byte %lld: %s",
@@ -2086,16 +2224,41 @@ retry:
     qemu_vfree(buf);
     s->co[index] = NULL;
     s->running_coroutines--;
-    if (!s->running_coroutines && s->ret == -EINPROGRESS) {
-        /* the convert job finished successfully */
-        s->ret = 0;
+}
+
+static void convert_print_stage_stats(ImgConvertState *s, int64_t elapsed_ns)
+{
+    static const char *const stage_names[CONVERT_STAGE__MAX] = {
+        [CONVERT_STAGE_STATUS] = "block-status",
+        [CONVERT_STAGE_READ]   = "read",
+        [CONVERT_STAGE_WRITE]  = "write",
+    };
+    long workers[CONVERT_STAGE__MAX] = {
+        [CONVERT_STAGE_STATUS] = 1,
+        [CONVERT_STAGE_READ]   = s->num_coroutines,
+        [CONVERT_STAGE_WRITE]  = s->write_workers ?: s->num_coroutines,
+    };
+    int i;
+
+    printf("%-12s %7s %10s %10s %12s\n",
+           "Stage", "Workers", "Bytes", "Busy (s)", "Throughput");
+    for (i = 0; i < CONVERT_STAGE__MAX; i++) {
+        ImgConvertStageStats *st = &s->stats[i];
+        g_autofree char *bytes = size_to_str(st->bytes);
+        g_autofree char *rate =
+            size_to_str(elapsed_ns ? st->bytes * 1e9 / elapsed_ns : 0);
+
+        printf("%-12s %7ld %10s %10.3f %10s/s\n", stage_names[i], workers[i],
+               bytes, st->busy_ns / 1e9, rate);
     }
+    printf("Total time: %.3f s\n", elapsed_ns / 1e9);
 }
 
 static int convert_do_copy(ImgConvertState *s)
 {
     int ret, i, n;
     int64_t sector_num = 0;
+    int64_t start_ns = get_clock();
 
     /* Check whether we have zero initialisation or can get it efficiently */
     if (!s->has_zero_init && s->target_is_new && s->min_sparse &&
@@ -2134,15 +2297,20 @@ static int convert_do_copy(ImgConvertState *s)
     s->ret = -EINPROGRESS;
 
     qemu_co_mutex_init(&s->lock);
+    qemu_co_queue_init(&s->write_queue);
     for (i = 0; i < s->num_coroutines; i++) {
         s->co[i] = qemu_coroutine_create(convert_co_do_copy, s);
         s->wait_sector_num[i] = -1;
         qemu_coroutine_enter(s->co[i]);
     }
 
-    while (s->running_coroutines) {
+    while (s->running_coroutines || s->running_writes) {
         main_loop_wait(false);
     }
+    if (s->ret == -EINPROGRESS) {
+        /* the convert job finished successfully */
+        s->ret = 0;
+    }
 
     if (s->compressed && !s->ret) {
         /* signal EOF to align */
@@ -2152,6 +2320,10 @@ static int convert_do_copy(ImgConvertState *s)
         }
     }
 
+    if (s->stage_stats) {
+        convert_print_stage_stats(s, get_clock() - start_ns);
+    }
+
     return s->ret;
 }
 
@@ -2231,6 +2403,97 @@ static void set_rate_limit(BlockBackend *blk, int64_t rate_limit)
     blk_set_io_limits(blk, &cfg);
 }
 
+#ifdef CONFIG_ZSTD
+/* Sample this many times the size of the dictionary, as zstd suggests */
+#define CONVERT_DICT_SAMPLE_RATIO   100
+#define CONVERT_DICT_MAX_SAMPLES    (64 * MiB)
+#define CONVERT_DICT_MIN_SAMPLES    8
+
+/*
+ * Train a zstd dictionary of up to @dict_size bytes on chunks of
+ * @chunk_size bytes taken evenly from all over the source, and write it
+ * to a temporary file. Chunks that only contain zeroes are skipped.
+ *
+ * Returns the name of the file, or NULL on error.
+ */
+static char *convert_train_dictionary(ImgConvertState *s, size_t dict_size,
+                                      size_t chunk_size)
+{
+    int64_t total = s->total_sectors * BDRV_SECTOR_SIZE;
+    int64_t nb_chunks = MAX(MIN(dict_size * CONVERT_DICT_SAMPLE_RATIO,
+                                CONVERT_DICT_MAX_SAMPLES) / chunk_size, 1);
+    int64_t step = MAX(QEMU_ALIGN_DOWN(total / nb_chunks, chunk_size),
+                       chunk_size);
+    g_autofree uint8_t *samples = g_malloc(nb_chunks * chunk_size);
+    g_autofree size_t *sizes = g_new(size_t, nb_chunks);
+    g_autofree void *dict = g_malloc(dict_size);
+    g_autoptr(GError) gerr = NULL;
+    unsigned nb_samples = 0;
+    size_t used = 0, dict_len;
+    int64_t offset;
+    char *filename;
+    int fd;
+
+    for (offset = 0; offset < total && nb_samples < nb_chunks;
+         offset += step) {
+        int64_t sector_num = offset >> BDRV_SECTOR_BITS;
+        int64_t src_cur_offset;
+        int src_cur, len, ret;
+
+        convert_select_part(s, sector_num, &src_cur, &src_cur_offset);
+        len = MIN(chunk_size, (s->src_sectors[src_cur] -
+                               (sector_num - src_cur_offset)) *
+                              BDRV_SECTOR_SIZE);
+
+        ret = blk_pread(s->src[src_cur],
+                        offset - src_cur_offset * BDRV_SECTOR_SIZE, len,
+                        samples + used, 0);
+        if (ret < 0) {
+            error_report("error while reading at byte %" PRId64 ": %s",
+                         offset, strerror(-ret));
+            return NULL;
+        }
+        if (buffer_is_zero(samples + used, len)) {
+            continue;
+        }
+        sizes[nb_samples++] = len;
+        used += len;
+    }
+
+    if (nb_samples < CONVERT_DICT_MIN_SAMPLES) {
+        error_report("Not enough data in the source to train a compression "
+                     "dictionary");
+        return NULL;
+    }
+
+    dict_len = ZDICT_trainFromBuffer(dict, dict_size, samples, sizes,
+                                     nb_samples);
+    if (ZDICT_isError(dict_len)) {
+        error_report("Failed to train compression dictionary: %s",
+                     ZDICT_getErrorName(dict_len));
+        return NULL;
+    }
+
+    fd = g_file_open_tmp("qemu-img-dict-XXXXXX", &filename, &gerr);
+    if (fd < 0) {
+        error_report("Could not create compression dictionary file: %s",
+                     gerr->message);
+        return NULL;
+    }
+    if (qemu_write_full(fd, dict, dict_len) != dict_len) {
+        error_report("Could not write compression dictionary file: %s",
+                     strerror(errno));
+        close(fd);
+        unlink(filename);
+        g_free(filename);
+        return NULL;
+    }
+    close(fd);
+
+    return filename;
+}
+#endif
+
 static int img_convert(int argc, char **argv)
 {
     int c, bs_i, flags, src_flags = BDRV_O_NO_SHARE;
@@ -2254,6 +2517,9 @@ static int img_convert(int argc, char **argv)
     bool bitmaps = false;
     bool skip_broken = false;
     int64_t rate_limit = 0;
+    long compress_workers = 0;
+    int64_t train_dict_size = 0;
+    char *dict_filename = NULL;
 
     ImgConvertState s = (ImgConvertState) {
         /* Need at least 4k of zeros for sparse detection */
@@ -2275,6 +2541,11 @@ static int img_convert(int argc, char **argv)
             {"target-is-zero", no_argument, 0, OPTION_TARGET_IS_ZERO},
             {"bitmaps", no_argument, 0, OPTION_BITMAPS},
             {"skip-broken-bitmaps", no_argument, 0, OPTION_SKIP_BROKEN},
+            {"write-workers", required_argument, 0, OPTION_WRITE_WORKERS},
+            {"compress-workers", required_argument, 0,
+             OPTION_COMPRESS_WORKERS},
+            {"stage-stats", no_argument, 0, OPTION_STAGE_STATS},
+            {"train-dictionary", required_argument, 0, OPTION_TRAIN_DICT},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hf:O:B:CcF:o:l:S:pt:T:qnm:WUr:",
@@ -2409,6 +2680,39 @@ static int img_convert(int argc, char **argv)
         case OPTION_SKIP_BROKEN:
             skip_broken = true;
             break;
+        case OPTION_WRITE_WORKERS:
+            if (qemu_strtol(optarg, NULL, 0, &s.write_workers) ||
+                s.write_workers < 1 || s.write_workers > MAX_WRITE_WORKERS) {
+                error_report("Invalid number of write workers. Allowed number "
+                             "of write workers is between 1 and %d",
+                             MAX_WRITE_WORKERS);
+                goto fail_getopt;
+            }
+            break;
+        case OPTION_COMPRESS_WORKERS:
+            if (qemu_strtol(optarg, NULL, 0, &compress_workers) ||
+                compress_workers < 1 ||
+                compress_workers > MAX_COMPRESS_WORKERS) {
+                error_report("Invalid number of compression workers. Allowed "
+                             "number of compression workers is between 1 "
+                             "and %d", MAX_COMPRESS_WORKERS);
+                goto fail_getopt;
+            }
+            break;
+        case OPTION_STAGE_STATS:
+            s.stage_stats = true;
+            break;
+        case OPTION_TRAIN_DICT:
+            train_dict_size = cvtnum("dictionary size", optarg);
+            if (train_dict_size < 0) {
+                goto fail_getopt;
+            }
+            if (train_dict_size < 1 * KiB || train_dict_size > 1 * MiB) {
+                error_report("Invalid dictionary size. Allowed sizes are "
+                             "between 1k and 1M");
+                goto fail_getopt;
+            }
+            break;
         }
     }
 
@@ -2426,6 +2730,29 @@ static int img_convert(int argc, char **argv)
         goto fail_getopt;
     }
 
+    if (compress_workers && !s.compressed) {
+        error_report("Use of --compress-workers requires -c");
+        goto fail_getopt;
+    }
+
+    if (compress_workers && skip_create) {
+        error_report("--compress-workers cannot be used with -n, set the "
+                     "compress-threads option of the target instead");
+        goto fail_getopt;
+    }
+
+    if (train_dict_size && (!s.compressed || skip_create)) {
+        error_report("Use of --train-dictionary requires -c and cannot be "
+                     "used with -n");
+        goto fail_getopt;
+    }
+#ifndef CONFIG_ZSTD
+    if (train_dict_size) {
+        error_report("--train-dictionary requires zstd support");
+        goto fail_getopt;
+    }
+#endif
+
     if (explict_min_sparse && s.copy_range) {
         error_report("Cannot enable copy offloading when -S is used");
         goto fail_getopt;
@@ -2658,6 +2985,26 @@ static int img_convert(int argc, char **argv)
         }
     }
 
+#ifdef CONFIG_ZSTD
+    if (train_dict_size) {
+        dict_filename = convert_train_dictionary(&s, train_dict_size,
+                                                 qemu_opt_get_size(opts,
+                                                     BLOCK_OPT_CLUSTER_SIZE,
+                                                     64 * KiB));
+        if (!dict_filename) {
+            ret = -1;
+            goto out;
+        }
+        if (!qemu_opt_set(opts, BLOCK_OPT_COMPRESSION_DICT, dict_filename,
+                          &local_err)) {
+            error_reportf_err(local_err, "Cannot store the dictionary in a "
+                              "%s image: ", out_fmt);
+            ret = -1;
+            goto out;
+        }
+    }
+#endif
+
     /*
      * The later open call will need any decryption secrets, and
      * bdrv_create() will purge "opts", so extract them now before
@@ -2666,6 +3013,9 @@ static int img_convert(int argc, char **argv)
     if (!skip_create) {
         open_opts = qdict_new();
         qemu_opt_foreach(opts, img_add_key_secrets, open_opts, &error_abort);
+        if (compress_workers) {
+            qdict_put_int(open_opts, "compress-threads", compress_workers);
+        }
 
         /* Create the new image */
         ret = bdrv_create(drv, out_filename, opts, &local_err);
@@ -2807,6 +3157,10 @@ out:
     }
     g_free(s.src_sectors);
     g_free(s.src_alignment);
+    if (dict_filename) {
+        unlink(dict_filename);
+        g_free(dict_filename);
+    }
 fail_getopt:
     qemu_opts_del(sn_opts);
     g_free(options);
@@ -188,6 +188,7 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
+    "                dirty-ring-reap-threads=n (KVM dirty ring reaping threads, default 0)\n"
     "                eager-split-size=n (KVM Eager Page Split chunk size, default 0, disabled. ARM only)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n"
@@ -248,6 +249,14 @@ SRST
         is disabled (dirty-ring-size=0).  When enabled, KVM will instead
         record dirty pages in a bitmap.
 
+    ``dirty-ring-reap-threads=n``
+        When the KVM dirty ring is enabled, harvest the dirty rings of all
+        vCPUs with n helper threads in parallel, each taking care of a
+        subset of the vCPUs.  This shortens the time slots are locked
+        while collecting dirty pages of guests with many vCPUs and a high
+        dirty rate, e.g. during live migration.  By default (0), or with
+        n=1, all the rings are harvested by a single thread.
+
     ``eager-split-size=n``
         KVM implements dirty page logging at the PAGE_SIZE granularity and
         enabling dirty-logging on a huge-page requires breaking it into
@@ -1460,6 +1469,12 @@ SRST
             supporting platforms, and 0 on other platforms. Setting it
             to 0 disables this feature.
 
+        ``sequential-prealloc-size``
+            The maximum size of the clusters that are allocated ahead
+            for sequential writes, which keeps their data contiguous in
+            the image file (default: 0, disabled). Clusters that aren't
+            used yet are leaked if QEMU doesn't exit cleanly.
+
         ``pass-discard-request``
             Whether discard requests to the qcow2 device should be
             forwarded to the data source (on/off; default: on if
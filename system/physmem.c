@@ -2150,6 +2150,52 @@ void qemu_ram_remap(ram_addr_t addr, ram_addr_t length)
         }
     }
 }
+
+int qemu_ram_remap_fd(RAMBlock *block, int fd, uint64_t fd_offset,
+                      Error **errp)
+{
+    struct stat st;
+    int flags = MAP_FIXED | MAP_SHARED;
+    int prot = PROT_READ;
+    void *area;
+
+    assert(qemu_ram_is_shared(block) && block->fd >= 0);
+
+    if (fstat(fd, &st) < 0) {
+        error_setg_errno(errp, errno, "Cannot stat fd for RAM block %s",
+                         block->idstr);
+        return -1;
+    }
+    if (S_ISREG(st.st_mode) && st.st_size < fd_offset + block->max_length) {
+        error_setg(errp, "File backing RAM block %s is too small: "
+                   "0x%" PRIx64 " < 0x%" PRIx64, block->idstr,
+                   (uint64_t)st.st_size, fd_offset + block->max_length);
+        return -1;
+    }
+
+    flags |= block->flags & RAM_NORESERVE ? MAP_NORESERVE : 0;
+    prot |= block->flags & RAM_READONLY ? 0 : PROT_WRITE;
+    area = mmap(block->host, block->max_length, prot, flags, fd, fd_offset);
+    if (area != block->host) {
+        error_setg_errno(errp, errno, "Cannot remap RAM block %s",
+                         block->idstr);
+        return -1;
+    }
+    memory_try_enable_merging(block->host, block->max_length);
+    qemu_ram_setup_dump(block->host, block->max_length);
+
+    close(block->fd);
+    block->fd = fd;
+    block->fd_offset = fd_offset;
+    return 0;
+}
+#else
+int qemu_ram_remap_fd(RAMBlock *block, int fd, uint64_t fd_offset,
+                      Error **errp)
+{
+    error_setg(errp, "Remapping RAM block %s is not supported", block->idstr);
+    return -1;
+}
 #endif /* !_WIN32 */
 
 /* Return a host pointer to ram allocated with qemu_ram_alloc.
@@ -12,6 +12,8 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/units.h"
+#include "qemu/bswap.h"
+#include "qapi/error.h"
 #include "crypto/init.h"
 #include "crypto/cipher.h"
 
@@ -164,6 +166,78 @@ static void test_cipher_speed_xts_aes_256(const void *opaque)
                       QCRYPTO_CIPHER_ALG_AES_256);
 }
 
+/*
+ * Encrypt requests the way LUKS images do, one XTS unit per sector with
+ * the sector number as the IV
+ */
+static void test_cipher_speed_xts_sectors(size_t request_size,
+                                          QCryptoCipherAlgorithm alg)
+{
+    const QCryptoCipherMode mode = QCRYPTO_CIPHER_MODE_XTS;
+    const size_t sector_size = 512;
+    const size_t total = 2 * GiB;
+    QCryptoCipher *cipher;
+    g_autofree uint8_t *key = NULL;
+    g_autofree uint8_t *buf = NULL;
+    uint8_t iv[16] = {};
+    uint64_t sector = 0;
+    size_t nkey, remain, i;
+    int dir;
+
+    if (!qcrypto_cipher_supports(alg, mode)) {
+        return;
+    }
+    g_assert(qcrypto_cipher_get_iv_len(alg, mode) == sizeof(iv));
+
+    nkey = qcrypto_cipher_get_key_len(alg) * 2;
+    key = g_new0(uint8_t, nkey);
+    memset(key, g_test_rand_int(), nkey);
+
+    buf = g_new0(uint8_t, request_size);
+    memset(buf, g_test_rand_int(), request_size);
+
+    cipher = qcrypto_cipher_new(alg, mode, key, nkey, &error_abort);
+
+    for (dir = 0; dir < 2; dir++) {
+        g_test_timer_start();
+        for (remain = total; remain; remain -= request_size) {
+            for (i = 0; i < request_size; i += sector_size, sector++) {
+                stq_le_p(iv, sector);
+                g_assert(qcrypto_cipher_setiv(cipher, iv, sizeof(iv),
+                                              &error_abort) == 0);
+                if (dir == 0) {
+                    g_assert(qcrypto_cipher_encrypt(cipher, buf + i, buf + i,
+                                                    sector_size,
+                                                    &error_abort) == 0);
+                } else {
+                    g_assert(qcrypto_cipher_decrypt(cipher, buf + i, buf + i,
+                                                    sector_size,
+                                                    &error_abort) == 0);
+                }
+            }
+        }
+        g_test_timer_elapsed();
+
+        g_test_message("%s(%s-xts) request %zu bytes, %zu byte sectors "
+                       "%.2f MB/sec ", dir == 0 ? "enc" : "dec",
+                       QCryptoCipherAlgorithm_str(alg),
+                       request_size, sector_size,
+                       (double)total / MiB / g_test_timer_last());
+    }
+
+    qcrypto_cipher_free(cipher);
+}
+
+static void test_cipher_speed_xts_sectors_aes_128(const void *opaque)
+{
+    test_cipher_speed_xts_sectors((size_t)opaque, QCRYPTO_CIPHER_ALG_AES_128);
+}
+
+static void test_cipher_speed_xts_sectors_aes_256(const void *opaque)
+{
+    test_cipher_speed_xts_sectors((size_t)opaque, QCRYPTO_CIPHER_ALG_AES_256);
+}
+
 
 int main(int argc, char **argv)
 {
@@ -204,5 +278,16 @@ int main(int argc, char **argv)
     ADD_TESTS(16384);
     ADD_TESTS(65536);
 
+    /* Guest request sizes, encrypted sector by sector as in LUKS images */
+#define ADD_SECTOR_TESTS(request)                       \
+    do {                                                \
+        ADD_TEST(xts_sectors, aes, 128, request);       \
+        ADD_TEST(xts_sectors, aes, 256, request);       \
+    } while (0)
+
+    ADD_SECTOR_TESTS(4096);
+    ADD_SECTOR_TESTS(65536);
+    ADD_SECTOR_TESTS(1048576);
+
     return g_test_run();
 }
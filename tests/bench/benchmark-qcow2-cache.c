@@ -0,0 +1,83 @@
+/*
+ * qcow2 metadata cache benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qapi/error.h"
+#include "qapi/qapi-types-block-core.h"
+#include "qapi/qmp/qdict.h"
+#include "block/block.h"
+#include "sysemu/block-backend.h"
+#include "qcow2-bench-helpers.h"
+
+/*
+ * With 64 KiB clusters, every L2 table of the image is allocated by the
+ * metadata preallocation: 8192 tables, 512 MiB of L2 cache to hold all.
+ */
+#define BENCH_IMAGE_SIZE    (4 * TiB)
+#define BENCH_READ_SIZE     (4 * KiB)
+#define BENCH_READS         (256 * 1024)
+
+static char *image;
+
+static void test_qcow2_cache_random_read(const void *opaque)
+{
+    uint64_t cache_size = (uintptr_t)opaque;
+    g_autofree void *buf = g_malloc(BENCH_READ_SIZE);
+    g_autoptr(BlockStatsSpecific) stats = NULL;
+    QDict *options = qdict_new();
+    BlockBackend *blk;
+    int i;
+
+    qdict_put_str(options, "driver", "qcow2");
+    qdict_put_int(options, "l2-cache-size", cache_size);
+    blk = blk_new_open(image, NULL, options, 0, &error_abort);
+
+    g_test_timer_start();
+    for (i = 0; i < BENCH_READS; i++) {
+        uint64_t n = (uint64_t)g_test_rand_int() << 32 | g_test_rand_int();
+        int64_t offset = n % (BENCH_IMAGE_SIZE / BENCH_READ_SIZE) *
+                         BENCH_READ_SIZE;
+
+        g_assert(blk_pread(blk, offset, BENCH_READ_SIZE, buf, 0) >= 0);
+    }
+    g_test_timer_elapsed();
+
+    stats = bdrv_get_specific_stats(blk_bs(blk));
+    g_assert(stats && stats->driver == BLOCKDEV_DRIVER_QCOW2);
+    g_test_message("random read: %" PRIu64 " MiB L2 cache, "
+                   "%" PRIu64 " misses %" PRIu64 " evictions, "
+                   "%.0f reads/sec",
+                   cache_size / MiB,
+                   stats->u.qcow2.l2_cache->misses,
+                   stats->u.qcow2.l2_cache->evictions,
+                   BENCH_READS / g_test_timer_last());
+
+    blk_unref(blk);
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    qcow2_bench_init(&argc, &argv);
+    image = qcow2_bench_create_image("benchmark-qcow2-cache", BENCH_IMAGE_SIZE);
+
+    /* Every L2 table fits, then a quarter of them */
+    g_test_add_data_func("/qcow2/cache/benchmark/random-read/all",
+                         (void *)(uintptr_t)(512 * MiB),
+                         test_qcow2_cache_random_read);
+    g_test_add_data_func("/qcow2/cache/benchmark/random-read/quarter",
+                         (void *)(uintptr_t)(128 * MiB),
+                         test_qcow2_cache_random_read);
+
+    ret = g_test_run();
+
+    qcow2_bench_remove_image(image);
+
+    return ret;
+}
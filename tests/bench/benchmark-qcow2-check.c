@@ -0,0 +1,81 @@
+/*
+ * qcow2 check benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qapi/error.h"
+#include "block/block.h"
+#include "block/snapshot.h"
+#include "sysemu/block-backend.h"
+#include "qcow2-bench-helpers.h"
+
+/*
+ * With 64 KiB clusters, the metadata preallocation allocates 512 L2 tables,
+ * which the check goes through once for the active L1 table, once for
+ * each snapshot and once more for the OFLAG_COPIED checks.
+ */
+#define BENCH_IMAGE_SIZE    (256 * GiB)
+#define BENCH_SNAPSHOTS     8
+
+static char *image;
+
+static void create_snapshots(void)
+{
+    BlockBackend *blk;
+    int i, ret;
+
+    blk = blk_new_open(image, NULL, NULL, BDRV_O_RDWR, &error_abort);
+    for (i = 0; i < BENCH_SNAPSHOTS; i++) {
+        QEMUSnapshotInfo sn = {};
+
+        snprintf(sn.name, sizeof(sn.name), "snap%d", i);
+
+        bdrv_graph_rdlock_main_loop();
+        ret = bdrv_snapshot_create(blk_bs(blk), &sn);
+        bdrv_graph_rdunlock_main_loop();
+        g_assert(ret == 0);
+    }
+    blk_unref(blk);
+}
+
+static void test_qcow2_check(const void *opaque)
+{
+    BdrvCheckResult result;
+    BlockBackend *blk;
+    int ret;
+
+    blk = blk_new_open(image, NULL, NULL, BDRV_O_CHECK, &error_abort);
+
+    g_test_timer_start();
+    ret = bdrv_check(blk_bs(blk), &result, 0, NULL, NULL);
+    g_test_timer_elapsed();
+
+    g_assert(ret == 0);
+    g_assert(!result.corruptions && !result.leaks && !result.check_errors);
+    g_test_message("check: %" PRIu64 " GiB, %d snapshots, %.3f sec",
+                   (uint64_t)BENCH_IMAGE_SIZE / GiB, BENCH_SNAPSHOTS,
+                   g_test_timer_last());
+
+    blk_unref(blk);
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    qcow2_bench_init(&argc, &argv);
+    image = qcow2_bench_create_image("benchmark-qcow2-check", BENCH_IMAGE_SIZE);
+    create_snapshots();
+
+    g_test_add_data_func("/qcow2/check/benchmark", NULL, test_qcow2_check);
+
+    ret = g_test_run();
+
+    qcow2_bench_remove_image(image);
+
+    return ret;
+}
@@ -0,0 +1,103 @@
+/*
+ * qcow2 allocating write benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/coroutine.h"
+#include "qemu/main-loop.h"
+#include "qapi/error.h"
+#include "block/block.h"
+#include "sysemu/block-backend.h"
+#include "qcow2-bench-helpers.h"
+
+/*
+ * Every write allocates a cluster of its own, with COW for the rest of
+ * it, so that the L2 entries of all writes in flight are linked by
+ * qcow2_co_link_l2meta().
+ */
+#define BENCH_CLUSTER_SIZE  (64 * KiB)
+#define BENCH_WRITE_SIZE    (4 * KiB)
+#define BENCH_WRITES        (16 * 1024)
+#define BENCH_IMAGE_SIZE    (BENCH_WRITES * BENCH_CLUSTER_SIZE)
+
+typedef struct BenchWriteState {
+    BlockBackend *blk;
+    void *buf;
+    int next;
+    int in_flight;
+} BenchWriteState;
+
+/* Unlike qcow2_bench_create_image(), leaves every cluster unallocated */
+static char *create_image(void)
+{
+    char *image;
+    int fd;
+
+    fd = g_file_open_tmp("qemu-benchmark-qcow2-write-XXXXXX", &image, NULL);
+    g_assert(fd >= 0);
+    close(fd);
+    bdrv_img_create(image, "qcow2", NULL, NULL, "cluster_size=64k",
+                    BENCH_IMAGE_SIZE, 0, true, &error_abort);
+
+    return image;
+}
+
+static void coroutine_fn bench_write_co(void *opaque)
+{
+    BenchWriteState *s = opaque;
+
+    while (s->next < BENCH_WRITES) {
+        int64_t offset = (int64_t)s->next++ * BENCH_CLUSTER_SIZE;
+
+        g_assert(blk_co_pwrite(s->blk, offset, BENCH_WRITE_SIZE, s->buf,
+                               0) >= 0);
+    }
+    s->in_flight--;
+}
+
+static void test_qcow2_write_allocating(const void *opaque)
+{
+    int queue_depth = (uintptr_t)opaque;
+    char *image = create_image();
+    BenchWriteState s = {
+        .buf = g_malloc0(BENCH_WRITE_SIZE),
+    };
+    int i;
+
+    s.blk = blk_new_open(image, NULL, NULL, BDRV_O_RDWR, &error_abort);
+
+    g_test_timer_start();
+    for (i = 0; i < queue_depth; i++) {
+        s.in_flight++;
+        qemu_coroutine_enter(qemu_coroutine_create(bench_write_co, &s));
+    }
+    while (s.in_flight) {
+        aio_poll(qemu_get_aio_context(), true);
+    }
+    g_assert(blk_flush(s.blk) == 0);
+    g_test_timer_elapsed();
+
+    g_test_message("allocating write: queue depth %d, %.0f writes/sec",
+                   queue_depth, BENCH_WRITES / g_test_timer_last());
+
+    blk_unref(s.blk);
+    g_free(s.buf);
+    qcow2_bench_remove_image(image);
+}
+
+int main(int argc, char **argv)
+{
+    qcow2_bench_init(&argc, &argv);
+
+    /* One request at a time, then enough for the links to be batched */
+    g_test_add_data_func("/qcow2/write/benchmark/allocating/1",
+                         (void *)(uintptr_t)1, test_qcow2_write_allocating);
+    g_test_add_data_func("/qcow2/write/benchmark/allocating/32",
+                         (void *)(uintptr_t)32, test_qcow2_write_allocating);
+
+    return g_test_run();
+}
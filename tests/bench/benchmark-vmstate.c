@@ -0,0 +1,235 @@
+/*
+ * VMState save/load speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/module.h"
+#include "migration/vmstate.h"
+#include "migration/qemu-file-types.h"
+#include "../migration/qemu-file.h"
+#include "io/channel-buffer.h"
+
+/*
+ * A few shapes of device state that show up in real migrations: a large
+ * register file, an MSI-X table, per-vCPU register sets and virtqueues.
+ */
+#define BENCH_NR_REGS       4096
+#define BENCH_NR_MSIX       2048
+#define BENCH_NR_VCPUS      256
+#define BENCH_NR_VQS        1024
+
+typedef struct BenchVCPU {
+    uint64_t gpr[32];
+    uint64_t pc;
+    uint32_t flags;
+} BenchVCPU;
+
+typedef struct BenchVirtQueue {
+    uint64_t desc;
+    uint64_t avail;
+    uint64_t used;
+    uint32_t num;
+    uint16_t last_avail_idx;
+    uint16_t used_idx;
+} BenchVirtQueue;
+
+typedef struct BenchState {
+    uint32_t regs[BENCH_NR_REGS];
+    uint32_t msix[BENCH_NR_MSIX * 4];
+    uint8_t config[4096];
+    BenchVCPU vcpus[BENCH_NR_VCPUS];
+    BenchVirtQueue vqs[BENCH_NR_VQS];
+} BenchState;
+
+static const VMStateDescription vmstate_bench_regs = {
+    .name = "bench/regs",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32_ARRAY(regs, BenchState, BENCH_NR_REGS),
+        VMSTATE_UINT8_ARRAY(config, BenchState, 4096),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_bench_msix = {
+    .name = "bench/msix",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32_ARRAY(msix, BenchState, BENCH_NR_MSIX * 4),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_bench_vcpu = {
+    .name = "bench/vcpu",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT64_ARRAY(gpr, BenchVCPU, 32),
+        VMSTATE_UINT64(pc, BenchVCPU),
+        VMSTATE_UINT32(flags, BenchVCPU),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_bench_vcpus = {
+    .name = "bench/vcpus",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_STRUCT_ARRAY(vcpus, BenchState, BENCH_NR_VCPUS, 1,
+                             vmstate_bench_vcpu, BenchVCPU),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_bench_vq = {
+    .name = "bench/virtqueue",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT64(desc, BenchVirtQueue),
+        VMSTATE_UINT64(avail, BenchVirtQueue),
+        VMSTATE_UINT64(used, BenchVirtQueue),
+        VMSTATE_UINT32(num, BenchVirtQueue),
+        VMSTATE_UINT16(last_avail_idx, BenchVirtQueue),
+        VMSTATE_UINT16(used_idx, BenchVirtQueue),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_bench_vqs = {
+    .name = "bench/virtqueues",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_STRUCT_ARRAY(vqs, BenchState, BENCH_NR_VQS, 1,
+                             vmstate_bench_vq, BenchVirtQueue),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+/* Amount of device state moved by each test */
+#define BENCH_TOTAL (64 * MiB)
+
+static BenchState *bench_state_new(void)
+{
+    BenchState *s = g_new(BenchState, 1);
+    uint8_t *p = (uint8_t *)s;
+    size_t i;
+
+    for (i = 0; i < sizeof(*s); i++) {
+        p[i] = g_test_rand_int();
+    }
+
+    return s;
+}
+
+static size_t bench_state_size(const VMStateDescription *vmsd, BenchState *s)
+{
+    QIOChannelBuffer *bioc = qio_channel_buffer_new(0);
+    QEMUFile *f = qemu_file_new_output(QIO_CHANNEL(bioc));
+    size_t size;
+
+    g_assert(!vmstate_save_state(f, vmsd, s, NULL));
+    g_assert(!qemu_fflush(f));
+    size = bioc->usage;
+    qemu_fclose(f);
+    object_unref(OBJECT(bioc));
+
+    return size;
+}
+
+static void test_vmstate_save_speed(const void *opaque)
+{
+    const VMStateDescription *vmsd = opaque;
+    g_autofree BenchState *s = bench_state_new();
+    size_t size = bench_state_size(vmsd, s);
+    size_t i, iterations = MAX(BENCH_TOTAL / size, 1);
+    QIOChannelBuffer *bioc = qio_channel_buffer_new(size * iterations);
+    QEMUFile *f = qemu_file_new_output(QIO_CHANNEL(bioc));
+
+    g_test_timer_start();
+    for (i = 0; i < iterations; i++) {
+        g_assert(!vmstate_save_state(f, vmsd, s, NULL));
+    }
+    g_assert(!qemu_fflush(f));
+    g_test_timer_elapsed();
+
+    g_assert_cmpuint(bioc->usage, ==, size * iterations);
+    g_test_message("save(%s): state %zu bytes %.2f MB/sec",
+                   vmsd->name, size,
+                   (double)size * iterations / MiB / g_test_timer_last());
+
+    qemu_fclose(f);
+    object_unref(OBJECT(bioc));
+}
+
+static void test_vmstate_load_speed(const void *opaque)
+{
+    const VMStateDescription *vmsd = opaque;
+    g_autofree BenchState *s = bench_state_new();
+    g_autofree BenchState *d = g_new0(BenchState, 1);
+    size_t size = bench_state_size(vmsd, s);
+    size_t i, iterations = MAX(BENCH_TOTAL / size, 1);
+    QIOChannelBuffer *out = qio_channel_buffer_new(size * iterations);
+    QIOChannelBuffer *bioc = qio_channel_buffer_new(size * iterations);
+    QEMUFile *f = qemu_file_new_output(QIO_CHANNEL(out));
+
+    for (i = 0; i < iterations; i++) {
+        g_assert(!vmstate_save_state(f, vmsd, s, NULL));
+    }
+    g_assert(!qemu_fflush(f));
+    memcpy(bioc->data, out->data, out->usage);
+    bioc->usage = out->usage;
+    qemu_fclose(f);
+    object_unref(OBJECT(out));
+
+    f = qemu_file_new_input(QIO_CHANNEL(bioc));
+
+    g_test_timer_start();
+    for (i = 0; i < iterations; i++) {
+        g_assert(!vmstate_load_state(f, vmsd, d, vmsd->version_id));
+    }
+    g_test_timer_elapsed();
+
+    g_assert(!qemu_file_get_error(f));
+    g_test_message("load(%s): state %zu bytes %.2f MB/sec",
+                   vmsd->name, size,
+                   (double)size * iterations / MiB / g_test_timer_last());
+
+    qemu_fclose(f);
+    object_unref(OBJECT(bioc));
+}
+
+int main(int argc, char **argv)
+{
+    static const VMStateDescription *vmsds[] = {
+        &vmstate_bench_regs,
+        &vmstate_bench_msix,
+        &vmstate_bench_vcpus,
+        &vmstate_bench_vqs,
+    };
+    size_t i;
+
+    module_call_init(MODULE_INIT_QOM);
+    g_test_init(&argc, &argv, NULL);
+
+    for (i = 0; i < ARRAY_SIZE(vmsds); i++) {
+        g_autofree char *save = g_strdup_printf("/vmstate/benchmark/%s/save",
+                                                vmsds[i]->name);
+        g_autofree char *load = g_strdup_printf("/vmstate/benchmark/%s/load",
+                                                vmsds[i]->name);
+
+        g_test_add_data_func(save, vmsds[i], test_vmstate_save_speed);
+        g_test_add_data_func(load, vmsds[i], test_vmstate_load_speed);
+    }
+
+    return g_test_run();
+}
@@ -0,0 +1,41 @@
+/*
+ * Helper functions for qcow2 benchmarks
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/main-loop.h"
+#include "qapi/error.h"
+#include "block/block.h"
+#include "qcow2-bench-helpers.h"
+
+void qcow2_bench_init(int *argc, char ***argv)
+{
+    qemu_init_main_loop(&error_abort);
+    bdrv_init();
+    g_test_init(argc, argv, NULL);
+}
+
+char *qcow2_bench_create_image(const char *name, int64_t size)
+{
+    char create_opts[] = "cluster_size=64k,preallocation=metadata";
+    g_autofree char *tmpl = g_strdup_printf("qemu-%s-XXXXXX", name);
+    char *image;
+    int fd;
+
+    fd = g_file_open_tmp(tmpl, &image, NULL);
+    g_assert(fd >= 0);
+    close(fd);
+    bdrv_img_create(image, "qcow2", NULL, NULL, create_opts,
+                    size, 0, true, &error_abort);
+
+    return image;
+}
+
+void qcow2_bench_remove_image(char *image)
+{
+    unlink(image);
+    g_free(image);
+}
@@ -0,0 +1,35 @@
+/*
+ * Helper functions for qcow2 benchmarks
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#ifndef TESTS_QCOW2_BENCH_HELPERS_H
+#define TESTS_QCOW2_BENCH_HELPERS_H
+
+/*
+ * Initializes the main loop, the block layer and the test framework.
+ */
+void qcow2_bench_init(int *argc, char ***argv);
+
+/*
+ * @name: the benchmark name, used in the file name
+ * @size: the virtual size of the image in bytes
+ *
+ * Creates a temporary qcow2 image with 64 KiB clusters and all of its
+ * metadata preallocated.
+ *
+ * Returns: the file name of the image, to be passed to
+ * qcow2_bench_remove_image()
+ */
+char *qcow2_bench_create_image(const char *name, int64_t size);
+
+/*
+ * Deletes an image created by qcow2_bench_create_image() and frees
+ * @image.
+ */
+void qcow2_bench_remove_image(char *image);
+
+#endif
@@ -654,10 +654,14 @@ typedef struct {
      */
     bool hide_stderr;
     bool use_shmem;
+    /* Back guest RAM with a shared memfd, which needs no file system */
+    bool use_memfd;
     /* only launch the target process */
     bool only_target;
     /* Use dirty ring if true; dirty logging otherwise */
     bool use_dirty_ring;
+    /* Threads reaping the dirty rings in parallel, with use_dirty_ring */
+    unsigned int dirty_ring_reap_threads;
     const char *opts_source;
     const char *opts_target;
     /* suspend the src before migrating to dest. */
@@ -768,7 +772,7 @@ static int test_migrate_start(QTestState **from, QTestState **to,
     const gchar *ignore_stderr;
     g_autofree char *shmem_opts = NULL;
     g_autofree char *shmem_path = NULL;
-    const char *kvm_opts = NULL;
+    g_autofree char *kvm_opts = NULL;
     const char *arch = qtest_get_arch();
     const char *memory_size;
     const char *machine_alias, *machine_opts = "";
@@ -850,8 +854,16 @@ static int test_migrate_start(QTestState **from, QTestState **to,
             memory_size, shmem_path);
     }
 
+    if (args->use_memfd) {
+        shmem_opts = g_strdup_printf(
+            "-object memory-backend-memfd,id=mem0,size=%s,share=on "
+            "-numa node,memdev=mem0", memory_size);
+    }
+
     if (args->use_dirty_ring) {
-        kvm_opts = ",dirty-ring-size=4096";
+        kvm_opts = g_strdup_printf(",dirty-ring-size=4096,"
+                                   "dirty-ring-reap-threads=%u",
+                                   args->dirty_ring_reap_threads);
     }
 
     machine = resolve_machine_version(machine_alias, QEMU_ENV_SRC,
@@ -1403,6 +1415,40 @@ static void test_postcopy(void)
     test_postcopy_common(&args);
 }
 
+static void test_postcopy_prefetch_finish(QTestState *from, QTestState *to,
+                                          void *opaque)
+{
+    QDict *rsp_return = migrate_query_not_failed(to);
+
+    g_assert(qdict_haskey(rsp_return, "postcopy-prefetched-pages"));
+    /* Faults are only attributed to vCPUs with the thread id feature */
+    if (uffd_feature_thread_id) {
+        g_assert_cmpint(qdict_get_int(rsp_return, "postcopy-prefetched-pages"),
+                        >, 0);
+    }
+    qobject_unref(rsp_return);
+}
+
+/*
+ * The guest walks its memory sequentially, so the destination detects
+ * the fault stream and prefetches ahead of it.  The window is only set
+ * once postcopy runs, after the fault thread has started.
+ */
+static void test_postcopy_prefetch(void)
+{
+    MigrateCommon args = {
+        .finish_hook = test_postcopy_prefetch_finish,
+    };
+    QTestState *from, *to;
+
+    if (migrate_postcopy_prepare(&from, &to, &args)) {
+        return;
+    }
+    migrate_postcopy_start(from, to);
+    migrate_set_parameter_int(to, "postcopy-prefetch-window", 64);
+    migrate_postcopy_complete(from, to, &args);
+}
+
 static void test_postcopy_suspend(void)
 {
     MigrateCommon args = {
@@ -1962,6 +2008,26 @@ static void test_precopy_unix_dirty_ring(void)
     test_precopy_common(&args);
 }
 
+/*
+ * The reaper threads must finish a round before each sync of the dirty
+ * bitmap, and must be stopped and joined when QEMU exits.
+ */
+static void test_precopy_unix_dirty_ring_reap_threads(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .start = {
+            .use_dirty_ring = true,
+            .dirty_ring_reap_threads = 4,
+        },
+        .listen_uri = uri,
+        .connect_uri = uri,
+        .live = true,
+    };
+
+    test_precopy_common(&args);
+}
+
 #ifdef CONFIG_GNUTLS
 static void test_precopy_unix_tls_psk(void)
 {
@@ -2077,6 +2143,34 @@ static void test_precopy_unix_xbzrle(void)
     test_precopy_common(&args);
 }
 
+static void *
+test_migrate_defer_hot_pages_start(QTestState *from,
+                                   QTestState *to)
+{
+    migrate_set_capability(from, "defer-hot-pages", true);
+
+    return NULL;
+}
+
+static void test_precopy_unix_defer_hot_pages(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = uri,
+        .start_hook = test_migrate_defer_hot_pages_start,
+        /*
+         * The guest keeps rewriting all of its test memory, so a few
+         * iterations are needed for chunks to be classified as hot and
+         * deferred to the completion stage.
+         */
+        .iterations = 4,
+        .live = true,
+    };
+
+    test_precopy_common(&args);
+}
+
 static void test_precopy_unix_compress(void)
 {
     g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
@@ -2222,6 +2316,33 @@ static void test_mode_reboot(void)
     test_file_common(&args, true);
 }
 
+#ifdef CONFIG_LINUX
+static void *test_mode_transfer_start(QTestState *from, QTestState *to)
+{
+    migrate_set_parameter_str(from, "mode", "cpr-transfer");
+    migrate_set_parameter_str(to, "mode", "cpr-transfer");
+
+    return NULL;
+}
+
+/*
+ * The memfd is handed over to the destination instead of being copied.
+ * A memfd, unlike a file in /dev/shm, works on every Linux host.
+ */
+static void test_mode_transfer(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .start.use_memfd = true,
+        .listen_uri = uri,
+        .connect_uri = uri,
+        .start_hook = test_mode_transfer_start,
+    };
+
+    test_precopy_common(&args);
+}
+#endif /* CONFIG_LINUX */
+
 static void test_precopy_file_mapped_ram_live(void)
 {
     g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
@@ -2248,6 +2369,92 @@ static void test_precopy_file_mapped_ram(void)
     test_file_common(&args, true);
 }
 
+/* Pages a checkpoint wrote to the file, or found to be zero */
+static int64_t read_ram_pages_saved(QTestState *who)
+{
+    return read_ram_property_int(who, "normal") +
+           read_ram_property_int(who, "duplicate");
+}
+
+/* Takes a first, full checkpoint, which saves every page */
+static void migrate_mapped_ram_incremental_first(QTestState *from,
+                                                 QTestState *to)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+
+    migrate_mapped_ram_start(from, to);
+    migrate_set_capability(from, "mapped-ram-incremental", true);
+
+    migrate_ensure_converge(from);
+    wait_for_serial("src_serial");
+    migrate_qmp(from, uri, "{}");
+    wait_for_migration_complete(from);
+
+    g_assert_cmpint(read_ram_pages_saved(from), >=,
+                    read_ram_property_int(from, "total") /
+                    read_ram_property_int(from, "page-size"));
+}
+
+static void *migrate_mapped_ram_incremental_start(QTestState *from,
+                                                  QTestState *to)
+{
+    /*
+     * Let the guest dirty memory again, so that the migration done by
+     * the test only rewrites the pages dirtied since.
+     */
+    migrate_mapped_ram_incremental_first(from, to);
+    qtest_qmp_assert_success(from, "{ 'execute' : 'cont'}");
+
+    return NULL;
+}
+
+/* The guest stays stopped after the first checkpoint */
+static void *migrate_mapped_ram_incremental_unchanged_start(QTestState *from,
+                                                            QTestState *to)
+{
+    migrate_mapped_ram_incremental_first(from, to);
+
+    return NULL;
+}
+
+static void migrate_mapped_ram_incremental_unchanged_end(QTestState *from,
+                                                         QTestState *to,
+                                                         void *opaque)
+{
+    /* Nothing was dirtied, so no page was saved again */
+    g_assert_cmpint(read_ram_pages_saved(from), ==, 0);
+    g_assert_cmpint(read_ram_property_int(from, "transferred"), <,
+                    1024 * 1024);
+}
+
+static void test_precopy_file_mapped_ram_incremental(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = migrate_mapped_ram_incremental_start,
+    };
+
+    test_file_common(&args, false);
+}
+
+static void test_precopy_file_mapped_ram_incremental_unchanged(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = migrate_mapped_ram_incremental_unchanged_start,
+        .finish_hook = migrate_mapped_ram_incremental_unchanged_end,
+    };
+
+    test_file_common(&args, true);
+}
+
 static void *migrate_multifd_mapped_ram_start(QTestState *from, QTestState *to)
 {
     migrate_mapped_ram_start(from, to);
@@ -2287,6 +2494,143 @@ static void test_multifd_file_mapped_ram(void)
     test_file_common(&args, true);
 }
 
+/* Waits for the job @id to conclude, checks it succeeded and dismisses it */
+static void wait_for_job_success(QTestState *who, const char *id)
+{
+    bool concluded = false;
+
+    while (!concluded) {
+        QDict *rsp = qtest_qmp(who, "{ 'execute': 'query-jobs' }");
+        const QListEntry *e;
+
+        QLIST_FOREACH_ENTRY(qdict_get_qlist(rsp, "return"), e) {
+            QDict *job = qobject_to(QDict, qlist_entry_obj(e));
+
+            if (strcmp(qdict_get_str(job, "id"), id) ||
+                strcmp(qdict_get_str(job, "status"), "concluded")) {
+                continue;
+            }
+            if (qdict_haskey(job, "error")) {
+                g_test_message("%s: %s", id, qdict_get_str(job, "error"));
+            }
+            g_assert_false(qdict_haskey(job, "error"));
+            concluded = true;
+        }
+        qobject_unref(rsp);
+        usleep(1000 * 10);
+    }
+
+    qtest_qmp_assert_success(who, "{ 'execute': 'job-dismiss',"
+                             "  'arguments': { 'id': %s } }", id);
+}
+
+/*
+ * Snapshots write RAM through the multifd channels at fixed offsets of the
+ * VM state area.  Loading the snapshot must restore consistent RAM.
+ */
+static void test_multifd_mapped_ram_snapshot(void)
+{
+    g_autofree char *img = g_strdup_printf("%s/snapshot.qcow2", tmpfs);
+    g_autofree char *opts = g_strdup_printf(
+        "-blockdev driver=file,filename=%s,node-name=file0 "
+        "-blockdev driver=qcow2,file=file0,node-name=disk0", img);
+    MigrateStart args = {
+        .opts_source = opts,
+    };
+    QTestState *from, *to;
+
+    if (!mkimg(img, "qcow2", 16)) {
+        g_test_skip("qemu-img not available");
+        return;
+    }
+
+    if (test_migrate_start(&from, &to, "defer", &args)) {
+        return;
+    }
+
+    migrate_set_capability(from, "mapped-ram", true);
+    migrate_set_capability(from, "multifd", true);
+    migrate_set_parameter_int(from, "multifd-channels", 4);
+
+    /* Wait for the guest to dirty its memory */
+    wait_for_serial("src_serial");
+
+    qtest_qmp_assert_success(from, "{ 'execute': 'snapshot-save',"
+                             "  'arguments': { 'job-id': 'save0',"
+                             "    'tag': 'snap0', 'vmstate': 'disk0',"
+                             "    'devices': [ 'disk0' ] } }");
+    wait_for_job_success(from, "save0");
+
+    /* The guest keeps changing its memory in between */
+    wait_for_serial("src_serial");
+
+    qtest_qmp_assert_success(from, "{ 'execute': 'snapshot-load',"
+                             "  'arguments': { 'job-id': 'load0',"
+                             "    'tag': 'snap0', 'vmstate': 'disk0',"
+                             "    'devices': [ 'disk0' ] } }");
+    wait_for_job_success(from, "load0");
+
+    qtest_qmp_assert_success(from, "{ 'execute': 'stop' }");
+    check_guests_ram(from);
+
+    test_migrate_end(from, to, false);
+    cleanup("snapshot.qcow2");
+}
+
+/*
+ * With only two channels, each page batch has to wait for a channel that
+ * is still loading the previous one.
+ */
+static void *migrate_multifd_mapped_ram_busy_start(QTestState *from,
+                                                   QTestState *to)
+{
+    migrate_multifd_mapped_ram_start(from, to);
+
+    migrate_set_parameter_int(from, "multifd-channels", 2);
+    migrate_set_parameter_int(to, "multifd-channels", 2);
+
+    return NULL;
+}
+
+static void test_multifd_file_mapped_ram_busy(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = migrate_multifd_mapped_ram_busy_start,
+    };
+
+    test_file_common(&args, true);
+}
+
+#ifdef CONFIG_LINUX_IO_URING
+static void *migrate_multifd_mapped_ram_io_uring_start(QTestState *from,
+                                                       QTestState *to)
+{
+    migrate_multifd_mapped_ram_start(from, to);
+
+    migrate_set_capability(from, "io-uring", true);
+    migrate_set_capability(to, "io-uring", true);
+
+    return NULL;
+}
+
+static void test_multifd_file_mapped_ram_io_uring(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = migrate_multifd_mapped_ram_io_uring_start,
+    };
+
+    test_file_common(&args, true);
+}
+#endif /* CONFIG_LINUX_IO_URING */
+
 
 static void test_precopy_tcp_plain(void)
 {
@@ -2707,6 +3051,78 @@ static void test_migrate_auto_converge(void)
     test_migrate_end(from, to, true);
 }
 
+/*
+ * With a 1ms downtime limit and a slow stream the migration never
+ * converges, so the auto-tuner must throttle the guest.  It can't be
+ * combined with auto-converge, which throttles the guest too.
+ */
+static void test_migrate_auto_tune(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateStart args = {};
+    QTestState *from, *to;
+    QDict *rsp, *info;
+    bool found = false;
+
+    if (test_migrate_start(&from, &to, uri, &args)) {
+        return;
+    }
+
+    migrate_set_capability(from, "auto-converge", true);
+    rsp = qtest_qmp(from, "{ 'execute': 'migrate-set-capabilities',"
+                    "'arguments': { 'capabilities': [ {"
+                    "'capability': 'auto-tune', 'state': true } ] } }");
+    g_assert(qdict_haskey(rsp, "error"));
+    qobject_unref(rsp);
+    migrate_set_capability(from, "auto-converge", false);
+
+    migrate_set_capability(from, "auto-tune", true);
+    migrate_set_parameter_int(from, "cpu-throttle-initial", 20);
+    migrate_set_parameter_int(from, "cpu-throttle-increment", 10);
+    migrate_set_parameter_int(from, "max-bandwidth", 1000 * 1000);
+    migrate_set_parameter_int(from, "downtime-limit", 1);
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate_qmp(from, uri, "{}");
+
+    while (!found) {
+        const QListEntry *e;
+
+        usleep(1000 * 10);
+        g_assert_false(src_state.stop_seen);
+
+        rsp = migrate_query(from);
+        if (qdict_haskey(rsp, "auto-tune")) {
+            info = qdict_get_qdict(rsp, "auto-tune");
+            QLIST_FOREACH_ENTRY(qdict_get_qlist(info, "decisions"), e) {
+                QDict *d = qobject_to(QDict, qlist_entry_obj(e));
+
+                g_assert_cmpstr(qdict_get_str(d, "parameter"), ==,
+                                "cpu-throttle-percentage");
+                if (!strcmp(qdict_get_str(d, "value"), "20")) {
+                    g_assert(qdict_get_int(info, "dirty-rate") > 0);
+                    found = true;
+                }
+            }
+        }
+        qobject_unref(rsp);
+    }
+    g_assert_cmpint(read_migrate_property_int(from,
+                                              "cpu-throttle-percentage"),
+                    >=, 20);
+
+    migrate_ensure_converge(from);
+
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+    wait_for_migration_complete(from);
+
+    test_migrate_end(from, to, true);
+}
+
 static void *
 test_migrate_precopy_tcp_multifd_start_common(QTestState *from,
                                               QTestState *to,
@@ -2734,6 +3150,17 @@ test_migrate_precopy_tcp_multifd_start(QTestState *from,
     return test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
 }
 
+/* io-uring only applies to file channels, sockets keep their own I/O */
+static void *
+test_migrate_precopy_tcp_multifd_start_io_uring(QTestState *from,
+                                                QTestState *to)
+{
+    test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
+    migrate_set_capability(from, "io-uring", true);
+    migrate_set_capability(to, "io-uring", true);
+    return NULL;
+}
+
 static void *
 test_migrate_precopy_tcp_multifd_start_zero_page_legacy(QTestState *from,
                                                         QTestState *to)
@@ -2793,6 +3220,94 @@ static void test_multifd_tcp_none(void)
     test_precopy_common(&args);
 }
 
+static void test_multifd_tcp_io_uring(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_start_io_uring,
+        .live = true,
+    };
+    test_precopy_common(&args);
+}
+
+/*
+ * VFIO devices can't be emulated, so these tests need four host VFs
+ * supporting migration, two for each side, for instance
+ * QTEST_VFIO_PCI_HOSTS=0000:01:00.1,0000:01:00.2,0000:01:00.3,0000:01:00.4
+ */
+#define QTEST_VFIO_PCI_HOSTS "QTEST_VFIO_PCI_HOSTS"
+
+/*
+ * Returns the -device options of both sides, with the state of vfio1
+ * loaded after the one of vfio0, or false if the VFs are not given.
+ */
+static bool test_vfio_device_state_opts(const char *target_extra,
+                                        char **opts_source,
+                                        char **opts_target)
+{
+    const char *env = getenv(QTEST_VFIO_PCI_HOSTS);
+    g_auto(GStrv) hosts = NULL;
+    const char *dev_fmt =
+        "-device vfio-pci,host=%s,id=vfio0,x-migration-multifd-transfer=on%s "
+        "-device vfio-pci,host=%s,id=vfio1,x-migration-multifd-transfer=on,"
+        "x-migration-load-after=vfio0%s";
+
+    if (!env) {
+        g_test_skip(QTEST_VFIO_PCI_HOSTS " not set");
+        return false;
+    }
+    hosts = g_strsplit(env, ",", -1);
+    if (g_strv_length(hosts) != 4) {
+        g_test_skip(QTEST_VFIO_PCI_HOSTS " needs four VFs");
+        return false;
+    }
+
+    *opts_source = g_strdup_printf(dev_fmt, hosts[0], "", hosts[1], "");
+    *opts_target = g_strdup_printf(dev_fmt, hosts[2], target_extra,
+                                   hosts[3], target_extra);
+    return true;
+}
+
+static void test_multifd_tcp_vfio_device_state(void)
+{
+    g_autofree char *opts_source = NULL;
+    g_autofree char *opts_target = NULL;
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_start,
+    };
+
+    if (!test_vfio_device_state_opts("", &opts_source, &opts_target)) {
+        return;
+    }
+    args.start.opts_source = opts_source;
+    args.start.opts_target = opts_target;
+    test_precopy_common(&args);
+}
+
+/* The destination must refuse to queue more device state than allowed */
+static void test_multifd_tcp_vfio_device_state_max_queued(void)
+{
+    g_autofree char *opts_source = NULL;
+    g_autofree char *opts_target = NULL;
+    MigrateCommon args = {
+        .start = {
+            .hide_stderr = true,
+        },
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_start,
+        .result = MIG_TEST_FAIL_DEST_QUIT_ERR,
+    };
+
+    if (!test_vfio_device_state_opts(",x-migration-max-queued-size=1",
+                                     &opts_source, &opts_target)) {
+        return;
+    }
+    args.start.opts_source = opts_source;
+    args.start.opts_target = opts_target;
+    test_precopy_common(&args);
+}
+
 static void test_multifd_tcp_zero_page_legacy(void)
 {
     MigrateCommon args = {
@@ -3583,6 +4098,8 @@ int main(int argc, char **argv)
 
     if (has_uffd) {
         migration_test_add("/migration/postcopy/plain", test_postcopy);
+        migration_test_add("/migration/postcopy/prefetch",
+                           test_postcopy_prefetch);
         migration_test_add("/migration/postcopy/recovery/plain",
                            test_postcopy_recovery);
         migration_test_add("/migration/postcopy/preempt/plain",
@@ -3615,6 +4132,8 @@ int main(int argc, char **argv)
                        test_precopy_unix_plain);
     migration_test_add("/migration/precopy/unix/xbzrle",
                        test_precopy_unix_xbzrle);
+    migration_test_add("/migration/precopy/unix/defer-hot-pages",
+                       test_precopy_unix_defer_hot_pages);
     /*
      * Compression fails from time to time.
      * Put test here but don't enable it until everything is fixed.
@@ -3640,16 +4159,32 @@ int main(int argc, char **argv)
     if (getenv("QEMU_TEST_FLAKY_TESTS")) {
         migration_test_add("/migration/mode/reboot", test_mode_reboot);
     }
+#ifdef CONFIG_LINUX
+    migration_test_add("/migration/mode/transfer", test_mode_transfer);
+#endif
 
     migration_test_add("/migration/precopy/file/mapped-ram",
                        test_precopy_file_mapped_ram);
     migration_test_add("/migration/precopy/file/mapped-ram/live",
                        test_precopy_file_mapped_ram_live);
+    migration_test_add("/migration/precopy/file/mapped-ram/incremental",
+                       test_precopy_file_mapped_ram_incremental);
+    migration_test_add("/migration/precopy/file/mapped-ram/incremental/"
+                       "unchanged",
+                       test_precopy_file_mapped_ram_incremental_unchanged);
 
     migration_test_add("/migration/multifd/file/mapped-ram",
                        test_multifd_file_mapped_ram);
     migration_test_add("/migration/multifd/file/mapped-ram/live",
                        test_multifd_file_mapped_ram_live);
+    migration_test_add("/migration/multifd/file/mapped-ram/busy-channels",
+                       test_multifd_file_mapped_ram_busy);
+    migration_test_add("/migration/multifd/snapshot/mapped-ram",
+                       test_multifd_mapped_ram_snapshot);
+#ifdef CONFIG_LINUX_IO_URING
+    migration_test_add("/migration/multifd/file/mapped-ram/io-uring",
+                       test_multifd_file_mapped_ram_io_uring);
+#endif
 
 #ifdef CONFIG_GNUTLS
     migration_test_add("/migration/precopy/unix/tls/psk",
@@ -3720,6 +4255,7 @@ int main(int argc, char **argv)
                        test_validate_uuid_src_not_set);
     migration_test_add("/migration/validate_uuid_dst_not_set",
                        test_validate_uuid_dst_not_set);
+    migration_test_add("/migration/auto_tune", test_migrate_auto_tune);
     /*
      * See explanation why this test is slow on function definition
      */
@@ -3734,6 +4270,12 @@ int main(int argc, char **argv)
     }
     migration_test_add("/migration/multifd/tcp/plain/none",
                        test_multifd_tcp_none);
+    migration_test_add("/migration/multifd/tcp/plain/io-uring",
+                       test_multifd_tcp_io_uring);
+    migration_test_add("/migration/multifd/tcp/vfio/device-state",
+                       test_multifd_tcp_vfio_device_state);
+    migration_test_add("/migration/multifd/tcp/vfio/device-state/max-queued",
+                       test_multifd_tcp_vfio_device_state_max_queued);
     migration_test_add("/migration/multifd/tcp/plain/zero-page/legacy",
                        test_multifd_tcp_zero_page_legacy);
     migration_test_add("/migration/multifd/tcp/plain/zero-page/none",
@@ -3768,6 +4310,8 @@ int main(int argc, char **argv)
     if (g_str_equal(arch, "x86_64") && has_kvm && kvm_dirty_ring_supported()) {
         migration_test_add("/migration/dirty_ring",
                            test_precopy_unix_dirty_ring);
+        migration_test_add("/migration/dirty_ring/reap-threads",
+                           test_precopy_unix_dirty_ring_reap_threads);
         migration_test_add("/migration/vcpu_dirty_limit",
                            test_vcpu_dirty_limit);
     }
@@ -0,0 +1,264 @@
+/*
+ * Backing chain allocation map tests
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/main-loop.h"
+#include "qemu/units.h"
+#include "qemu/bitmap.h"
+#include "block/block_int.h"
+#include "sysemu/block-backend.h"
+
+#define TEST_IMAGE_SIZE     (1 * MiB)
+#define TEST_CLUSTER_SIZE   (4 * KiB)
+
+typedef struct BDRVTestState {
+    /* Clusters allocated in this layer, reads always return zeroes */
+    DECLARE_BITMAP(allocated, TEST_IMAGE_SIZE / TEST_CLUSTER_SIZE);
+} BDRVTestState;
+
+static int coroutine_fn GRAPH_RDLOCK
+test_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
+               QEMUIOVector *qiov, BdrvRequestFlags flags)
+{
+    qemu_iovec_memset(qiov, 0, 0, bytes);
+    return 0;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+test_co_pwritev(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                QEMUIOVector *qiov, BdrvRequestFlags flags)
+{
+    BDRVTestState *s = bs->opaque;
+
+    bitmap_set(s->allocated, offset / TEST_CLUSTER_SIZE,
+               DIV_ROUND_UP(offset + bytes, TEST_CLUSTER_SIZE) -
+               offset / TEST_CLUSTER_SIZE);
+    return 0;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+test_co_block_status(BlockDriverState *bs, bool want_zero, int64_t offset,
+                     int64_t bytes, int64_t *pnum, int64_t *map,
+                     BlockDriverState **file)
+{
+    BDRVTestState *s = bs->opaque;
+    int64_t cluster = offset / TEST_CLUSTER_SIZE;
+    bool allocated = test_bit(cluster, s->allocated);
+    int64_t end = cluster + 1;
+
+    while (end * TEST_CLUSTER_SIZE < offset + bytes &&
+           test_bit(end, s->allocated) == allocated) {
+        end++;
+    }
+
+    *pnum = MIN(end * TEST_CLUSTER_SIZE, offset + bytes) - offset;
+    *map = offset;
+    *file = bs;
+    return allocated ? BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID : 0;
+}
+
+static int64_t coroutine_fn GRAPH_RDLOCK test_co_getlength(BlockDriverState *bs)
+{
+    return TEST_IMAGE_SIZE;
+}
+
+static BlockDriver bdrv_test = {
+    .format_name = "test",
+    .instance_size = sizeof(BDRVTestState),
+    .supports_backing = true,
+    .bdrv_child_perm = bdrv_default_perms,
+    .bdrv_co_preadv = test_co_preadv,
+    .bdrv_co_pwritev = test_co_pwritev,
+    .bdrv_co_block_status = test_co_block_status,
+    .bdrv_co_getlength = test_co_getlength,
+};
+
+static BlockDriverState *base, *top;
+
+static void chain_setup(void)
+{
+    base = bdrv_new_open_driver(&bdrv_test, "base", BDRV_O_RDWR,
+                                &error_abort);
+    top = bdrv_new_open_driver(&bdrv_test, "top", BDRV_O_RDWR, &error_abort);
+    bdrv_set_backing_hd(top, base, &error_abort);
+    bdrv_graph_rdlock_main_loop();
+}
+
+static void chain_teardown(void)
+{
+    bdrv_graph_rdunlock_main_loop();
+    bdrv_unref(top);
+    bdrv_unref(base);
+}
+
+/* Returns the skip count at @offset and sets *@bytes to what it covers */
+static int lookup(BlockDriverState *bs, int64_t offset, int64_t *bytes)
+{
+    uint64_t gen;
+
+    *bytes = INT64_MAX - offset;
+    return bdrv_chain_map_lookup(bs, offset, bytes, &gen);
+}
+
+static void fill(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                 int skip)
+{
+    int64_t pnum = bytes;
+    uint64_t gen;
+
+    bdrv_chain_map_lookup(bs, offset, &pnum, &gen);
+    bdrv_chain_map_fill(bs, offset, bytes, skip, gen);
+}
+
+static void test_hit(void)
+{
+    int64_t bytes;
+
+    chain_setup();
+
+    g_assert_cmpint(lookup(top, 0, &bytes), ==, 0);
+
+    fill(top, 0, 64 * KiB, 2);
+    g_assert_cmpint(lookup(top, 0, &bytes), ==, 2);
+    g_assert_cmpint(bytes, ==, 64 * KiB);
+    g_assert_cmpint(lookup(top, 32 * KiB, &bytes), ==, 2);
+    g_assert_cmpint(bytes, ==, 32 * KiB);
+    g_assert_cmpint(lookup(top, 64 * KiB, &bytes), ==, 0);
+
+    /* Adjacent ranges with the same skip count are merged */
+    fill(top, 64 * KiB, 64 * KiB, 2);
+    g_assert_cmpint(lookup(top, 0, &bytes), ==, 2);
+    g_assert_cmpint(bytes, ==, 128 * KiB);
+
+    chain_teardown();
+}
+
+static void test_invalidate_write(void)
+{
+    int64_t bytes;
+
+    chain_setup();
+
+    fill(top, 0, 64 * KiB, 2);
+
+    /* A write to the top node splits the range */
+    bdrv_chain_map_invalidate_range(top, 16 * KiB, 4 * KiB);
+    g_assert_cmpint(lookup(top, 0, &bytes), ==, 2);
+    g_assert_cmpint(bytes, ==, 16 * KiB);
+    g_assert_cmpint(lookup(top, 16 * KiB, &bytes), ==, 0);
+    g_assert_cmpint(lookup(top, 20 * KiB, &bytes), ==, 2);
+    g_assert_cmpint(bytes, ==, 44 * KiB);
+
+    /* A write to the backing node invalidates its overlays */
+    bdrv_chain_map_invalidate_range(base, 32 * KiB, 4 * KiB);
+    g_assert_cmpint(lookup(top, 32 * KiB, &bytes), ==, 0);
+    g_assert_cmpint(lookup(top, 36 * KiB, &bytes), ==, 2);
+    g_assert_cmpint(bytes, ==, 28 * KiB);
+
+    /* Once everything is invalidated, the map can be filled again */
+    bdrv_chain_map_invalidate(base);
+    g_assert_cmpint(lookup(top, 0, &bytes), ==, 0);
+    fill(top, 0, 64 * KiB, 1);
+    g_assert_cmpint(lookup(top, 0, &bytes), ==, 1);
+    g_assert_cmpint(bytes, ==, 64 * KiB);
+
+    chain_teardown();
+}
+
+/*
+ * A write between the lookup and the fill may have allocated what the
+ * block status query saw unallocated, so the fill must be dropped, even
+ * when the map was empty at the time of the write.
+ */
+static void test_invalidate_during_query(void)
+{
+    int64_t bytes = 64 * KiB;
+    uint64_t gen;
+
+    chain_setup();
+
+    g_assert_cmpint(bdrv_chain_map_lookup(top, 0, &bytes, &gen), ==, 0);
+    bdrv_chain_map_invalidate_range(base, 0, 4 * KiB);
+    bdrv_chain_map_fill(top, 0, 64 * KiB, 2, gen);
+    g_assert_cmpint(lookup(top, 0, &bytes), ==, 0);
+
+    /* The same with ranges in the map */
+    fill(top, 64 * KiB, 64 * KiB, 2);
+    bytes = 64 * KiB;
+    g_assert_cmpint(bdrv_chain_map_lookup(top, 0, &bytes, &gen), ==, 0);
+    bdrv_chain_map_invalidate_range(top, 96 * KiB, 4 * KiB);
+    bdrv_chain_map_fill(top, 0, 64 * KiB, 2, gen);
+    g_assert_cmpint(lookup(top, 0, &bytes), ==, 0);
+
+    chain_teardown();
+}
+
+/*
+ * Copy-on-read allocates data in the top node without a write request, a
+ * block status query after it must not skip the top node anymore.
+ */
+static void test_invalidate_copy_on_read(void)
+{
+    BlockBackend *blk;
+    int64_t bytes, pnum;
+    char buf[TEST_CLUSTER_SIZE];
+
+    chain_setup();
+
+    blk = blk_new(qemu_get_aio_context(), BLK_PERM_CONSISTENT_READ,
+                  BLK_PERM_ALL);
+    blk_insert_bs(blk, top, &error_abort);
+
+    g_assert_cmpint(bdrv_is_allocated_above(top, NULL, false, 0, 64 * KiB,
+                                            &pnum), ==, 0);
+    g_assert_cmpint(pnum, ==, 64 * KiB);
+    g_assert_cmpint(lookup(top, 0, &bytes), ==, 1);
+
+    bdrv_enable_copy_on_read(top);
+    g_assert_cmpint(blk_pread(blk, 16 * KiB, sizeof(buf), buf, 0), ==, 0);
+    bdrv_disable_copy_on_read(top);
+
+    g_assert_cmpint(lookup(top, 16 * KiB, &bytes), ==, 0);
+    g_assert_cmpint(bdrv_is_allocated_above(top, NULL, false, 16 * KiB,
+                                            TEST_CLUSTER_SIZE, &pnum), ==, 1);
+    g_assert_cmpint(pnum, ==, TEST_CLUSTER_SIZE);
+
+    /* The rest of the range is still known not to be allocated in top */
+    g_assert_cmpint(lookup(top, 0, &bytes), ==, 1);
+    g_assert_cmpint(bytes, ==, 16 * KiB);
+
+    blk_unref(blk);
+    chain_teardown();
+}
+
+int main(int argc, char **argv)
+{
+    bdrv_init();
+    qemu_init_main_loop(&error_abort);
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/bdrv-chain-map/hit", test_hit);
+    g_test_add_func("/bdrv-chain-map/invalidate-write", test_invalidate_write);
+    g_test_add_func("/bdrv-chain-map/invalidate-during-query",
+                    test_invalidate_during_query);
+    g_test_add_func("/bdrv-chain-map/invalidate-copy-on-read",
+                    test_invalidate_copy_on_read);
+
+    return g_test_run();
+}
@@ -0,0 +1,149 @@
+/*
+ * COLO incremental device state unit tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/module.h"
+#include "io/channel-buffer.h"
+#include "../migration/qemu-file.h"
+#include "../migration/colo-device-state.h"
+
+/* Three sections of 16, 32 and 8 bytes */
+#define STATE_SIZE  56
+static const uint64_t state_ends[] = { 16, 48, 56 };
+
+/* Marker and size of a section sent as data, or marker of one not sent */
+#define SECTION_DATA_SIZE(size)     (1 + 8 + (size))
+#define SECTION_UNCHANGED_SIZE      1
+
+static GArray *section_ends_new(void)
+{
+    GArray *ends = g_array_new(false, false, sizeof(uint64_t));
+
+    g_array_append_vals(ends, state_ends, ARRAY_SIZE(state_ends));
+    return ends;
+}
+
+/*
+ * Sends @data through colo_device_state_put(), returning a copy of what
+ * was written: closing a buffer channel frees its data.
+ */
+static GByteArray *put(COLODeviceState *primary, const uint8_t *data)
+{
+    QIOChannelBuffer *bioc = qio_channel_buffer_new(STATE_SIZE);
+    g_autoptr(GArray) section_ends = section_ends_new();
+    QEMUFile *f = qemu_file_new_output(QIO_CHANNEL(bioc));
+    GByteArray *wire = g_byte_array_new();
+
+    colo_device_state_put(f, primary, data, STATE_SIZE, section_ends);
+    qemu_fflush(f);
+    g_assert_cmpint(qemu_file_get_error(f), ==, 0);
+    g_byte_array_append(wire, bioc->data, bioc->usage);
+    qemu_fclose(f);
+    object_unref(OBJECT(bioc));
+    return wire;
+}
+
+static QEMUFile *open_input(GByteArray *wire)
+{
+    QIOChannelBuffer *bioc = qio_channel_buffer_new(wire->len);
+    QEMUFile *f;
+
+    memcpy(bioc->data, wire->data, wire->len);
+    bioc->usage = wire->len;
+    f = qemu_file_new_input(QIO_CHANNEL(bioc));
+    object_unref(OBJECT(bioc));
+    return f;
+}
+
+/*
+ * Sends @data through colo_device_state_put() and loads it back with
+ * colo_device_state_get(), returning the number of bytes on the wire.
+ */
+static size_t checkpoint(COLODeviceState *primary, COLODeviceState *secondary,
+                         const uint8_t *data)
+{
+    g_autoptr(GByteArray) wire = put(primary, data);
+    QEMUFile *f = open_input(wire);
+    uint8_t loaded[STATE_SIZE];
+
+    g_assert_true(colo_device_state_get(f, secondary, loaded, STATE_SIZE,
+                                        &error_abort));
+    /* Everything was consumed */
+    qemu_get_byte(f);
+    g_assert_cmpint(qemu_file_get_error(f), ==, -EIO);
+    qemu_fclose(f);
+
+    g_assert_cmpmem(loaded, STATE_SIZE, data, STATE_SIZE);
+    return wire->len;
+}
+
+static void test_unchanged_sections(void)
+{
+    COLODeviceState primary = {}, secondary = {};
+    uint8_t data[STATE_SIZE];
+    int i;
+
+    for (i = 0; i < STATE_SIZE; i++) {
+        data[i] = i;
+    }
+
+    /* The first checkpoint sends everything */
+    g_assert_cmpint(checkpoint(&primary, &secondary, data), ==,
+                    4 + SECTION_DATA_SIZE(16) + SECTION_DATA_SIZE(32) +
+                    SECTION_DATA_SIZE(8));
+
+    /* Only the second section changed */
+    data[20] ^= 0xff;
+    g_assert_cmpint(checkpoint(&primary, &secondary, data), ==,
+                    4 + SECTION_UNCHANGED_SIZE + SECTION_DATA_SIZE(32) +
+                    SECTION_UNCHANGED_SIZE);
+
+    /* Nothing changed */
+    g_assert_cmpint(checkpoint(&primary, &secondary, data), ==,
+                    4 + 3 * SECTION_UNCHANGED_SIZE);
+
+    colo_device_state_reset(&primary);
+    colo_device_state_reset(&secondary);
+}
+
+/* The secondary can't fill a section it never received */
+static void test_unchanged_never_received(void)
+{
+    COLODeviceState primary = {}, secondary = {};
+    uint8_t data[STATE_SIZE] = { 0 };
+    Error *local_err = NULL;
+    g_autoptr(GByteArray) wire = NULL;
+    QEMUFile *f;
+
+    /* The primary thinks the secondary got this first checkpoint */
+    g_byte_array_unref(put(&primary, data));
+    wire = put(&primary, data);
+
+    f = open_input(wire);
+    g_assert_false(colo_device_state_get(f, &secondary, data, STATE_SIZE,
+                                         &local_err));
+    error_free_or_abort(&local_err);
+    g_assert_null(secondary.data);
+    qemu_fclose(f);
+
+    colo_device_state_reset(&primary);
+}
+
+int main(int argc, char **argv)
+{
+    module_call_init(MODULE_INIT_QOM);
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/colo/device-state/unchanged-sections",
+                    test_unchanged_sections);
+    g_test_add_func("/colo/device-state/unchanged-never-received",
+                    test_unchanged_never_received);
+
+    return g_test_run();
+}
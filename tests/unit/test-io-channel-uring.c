@@ -0,0 +1,145 @@
+/*
+ * QEMU I/O channel io_uring test
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "io/channel-file.h"
+#include "io/channel-uring.h"
+#include "qapi/error.h"
+#include "qemu/module.h"
+
+#define TEST_FILE "tests/test-io-channel-uring.txt"
+#define TEST_SIZE 4096
+
+/* Returns NULL and skips the test if io_uring is not available */
+static QIOChannelUring *test_io_channel_uring_open(QIOChannelFile **fioc)
+{
+    QIOChannelUring *uioc;
+    Error *local_err = NULL;
+
+    unlink(TEST_FILE);
+    *fioc = qio_channel_file_new_path(TEST_FILE, O_RDWR | O_CREAT | O_TRUNC,
+                                      0600, &error_abort);
+
+    uioc = qio_channel_uring_new(QIO_CHANNEL(*fioc), &local_err);
+    if (!uioc) {
+        g_test_skip(error_get_pretty(local_err));
+        error_free(local_err);
+        object_unref(OBJECT(*fioc));
+        unlink(TEST_FILE);
+    }
+
+    return uioc;
+}
+
+static void test_io_channel_uring_close(QIOChannelUring *uioc,
+                                        QIOChannelFile *fioc)
+{
+    object_unref(OBJECT(uioc));
+    object_unref(OBJECT(fioc));
+    unlink(TEST_FILE);
+}
+
+static void test_io_channel_uring_rw(void)
+{
+    QIOChannelFile *fioc;
+    QIOChannelUring *uioc = test_io_channel_uring_open(&fioc);
+    g_autofree char *src = g_malloc(TEST_SIZE);
+    g_autofree char *fixed = g_malloc0(TEST_SIZE);
+    g_autofree char *dst = g_malloc0(TEST_SIZE);
+    struct iovec reg = { .iov_base = fixed, .iov_len = TEST_SIZE };
+    struct iovec iov[2] = {
+        { .iov_base = src, .iov_len = TEST_SIZE / 2 },
+        { .iov_base = src + TEST_SIZE / 2, .iov_len = TEST_SIZE / 2 },
+    };
+    int i;
+
+    if (!uioc) {
+        return;
+    }
+
+    for (i = 0; i < TEST_SIZE; i++) {
+        src[i] = i % 251;
+    }
+
+    g_assert_true(qio_channel_uring_register_buffers(uioc, &reg, 1,
+                                                     &error_abort));
+
+    /* Queued writes only reach the file when they are flushed */
+    g_assert_cmpint(qio_channel_uring_pwritev_queue(uioc, &iov[1], 1,
+                                                    TEST_SIZE / 2,
+                                                    &error_abort), ==, 0);
+    g_assert_cmpint(qio_channel_uring_pwritev_queue(uioc, &iov[0], 1, 0,
+                                                    &error_abort), ==, 0);
+    g_assert_cmpint(qio_channel_uring_flush(uioc, &error_abort), ==, 0);
+
+    /* Into the registered buffer, and into memory that is not registered */
+    g_assert_cmpint(qio_channel_pread(QIO_CHANNEL(uioc), fixed + 8,
+                                      TEST_SIZE - 8, 8, &error_abort),
+                    ==, TEST_SIZE - 8);
+    g_assert_cmpmem(fixed + 8, TEST_SIZE - 8, src + 8, TEST_SIZE - 8);
+    g_assert_cmpint(qio_channel_pread(QIO_CHANNEL(uioc), dst, TEST_SIZE, 0,
+                                      &error_abort), ==, TEST_SIZE);
+    g_assert_cmpmem(dst, TEST_SIZE, src, TEST_SIZE);
+
+    test_io_channel_uring_close(uioc, fioc);
+}
+
+static void test_io_channel_uring_fds(void)
+{
+    QIOChannelFile *fioc;
+    QIOChannelUring *uioc = test_io_channel_uring_open(&fioc);
+    QIOChannelClass *klass;
+    char buf[16] = { 0 };
+    struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+    int fd = 0;
+    int *fds = NULL;
+    size_t nfds = 0;
+    Error *local_err = NULL;
+
+    if (!uioc) {
+        return;
+    }
+
+    klass = QIO_CHANNEL_GET_CLASS(uioc);
+
+    g_assert_cmpint(klass->io_writev(QIO_CHANNEL(uioc), &iov, 1, &fd, 1, 0,
+                                     &local_err), ==, -1);
+    error_free_or_abort(&local_err);
+
+    g_assert_cmpint(klass->io_readv(QIO_CHANNEL(uioc), &iov, 1, &fds, &nfds,
+                                    0, &local_err), ==, -1);
+    error_free_or_abort(&local_err);
+    g_assert_null(fds);
+
+    /* Nothing was written */
+    g_assert_cmpint(qio_channel_pread(QIO_CHANNEL(uioc), buf, sizeof(buf), 0,
+                                      &error_abort), ==, 0);
+
+    test_io_channel_uring_close(uioc, fioc);
+}
+
+int main(int argc, char **argv)
+{
+    module_call_init(MODULE_INIT_QOM);
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/io/channel/uring/rw", test_io_channel_uring_rw);
+    g_test_add_func("/io/channel/uring/fds", test_io_channel_uring_fds);
+    return g_test_run();
+}
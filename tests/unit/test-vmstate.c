@@ -330,6 +330,61 @@ static void test_simple_array(void)
                          sizeof(wire_simple_arr)));
 }
 
+typedef struct TestWideArray {
+    uint8_t u8[3];
+    uint32_t u32[3];
+    int64_t i64[2];
+} TestWideArray;
+
+TestWideArray obj_wide_arr = {
+    .u8 = { 0x01, 0x02, 0x03 },
+    .u32 = { 0x11223344, 0x55667788, 0x99aabbcc },
+    .i64 = { 0x0102030405060708LL, -2 },
+};
+
+static const VMStateDescription vmstate_wide_arr = {
+    .name = "simple/array/wide",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT8_ARRAY(u8, TestWideArray, 3),
+        VMSTATE_UINT32_ARRAY(u32, TestWideArray, 3),
+        VMSTATE_INT64_ARRAY(i64, TestWideArray, 2),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+uint8_t wire_wide_arr[] = {
+    /* u8 */  0x01, 0x02, 0x03,
+    /* u32 */ 0x11, 0x22, 0x33, 0x44,
+    /* u32 */ 0x55, 0x66, 0x77, 0x88,
+    /* u32 */ 0x99, 0xaa, 0xbb, 0xcc,
+    /* i64 */ 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+    /* i64 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xfe,
+    QEMU_VM_EOF, /* just to ensure we won't get EOF reported prematurely */
+};
+
+static void obj_wide_arr_copy(void *target, void *source)
+{
+    memcpy(target, source, sizeof(TestWideArray));
+}
+
+/* Arrays of fixed-width integers are moved in bulk, check the byte order */
+static void test_wide_array(void)
+{
+    TestWideArray obj, obj_clone;
+
+    memset(&obj, 0, sizeof(obj));
+    save_vmstate(&vmstate_wide_arr, &obj_wide_arr);
+
+    compare_vmstate(wire_wide_arr, sizeof(wire_wide_arr));
+
+    SUCCESS(load_vmstate(&vmstate_wide_arr, &obj, &obj_clone,
+                         obj_wide_arr_copy, 1, wire_wide_arr,
+                         sizeof(wire_wide_arr)));
+    SUCCESS(memcmp(&obj, &obj_wide_arr, sizeof(obj)));
+}
+
 typedef struct TestStruct {
     uint32_t a, b, c, e;
     uint64_t d, f;
@@ -1492,6 +1547,7 @@ int main(int argc, char **argv)
     g_test_init(&argc, &argv, NULL);
     g_test_add_func("/vmstate/simple/primitive", test_simple_primitive);
     g_test_add_func("/vmstate/simple/array", test_simple_array);
+    g_test_add_func("/vmstate/simple/array/wide", test_wide_array);
     g_test_add_func("/vmstate/versioned/load/v1", test_load_v1);
     g_test_add_func("/vmstate/versioned/load/v2", test_load_v2);
     g_test_add_func("/vmstate/field_exists/load/noskip", test_load_noskip);